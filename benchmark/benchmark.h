@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+
+namespace benchmark {
+
+// Keeps the compiler from optimizing away a computation whose result is otherwise unused
+template<class T> void do_not_optimize(const T &value) { asm volatile("" : : "r,m"(value) : "memory"); }
+
+// Runs operation iterations times, after a warmup, and prints the mean time per operation
+template<class Operation> double run(std::string_view name, std::uint64_t iterations, Operation &&operation)
+{
+  for (std::uint64_t i = 0; i < iterations / 10; ++i) { operation(i); }
+
+  const auto start = std::chrono::steady_clock::now();
+  for (std::uint64_t i = 0; i < iterations; ++i) { operation(i); }
+  const auto elapsed = std::chrono::duration<double, std::nano>{ std::chrono::steady_clock::now() - start };
+
+  const auto per_operation = elapsed.count() / static_cast<double>(iterations);
+  std::printf("%-40.*s %10.2f ns/op\n", static_cast<int>(name.size()), name.data(), per_operation);
+  return per_operation;
+}
+
+}
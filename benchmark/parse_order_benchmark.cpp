@@ -0,0 +1,52 @@
+#include "benchmark.h"
+#include "order.h"
+#include <array>
+#include <charconv>
+#include <optional>
+
+namespace {
+// Previous implementation, which did not validate the message
+std::optional<exchange_server::order> parse_order_unchecked(std::string_view message)
+{
+  if (message.size() != 4 + 8 + 1 + 4 + 8) { return std::nullopt; }
+
+  const auto quantity = message.substr(4 + 8 + 1, 4);
+  const auto price = message.substr(4 + 8 + 1 + 4, 8);
+
+  int parsed_quantity{};
+  double parsed_price{};
+  std::from_chars(quantity.begin(), quantity.end(), parsed_quantity);
+  std::from_chars(price.begin(), price.end(), parsed_price);
+
+  return exchange_server::order{ std::string{ message.substr(0, 4) },
+    std::string{ message.substr(4, 8) },
+    message[4 + 8] == '-' ? exchange_server::order_side::sell : exchange_server::order_side::buy,
+    static_cast<std::uint64_t>(parsed_quantity),
+    parsed_price };
+}
+
+constexpr std::array messages{ std::string_view{ "1234 BTCUSDT+001000010000" },
+  std::string_view{ "0a7z ETHUSDT-012300099850" },
+  std::string_view{ "zzzz    SYM7+999999999999" },
+  std::string_view{ "b2c4 SOLUSDT-000100000042" } };
+
+constexpr std::array invalid_messages{ std::string_view{ "1234 BTCUSDT+00a000010000" },
+  std::string_view{ "0a7z ETHUSDT*012300099850" },
+  std::string_view{ "zzzz    SYM7+99999999999:" },
+  std::string_view{ "b2c4 SOL/SDT-000100000042" } };
+
+constexpr std::uint64_t iterations{ 10'000'000 };
+}
+
+int main()
+{
+  benchmark::run("parse_order unchecked (previous)", iterations, [](std::uint64_t i) {
+    benchmark::do_not_optimize(parse_order_unchecked(messages[i % messages.size()]));
+  });
+  benchmark::run("parse_order valid", iterations, [](std::uint64_t i) {
+    benchmark::do_not_optimize(exchange_server::parse_order(messages[i % messages.size()]));
+  });
+  benchmark::run("parse_order invalid", iterations, [](std::uint64_t i) {
+    benchmark::do_not_optimize(exchange_server::parse_order(invalid_messages[i % invalid_messages.size()]));
+  });
+}
@@ -0,0 +1,110 @@
+#include "benchmark.h"
+#include "price_ladder.h"
+#include <array>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+using price_type = std::int64_t;
+
+// Aggregated quantities of the asks of a symbol, as the market kept them before
+class map_book
+{
+public:
+  void add(price_type price, std::uint64_t quantity) { _levels[price] += quantity; }
+
+  void remove(price_type price, std::uint64_t quantity)
+  {
+    const auto it = _levels.find(price);
+    if (it == _levels.end()) { return; }
+    if ((it->second -= std::min(it->second, quantity)) == 0) { _levels.erase(it); }
+  }
+
+  price_type best() const { return _levels.empty() ? 0 : _levels.begin()->first; }
+
+  // Sum of the quantities of the best levels, e.g. to sweep them
+  std::uint64_t top(std::size_t count) const
+  {
+    std::uint64_t quantity{};
+    for (auto it = _levels.begin(); it != _levels.end() && count-- > 0; ++it) { quantity += it->second; }
+    return quantity;
+  }
+
+private:
+  std::map<price_type, std::uint64_t> _levels;
+};
+
+class ladder_book
+{
+public:
+  void add(price_type price, std::uint64_t quantity) { _levels[price] += quantity; }
+
+  void remove(price_type price, std::uint64_t quantity)
+  {
+    auto *level = _levels.find(price);
+    if (level == nullptr) { return; }
+    if ((*level -= std::min(*level, quantity)) == 0) { _levels.erase(price); }
+  }
+
+  price_type best() const { return _levels.lowest().value_or(0); }
+
+  std::uint64_t top(std::size_t count)
+  {
+    std::uint64_t quantity{};
+    for (auto price = _levels.lowest(); price && count-- > 0; price = _levels.next_above(*price))
+    {
+      quantity += *_levels.find(*price);
+    }
+    return quantity;
+  }
+
+private:
+  exchange_server::price_ladder<std::uint64_t> _levels;
+};
+
+constexpr price_type mid{ 10'000'000 };
+constexpr std::uint64_t iterations{ 2'000'000 };
+
+// Prices are drawn around the top of the book, the deeper the book the further from it
+std::vector<price_type> make_prices(std::size_t depth)
+{
+  std::mt19937_64 engine{ 42 };
+  std::geometric_distribution<price_type> distance{ 4.0 / static_cast<double>(depth) };
+
+  std::vector<price_type> prices(1U << 16U);
+  for (auto &price : prices) { price = mid + std::min<price_type>(distance(engine), static_cast<price_type>(depth)); }
+  return prices;
+}
+
+template<class Book> void run(const std::string &name, std::size_t depth)
+{
+  const auto prices = make_prices(depth);
+  Book book;
+  for (std::size_t level = 0; level <= depth; ++level) { book.add(mid + static_cast<price_type>(level), 10); }
+
+  benchmark::run(name + " update+best, depth " + std::to_string(depth), iterations, [&](std::uint64_t i) {
+    const auto price = prices[i % prices.size()];
+    if (i % 2 == 0) { book.add(price, 10); }
+    else
+    {
+      book.remove(price, 10);
+    }
+    benchmark::do_not_optimize(book.best());
+  });
+
+  benchmark::run(name + " top 5 levels, depth " + std::to_string(depth), iterations, [&](std::uint64_t) {
+    benchmark::do_not_optimize(book.top(5));
+  });
+}
+}
+
+int main()
+{
+  for (const std::size_t depth : { 10U, 100U, 1000U })
+  {
+    run<map_book>("std::map", depth);
+    run<ladder_book>("price_ladder", depth);
+  }
+}
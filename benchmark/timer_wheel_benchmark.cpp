@@ -0,0 +1,75 @@
+#include "benchmark.h"
+#include "timer_wheel.h"
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+using exchange_server::timer_wheel;
+using clock_type = timer_wheel::clock;
+using namespace std::chrono_literals;
+
+// Timers in an ordered map, as a priority queue which can cancel
+class map_timers
+{
+public:
+  using timer_id = std::multimap<clock_type::time_point, std::function<void()>>::iterator;
+
+  timer_id schedule(clock_type::time_point deadline, std::function<void()> callback)
+  {
+    return _timers.emplace(deadline, std::move(callback));
+  }
+
+  void cancel(timer_id id) { _timers.erase(id); }
+
+  void advance(clock_type::time_point now)
+  {
+    while (!_timers.empty() && _timers.begin()->first <= now)
+    {
+      auto callback = std::move(_timers.begin()->second);
+      _timers.erase(_timers.begin());
+      callback();
+    }
+  }
+
+private:
+  std::multimap<clock_type::time_point, std::function<void()>> _timers;
+};
+
+constexpr std::uint64_t iterations{ 1'000'000 };
+
+// Each operation pushes back the idle timer of a random connection, as a read would, then time moves on by a tick.
+// Expired timers are armed again.
+template<class Timers> void run(const std::string &name, std::size_t connections)
+{
+  Timers timers;
+  auto now = clock_type::now();
+  std::vector<decltype(timers.schedule(now, {}))> ids(connections);
+  std::mt19937_64 engine{ 42 };
+  std::uniform_int_distribution<std::int64_t> timeout{ 1'000, 60'000 };
+
+  std::function<void(std::size_t)> arm = [&](std::size_t connection) {
+    ids[connection] =
+      timers.schedule(now + std::chrono::milliseconds{ timeout(engine) }, [&arm, connection] { arm(connection); });
+  };
+  for (std::size_t connection = 0; connection < connections; ++connection) { arm(connection); }
+
+  benchmark::run(name + " reschedule+advance, " + std::to_string(connections) + " timers", iterations, [&](auto) {
+    const auto connection = engine() % connections;
+    timers.cancel(ids[connection]);
+    now += 1ms;
+    arm(connection);
+    timers.advance(now);
+  });
+}
+}
+
+int main()
+{
+  for (const std::size_t connections : { 1'000U, 100'000U, 1'000'000U })
+  {
+    run<map_timers>("std::multimap", connections);
+    run<timer_wheel>("timer_wheel", connections);
+  }
+}
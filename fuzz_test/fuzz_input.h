@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace fuzz {
+
+// Splits the fuzzer provided bytes into small decisions and payloads
+class fuzz_input
+{
+public:
+  fuzz_input(const uint8_t *data, size_t size) : _data{ data, size } {}
+
+  bool empty() const { return _data.empty(); }
+
+  std::uint8_t take_byte()
+  {
+    if (_data.empty()) { return 0; }
+
+    const auto value = _data.front();
+    _data = _data.subspan(1);
+    return value;
+  }
+
+  // Payload of up to max_size bytes, its length being given by the next two bytes
+  std::string_view take_bytes(std::size_t max_size)
+  {
+    const auto wanted = static_cast<std::size_t>(take_byte()) << 8U | take_byte();
+    const auto size = std::min({ wanted, max_size, _data.size() });
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    const auto bytes = std::string_view{ reinterpret_cast<const char *>(_data.data()), size };
+    _data = _data.subspan(size);
+    return bytes;
+  }
+
+private:
+  std::span<const uint8_t> _data;
+};
+
+}
@@ -0,0 +1,66 @@
+#include "order.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <string_view>
+
+namespace {
+bool is_digits(std::string_view field)
+{
+  return std::all_of(field.begin(), field.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// Straightforward implementation of the message format the vectorized parser is checked against
+bool is_valid(std::string_view message)
+{
+  if (message.size() == 27)
+  {
+    const auto type = message[25];
+    const auto tif = message[26];
+    if ((type != 'L' && type != 'M' && type != 'P') || (tif != 'D' && tif != 'I' && tif != 'F')) { return false; }
+    if ((type == 'M' && tif == 'D') || (type == 'P' && tif != 'D')) { return false; }
+    message = message.substr(0, 25);
+  }
+  if (message.size() != 25) { return false; }
+
+  const auto id = message.substr(0, 4);
+  const auto symbol = message.substr(4, 8);
+  const auto is_symbol_char = [](char c) {
+    return c == ' ' || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+  };
+  return std::all_of(id.begin(), id.end(), [](char c) { return c > ' ' && c <= '~'; })
+         && std::all_of(symbol.begin(), symbol.end(), is_symbol_char) && (message[12] == '+' || message[12] == '-')
+         && is_digits(message.substr(13));
+}
+
+std::uint64_t to_number(std::string_view field)
+{
+  std::uint64_t value{};
+  std::from_chars(field.data(), field.data() + field.size(), value);
+  return value;
+}
+}
+
+// cppcheck-suppress unusedFunction symbolName=LLVMFuzzerTestOneInput
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size)
+{
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  const auto message = std::string_view{ reinterpret_cast<const char *>(Data), Size };
+
+  const auto [order, err] = exchange_server::parse_order(message);
+  if (static_cast<bool>(err) == is_valid(message)) { std::abort(); }
+
+  // Fields are taken verbatim from their fixed position in the message
+  if (!err
+      && (order.id != message.substr(0, 4) || order.symbol != message.substr(4, 8)
+          || (order.way == exchange_server::order_side::sell) != (message[12] == '-')
+          || order.quantity != to_number(message.substr(13, 4))
+          || order.price != static_cast<double>(to_number(message.substr(17, 8)))
+          || (message.size() == 25 && (order.type != exchange_server::order_type::limit
+                                        || order.tif != exchange_server::time_in_force::day))))
+  {
+    std::abort();
+  }
+
+  return 0;
+}
@@ -0,0 +1,326 @@
+#include "epoll_impl.h"
+#include "exchange_server.h"
+#include "fuzz_input.h"
+#include "market.h"
+#include "socket_impl.h"
+#include "worker.h"
+
+#include <spdlog/spdlog.h>
+#include <sys/epoll.h>
+
+#include <map>
+
+// Drives a full server through in-memory stand-ins of its sockets, epoll and market.
+// Each input is a script of connections, client data chunks, socket writability changes and executions.
+
+namespace {
+
+constexpr int listen_fd{ 100 };
+constexpr int control_fd{ 200 };
+constexpr int first_client_fd{ 300 };
+constexpr std::size_t max_clients{ 8 };
+constexpr std::size_t max_chunk_size{ 4096 };
+
+class memory_socket : public exchange_server::socket_interface
+{
+public:
+  explicit memory_socket(int fd) : _fd{ fd } {}
+
+  exchange_server::result<std::ptrdiff_t> read(std::span<char> buffer) override
+  {
+    const auto size = std::min(buffer.size(), inbound.size());
+    std::copy_n(inbound.begin(), size, buffer.begin());
+    inbound.erase(0, size);
+    return { .result = static_cast<std::ptrdiff_t>(size) };
+  }
+
+  exchange_server::result<std::ptrdiff_t> write(std::span<const char> buffer) override
+  {
+    if (!writable) { return { .err = std::make_error_code(std::errc::resource_unavailable_try_again) }; }
+    return { .result = static_cast<std::ptrdiff_t>(buffer.size()) };
+  }
+
+  std::error_code shutdown() override
+  {
+    inbound.clear();
+    shut_down = true;
+    return {};
+  }
+
+  int get_fd() const override { return _fd; }
+
+  std::string inbound;
+  bool writable{ true };
+  bool readable{ false };
+  bool shut_down{ false };
+  bool closed{ false };
+
+private:
+  int _fd;
+};
+
+struct world
+{
+  std::vector<std::shared_ptr<memory_socket>> clients;
+  std::map<int, std::uint32_t> interests;
+  std::map<int, std::uint64_t> keys;
+};
+
+class memory_listen_socket : public exchange_server::listen_socket_interface
+{
+public:
+  explicit memory_listen_socket(world &world) : _world{ world } {}
+
+  exchange_server::result<std::shared_ptr<exchange_server::socket_interface>> accept() const override
+  {
+    if (_world.clients.size() >= max_clients)
+    {
+      return { .err = std::make_error_code(std::errc::resource_unavailable_try_again) };
+    }
+
+    const auto fd = first_client_fd + static_cast<int>(_world.clients.size());
+    return { .result = _world.clients.emplace_back(std::make_shared<memory_socket>(fd)) };
+  }
+
+  int get_fd() const override { return listen_fd; }
+
+private:
+  world &_world;
+};
+
+class inline_worker : public exchange_server::worker_interface
+{
+public:
+  void post(std::function<void()> work) override { work(); }
+};
+
+class memory_market : public exchange_server::market_interface
+{
+public:
+  exchange_server::order_result add_order(const exchange_server::order &order,
+    std::function<void(const exchange_server::fill &)> callback) override
+  {
+    // Orders which cannot rest only get a partial execution
+    if (order.tif != exchange_server::time_in_force::day)
+    {
+      return { .status = exchange_server::order_status::done, .fills = { { order.quantity / 2, order.price } } };
+    }
+
+    _orders.push_back({ order, std::move(callback) });
+    return {};
+  }
+
+  bool update_order(const exchange_server::order &order) override
+  {
+    return std::any_of(_orders.begin(), _orders.end(), [&order](const auto &o) { return o.order.id == order.id; });
+  }
+
+  bool cancel_order(const std::string &id) override
+  {
+    const auto it = std::find_if(_orders.begin(), _orders.end(), [&id](const auto &o) { return o.order.id == id; });
+    if (it == _orders.end()) { return false; }
+
+    _orders.erase(it);
+    return true;
+  }
+
+  std::vector<std::string> cancel_all(std::uint64_t owner, const exchange_server::cancel_filter &filter) override
+  {
+    std::vector<std::string> cancelled;
+    std::erase_if(_orders, [&](const auto &o) {
+      const auto matches = o.order.owner == owner && (filter.symbol.empty() || o.order.symbol == filter.symbol)
+                           && (!filter.side || o.order.way == *filter.side);
+      if (matches) { cancelled.push_back(o.order.id); }
+      return matches;
+    });
+    return cancelled;
+  }
+
+  std::vector<exchange_server::order_result> mass_quote(std::vector<exchange_server::quote_entry> entries) override
+  {
+    std::vector<exchange_server::order_result> results;
+    for (auto &entry : entries)
+    {
+      if (!entry.replace) { results.push_back(add_order(entry.order, std::move(entry.callback))); }
+      else
+      {
+        results.push_back({ .status = update_order(entry.order) ? exchange_server::order_status::rested
+                                                                : exchange_server::order_status::rejected });
+      }
+    }
+    return results;
+  }
+
+  // Odd indexes execute half of what is left of the order, even ones all of it
+  void execute(std::size_t index)
+  {
+    if (_orders.empty()) { return; }
+
+    const auto it = _orders.begin() + static_cast<std::ptrdiff_t>(index % _orders.size());
+    auto &quantity = it->order.quantity;
+    const exchange_server::fill fill{ index % 2 == 0 ? quantity : quantity / 2, it->order.price };
+    quantity -= fill.quantity;
+    if (quantity > 0)
+    {
+      it->callback(fill);
+      return;
+    }
+
+    auto callback = std::move(it->callback);
+    _orders.erase(it);
+    callback(fill);
+  }
+
+private:
+  struct pending_order
+  {
+    exchange_server::order order;
+    std::function<void(const exchange_server::fill &)> callback;
+  };
+
+  std::vector<pending_order> _orders;
+};
+
+class scripted_epoll : public exchange_server::epoll_interface
+{
+public:
+  scripted_epoll(world &world, memory_market &market, fuzz::fuzz_input &input)
+    : _world{ world }, _market{ market }, _input{ input }
+  {}
+
+  void add(int fd, std::uint32_t events) const override { _world.interests[fd] = events; }
+  void modify(int fd, std::uint32_t events) const override { _world.interests[fd] = events; }
+  void add(int fd, std::uint32_t events, std::uint64_t data) const override
+  {
+    _world.interests[fd] = events;
+    _world.keys[fd] = data;
+  }
+  void modify(int fd, std::uint32_t events, std::uint64_t data) const override
+  {
+    _world.interests[fd] = events;
+    _world.keys[fd] = data;
+  }
+  void remove(int fd) const override { _world.interests.erase(fd); }
+
+  std::span<epoll_event> wait() override
+  {
+    // Once the server drops a client its socket is only referenced by the world
+    for (const auto &client : _world.clients)
+    {
+      // Orders of closed connections stay in the market, their executions are orphaned
+      if (!client->closed && client.use_count() == 1) { client->closed = true; }
+    }
+
+    // Level triggered: sockets which still have unread data are reported again first
+    for (const auto &client : _world.clients)
+    {
+      if (client->closed || client->inbound.empty()) { client->readable = false; }
+      if (client->readable && has_interest(client->get_fd(), EPOLLIN)) { return report(client->get_fd(), EPOLLIN); }
+      if (client->shut_down && !client->closed) { return report(client->get_fd(), EPOLLHUP); }
+    }
+
+    while (!_input.empty())
+    {
+      const auto op = _input.take_byte();
+      const auto client_index = static_cast<std::size_t>(_input.take_byte());
+
+      switch (op % 4)
+      {
+      case 0:
+        return report(listen_fd, EPOLLIN);
+      case 1:
+        if (auto client = get_client(client_index))
+        {
+          // An empty chunk is a disconnection
+          client->inbound = _input.take_bytes(max_chunk_size);
+          client->readable = !client->inbound.empty();
+          return report(client->get_fd(), EPOLLIN);
+        }
+        break;
+      case 2:
+        if (auto client = get_client(client_index))
+        {
+          client->writable = !client->writable;
+          if (client->writable && has_interest(client->get_fd(), EPOLLOUT))
+          {
+            return report(client->get_fd(), EPOLLOUT);
+          }
+        }
+        break;
+      default:
+        _market.execute(client_index);
+        break;
+      }
+    }
+
+    return {};
+  }
+
+  // Timers are not scripted, time only passes as fast as the input is consumed
+  std::span<epoll_event> wait_for(std::chrono::milliseconds /*timeout*/) override { return wait(); }
+
+private:
+  std::shared_ptr<memory_socket> get_client(std::size_t index) const
+  {
+    if (_world.clients.empty()) { return nullptr; }
+    return _world.clients[index % _world.clients.size()];
+  }
+
+  bool has_interest(int fd, std::uint32_t events) const
+  {
+    const auto it = _world.interests.find(fd);
+    return it != _world.interests.end() && (it->second & events) != 0U;
+  }
+
+  std::span<epoll_event> report(int fd, std::uint32_t events)
+  {
+    _event = epoll_event{ .events = events, .data = { .u64 = _world.keys[fd] } };
+    return std::span{ &_event, 1 };
+  }
+
+  world &_world;
+  memory_market &_market;
+  fuzz::fuzz_input &_input;
+  epoll_event _event{};
+};
+}
+
+// cppcheck-suppress unusedFunction symbolName=LLVMFuzzerInitialize
+extern "C" int LLVMFuzzerInitialize(int * /*argc*/, char *** /*argv*/)
+{
+  spdlog::set_level(spdlog::level::off);
+  return 0;
+}
+
+// cppcheck-suppress unusedFunction symbolName=LLVMFuzzerTestOneInput
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size)
+{
+  fuzz::fuzz_input input{ Data, Size };
+  world world;
+
+  // Small limits so that watermarks, slow consumers and throttles are reached by short inputs
+  const exchange_server::server_options options{
+    .connection = { .queue_high_watermark = 4,
+      .queue_low_watermark = 1,
+      .write_high_watermark = 256,
+      .write_low_watermark = 64,
+      .max_write_buffer = 1024,
+      .slow_consumer = input.take_byte() % 2 == 0 ? exchange_server::slow_consumer_policy::disconnect
+                                                   : exchange_server::slow_consumer_policy::flag },
+    .throttle = { .session_rate = 1000, .session_burst = 64, .symbol_rate = 100, .symbol_burst = 8 },
+    .orphan_orders =
+      input.take_byte() % 2 == 0 ? exchange_server::orphan_policy::retain : exchange_server::orphan_policy::cancel
+  };
+
+  auto market = std::make_shared<memory_market>();
+  exchange_server::server server{ std::make_shared<memory_listen_socket>(world),
+    std::make_shared<scripted_epoll>(world, *market, input),
+    std::make_shared<inline_worker>(),
+    std::make_shared<memory_socket>(control_fd),
+    market,
+    options };
+
+  server.run();
+
+  return 0;
+}
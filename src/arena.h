@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+
+namespace exchange_server {
+
+// Memory of short-lived allocations, released all at once with the arena: allocating is a pointer bump in the inline
+// buffer, then in blocks of the heap once it overflows. Deallocating does nothing. Not thread safe.
+template<std::size_t Size> class arena
+{
+public:
+  arena() = default;
+  arena(const arena &) = delete;
+  arena(arena &&) noexcept = delete;
+  arena &operator=(const arena &) = delete;
+  arena &operator=(arena &&) noexcept = delete;
+  ~arena() = default;
+
+  std::pmr::memory_resource *resource() { return &_resource; }
+
+  // Allocations do not outlive it, the inline buffer is used again
+  void release() { _resource.release(); }
+
+private:
+  alignas(std::max_align_t) std::array<std::byte, Size> _buffer;
+  std::pmr::monotonic_buffer_resource _resource{ _buffer.data(), _buffer.size() };
+};
+
+}
@@ -0,0 +1,51 @@
+#include "block_pool.h"
+#include <new>
+
+namespace exchange_server {
+
+block_pool::~block_pool()
+{
+  for (auto *block : _free) { ::operator delete(block); }
+}
+
+void *block_pool::allocate(std::size_t size)
+{
+  {
+    std::scoped_lock l{ _mutex };
+    if (_block_size == 0) { _block_size = size; }
+
+    if (size == _block_size && !_free.empty())
+    {
+      auto *block = _free.back();
+      _free.pop_back();
+      return block;
+    }
+
+    // Releasing a block then never allocates
+    if (size == _block_size) { _free.reserve(++_allocated); }
+  }
+
+  return ::operator new(size);
+}
+
+void block_pool::deallocate(void *block, std::size_t size)
+{
+  {
+    std::scoped_lock l{ _mutex };
+    if (size == _block_size)
+    {
+      _free.push_back(block);
+      return;
+    }
+  }
+
+  ::operator delete(block);
+}
+
+std::size_t block_pool::free_blocks() const
+{
+  std::scoped_lock l{ _mutex };
+  return _free.size();
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace exchange_server {
+
+// Recycles released blocks of one size, the first one requested, other sizes go to the global heap.
+// Blocks can be released from any thread.
+class block_pool
+{
+public:
+  block_pool() = default;
+  block_pool(const block_pool &) = delete;
+  block_pool(block_pool &&) noexcept = delete;
+  block_pool &operator=(const block_pool &) = delete;
+  block_pool &operator=(block_pool &&) noexcept = delete;
+  ~block_pool();
+
+  void *allocate(std::size_t size);
+  void deallocate(void *block, std::size_t size);
+
+  std::size_t free_blocks() const;
+
+private:
+  mutable std::mutex _mutex;
+  std::size_t _block_size{};
+  std::size_t _allocated{};
+  std::vector<void *> _free;
+};
+
+// Allocator of std::allocate_shared objects, which get their object and control block from a shared pool
+template<class T> class pool_allocator
+{
+public:
+  using value_type = T;
+
+  explicit pool_allocator(std::shared_ptr<block_pool> pool) : _pool{ std::move(pool) } {}
+  template<class U> explicit pool_allocator(const pool_allocator<U> &other) : _pool{ other.pool() } {}
+
+  T *allocate(std::size_t count)
+  {
+    static_assert(alignof(T) <= alignof(std::max_align_t));
+    return static_cast<T *>(_pool->allocate(count * sizeof(T)));
+  }
+  void deallocate(T *block, std::size_t count) { _pool->deallocate(block, count * sizeof(T)); }
+
+  const std::shared_ptr<block_pool> &pool() const { return _pool; }
+
+  template<class U> bool operator==(const pool_allocator<U> &other) const { return _pool == other.pool(); }
+
+private:
+  std::shared_ptr<block_pool> _pool;
+};
+
+}
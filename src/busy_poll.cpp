@@ -0,0 +1,44 @@
+#include "busy_poll.h"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+namespace exchange_server {
+
+void idle_backoff::idle()
+{
+  if (_idle_polls < _options.spin_polls)
+  {
+    ++_idle_polls;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+    return;
+  }
+
+  if (_idle_polls < _options.spin_polls + _options.yield_polls)
+  {
+    ++_idle_polls;
+    _sleep = std::chrono::microseconds{ 1 };
+    std::this_thread::yield();
+    return;
+  }
+
+  std::this_thread::sleep_for(_sleep);
+  _sleep = std::min(_sleep * 2, _options.max_sleep);
+}
+
+std::error_code pin_current_thread(int cpu)
+{
+  if (cpu < 0) { return {}; }
+  if (cpu >= CPU_SETSIZE) { return std::make_error_code(std::errc::invalid_argument); }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(static_cast<std::size_t>(cpu), &cpus);
+
+  return std::error_code{ ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus), std::generic_category() };
+}
+
+}
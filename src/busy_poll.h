@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <system_error>
+
+namespace exchange_server {
+
+// Polling threads spin instead of blocking in the kernel, trading CPU for wakeup latency
+struct busy_poll_options
+{
+  bool enabled{};
+  // Empty polls spinning, then yielding, before sleeping between polls
+  std::uint32_t spin_polls{ 10'000 };
+  std::uint32_t yield_polls{ 100 };
+  // Bounds the latency added by an idle thread
+  std::chrono::microseconds max_sleep{ 50 };
+};
+
+// Paces the polls of an idle thread, reset as soon as work is found
+class idle_backoff
+{
+public:
+  explicit idle_backoff(const busy_poll_options &options) : _options{ options } {}
+
+  void idle();
+  void reset() { _idle_polls = 0; }
+
+private:
+  const busy_poll_options &_options;
+  std::uint32_t _idle_polls{};
+  std::chrono::microseconds _sleep{};
+};
+
+// Negative cpu leaves the thread unpinned
+std::error_code pin_current_thread(int cpu);
+
+}
@@ -7,7 +7,8 @@
 
 namespace exchange_server {
 
-epoll_impl::epoll_impl() : _fd{ ::epoll_create1(0) }, _events{ 1024 }
+epoll_impl::epoll_impl(busy_poll_options busy_poll)
+  : _busy_poll{ busy_poll }, _fd{ ::epoll_create1(0) }, _events{ 1024 }
 {
   if (_fd < 0) { throw std::system_error{ get_last_error() }; }
 }
@@ -34,6 +35,26 @@ void epoll_impl::modify(int fd, std::uint32_t events) const
   if (epoll_ctl(_fd, EPOLL_CTL_MOD, fd, &evt) < 0) { throw std::system_error{ get_last_error() }; }
 }
 
+void epoll_impl::add(int fd, std::uint32_t events, std::uint64_t data) const
+{
+  struct epoll_event evt
+  {
+    .events = events, .data = {.u64 = data }
+  };
+
+  if (epoll_ctl(_fd, EPOLL_CTL_ADD, fd, &evt) < 0) { throw std::system_error{ get_last_error() }; }
+}
+
+void epoll_impl::modify(int fd, std::uint32_t events, std::uint64_t data) const
+{
+  struct epoll_event evt
+  {
+    .events = events, .data = {.u64 = data }
+  };
+
+  if (epoll_ctl(_fd, EPOLL_CTL_MOD, fd, &evt) < 0) { throw std::system_error{ get_last_error() }; }
+}
+
 void epoll_impl::remove(int fd) const
 {
   if (epoll_ctl(_fd, EPOLL_CTL_DEL, fd, nullptr) < 0) { throw std::system_error{ get_last_error() }; }
@@ -41,7 +62,43 @@ void epoll_impl::remove(int fd) const
 
 std::span<epoll_event> epoll_impl::wait()
 {
-  int result = epoll_wait(_fd, _events.data(), static_cast<int>(_events.size()), -1);
+  if (!_busy_poll.enabled) { return poll(std::chrono::milliseconds{ -1 }); }
+
+  // Like a blocking wait, only returns with events
+  idle_backoff backoff{ _busy_poll };
+  for (;;)
+  {
+    auto events = poll(std::chrono::milliseconds{ 0 });
+    if (!events.empty()) { return events; }
+
+    backoff.idle();
+  }
+}
+
+std::span<epoll_event> epoll_impl::wait_for(std::chrono::milliseconds timeout)
+{
+  if (!_busy_poll.enabled || timeout.count() <= 0) { return poll(timeout); }
+
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  idle_backoff backoff{ _busy_poll };
+  for (;;)
+  {
+    auto events = poll(std::chrono::milliseconds{ 0 });
+    if (!events.empty() || std::chrono::steady_clock::now() >= deadline) { return events; }
+
+    backoff.idle();
+  }
+}
+
+std::span<epoll_event> epoll_impl::poll(std::chrono::milliseconds timeout)
+{
+  int result = epoll_wait(_fd, _events.data(), static_cast<int>(_events.size()), static_cast<int>(timeout.count()));
+  // An infinite wait only returns with events, even when interrupted by a signal
+  while (result < 0 && errno == EINTR && timeout.count() < 0)
+  {
+    result = epoll_wait(_fd, _events.data(), static_cast<int>(_events.size()), -1);
+  }
+  if (result < 0 && errno == EINTR) { result = 0; }
   if (result < 0) { throw std::system_error{ get_last_error() }; }
 
   return std::span{ _events }.subspan(0, static_cast<size_t>(result));
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "busy_poll.h"
+#include <chrono>
 #include <cstdint>
 #include <span>
 #include <vector>
@@ -15,15 +17,20 @@ public:
 
   virtual void add(int fd, std::uint32_t events) const = 0;
   virtual void modify(int fd, std::uint32_t events) const = 0;
+  // Events of fd are reported with data as their data.u64 instead of fd
+  virtual void add(int fd, std::uint32_t events, std::uint64_t data) const = 0;
+  virtual void modify(int fd, std::uint32_t events, std::uint64_t data) const = 0;
   virtual void remove(int fd) const = 0;
 
   virtual std::span<epoll_event> wait() = 0;
+  // Returns no events once the timeout is over
+  virtual std::span<epoll_event> wait_for(std::chrono::milliseconds timeout) = 0;
 };
 
 class epoll_impl : public epoll_interface
 {
 public:
-  epoll_impl();
+  explicit epoll_impl(busy_poll_options busy_poll = {});
   epoll_impl(const epoll_impl &) = delete;
   epoll_impl(epoll_impl &&) noexcept = delete;
   epoll_impl &operator=(const epoll_impl &) = delete;
@@ -32,11 +39,17 @@ public:
 
   void add(int fd, std::uint32_t events) const override;
   void modify(int fd, std::uint32_t events) const override;
+  void add(int fd, std::uint32_t events, std::uint64_t data) const override;
+  void modify(int fd, std::uint32_t events, std::uint64_t data) const override;
   void remove(int fd) const override;
 
   std::span<epoll_event> wait() override;
+  std::span<epoll_event> wait_for(std::chrono::milliseconds timeout) override;
 
 private:
+  std::span<epoll_event> poll(std::chrono::milliseconds timeout);
+
+  busy_poll_options _busy_poll;
   int _fd;
   std::vector<epoll_event> _events;
 };
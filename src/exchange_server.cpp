@@ -1,85 +1,713 @@
 #include "exchange_server.h"
+#include "arena.h"
+#include "block_pool.h"
 #include "epoll_impl.h"
+#include "handoff.h"
 #include "market.h"
+#include "market_data.h"
 #include "order.h"
+#include "replication.h"
+#include "risk.h"
 #include "socket_impl.h"
+#include "task.h"
+#include "token_bucket.h"
 #include "worker.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iterator>
 #include <magic_enum.hpp>
+#include <map>
+#include <optional>
+#include <random>
 #include <spdlog/spdlog.h>
-#include <sstream>
 #include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <thread>
 #include <unordered_set>
 
 #pragma GCC diagnostic ignored "-Wold-style-cast"
 
 namespace exchange_server {
 
+namespace {
+  constexpr std::string_view id_prefix{ "id" };
+  constexpr std::string_view order_prefix{ "order" };
+  constexpr std::string_view cancel_prefix{ "cancel" };
+  // Not a prefix of cancel messages: their order ids are any 4 printable characters
+  constexpr std::string_view mass_cancel_prefix{ "masscancel" };
+  constexpr std::string_view quote_prefix{ "quote" };
+  constexpr char quote_separator{ ';' };
+  constexpr std::string_view list_orders_message{ "listorders" };
+  constexpr std::string_view list_symbols_message{ "listsymbols" };
+  constexpr std::string_view subscribe_prefix{ "subscribe" };
+  constexpr std::string_view unsubscribe_prefix{ "unsubscribe" };
+  constexpr std::string_view snapshot_prefix{ "snapshot" };
+  constexpr std::string_view login_prefix{ "login" };
+  constexpr std::string_view resume_prefix{ "resume" };
+  constexpr std::string_view replay_prefix{ "replay" };
+
+  constexpr std::string_view ok_message{ "ok\n" };
+  constexpr std::string_view reject_message{ "rejected\n" };
+  // Status of each entry of a quote in its response
+  constexpr char accepted_status{ 'A' };
+  constexpr char rejected_status{ 'R' };
+
+  // Connection slots allocated up front at most, past it the slots grow on accept
+  constexpr rlim_t max_preallocated_connections{ 1 << 16 };
+
+  // Allows heterogeneous lookup of string keys
+  struct string_hash
+  {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view value) const { return std::hash<std::string_view>{}(value); }
+  };
+
+  // Epoll data of a connection
+  constexpr std::uint64_t connection_key(int fd, std::uint32_t generation)
+  {
+    return (std::uint64_t{ generation } << 32U) | static_cast<std::uint32_t>(fd);
+  }
+
+  constexpr int key_fd(std::uint64_t key) { return static_cast<int>(key & 0xffff'ffffU); }
+
+  // Between checks whether the sessions are idle enough to be handed off
+  constexpr std::chrono::milliseconds max_handoff_backoff{ 100 };
+
+  // Ids of orders are only unique per session, the market sees them qualified by it
+  std::string market_order_id(session_id session, std::string_view id) { return fmt::format("{}/{}", session, id); }
+
+  order to_market_order(order order, session_id session)
+  {
+    order.id = market_order_id(session, order.id);
+    order.owner = session;
+    return order;
+  }
+
+  // masscancel[symbol(8)][+/-], both optional
+  std::optional<cancel_filter> parse_cancel_filter(std::string_view message)
+  {
+    constexpr std::size_t symbol_size{ 8 };
+    cancel_filter filter;
+    if (message.size() >= symbol_size)
+    {
+      filter.symbol = message.substr(0, symbol_size);
+      message.remove_prefix(symbol_size);
+    }
+    if (message == "+") { filter.side = order_side::buy; }
+    else if (message == "-")
+    {
+      filter.side = order_side::sell;
+    }
+    else if (!message.empty())
+    {
+      return std::nullopt;
+    }
+
+    return filter;
+  }
+
+  // Symbol is after the 4 characters order id, malformed orders are rejected later anyway
+  std::string_view order_symbol(std::string_view order)
+  {
+    constexpr std::size_t id_size{ 4 };
+    constexpr std::size_t symbol_size{ 8 };
+    return order.substr(std::min(order.size(), id_size), symbol_size);
+  }
+
+  // exec<id(4)><quantity(4)><price(8)>
+  std::pmr::string execution_message(std::string_view id, const fill &fill, std::pmr::memory_resource *memory)
+  {
+    std::pmr::string message{ memory };
+    fmt::format_to(std::back_inserter(message), "exec{}{:0>4}{:0>8.0f}\n", id, fill.quantity, fill.price);
+    return message;
+  }
+
+  // Hexadecimal characters of the tokens sessions are resumed with
+  constexpr std::size_t session_token_size{ 32 };
+
+  std::string make_session_token()
+  {
+    std::random_device random;
+    std::uniform_int_distribution<std::uint64_t> distribution;
+    return fmt::format("{:016x}{:016x}", distribution(random), distribution(random));
+  }
+
+  // Takes as long whatever the characters which differ
+  bool same_token(std::string_view token, std::string_view expected)
+  {
+    if (token.size() != expected.size()) { return false; }
+
+    unsigned char differences{};
+    for (std::size_t i = 0; i < token.size(); ++i)
+    {
+      differences |= static_cast<unsigned char>(token[i] ^ expected[i]);
+    }
+    return differences == 0;
+  }
+
+  // Line of the listorders response
+  void append_order_line(std::string &response, const order &order)
+  {
+    fmt::format_to(std::back_inserter(response),
+      "{: >4}{: >8}{}{:0>4}{:0>8.0f}\n",
+      order.id,
+      order.symbol,
+      order.way == order_side::buy ? '+' : '-',
+      order.quantity,
+      order.price);
+  }
+}
+
+// Order flow of a client. The sessions of clients which logged in outlive their connections, a reconnecting client
+// resumes them with the token it was given, the others end with their connection.
+struct server::session
+{
+  session(std::string session_name, std::size_t retransmit_capacity)
+    : name{ std::move(session_name) }, _retransmit_capacity{ std::max<std::size_t>(retransmit_capacity, 1) }
+  {}
+
+  bool resumable() const { return !name.empty(); }
+
+  // Empty for the sessions of unnamed connections
+  const std::string name;
+  session_id id{};
+  std::string token;
+
+  // Only used by the message queue of the connection the session is attached to
+  std::unordered_map<std::string, order> outstanding_orders;
+  risk_cache risk;
+
+  // The listorders response is patched while orders are only added and rebuilt on the next request otherwise
+  void on_order_added(const order &order)
+  {
+    if (_orders_response) { append_order_line(*_orders_response, order); }
+  }
+
+  void on_orders_changed() { _orders_response.reset(); }
+
+  const std::string &list_orders_response()
+  {
+    if (!_orders_response)
+    {
+      _orders_response.emplace();
+      for (const auto &[id, order] : outstanding_orders) { append_order_line(*_orders_response, order); }
+    }
+
+    return *_orders_response;
+  }
+
+  // Numbers an order flow message and keeps it for replay, the oldest ones are overwritten past the capacity
+  const std::string &sequence(std::string_view message)
+  {
+    ++_last_sequence;
+    auto &kept = _retransmit.size() < _retransmit_capacity ? _retransmit.emplace_back()
+                                                           : _retransmit[retransmit_index(_last_sequence)];
+
+    // Once the ring is full, the memory of the message overwritten is reused
+    kept.clear();
+    fmt::format_to(std::back_inserter(kept), "{:0>8}{}", _last_sequence, message);
+    return kept;
+  }
+
+  std::uint64_t last_sequence() const { return _last_sequence; }
+
+  // Calls f with the kept messages from sequence number from on, returns false when some were already dropped
+  template<class F> bool replay(std::uint64_t from, F &&f) const
+  {
+    const auto first = _last_sequence + 1 - _retransmit.size();
+    if (from < first || from > _last_sequence + 1) { return false; }
+
+    for (auto sequence = from; sequence <= _last_sequence; ++sequence) { f(_retransmit[retransmit_index(sequence)]); }
+    return true;
+  }
+
+  handoff_session hand_off()
+  {
+    handoff_session handoff{
+      .id = id, .name = name, .token = token, .last_sequence = _last_sequence, .positions = risk.positions()
+    };
+    for (const auto &[client_id, order] : outstanding_orders) { handoff.outstanding_orders.push_back(order); }
+
+    std::scoped_lock l{ attachment_mutex };
+    handoff.detached_executions = detached_executions;
+    return handoff;
+  }
+
+  // Numbering goes on from the previous server, replays of what it sent are rejected
+  void take_over(handoff_session handoff)
+  {
+    id = handoff.id;
+    token = std::move(handoff.token);
+    _last_sequence = handoff.last_sequence;
+    for (const auto &[symbol, position] : handoff.positions) { risk.restore_position(symbol, position); }
+    for (auto &order : handoff.outstanding_orders)
+    {
+      risk.on_new(order);
+      outstanding_orders.insert(std::pair{ order.id, std::move(order) });
+    }
+    detached_executions = std::move(handoff.detached_executions);
+  }
+
+  // Connection the session is attached to, null while its client is away. Executions received in the meantime are
+  // sent once it comes back.
+  std::mutex attachment_mutex;
+  client_data *connection{};
+  std::vector<std::pair<std::string, fill>> detached_executions;
+
+  // Position among the detached sessions of the state, and since when, guarded by its sessions mutex
+  std::uint64_t detached_key{};
+  std::chrono::steady_clock::time_point detached_at;
+
+private:
+  std::size_t retransmit_index(std::uint64_t sequence) const { return (sequence - 1) % _retransmit_capacity; }
+
+  std::optional<std::string> _orders_response;
+  std::uint64_t _last_sequence{};
+  // Ring of the latest messages
+  std::size_t _retransmit_capacity;
+  std::vector<std::string> _retransmit;
+};
+
 struct server::state
 {
+  state(const server_options &options, std::shared_ptr<market_data_publisher> publisher)
+    : risk_limits{ options.risk }, sessions{ options.first_session_id }, market_data{ std::move(publisher) },
+      max_detached_executions{ options.max_detached_executions }, _retransmit_buffer{ options.retransmit_buffer },
+      _max_detached_sessions{ options.max_detached_sessions },
+      _detached_session_timeout{ options.detached_session_timeout }
+  {}
+
+  // On the first login of the client, null if it already has a session
+  std::shared_ptr<session> create_session(const std::string &name)
+  {
+    std::scoped_lock l{ _sessions_mutex };
+    auto &session = _resumable_sessions[name];
+    if (session) { return nullptr; }
+
+    session = std::make_shared<server::session>(name, _retransmit_buffer);
+    session->id = sessions.add(session);
+    session->token = make_session_token();
+    return session;
+  }
+
+  // Null unless the token is the one of the session
+  std::shared_ptr<session> find_session(std::string_view name, std::string_view token)
+  {
+    std::scoped_lock l{ _sessions_mutex };
+    const auto it = _resumable_sessions.find(std::string{ name });
+    if (it == _resumable_sessions.end() || !same_token(token, it->second->token)) { return nullptr; }
+
+    return it->second;
+  }
+
+  // With the attachment mutex of the session held. False when the session was ended.
+  bool attach(const std::shared_ptr<session> &session)
+  {
+    std::scoped_lock l{ _sessions_mutex };
+    const auto it = _resumable_sessions.find(session->name);
+    if (it == _resumable_sessions.end() || it->second != session) { return false; }
+
+    _detached.erase(session->detached_key);
+    return true;
+  }
+
+  // With the attachment mutex of the session held. Returns the sessions to end, no longer resumable: those away for
+  // too long and the oldest past the limit.
+  std::vector<std::shared_ptr<session>> detach(const std::shared_ptr<session> &session,
+    std::chrono::steady_clock::time_point now)
+  {
+    std::scoped_lock l{ _sessions_mutex };
+    session->detached_key = ++_last_detached_key;
+    session->detached_at = now;
+    _detached.emplace(session->detached_key, session);
+
+    std::vector<std::shared_ptr<server::session>> ended;
+    const auto expired = [this, now](const server::session &detached) {
+      return _detached_session_timeout.count() > 0 && now - detached.detached_at >= _detached_session_timeout;
+    };
+    while (!_detached.empty() && (_detached.size() > _max_detached_sessions || expired(*_detached.begin()->second)))
+    {
+      auto oldest = std::move(_detached.begin()->second);
+      _detached.erase(_detached.begin());
+      _resumable_sessions.erase(oldest->name);
+      ended.push_back(std::move(oldest));
+    }
+
+    return ended;
+  }
+
+  std::vector<std::shared_ptr<session>> resumable_sessions()
+  {
+    std::scoped_lock l{ _sessions_mutex };
+    std::vector<std::shared_ptr<session>> result;
+    result.reserve(_resumable_sessions.size());
+    for (const auto &[name, session] : _resumable_sessions) { result.push_back(session); }
+    return result;
+  }
+
+  // Session handed off by the previous server, under its id, attached to a connection or detached afterwards
+  void restore_session(const std::shared_ptr<session> &session)
+  {
+    sessions.restore(session->id, session);
+    if (!session->resumable()) { return; }
+
+    std::scoped_lock l{ _sessions_mutex };
+    _resumable_sessions[session->name] = session;
+  }
+
   bool add_symbol(const std::string &symbol)
   {
     std::scoped_lock l{ _mutex };
-    return _known_symbols.insert(symbol).second;
+    if (!_known_symbols.insert(symbol).second) { return false; }
+
+    _symbols_version.fetch_add(1, std::memory_order_release);
+    return true;
+  }
+
+  bool has_symbol(std::string_view symbol) const
+  {
+    std::scoped_lock l{ _mutex };
+    return _known_symbols.contains(std::string{ symbol });
   }
 
-  std::vector<std::string> list_symbols() const
+  // Readers keep the listsymbols response of the version they last saw, they only lock when symbols were added
+  std::uint64_t symbols_version() const { return _symbols_version.load(std::memory_order_acquire); }
+
+  std::vector<std::string> symbols() const
   {
     std::scoped_lock l{ _mutex };
     return { _known_symbols.begin(), _known_symbols.end() };
   }
 
+  // Serialized once per version and shared by all readers
+  std::shared_ptr<const std::string> list_symbols() const
+  {
+    std::scoped_lock l{ _mutex };
+    if (!_symbols_response || _symbols_response_version != _symbols_version.load(std::memory_order_relaxed))
+    {
+      auto response = std::make_shared<std::string>();
+      response->reserve(_known_symbols.size() * 9);
+      for (const auto &symbol : _known_symbols)
+      {
+        response->append(symbol);
+        response->push_back('\n');
+      }
+
+      _symbols_response = std::move(response);
+      _symbols_response_version = _symbols_version.load(std::memory_order_relaxed);
+    }
+
+    return _symbols_response;
+  }
+
+  risk_limits_store risk_limits;
+  session_registry<session> sessions;
+  // Session coroutines which did not return yet, including those of released connections
+  std::atomic<std::size_t> running_sessions{};
+  // Null when the server does not publish market data
+  std::shared_ptr<market_data_publisher> market_data;
+  const std::size_t max_detached_executions;
+
 private:
   std::unordered_set<std::string> _known_symbols;
+  std::atomic<std::uint64_t> _symbols_version{};
+  mutable std::shared_ptr<const std::string> _symbols_response;
+  mutable std::uint64_t _symbols_response_version{};
   mutable std::mutex _mutex;
+
+  std::size_t _retransmit_buffer;
+  std::size_t _max_detached_sessions;
+  std::chrono::milliseconds _detached_session_timeout;
+  std::mutex _sessions_mutex;
+  std::unordered_map<std::string, std::shared_ptr<session>> _resumable_sessions;
+  // By detach order, the oldest first
+  std::map<std::uint64_t, std::shared_ptr<session>> _detached;
+  std::uint64_t _last_detached_key{};
 };
 
 enum class client_state { connected, identified };
 
+namespace {
+  // Messages of one read of a client, their memory and the transient memory of their handling are released at once
+  // after the last one was handled
+  struct read_batch
+  {
+    // Enough for the messages of a typical read and their responses not to reach the heap
+    arena<4096> memory;
+    std::pmr::vector<std::pmr::string> messages{ memory.resource() };
+    // Messages which are rejected rather than handled, by position
+    std::pmr::vector<bool> throttled{ std::pmr::polymorphic_allocator<bool>{ memory.resource() } };
+  };
+
+  // Limits of a run of a session coroutine, the same as those of a batch of the message queue
+  class run_budget
+  {
+  public:
+    explicit run_budget(const strand_options &options) : _options{ options } { restart(); }
+
+    // Counts a handled event, true once the coroutine should let the other clients run
+    bool spend()
+    {
+      return ++_handled >= std::max<std::size_t>(_options.max_batch, 1)
+             || (_options.time_budget.count() > 0 && std::chrono::steady_clock::now() >= _deadline);
+    }
+
+    void restart()
+    {
+      _handled = 0;
+      if (_options.time_budget.count() > 0) { _deadline = std::chrono::steady_clock::now() + _options.time_budget; }
+    }
+
+  private:
+    const strand_options &_options;
+    std::size_t _handled{};
+    std::chrono::steady_clock::time_point _deadline;
+  };
+}
+
+// Work of a client handled by its session coroutine, in the order it was pushed
+struct server::client_event
+{
+  enum class kind { messages, execution };
+
+  kind type{ kind::messages };
+  std::shared_ptr<read_batch> batch;
+  // Of the executed order
+  std::string id;
+  exchange_server::fill fill;
+};
+
 struct server::client_data
+  : market_data_subscriber
+  , std::enable_shared_from_this<client_data>
 {
   explicit client_data(std::shared_ptr<socket_interface> sock,
     std::weak_ptr<epoll_interface> epoll,
-    worker_interface &worker)
-    : message_queue{ worker }, _sock{ std::move(sock) }, _epoll{ std::move(epoll) }
+    worker_interface &worker,
+    const server_options &options,
+    std::shared_ptr<server_metrics> metrics,
+    std::uint64_t epoll_key,
+    journal *journal)
+    : message_queue{ worker, options.batching, [this] { flush(); } }, events{ message_queue }, _sock{ std::move(sock) },
+      _epoll{ std::move(epoll) }, _epoll_key{ epoll_key }, _limits{ options.connection },
+      _throttle{ options.throttle }, _metrics{ std::move(metrics) }, _journal{ journal },
+      _session_bucket{ _throttle.session_rate, _throttle.session_burst, token_bucket::clock::now() }
   {}
 
-
   client_state state{ client_state::connected };
   std::string name{ "unidentified" };
+  bool slow_consumer{ false };
 
-  std::unordered_map<std::string, order> outstanding_orders;
+  // Replaced by the resumed session on login
+  std::shared_ptr<server::session> session;
+  std::unordered_set<std::string> subscriptions;
+  // Runs the session coroutine and the market data of the client
   strand message_queue;
+  event_queue<client_event> events;
+
+  server_metrics &metrics() { return *_metrics; }
 
+  // Only called from the message queue
+  const risk_limits &current_risk_limits(const risk_limits_store &store)
+  {
+    if (const auto version = store.version(); version != _risk_limits_version)
+    {
+      _risk_limits = store.current();
+      _risk_limits_version = version;
+    }
+
+    return *_risk_limits;
+  }
+
+  // Only called from the message queue
+  const std::string &list_symbols_response(const server::state &server_state)
+  {
+    if (const auto version = server_state.symbols_version(); !_symbols_response || version != _symbols_version)
+    {
+      _symbols_response = server_state.list_symbols();
+      _symbols_version = version;
+    }
 
+    return *_symbols_response;
+  }
+
+  // Only called from the message queue, the message is sent at the end of the current batch
   std::error_code write(std::string_view message)
   {
-    bool was_empty = _write_buffer.empty();
+    if (_closing || _handed_off) { return std::make_error_code(std::errc::connection_aborted); }
+
     _write_buffer.insert(_write_buffer.end(), message.begin(), message.end());
-    if (was_empty || message.empty())
+    return {};
+  }
+
+  // Only called from the message queue, for the order flow which resumable sessions number
+  std::error_code write_sequenced(std::string_view message)
+  {
+    return write(session->resumable() ? std::string_view{ session->sequence(message) } : message);
+  }
+
+  // Only called from the message queue, the reactor sees the connection as closed and releases the client
+  std::error_code disconnect()
+  {
+    if (_closing) { return {}; }
+
+    _closing = true;
+    _write_buffer = {};
+    _released = 0;
+    _holds.clear();
+    return _sock->shutdown();
+  }
+
+  // Only called from the worker while the session coroutine is idle: the connection is left open for the successor
+  // and nothing is written to it from now on
+  handoff_connection hand_off()
+  {
+    handoff_connection handoff{ .fd = _sock->get_fd(),
+      .session = session->id,
+      .identified = state == client_state::identified,
+      .name = name,
+      .subscriptions = { subscriptions.begin(), subscriptions.end() },
+      .read_buffer = { _read_buffer.begin(), _read_buffer.end() },
+      .write_buffer = { _write_buffer.begin(), _write_buffer.end() } };
+
+    // Market data not flushed yet goes with the responses
     {
-      auto [bytes_written, err] = _sock->write(_write_buffer);
+      std::scoped_lock l{ _market_data_mutex };
+      for (const auto &message : _pending_market_data) { handoff.write_buffer += *message; }
+    }
 
-      if (!err) { _write_buffer.erase(_write_buffer.begin(), _write_buffer.begin() + bytes_written); }
+    _handed_off = true;
+    return handoff;
+  }
+
+  // When the successor could not be given the connection, it is served again
+  void take_back() { _handed_off = false; }
+
+  // Before the session coroutine runs
+  void take_over(const handoff_connection &handoff)
+  {
+    state = handoff.identified ? client_state::identified : client_state::connected;
+    name = handoff.name;
+    subscriptions.insert(handoff.subscriptions.begin(), handoff.subscriptions.end());
+    _read_buffer.assign(handoff.read_buffer.begin(), handoff.read_buffer.end());
+    _write_buffer.assign(handoff.write_buffer.begin(), handoff.write_buffer.end());
+  }
+
+  // Only called from the message queue, once the socket is reported writable
+  std::error_code on_writable()
+  {
+    _waiting_writable = false;
+    return flush();
+  }
+
+  // Called by the message queue after each batch, so that the responses of pipelined messages share a write
+  std::error_code flush()
+  {
+    if (_closing || _handed_off) { return std::make_error_code(std::errc::connection_aborted); }
 
-      const auto add_write = !_write_buffer.empty() && was_empty;
-      const auto remove_write = _write_buffer.empty() && !was_empty;
-      if (add_write || remove_write)
+    // A socket which did not accept everything is not written to again until the reactor reports it writable
+    if (release_writes() > 0 && !_waiting_writable)
+    {
+      auto [bytes_written, err] = _sock->write(std::span{ _write_buffer.data(), _released });
+
+      if (!err)
       {
-        if (const auto epoll = _epoll.lock())
-        {
-          std::uint32_t flags = EPOLLIN;
-          if (add_write) { flags |= EPOLLOUT; }
+        const auto written = static_cast<std::size_t>(bytes_written);
+        _write_buffer.erase(_write_buffer.begin(), _write_buffer.begin() + bytes_written);
+        _released -= written;
+        for (auto &hold : _holds) { hold.end -= written; }
+      }
+      _waiting_writable = _released > 0;
+    }
 
-          epoll->modify(_sock->get_fd(), flags);
-        }
+    // Bytes held for replication wait for the journal rather than for the client, only those it could have read count
+    if (_released > _limits.max_write_buffer && !slow_consumer)
+    {
+      slow_consumer = true;
+      ++_metrics->slow_consumers;
+      if (_limits.slow_consumer == slow_consumer_policy::disconnect)
+      {
+        spdlog::warn("Client ({}) is not reading its responses, disconnecting", name);
+        return disconnect();
       }
+
+      spdlog::warn("Client ({}) is not reading its responses, {} bytes pending", name, _released);
+    }
+
+    std::scoped_lock l{ _interest_mutex };
+    _write_pending = _waiting_writable;
+    if (_released >= _limits.write_high_watermark) { _write_paused = true; }
+    else if (_released <= _limits.write_low_watermark)
+    {
+      _write_paused = false;
     }
+    update_interest();
 
     return {};
   }
 
-  result<std::vector<std::string>> read()
+  // Called by the publisher, from any thread
+  void deliver(std::shared_ptr<const std::string> message, std::optional<level_key> key) override
+  {
+    {
+      std::scoped_lock l{ _market_data_mutex };
+      if (key)
+      {
+        // The previous update of the level was not sent yet, only the latest quantity matters
+        if (const auto it = _pending_levels.find(*key); it != _pending_levels.end())
+        {
+          auto &pending = _pending_market_data[it->second];
+          _pending_market_data_size += message->size() - pending->size();
+          pending = std::move(message);
+          ++_metrics->conflated_updates;
+          return;
+        }
+
+        _pending_levels.emplace(*key, _pending_market_data.size());
+      }
+
+      _pending_market_data_size += message->size();
+      _pending_market_data.push_back(std::move(message));
+
+      // Past the write buffer limit the client is handled as a slow consumer by the flush
+      const auto overflowing = _pending_market_data_size > _limits.max_write_buffer;
+      if (std::exchange(_market_data_flush_posted, true) && !overflowing) { return; }
+    }
+
+    message_queue.post([this] { flush_market_data(); });
+  }
+
+  // Only called from the message queue
+  void flush_market_data()
+  {
+    std::vector<std::shared_ptr<const std::string>> messages;
+
+    {
+      std::scoped_lock l{ _market_data_mutex };
+
+      // Updates of a client which does not read them keep being conflated until its write buffer drains,
+      // the next flush then comes from the reactor once the socket is writable
+      if (is_write_paused() && _pending_market_data_size <= _limits.max_write_buffer) { return; }
+
+      _market_data_flush_posted = false;
+      messages.swap(_pending_market_data);
+      _pending_levels.clear();
+      _pending_market_data_size = 0;
+    }
+
+    std::string batch;
+    for (const auto &message : messages) { batch += *message; }
+    if (!batch.empty()) { write(batch); }
+  }
+
+  // Appends the complete messages read to messages
+  result<std::size_t> read(std::pmr::vector<std::pmr::string> &messages)
   {
     auto [bytes_read, err] = _sock->read(_temp_read_buffer);
     if (err) { return { .err = err }; }
@@ -96,71 +724,314 @@ struct server::client_data
 
     const auto is_eol = [](char c) { return c == '\n' || c == '\r'; };
 
-    std::vector<std::string> result;
+    const auto complete = messages.size();
 
     auto last = _read_buffer.begin();
     for (auto previous = _read_buffer.begin(), next = std::find_if(previous, _read_buffer.end(), is_eol);
          next != _read_buffer.end();)
     {
-      result.emplace_back(previous, next);
+      messages.emplace_back(previous, next);
       previous = last = std::find_if(next + 1, _read_buffer.end(), std::not_fn(is_eol));
       next = std::find_if(previous, _read_buffer.end(), is_eol);
     }
 
     _read_buffer.erase(_read_buffer.begin(), last);
 
-    return { .result = result };
+    // A client streaming bytes without ever ending its line must not grow the buffer forever
+    if (_read_buffer.size() > _limits.max_message_size)
+    {
+      return { .err = std::make_error_code(std::errc::message_size) };
+    }
+
+    return { .result = messages.size() - complete };
+  }
+
+  // Called by the reactor before posting a message, so that flooding clients are rejected without reaching the market
+  bool throttle(std::string_view message, token_bucket::clock::time_point now)
+  {
+    // A quote counts as a single message against the session, but each of its orders against its symbol
+    const auto is_order = message.starts_with(order_prefix);
+    const auto is_quote = message.starts_with(quote_prefix);
+    if (!is_order && !is_quote && !message.starts_with(cancel_prefix) && !message.starts_with(mass_cancel_prefix))
+    {
+      return false;
+    }
+
+    // Entries are counted by their separators, before the quote costs the session anything
+    if (is_quote && _throttle.max_quote_entries > 0
+        && static_cast<std::size_t>(std::count(message.begin(), message.end(), quote_separator))
+             >= _throttle.max_quote_entries)
+    {
+      return true;
+    }
+
+    if (!_session_bucket.try_consume(now)) { return true; }
+
+    if (_throttle.symbol_rate <= 0) { return false; }
+
+    if (is_order) { return !try_consume_symbol(order_symbol(message.substr(order_prefix.size())), now); }
+    if (!is_quote) { return false; }
+
+    const auto entries = message.substr(quote_prefix.size());
+    for (std::size_t begin = 0; begin <= entries.size();)
+    {
+      const auto end = std::min(entries.find(quote_separator, begin), entries.size());
+      if (!try_consume_symbol(order_symbol(entries.substr(begin, end - begin)), now)) { return true; }
+      begin = end + 1;
+    }
+
+    return false;
+  }
+
+  // Called by the reactor before messages are posted to the message queue
+  void on_messages_queued(std::size_t count)
+  {
+    if (_queued.fetch_add(count) + count > _limits.queue_high_watermark)
+    {
+      std::scoped_lock l{ _interest_mutex };
+      // The queue may have been drained in the meantime, by a session which did not see reading paused yet
+      _queue_paused = _queued.load() > _limits.queue_high_watermark;
+      update_interest();
+    }
+  }
+
+  // Called from the session coroutine once a message has been processed
+  void on_message_processed()
+  {
+    // Reading paused above the high watermark resumes at or below the low watermark
+    if (_queued.fetch_sub(1) - 1 <= _limits.queue_low_watermark && _queue_paused)
+    {
+      std::scoped_lock l{ _interest_mutex };
+      if (!_queue_paused) { return; }
+
+      _queue_paused = false;
+      update_interest();
+    }
   }
 
 private:
+  // Bytes of the write buffer up to the end of the responses the quorum replicated, they were written after the market
+  // journaled the records they depend on
+  struct replication_hold
+  {
+    std::size_t end{};
+    std::uint64_t position{};
+  };
+
+  // Returns the number of bytes at the start of the write buffer which may be sent
+  std::size_t release_writes()
+  {
+    if (_journal == nullptr || _journal->quorum() == 0)
+    {
+      _released = _write_buffer.size();
+      return _released;
+    }
+
+    // Whatever was written since the previous flush waits for everything journaled so far
+    if (const auto checked = _holds.empty() ? _released : _holds.back().end; _write_buffer.size() > checked)
+    {
+      const auto position = _journal->position();
+      if (_holds.empty() && _journal->replicated() >= position) { _released = _write_buffer.size(); }
+      else
+      {
+        _holds.push_back({ .end = _write_buffer.size(), .position = position });
+        _journal->when_replicated(position, [client = weak_from_this()] {
+          if (const auto locked = client.lock())
+          {
+            locked->message_queue.post([client_data = locked.get()] { client_data->flush(); });
+          }
+        });
+      }
+    }
+
+    const auto replicated = _journal->replicated();
+    while (!_holds.empty() && _holds.front().position <= replicated)
+    {
+      _released = _holds.front().end;
+      _holds.pop_front();
+    }
+
+    return _released;
+  }
+
+  bool is_write_paused()
+  {
+    std::scoped_lock l{ _interest_mutex };
+    return _write_paused;
+  }
+
+  void update_interest()
+  {
+    std::uint32_t interest = _queue_paused || _write_paused ? 0U : EPOLLIN;
+    if (_write_pending) { interest |= EPOLLOUT; }
+
+    if (interest != _interest)
+    {
+      _interest = interest;
+      if (const auto epoll = _epoll.lock()) { epoll->modify(_sock->get_fd(), interest, _epoll_key); }
+    }
+  }
+
+  bool try_consume_symbol(std::string_view symbol, token_bucket::clock::time_point now)
+  {
+    auto it = _symbol_buckets.find(symbol);
+    if (it == _symbol_buckets.end())
+    {
+      // Full buckets are equivalent to new ones, dropping them bounds the number kept for clients using many symbols
+      if (_symbol_buckets.size() >= max_symbol_buckets)
+      {
+        std::erase_if(_symbol_buckets, [now](const auto &bucket) { return bucket.second.full(now); });
+      }
+
+      it = _symbol_buckets
+             .emplace(std::string{ symbol }, token_bucket{ _throttle.symbol_rate, _throttle.symbol_burst, now })
+             .first;
+    }
+
+    return it->second.try_consume(now);
+  }
+
+  static constexpr std::size_t max_symbol_buckets{ 256 };
+
   std::shared_ptr<socket_interface> _sock;
   std::weak_ptr<epoll_interface> _epoll;
+  std::uint64_t _epoll_key;
+  connection_limits _limits;
+  throttle_limits _throttle;
+  std::shared_ptr<server_metrics> _metrics;
+  journal *_journal;
+
+  // Only used by the reactor
+  token_bucket _session_bucket;
+  std::unordered_map<std::string, token_bucket, string_hash, std::equal_to<>> _symbol_buckets;
+
+  std::shared_ptr<const risk_limits> _risk_limits;
+  std::uint64_t _risk_limits_version{};
+
+  std::shared_ptr<const std::string> _symbols_response;
+  std::uint64_t _symbols_version{};
 
   std::vector<char> _write_buffer;
+  // Bytes at the start of the write buffer which may be sent, the rest waits for replication
+  std::size_t _released{};
+  std::deque<replication_hold> _holds;
+  bool _waiting_writable{ false };
+  bool _closing{ false };
+  bool _handed_off{ false };
+
+  // Events the reactor is interested in, updated both from the reactor and the message queue
+  std::mutex _interest_mutex;
+  std::uint32_t _interest{ EPOLLIN };
+  bool _write_pending{ false };
+  bool _write_paused{ false };
+  // Read without the lock by the sessions, which only take it to resume reading
+  std::atomic<bool> _queue_paused{ false };
+  std::atomic<std::size_t> _queued{};
 
   std::array<char, 1024> _temp_read_buffer{};
   std::vector<char> _read_buffer;
+
+  // Market data waiting to be written, filled by the publisher
+  std::mutex _market_data_mutex;
+  std::vector<std::shared_ptr<const std::string>> _pending_market_data;
+  std::unordered_map<level_key, std::size_t, level_key_hash> _pending_levels;
+  std::size_t _pending_market_data_size{};
+  bool _market_data_flush_posted{ false };
 };
 
 server::server(std::shared_ptr<listen_socket_interface> listener,
   std::shared_ptr<epoll_interface> epoll,
   std::shared_ptr<worker_interface> worker,
   std::shared_ptr<socket_interface> control,
-  std::shared_ptr<market_interface> market)
+  std::shared_ptr<market_interface> market,
+  server_options options,
+  std::shared_ptr<market_data_publisher> market_data,
+  std::shared_ptr<journal> journal,
+  std::shared_ptr<listen_socket_interface> handoff_listener)
   : _worker{ std::move(worker) },
     _listener{ std::move(listener) },
     _epoll{ std::move(epoll) },
     _control{ std::move(control) },
     _market{ std::move(market) },
-    _state{ std::make_shared<state>() }
-{}
+    _options{ options },
+    _journal{ std::move(journal) },
+    _handoff_listener{ std::move(handoff_listener) },
+    _client_pool{ std::make_shared<block_pool>() },
+    _session_pool{ std::make_shared<block_pool>() },
+    _frame_pool{ std::make_shared<block_pool>() },
+    _batch_pool{ std::make_shared<block_pool>() },
+    _state{ std::make_shared<state>(_options, std::move(market_data)) },
+    _metrics{ std::make_shared<server_metrics>() }
+{
+  // Reading would otherwise never resume once paused
+  const auto &limits = _options.connection;
+  if (limits.queue_low_watermark >= limits.queue_high_watermark)
+  {
+    throw std::invalid_argument{ "Queue low watermark must be below the high watermark" };
+  }
+  if (limits.write_low_watermark >= limits.write_high_watermark)
+  {
+    throw std::invalid_argument{ "Write low watermark must be below the high watermark" };
+  }
+
+  // Descriptors stay below the open files limit, so accepts do not reallocate the slots under load
+  rlimit files{};
+  if (::getrlimit(RLIMIT_NOFILE, &files) == 0)
+  {
+    _connections.resize(static_cast<std::size_t>(std::min(files.rlim_cur, max_preallocated_connections)));
+  }
+}
 
 void server::run()
 {
-  _epoll->add(_listener->get_fd(), EPOLLIN);
-  _epoll->add(_control->get_fd(), EPOLLIN);
+  const auto listener_fd = _listener->get_fd();
+  const auto control_fd = _control->get_fd();
+  const auto handoff_fd = _handoff_listener ? _handoff_listener->get_fd() : -1;
+  if (!_registered)
+  {
+    _epoll->add(listener_fd, EPOLLIN, connection_key(listener_fd, 0));
+    _epoll->add(control_fd, EPOLLIN, connection_key(control_fd, 0));
+    if (_handoff_listener) { _epoll->add(handoff_fd, EPOLLIN, connection_key(handoff_fd, 0)); }
+    _registered = true;
+  }
+
+  const auto timeouts = _options.login_timeout.count() > 0 || _options.idle_timeout.count() > 0;
+  if (timeouts) { _now = timer_wheel::clock::now(); }
 
   for (;;)
   {
-    const auto events = _epoll->wait();
+    // Without timers the reactor only wakes up for events
+    const auto deadline = _timers.next_deadline();
+    const auto timeout = deadline ? std::chrono::ceil<std::chrono::milliseconds>(*deadline - timer_wheel::clock::now())
+                                  : std::chrono::milliseconds{};
+    const auto events = deadline ? _epoll->wait_for(std::max(timeout, std::chrono::milliseconds{ 0 })) : _epoll->wait();
+    if (timeouts) { _now = timer_wheel::clock::now(); }
+
     for (const auto &evt : events)
     {
-      if ((evt.events & EPOLLERR) != 0U) { throw std::runtime_error{ "Error in epoll::wait" }; }
-      else if (evt.data.fd == _control->get_fd())
+      const auto fd = key_fd(evt.data.u64);
+      const auto is_server_fd = fd == control_fd || fd == listener_fd || fd == handoff_fd;
+      if ((evt.events & EPOLLERR) != 0U && is_server_fd) { throw std::runtime_error{ "Error in epoll::wait" }; }
+      else if (fd == control_fd)
       {
         on_control();
       }
-      else if (evt.data.fd == _listener->get_fd())
+      else if (fd == listener_fd)
       {
         on_connect();
       }
-      else if ((evt.events & EPOLLIN) != 0U)
+      else if (fd == handoff_fd)
+      {
+        on_handoff();
+      }
+      else if ((evt.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0U)
       {
-        on_read(evt.data.fd);
+        // Closed and failed connections are reported even when reading is paused, reading tells which it is
+        on_read(evt.data.u64);
       }
       else if ((evt.events & EPOLLOUT) != 0U)
       {
-        on_write(evt.data.fd);
+        on_write(evt.data.u64);
       }
       else
       {
@@ -168,108 +1039,476 @@ void server::run()
       }
     }
 
-    if (events.empty() || _should_stop) { break; }
+    if (!_timers.empty()) { _timers.advance(_now); }
+
+    if ((events.empty() && !deadline) || _should_stop) { break; }
+  }
+}
+
+void server::on_control()
+{
+  std::uint64_t evt{};
+
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  auto [bytes_read, err] = _control->read(std::span{ reinterpret_cast<char *>(&evt), sizeof(evt) });
+  if (err) { throw std::system_error{ err }; }
+
+  switch (static_cast<control_command>(evt))
+  {
+  case control_command::stop:
+    _should_stop = true;
+    break;
+  case control_command::reload_risk_limits:
+    reload_risk_limits();
+    break;
+  default:
+    spdlog::error("Unknown control command {}", evt);
+    break;
+  }
+}
+
+void server::reload_risk_limits()
+{
+  if (_options.risk_limits_file.empty())
+  {
+    spdlog::error("Cannot reload risk limits: no risk limits file");
+    return;
+  }
+
+  std::ifstream input{ _options.risk_limits_file };
+  auto [limits, err] = parse_risk_limits(input);
+  if (!input.eof() || err)
+  {
+    spdlog::error("Cannot reload risk limits from {}, keeping current ones", _options.risk_limits_file);
+    return;
+  }
+
+  _state->risk_limits.publish(limits);
+  spdlog::info("Reloaded risk limits from {}", _options.risk_limits_file);
+}
+
+server::connection_slot *server::find_connection(std::uint64_t key)
+{
+  const auto fd = static_cast<std::size_t>(key_fd(key));
+  if (fd >= _connections.size()) { return nullptr; }
+
+  // An event of a previous connection of the fd, e.g. later in the same batch as its disconnection
+  auto &slot = _connections[fd];
+  if (!slot.client || connection_key(key_fd(key), slot.generation) != key) { return nullptr; }
+
+  return &slot;
+}
+
+void server::release(connection_slot &slot)
+{
+  // The session coroutine ends once it handled what was already pushed, executions routed to the session from then on
+  // are orphaned
+  slot.client->events.close();
+
+  _timers.cancel(slot.login_timer);
+  _timers.cancel(slot.idle_timer);
+  slot.login_timer = {};
+  slot.idle_timer = {};
+  slot.client.reset();
+  ++slot.generation;
+}
+
+void server::on_connect()
+{
+  auto [client_fd, err] = _listener->accept();
+  if (client_fd) { start_session(add_connection(std::move(client_fd), nullptr)); }
+}
+
+std::uint64_t server::add_connection(std::shared_ptr<socket_interface> sock, std::shared_ptr<session> session)
+{
+  const auto fd = sock->get_fd();
+  const auto index = static_cast<std::size_t>(fd);
+  if (index >= _connections.size()) { _connections.resize(index + 1); }
+
+  auto &slot = _connections[index];
+  const auto key = connection_key(fd, slot.generation);
+  _epoll->add(fd, EPOLLIN, key);
+
+  // The memory of disconnected clients is reused
+  slot.client = std::allocate_shared<client_data>(pool_allocator<client_data>{ _client_pool },
+    std::move(sock),
+    _epoll,
+    *_worker,
+    _options,
+    _metrics,
+    key,
+    _journal.get());
+  slot.client->message_queue.set_owner(slot.client);
+
+  // Until the client logs in
+  if (!session)
+  {
+    session = std::allocate_shared<server::session>(pool_allocator<server::session>{ _session_pool }, "", 0);
+    session->id = _state->sessions.add(session);
+  }
+  session->connection = slot.client.get();
+  slot.client->session = std::move(session);
+  ++_metrics->connections;
+
+  return key;
+}
+
+void server::start_session(std::uint64_t key)
+{
+  auto &slot = _connections[static_cast<std::size_t>(key_fd(key))];
+
+  // Waits for the first event, the server outlives it
+  run_session(_frame_pool, *slot.client, *_state, *_market, _options);
+
+  if (_options.login_timeout.count() > 0)
+  {
+    slot.login_timer = _timers.schedule(_now + _options.login_timeout, [this, key] { on_login_timeout(key); });
+  }
+  if (_options.idle_timeout.count() > 0)
+  {
+    slot.last_read = _now;
+    slot.idle_timer = _timers.schedule(_now + _options.idle_timeout, [this, key] { on_idle_timeout(key); });
+  }
+}
+
+void server::on_handoff()
+{
+  auto [successor, err] = _handoff_listener->accept();
+  if (!successor || _successor) { return; }
+
+  // Nothing is read from the clients from now on, what they send waits in their sockets for the successor
+  spdlog::info("Successor connected, handing the server off");
+  _successor = std::move(successor);
+  _should_stop = true;
+}
+
+void server::take_over(handoff_state state)
+{
+  for (const auto &symbol : state.symbols) { _state->add_symbol(symbol); }
+
+  std::unordered_map<session_id, std::shared_ptr<session>> sessions;
+  for (auto &handoff : state.sessions)
+  {
+    auto restored = std::make_shared<session>(handoff.name, handoff.name.empty() ? 0 : _options.retransmit_buffer);
+    restored->take_over(std::move(handoff));
+    _state->restore_session(restored);
+    sessions.emplace(restored->id, std::move(restored));
+  }
+
+  // Market ids are qualified by the session, executions are routed by the id of the client
+  for (const auto &order : state.resting_orders)
+  {
+    const auto client_id = order.id.substr(order.id.find('/') + 1);
+    _market->add_order(
+      order, [id = client_id, owner = order.owner, state = _state.get(), metrics = _metrics.get()](const fill &fill) {
+        on_execution(id, fill, owner, *state, *metrics);
+      });
+  }
+
+  for (const auto &handoff : state.connections)
+  {
+    const auto restored = sessions.find(handoff.session);
+    const auto key = add_connection(
+      std::make_shared<socket_impl>(handoff.fd), restored != sessions.end() ? restored->second : nullptr);
+
+    auto &client = *_connections[static_cast<std::size_t>(key_fd(key))].client;
+    client.take_over(handoff);
+    // Subscribers get the snapshots of their symbols again, then the updates
+    for (const auto &symbol : handoff.subscriptions)
+    {
+      if (_state->market_data) { _state->market_data->subscribe(symbol, client.shared_from_this()); }
+    }
+    start_session(key);
+
+    // Responses the previous server could not write yet
+    client.message_queue.post([client_data = &client] { client_data->flush(); });
+  }
+
+  // Clients which were away are so from now on
+  for (const auto &[id, restored] : sessions)
+  {
+    if (!restored->resumable()) { continue; }
+
+    std::vector<std::shared_ptr<session>> ended;
+    {
+      std::scoped_lock l{ restored->attachment_mutex };
+      if (restored->connection == nullptr) { ended = _state->detach(restored, std::chrono::steady_clock::now()); }
+    }
+    for (const auto &detached : ended) { end_session(*detached, *_state, *_market, _options.orphan_orders); }
+  }
+
+  spdlog::info("Took over {} connections, {} sessions and {} resting orders",
+    state.connections.size(),
+    state.sessions.size(),
+    state.resting_orders.size());
+}
+
+std::error_code server::hand_off(market &market)
+{
+  // Work posted by the reactor before it stopped is handled first, the sessions are idle once it all ran
+  handoff_state state;
+  const auto deadline = std::chrono::steady_clock::now() + _options.handoff_timeout;
+  for (std::chrono::milliseconds backoff{ 1 };; backoff = std::min(backoff * 2, max_handoff_backoff))
+  {
+    std::promise<bool> done;
+    auto result = done.get_future();
+    _worker->post([this, &state, &market, &done] { done.set_value(capture_handoff(state, market)); });
+    if (result.get()) { break; }
+
+    const auto timed_out = std::chrono::steady_clock::now() >= deadline;
+    if (timed_out) { return cancel_handoff(std::make_error_code(std::errc::timed_out)); }
+    std::this_thread::sleep_for(backoff);
+  }
+
+  if (const auto err = send_handoff(_successor->get_fd(), state)) { return cancel_handoff(err); }
+
+  spdlog::info("Handed off {} connections, {} sessions and {} resting orders",
+    state.connections.size(),
+    state.sessions.size(),
+    state.resting_orders.size());
+  return {};
+}
+
+bool server::capture_handoff(handoff_state &state, market &market)
+{
+  std::size_t connected{};
+  for (const auto &slot : _connections)
+  {
+    if (!slot.client) { continue; }
+    if (!slot.client->events.idle()) { return false; }
+    ++connected;
+  }
+
+  // Coroutines of released connections may still have messages to handle
+  if (_state->running_sessions != connected) { return false; }
+
+  state.listener_fd = _listener->get_fd();
+  state.last_session_id = _state->sessions.last_id();
+  state.symbols = _state->symbols();
+  state.resting_orders = market.resting_orders();
+  for (const auto &session : _state->resumable_sessions()) { state.sessions.push_back(session->hand_off()); }
+  for (const auto &slot : _connections)
+  {
+    if (!slot.client) { continue; }
+    if (!slot.client->session->resumable()) { state.sessions.push_back(slot.client->session->hand_off()); }
+    state.connections.push_back(slot.client->hand_off());
   }
+
+  return true;
 }
 
-void server::on_control()
+std::error_code server::cancel_handoff(std::error_code err)
 {
-  std::uint64_t evt{};
+  std::promise<void> done;
+  auto result = done.get_future();
+  _worker->post([this, &done] {
+    for (const auto &slot : _connections)
+    {
+      if (slot.client) { slot.client->take_back(); }
+    }
+    done.set_value();
+  });
+  result.get();
 
-  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-  auto [bytes_read, err] = _control->read(std::span{ reinterpret_cast<char *>(&evt), sizeof(evt) });
-  if (err) { throw std::system_error{ err }; }
+  _successor = nullptr;
+  _should_stop = false;
+  return err;
+}
 
-  _should_stop = evt == 1;
+void server::on_login_timeout(std::uint64_t key)
+{
+  auto *slot = find_connection(key);
+  if (slot == nullptr) { return; }
+
+  // Whether the client identified is only known to its message queue
+  slot->login_timer = {};
+  slot->client->message_queue.post([client_data = slot->client.get(), timeout = _options.login_timeout] {
+    if (client_data->state == client_state::identified) { return; }
+
+    spdlog::warn("Client did not identify within {}ms, disconnecting", timeout.count());
+    ++client_data->metrics().timed_out_connections;
+    client_data->disconnect();
+  });
 }
 
-void server::on_connect()
+void server::on_idle_timeout(std::uint64_t key)
 {
-  auto [client_fd, err] = _listener->accept();
-  if (client_fd)
+  auto *slot = find_connection(key);
+  if (slot == nullptr) { return; }
+
+  // Reads do not touch the timer, it is pushed back when it expires after some
+  slot->idle_timer = {};
+  if (const auto deadline = slot->last_read + _options.idle_timeout; deadline > _now)
   {
-    auto fd = client_fd->get_fd();
-    _epoll->add(fd, EPOLLIN);
-    _client_data[fd] = std::make_shared<client_data>(std::move(client_fd), _epoll, *_worker);
+    slot->idle_timer = _timers.schedule(deadline, [this, key] { on_idle_timeout(key); });
+    return;
   }
+
+  ++_metrics->timed_out_connections;
+  slot->client->message_queue.post([client_data = slot->client.get(), timeout = _options.idle_timeout] {
+    spdlog::warn("Client ({}) sent nothing for {}ms, disconnecting", client_data->name, timeout.count());
+    client_data->disconnect();
+  });
 }
 
-void server::on_read(int fd)
+void server::on_read(std::uint64_t key)
 {
-  auto client_data_it = _client_data.find(fd);
-  if (client_data_it == _client_data.end())
+  const auto fd = key_fd(key);
+  auto *slot = find_connection(key);
+  if (slot == nullptr)
   {
     spdlog::error("Unknown client {}", fd);
     return;
   }
 
-  const auto client_data = client_data_it->second;
+  // Posted work does not own the client, its message queue is kept alive while it has pending work
+  auto *client_data = slot->client.get();
+  slot->last_read = _now;
 
-  auto [messages, err] = client_data->read();
-  if (err && err.value() != static_cast<int>(std::errc::connection_aborted))
+  // Recycled, a read costs no allocation unless its messages overflow the arena of the batch
+  auto batch = std::allocate_shared<read_batch>(pool_allocator<read_batch>{ _batch_pool });
+  auto [count, err] = client_data->read(batch->messages);
+  if (err == std::errc::connection_aborted)
+  {
+    spdlog::info("Client ({}) disconnected", client_data->name);
+    release(*slot);
+    return;
+  }
+  else if (err == std::errc::message_size)
+  {
+    spdlog::error("Client ({}) sent a message longer than {} bytes, disconnecting",
+      client_data->name,
+      _options.connection.max_message_size);
+    release(*slot);
+    return;
+  }
+  else if (err == std::errc::resource_unavailable_try_again || err == std::errc::operation_would_block)
   {
-    spdlog::error("Error while reading client message");
     return;
   }
   else if (err)
   {
-    spdlog::info("Client ({}) disconnected", client_data->name);
-    _client_data.erase(fd);
+    spdlog::error("Error while reading client ({}) message: {}, disconnecting", client_data->name, err.message());
+    release(*slot);
     return;
   }
   else
   {
-    for (auto &message : messages)
+    client_data->on_messages_queued(count);
+    _metrics->received_messages += count;
+    if (count == 0) { return; }
+
+    const auto now = token_bucket::clock::now();
+    batch->throttled.reserve(count);
+    for (const auto &message : batch->messages)
     {
-      client_data->message_queue.post([message = std::move(message), client_data, state = _state, market = _market] {
-        on_client_message(message, *client_data, *state, *market);
-      });
+      const auto throttled = client_data->throttle(message, now);
+      if (throttled)
+      {
+        spdlog::debug("Throttling message \"{}\" from client {}", message, fd);
+        ++_metrics->throttled_messages;
+      }
+      batch->throttled.push_back(throttled);
     }
+
+    client_data->events.push({ .batch = std::move(batch) });
   }
 }
 
-void server::on_write(int fd)
+void server::on_write(std::uint64_t key)
 {
-  auto client_data_it = _client_data.find(fd);
-  if (client_data_it == _client_data.end())
+  auto *slot = find_connection(key);
+  if (slot == nullptr)
   {
-    spdlog::error("Unknown client {}", fd);
+    spdlog::error("Unknown client {}", key_fd(key));
     return;
   }
 
-  const auto client_data = client_data_it->second;
-  client_data->message_queue.post([client_data] { client_data->write(""); });
+  auto *client_data = slot->client.get();
+  client_data->message_queue.post([client_data] {
+    client_data->on_writable();
+    client_data->flush_market_data();
+  });
 }
 
-namespace {
-  constexpr std::string_view id_prefix{ "id" };
-  constexpr std::string_view order_prefix{ "order" };
-  constexpr std::string_view cancel_prefix{ "cancel" };
-  constexpr std::string_view list_orders_message{ "listorders" };
-  constexpr std::string_view list_symbols_message{ "listsymbols" };
+task server::run_session(const std::shared_ptr<block_pool> & /*frames*/,
+  client_data &client_data,
+  state &state,
+  market_interface &market,
+  const server_options &options)
+{
+  // The events queued are handled in a row like a batch of the message queue, up to the same limits before the other
+  // clients get their turn
+  ++state.running_sessions;
+  run_budget budget{ options.batching };
+  while (auto event = co_await client_data.events.next())
+  {
+    if (event->type == client_event::kind::execution)
+    {
+      on_client_execution(event->id, event->fill, client_data);
+      if (budget.spend())
+      {
+        co_await client_data.events.reschedule();
+        budget.restart();
+      }
+      continue;
+    }
 
-  constexpr std::string_view ok_message{ "ok\n" };
-  constexpr std::string_view reject_message{ "rejected\n" };
+    auto &batch = *event->batch;
+    for (std::size_t i = 0; i < batch.messages.size(); ++i)
+    {
+      if (batch.throttled[i]) { client_data.write_sequenced(reject_message); }
+      else
+      {
+        on_client_message(batch.messages[i], client_data, state, market, batch.memory.resource());
+      }
+      client_data.on_message_processed();
+
+      if (budget.spend())
+      {
+        co_await client_data.events.reschedule();
+        budget.restart();
+      }
+    }
+  }
+
+  on_client_disconnected(client_data, state, market, options.orphan_orders);
+
+  // Only executions routed before the session was detached are pushed once the connection is released
+  while (auto event = client_data.events.try_pop())
+  {
+    if (event->type == client_event::kind::execution) { on_client_execution(event->id, event->fill, client_data); }
+  }
+  --state.running_sessions;
 }
 
-void server::on_client_message(const std::string &message,
+void server::on_client_message(std::string_view message,
   client_data &client_data,
   state &state,
-  market_interface &market)
+  market_interface &market,
+  std::pmr::memory_resource *memory)
 {
   spdlog::trace("Processing message: {}", message);
 
   if (message.starts_with(id_prefix))
   {
-    on_client_id(std::string_view{ message }.substr(id_prefix.size()), client_data);
+    on_client_id(message.substr(id_prefix.size()), client_data);
   }
   else if (message.starts_with(order_prefix))
   {
-    on_client_order(std::string_view{ message }.substr(order_prefix.size()), client_data, state, market);
+    on_client_order(message.substr(order_prefix.size()), client_data, state, market, memory);
+  }
+  else if (message.starts_with(quote_prefix))
+  {
+    on_client_quote(message.substr(quote_prefix.size()), client_data, state, market, memory);
+  }
+  else if (message.starts_with(mass_cancel_prefix))
+  {
+    on_client_cancel_all(message.substr(mass_cancel_prefix.size()), client_data, market);
   }
   else if (message.starts_with(cancel_prefix))
   {
-    on_client_cancel(std::string_view{ message }.substr(cancel_prefix.size()), client_data, market);
+    on_client_cancel(message.substr(cancel_prefix.size()), client_data, market);
   }
   else if (message == list_orders_message)
   {
@@ -279,6 +1518,30 @@ void server::on_client_message(const std::string &message,
   {
     on_client_list_symbols(client_data, state);
   }
+  else if (message.starts_with(subscribe_prefix))
+  {
+    on_client_subscribe(message.substr(subscribe_prefix.size()), client_data, state);
+  }
+  else if (message.starts_with(unsubscribe_prefix))
+  {
+    on_client_unsubscribe(message.substr(unsubscribe_prefix.size()), client_data, state);
+  }
+  else if (message.starts_with(snapshot_prefix))
+  {
+    on_client_snapshot(message.substr(snapshot_prefix.size()), client_data, state);
+  }
+  else if (message.starts_with(login_prefix))
+  {
+    on_client_login(message.substr(login_prefix.size()), client_data, state);
+  }
+  else if (message.starts_with(resume_prefix))
+  {
+    on_client_resume(message.substr(resume_prefix.size()), client_data, state);
+  }
+  else if (message.starts_with(replay_prefix))
+  {
+    on_client_replay(message.substr(replay_prefix.size()), client_data);
+  }
   else
   {
     spdlog::error("Unhandled message: {}", message);
@@ -293,16 +1556,127 @@ void server::on_client_id(std::string_view id_message, client_data &client_data)
   spdlog::info("Client authentified as {}", client_data.name);
 }
 
+void server::on_client_login(std::string_view name, client_data &client_data, state &state)
+{
+  if (name.empty() || client_data.state == client_state::identified)
+  {
+    spdlog::error("Rejecting login of {} as {}", client_data.name, name);
+    client_data.write(reject_message);
+    return;
+  }
+
+  // The session of a client which logged in before is only resumed with its token
+  auto session = state.create_session(std::string{ name });
+  if (!session || !attach_session(session, client_data, state))
+  {
+    spdlog::error("Rejecting login as {}: session already exists", name);
+    client_data.write(reject_message);
+    return;
+  }
+
+  spdlog::info("Client logged in as {}", client_data.name);
+  client_data.write(fmt::format("token{}\n", client_data.session->token));
+  client_data.write(fmt::format("seq{:0>8}\n", client_data.session->last_sequence()));
+}
+
+// resume<token(32)><name>
+void server::on_client_resume(std::string_view resume_message, client_data &client_data, state &state)
+{
+  const auto token = resume_message.substr(0, session_token_size);
+  const auto name = resume_message.substr(token.size());
+  auto session = name.empty() || client_data.state == client_state::identified ? nullptr
+                                                                               : state.find_session(name, token);
+  if (!session)
+  {
+    spdlog::error("Rejecting resumption of {} as {}: unknown session or wrong token", client_data.name, name);
+    client_data.write(reject_message);
+    return;
+  }
+
+  // Until the previous connection of the client is released
+  const auto executions = attach_session(session, client_data, state);
+  if (!executions)
+  {
+    spdlog::error("Rejecting resumption as {}: session is in use or ended", name);
+    client_data.write(reject_message);
+    return;
+  }
+
+  spdlog::info("Client resumed its session as {}, {} orders outstanding, {} executions while away",
+    client_data.name,
+    client_data.session->outstanding_orders.size(),
+    executions->size());
+
+  // The client asks for a replay of what follows the last message it received
+  client_data.write(fmt::format("seq{:0>8}\n", client_data.session->last_sequence()));
+  for (const auto &[id, fill] : *executions) { on_client_execution(id, fill, client_data); }
+}
+
+std::optional<std::vector<std::pair<std::string, fill>>>
+  server::attach_session(const std::shared_ptr<session> &session, client_data &client_data, state &state)
+{
+  std::vector<std::pair<std::string, fill>> executions;
+  {
+    std::scoped_lock l{ session->attachment_mutex };
+    if (session->connection != nullptr || !state.attach(session)) { return std::nullopt; }
+
+    session->connection = &client_data;
+    executions.swap(session->detached_executions);
+  }
+
+  // The session of the connection had no order yet
+  state.sessions.remove(client_data.session->id);
+  client_data.session = session;
+  client_data.name = session->name;
+  client_data.state = client_state::identified;
+  return executions;
+}
+
+void server::on_client_replay(std::string_view replay_message, client_data &client_data)
+{
+  std::uint64_t from{};
+  const auto *const end = replay_message.data() + replay_message.size();
+  const auto [parsed, err] = std::from_chars(replay_message.data(), end, from);
+
+  const auto &session = *client_data.session;
+  if (err != std::errc{} || parsed != end || !session.resumable()
+      || !session.replay(from, [&client_data](const std::string &message) { client_data.write(message); }))
+  {
+    spdlog::error("Rejecting replay from {} of {}: not logged in or messages no longer kept",
+      replay_message,
+      client_data.name);
+    client_data.write(reject_message);
+    return;
+  }
+
+  spdlog::info("Replayed messages from {} to {}", from, client_data.name);
+}
+
 void server::on_client_order(std::string_view order_message,
   client_data &client_data,
   state &state,
-  market_interface &market)
+  market_interface &market,
+  std::pmr::memory_resource *memory)
 {
-  if (auto order = parse_order(order_message); order && client_data.state == client_state::identified)
+  auto parsed = parse_order(order_message);
+  if (auto *order = parsed.err ? nullptr : &parsed.result; order && client_data.state == client_state::identified)
   {
-    const auto it = client_data.outstanding_orders.find(order->id);
-    if (it == client_data.outstanding_orders.end())
+    auto &session = *client_data.session;
+    const auto &limits = client_data.current_risk_limits(state.risk_limits);
+    const auto it = session.outstanding_orders.find(order->id);
+    if (it == session.outstanding_orders.end())
     {
+      if (const auto breach = session.risk.check_new(*order, limits); breach != risk_breach::none)
+      {
+        spdlog::error("Rejecting new order {} from {}: {} limit breached",
+          order->id,
+          client_data.name,
+          magic_enum::enum_name(breach));
+
+        client_data.write_sequenced(reject_message);
+        return;
+      }
+
       spdlog::info("Received new order {} from client: {} {}{}@{}",
         order->id,
         magic_enum::enum_name(order->way),
@@ -312,16 +1686,38 @@ void server::on_client_order(std::string_view order_message,
 
       if (state.add_symbol(order->symbol)) { spdlog::info("Added new symbol {}", order->symbol); }
 
-      market.add_order(*order, [&client_data, id = order->id]() {
-        client_data.message_queue.post([&client_data, id]() {
-          client_data.write(fmt::format("exec{}\n", id));
-          client_data.outstanding_orders.erase(id);
+      // The order may outlive the connection, its executions are routed by session
+      const auto [status, fills] = market.add_order(to_market_order(*order, session.id),
+        [id = order->id, owner = session.id, state = &state, metrics = &client_data.metrics()](const fill &fill) {
+          on_execution(id, fill, owner, *state, *metrics);
         });
-      });
 
-      client_data.outstanding_orders.insert(std::pair{ order->id, std::move(*order) });
+      if (status == order_status::rejected)
+      {
+        spdlog::error("Rejecting new order {} from {}: rejected by market", order->id, client_data.name);
+        client_data.write_sequenced(reject_message);
+        return;
+      }
+
+      session.risk.on_new(*order);
+      client_data.write_sequenced(ok_message);
+      for (const auto &fill : fills)
+      {
+        session.risk.on_execution(*order, fill.quantity);
+        order->quantity -= fill.quantity;
+        client_data.write_sequenced(execution_message(order->id, fill, memory));
+      }
 
-      client_data.write(ok_message);
+      if (status == order_status::rested)
+      {
+        session.on_order_added(*order);
+        session.outstanding_orders.insert(std::pair{ order->id, std::move(*order) });
+      }
+      else if (order->quantity > 0)
+      {
+        // The part which did not execute at once never entered the book
+        session.risk.on_cancel(*order);
+      }
     }
     else
     {
@@ -329,9 +1725,19 @@ void server::on_client_order(std::string_view order_message,
       {
         spdlog::error("Error updating order {} from client: can only update price or quantity", order->id);
 
-        client_data.write(reject_message);
+        client_data.write_sequenced(reject_message);
+      }
+      else if (const auto breach = session.risk.check_update(it->second, *order, limits);
+               breach != risk_breach::none)
+      {
+        spdlog::error("Rejecting update of order {} from {}: {} limit breached",
+          order->id,
+          client_data.name,
+          magic_enum::enum_name(breach));
+
+        client_data.write_sequenced(reject_message);
       }
-      else if (market.update_order(*order))
+      else if (market.update_order(to_market_order(*order, session.id)))
       {
         spdlog::info("Received update order {} from client: {} {}{}@{}",
           order->id,
@@ -340,14 +1746,16 @@ void server::on_client_order(std::string_view order_message,
           order->symbol,
           order->price);
 
+        session.risk.on_update(it->second, *order);
         it->second = *order;
+        session.on_orders_changed();
 
-        client_data.write(ok_message);
+        client_data.write_sequenced(ok_message);
       }
       else
       {
         spdlog::error("Error updating order {} from client: rejected by market", order->id);
-        client_data.write(reject_message);
+        client_data.write_sequenced(reject_message);
       }
     }
   }
@@ -357,26 +1765,146 @@ void server::on_client_order(std::string_view order_message,
   }
   else
   {
-    spdlog::error("Received invalid order \"{}\" from {}", order_message, client_data.name);
+    spdlog::error("Received invalid order \"{}\" from {}: {}", order_message, client_data.name, parsed.err.message());
+  }
+}
+
+void server::on_client_quote(std::string_view quote_message,
+  client_data &client_data,
+  state &state,
+  market_interface &market,
+  std::pmr::memory_resource *memory)
+{
+  if (client_data.state != client_state::identified)
+  {
+    spdlog::error("Received quote \"{}\" from unidentified client", quote_message);
+    return;
+  }
+
+  auto &session = *client_data.session;
+  const auto &limits = client_data.current_risk_limits(state.risk_limits);
+
+  struct pending_entry
+  {
+    exchange_server::order order;
+    // Order being replaced
+    std::optional<exchange_server::order> previous;
+    std::size_t position{};
+  };
+  std::pmr::vector<pending_entry> pending{ memory };
+  // Moved to the market
+  std::vector<quote_entry> entries;
+  std::pmr::string statuses{ memory };
+
+  // Entries which do not reach the market are rejected as they are parsed
+  for (std::size_t begin = 0; begin <= quote_message.size();)
+  {
+    const auto end = std::min(quote_message.find(quote_separator, begin), quote_message.size());
+    auto [order, err] = parse_order(quote_message.substr(begin, end - begin));
+    begin = end + 1;
+    statuses.push_back(rejected_status);
+
+    const auto it = session.outstanding_orders.find(order.id);
+    const auto replace = it != session.outstanding_orders.end();
+    // An order can only appear once per quote
+    const auto repeated =
+      std::any_of(pending.begin(), pending.end(), [&order](const auto &other) { return other.order.id == order.id; });
+    if (err || repeated || (replace && (order.way != it->second.way || order.symbol != it->second.symbol))
+        || (replace ? session.risk.check_update(it->second, order, limits) : session.risk.check_new(order, limits))
+             != risk_breach::none)
+    {
+      continue;
+    }
+
+    // Risk is taken at once so that the next entries are checked against it, and given back if the market rejects
+    if (replace) { session.risk.on_update(it->second, order); }
+    else
+    {
+      session.risk.on_new(order);
+      if (state.add_symbol(order.symbol)) { spdlog::info("Added new symbol {}", order.symbol); }
+    }
+
+    entries.push_back({ .order = to_market_order(order, session.id), .replace = replace });
+    if (!replace)
+    {
+      entries.back().callback =
+        [id = order.id, owner = session.id, state = &state, metrics = &client_data.metrics()](const fill &fill) {
+          on_execution(id, fill, owner, *state, *metrics);
+        };
+    }
+    pending.push_back({ .order = std::move(order),
+      .previous = replace ? std::optional{ it->second } : std::nullopt,
+      .position = statuses.size() - 1 });
+  }
+
+  const auto results = entries.empty() ? std::vector<order_result>{} : market.mass_quote(std::move(entries));
+  std::pmr::vector<std::pmr::string> executions{ memory };
+  for (std::size_t i = 0; i < pending.size(); ++i)
+  {
+    auto &[order, previous, position] = pending[i];
+    const auto &[status, fills] = results[i];
+    if (status == order_status::rejected)
+    {
+      if (previous) { session.risk.on_update(order, *previous); }
+      else
+      {
+        session.risk.on_cancel(order);
+      }
+      continue;
+    }
+
+    statuses[position] = accepted_status;
+    if (previous)
+    {
+      session.outstanding_orders[order.id] = order;
+      session.on_orders_changed();
+      continue;
+    }
+
+    for (const auto &fill : fills)
+    {
+      session.risk.on_execution(order, fill.quantity);
+      order.quantity -= fill.quantity;
+      executions.push_back(execution_message(order.id, fill, memory));
+    }
+
+    if (status == order_status::rested)
+    {
+      session.on_order_added(order);
+      session.outstanding_orders.insert(std::pair{ order.id, std::move(order) });
+    }
+    else if (order.quantity > 0)
+    {
+      session.risk.on_cancel(order);
+    }
   }
+
+  spdlog::info("Received quote of {} orders from {}: {}", statuses.size(), client_data.name, statuses);
+  std::pmr::string response{ memory };
+  fmt::format_to(std::back_inserter(response), "quote{}\n", statuses);
+  client_data.write_sequenced(response);
+  for (const auto &execution : executions) { client_data.write_sequenced(execution); }
 }
 
 void server::on_client_cancel(std::string_view cancel_message, client_data &client_data, market_interface &market)
 {
-  const auto it = client_data.outstanding_orders.find(std::string{ cancel_message });
-  if (it != client_data.outstanding_orders.end())
+  auto &session = *client_data.session;
+  const auto it = session.outstanding_orders.find(std::string{ cancel_message });
+  if (it != session.outstanding_orders.end())
   {
-    if (market.cancel_order(it->second.id))
+    if (market.cancel_order(market_order_id(session.id, it->second.id)))
     {
       spdlog::info("Cancelling order {} from client {}", cancel_message, client_data.name);
-      client_data.outstanding_orders.erase(it);
+      session.risk.on_cancel(it->second);
+      session.outstanding_orders.erase(it);
+      session.on_orders_changed();
 
-      client_data.write(ok_message);
+      client_data.write_sequenced(ok_message);
     }
     else
     {
       spdlog::info("Error cancelling order {} from client {}: rejected by market", cancel_message, client_data.name);
-      client_data.write(reject_message);
+      client_data.write_sequenced(reject_message);
     }
   }
   else
@@ -385,25 +1913,131 @@ void server::on_client_cancel(std::string_view cancel_message, client_data &clie
   }
 }
 
+void server::on_client_cancel_all(std::string_view filter_message,
+  client_data &client_data,
+  market_interface &market)
+{
+  const auto filter = parse_cancel_filter(filter_message);
+  if (!filter || client_data.state != client_state::identified)
+  {
+    spdlog::error("Rejecting mass cancel \"{}\" from client {}", filter_message, client_data.name);
+    client_data.write_sequenced(reject_message);
+    return;
+  }
+
+  auto &session = *client_data.session;
+  const auto cancelled = market.cancel_all(session.id, *filter);
+  spdlog::info("Cancelled {} orders of client {}", cancelled.size(), client_data.name);
+
+  // Market ids are qualified by the session
+  const auto prefix_size = market_order_id(session.id, "").size();
+  for (const auto &id : cancelled)
+  {
+    if (const auto it = session.outstanding_orders.find(id.substr(prefix_size)); it != session.outstanding_orders.end())
+    {
+      session.risk.on_cancel(it->second);
+      session.outstanding_orders.erase(it);
+    }
+  }
+  if (!cancelled.empty()) { session.on_orders_changed(); }
+
+  client_data.write_sequenced(ok_message);
+}
+
+void server::on_execution(const std::string &id,
+  const fill &fill,
+  session_id owner,
+  state &state,
+  server_metrics &metrics)
+{
+  auto routed = false;
+  state.sessions.with_session(owner, [&id, &fill, &routed, &state](session &session) {
+    std::scoped_lock l{ session.attachment_mutex };
+    if (session.connection != nullptr)
+    {
+      // The connection is released only after its session coroutine detached it
+      session.connection->events.push({ .type = client_event::kind::execution, .id = id, .fill = fill });
+      routed = true;
+    }
+    else if (session.resumable() && session.detached_executions.size() < state.max_detached_executions)
+    {
+      session.detached_executions.emplace_back(id, fill);
+      routed = true;
+    }
+  });
+
+  if (!routed)
+  {
+    spdlog::warn("Dropping execution of order {}: session {} is disconnected", id, owner);
+    ++metrics.orphaned_executions;
+  }
+}
+
+void server::on_client_execution(const std::string &id, const fill &fill, client_data &client_data)
+{
+  auto &session = *client_data.session;
+  arena<64> memory;
+  client_data.write_sequenced(execution_message(id, fill, memory.resource()));
+  if (const auto executed = session.outstanding_orders.find(id); executed != session.outstanding_orders.end())
+  {
+    session.risk.on_execution(executed->second, fill.quantity);
+    if (fill.quantity < executed->second.quantity) { executed->second.quantity -= fill.quantity; }
+    else
+    {
+      session.outstanding_orders.erase(executed);
+    }
+    session.on_orders_changed();
+  }
+}
+
+void server::on_client_disconnected(client_data &client_data,
+  state &state,
+  market_interface &market,
+  orphan_policy policy)
+{
+  auto &session = *client_data.session;
+
+  // Executions of other sessions are orphaned from now on
+  if (!session.resumable()) { state.sessions.remove(session.id); }
+
+  std::vector<std::shared_ptr<server::session>> ended;
+  {
+    std::scoped_lock l{ session.attachment_mutex };
+    session.connection = nullptr;
+    if (session.resumable()) { ended = state.detach(client_data.session, std::chrono::steady_clock::now()); }
+  }
+
+  for (const auto &detached : ended)
+  {
+    spdlog::info("Ending session {}, away for too long or too many sessions are", detached->name);
+    end_session(*detached, state, market, policy);
+  }
+
+  if (session.resumable())
+  {
+    spdlog::info("Session {} is kept with {} orders", session.name, session.outstanding_orders.size());
+    return;
+  }
+
+  end_session(session, state, market, policy);
+}
+
+void server::end_session(session &session, state &state, market_interface &market, orphan_policy policy)
+{
+  state.sessions.remove(session.id);
+  if (policy == orphan_policy::retain || session.outstanding_orders.empty()) { return; }
+
+  // Orders executed meanwhile are dropped as orphans
+  const auto cancelled = market.cancel_all(session.id, {});
+  spdlog::info("Cancelled {} orders of session {}", cancelled.size(), session.id);
+  session.outstanding_orders.clear();
+}
+
 void server::on_client_list_orders(client_data &client_data)
 {
   spdlog::info("Received orderlist request from {}", client_data.name);
 
-  std::ostringstream oss;
-  std::transform(client_data.outstanding_orders.begin(),
-    client_data.outstanding_orders.end(),
-    std::ostream_iterator<std::string>{ oss, "\n" },
-    [](const auto &element) {
-      const auto &order = element.second;
-      return fmt::format("{: >4}{: >8}{}{:0>4}{:0>8.0f}",
-        order.id,
-        order.symbol,
-        order.way == order_side::buy ? '+' : '-',
-        order.quantity,
-        order.price);
-    });
-
-  const auto message = oss.str();
+  const auto &message = client_data.session->list_orders_response();
 
   spdlog::trace("Sending orderlist response: {}", message);
   client_data.write(message);
@@ -413,13 +2047,57 @@ void server::on_client_list_symbols(client_data &client_data, const state &state
 {
   spdlog::info("Received symbollist request from {}", client_data.name);
 
-  std::ostringstream oss;
-  auto known_symbols = state.list_symbols();
-  std::copy(known_symbols.begin(), known_symbols.end(), std::ostream_iterator<std::string>{ oss, "\n" });
-
-  const auto message = oss.str();
+  const auto &message = client_data.list_symbols_response(state);
 
   spdlog::trace("Sending symbollist response: {}", message);
   client_data.write(message);
 }
+
+void server::on_client_subscribe(std::string_view symbol, client_data &client_data, const state &state)
+{
+  // Only symbols orders were placed for have a feed, so that clients cannot make the publisher grow
+  if (!state.market_data || client_data.state != client_state::identified || !state.has_symbol(symbol)
+      || !client_data.subscriptions.emplace(symbol).second)
+  {
+    spdlog::error("Rejecting subscription of {} to {}", client_data.name, symbol);
+    client_data.write(reject_message);
+    return;
+  }
+
+  spdlog::info("Client {} subscribed to {}", client_data.name, symbol);
+
+  // The snapshot follows the acknowledgement
+  client_data.write(ok_message);
+  state.market_data->subscribe(std::string{ symbol }, client_data.shared_from_this());
+}
+
+void server::on_client_unsubscribe(std::string_view symbol, client_data &client_data, const state &state)
+{
+  const auto it = client_data.subscriptions.find(std::string{ symbol });
+  if (!state.market_data || it == client_data.subscriptions.end())
+  {
+    spdlog::error("Rejecting unsubscription of {} from {}", client_data.name, symbol);
+    client_data.write(reject_message);
+    return;
+  }
+
+  spdlog::info("Client {} unsubscribed from {}", client_data.name, symbol);
+
+  client_data.subscriptions.erase(it);
+  state.market_data->unsubscribe(std::string{ symbol }, client_data);
+  client_data.write(ok_message);
+}
+
+void server::on_client_snapshot(std::string_view symbol, client_data &client_data, const state &state)
+{
+  if (!state.market_data || client_data.state != client_state::identified || !state.has_symbol(symbol))
+  {
+    spdlog::error("Rejecting snapshot request of {} for {}", client_data.name, symbol);
+    client_data.write(reject_message);
+    return;
+  }
+
+  spdlog::info("Received snapshot request for {} from {}", symbol, client_data.name);
+  state.market_data->snapshot(std::string{ symbol }, client_data);
+}
 }
\ No newline at end of file
@@ -1,15 +1,97 @@
 #pragma once
 
+#include "metrics.h"
+#include "risk.h"
+#include "session_registry.h"
+#include "timer_wheel.h"
+#include "worker.h"
 #include <memory>
-#include <unordered_map>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace exchange_server {
 
 class listen_socket_interface;
 class epoll_interface;
-class worker_interface;
 class socket_interface;
 class market_interface;
+struct fill;
+class market_data_publisher;
+class block_pool;
+class task;
+class journal;
+class market;
+struct handoff_state;
+
+enum class slow_consumer_policy { disconnect, flag };
+
+// What happens to the orders of a client which disconnects, their executions are dropped when retained
+enum class orphan_policy { retain, cancel };
+
+struct connection_limits
+{
+  // Clients sending longer messages are disconnected
+  std::size_t max_message_size{ 1024 };
+  // Reading from a client pauses while more of its messages are queued for processing, until the queue is drained
+  // back to the low watermark. Each low watermark must be below its high watermark.
+  std::size_t queue_high_watermark{ 1024 };
+  std::size_t queue_low_watermark{ 256 };
+  // Same for the bytes waiting to be sent to a client which does not read its responses
+  std::size_t write_high_watermark{ 1U << 20U };
+  std::size_t write_low_watermark{ 1U << 16U };
+  // Clients with more bytes waiting to be sent are slow consumers, handled according to the policy
+  std::size_t max_write_buffer{ 16U << 20U };
+  slow_consumer_policy slow_consumer{ slow_consumer_policy::disconnect };
+};
+
+// Rates are in messages per second and bursts in messages, a zero rate disables the throttle
+struct throttle_limits
+{
+  // Orders and cancels of a client
+  double session_rate{ 0 };
+  double session_burst{ 0 };
+  // Orders of a client for a given symbol, each entry of a quote counts against the bucket of its symbol
+  double symbol_rate{ 0 };
+  double symbol_burst{ 0 };
+  // Quotes with more entries are rejected whole, unlimited if zero
+  std::size_t max_quote_entries{ 64 };
+};
+
+struct server_options
+{
+  connection_limits connection;
+  throttle_limits throttle;
+  // Messages of a client processed in a row before the worker moves to other clients
+  strand_options batching{ .max_batch = 16 };
+  risk_limits risk;
+  orphan_policy orphan_orders{ orphan_policy::retain };
+  // Order flow messages kept per logged in session for replay after a reconnection
+  std::size_t retransmit_buffer{ 1024 };
+  // Sessions of clients away are ended past this many, the oldest first, or once away this long, never if zero. Their
+  // orders are then handled like those of disconnected unnamed clients.
+  std::size_t max_detached_sessions{ 1024 };
+  std::chrono::milliseconds detached_session_timeout{ std::chrono::hours{ 1 } };
+  // Executions kept for a client away, the others are dropped as orphans
+  std::size_t max_detached_executions{ 1024 };
+  // Read on control_command::reload_risk_limits
+  std::string risk_limits_file;
+  // Connections which have not identified within this delay are closed, disabled if zero
+  std::chrono::milliseconds login_timeout{ 0 };
+  // Connections which have sent nothing for this long are closed, disabled if zero
+  std::chrono::milliseconds idle_timeout{ 0 };
+  // Sessions still handling what they were sent by then keep the server from handing off, it serves on instead
+  std::chrono::milliseconds handoff_timeout{ std::chrono::seconds{ 10 } };
+  // Session ids also own the orders in the market, a follower taking over starts past those it replicated
+  session_id first_session_id{ 1 };
+};
+
+// Values written to the control socket, one per write. The control socket must keep them apart, e.g. a pipe: an
+// eventfd would add up commands written before the server reads them.
+enum class control_command : std::uint64_t { stop = 1, reload_risk_limits = 2 };
 
 class server
 {
@@ -18,39 +100,136 @@ public:
     std::shared_ptr<epoll_interface> epoll,
     std::shared_ptr<worker_interface> worker,
     std::shared_ptr<socket_interface> control,
-    std::shared_ptr<market_interface> market);
+    std::shared_ptr<market_interface> market,
+    server_options options = {},
+    std::shared_ptr<market_data_publisher> market_data = nullptr,
+    std::shared_ptr<journal> journal = nullptr,
+    std::shared_ptr<listen_socket_interface> handoff_listener = nullptr);
 
+  // Until stopped, or until a successor connects to the handoff listener
   void run();
 
+  // Connections, sessions and listener handed off by the previous server, before running
+  void take_over(handoff_state state);
+  // Once run returned because a successor connected: waits for the sessions to handle what they were sent, then hands
+  // everything off to the successor. The worker must still run, while the market must no longer change but through the
+  // sessions. On failure the successor is dropped and the server can run again, with the connections it kept.
+  std::error_code hand_off(market &market);
+  bool handoff_requested() const { return _successor != nullptr; }
+
+  const server_metrics &metrics() const { return *_metrics; }
+
 private:
   void on_control();
+  void reload_risk_limits();
 
   void on_connect();
-  void on_read(int fd);
-  void on_write(int fd);
+  void on_handoff();
+  // Run by the worker, false while a session still has work
+  bool capture_handoff(handoff_state &state, market &market);
+  // Gives the connections back to the reactor after a failed handoff
+  std::error_code cancel_handoff(std::error_code err);
+  void on_read(std::uint64_t key);
+  void on_write(std::uint64_t key);
+  void on_login_timeout(std::uint64_t key);
+  void on_idle_timeout(std::uint64_t key);
 
   struct client_data;
+  struct client_event;
+  struct session;
   struct state;
 
-  static void
-    on_client_message(const std::string &message, client_data &client_data, state &state, market_interface &market);
+  // Connections are indexed by fd, the generation tells apart the successive connections of a reused fd
+  struct connection_slot
+  {
+    std::shared_ptr<client_data> client;
+    std::uint32_t generation{};
+    timer_wheel::timer_id login_timer{};
+    timer_wheel::timer_id idle_timer{};
+    timer_wheel::clock::time_point last_read;
+  };
+
+  // The connection gets a new unnamed session unless given one, returns its key
+  std::uint64_t add_connection(std::shared_ptr<socket_interface> sock, std::shared_ptr<session> session);
+  // Runs the session coroutine of the connection and schedules its timeouts
+  void start_session(std::uint64_t key);
+  connection_slot *find_connection(std::uint64_t key);
+  // Ends the session of the connection, its message queue still processes what was already posted
+  void release(connection_slot &slot);
+
+  // Handles the events of a connection until it is released
+  static task run_session(const std::shared_ptr<block_pool> &frames,
+    client_data &client_data,
+    state &state,
+    market_interface &market,
+    const server_options &options);
+  // Transient allocations of the handlers come from memory, released once the batch of the message was handled
+  static void on_client_message(std::string_view message,
+    client_data &client_data,
+    state &state,
+    market_interface &market,
+    std::pmr::memory_resource *memory);
   static void on_client_id(std::string_view id_message, client_data &client_data);
-  static void
-    on_client_order(std::string_view order_message, client_data &client_data, state &state, market_interface &market);
+  static void on_client_login(std::string_view name, client_data &client_data, state &state);
+  static void on_client_resume(std::string_view resume_message, client_data &client_data, state &state);
+  // Attaches the session to the connection and returns the executions received while it was detached, none when it is
+  // attached to another connection or was ended
+  static std::optional<std::vector<std::pair<std::string, fill>>>
+    attach_session(const std::shared_ptr<session> &session, client_data &client_data, state &state);
+  static void on_client_replay(std::string_view replay_message, client_data &client_data);
+  static void on_client_order(std::string_view order_message,
+    client_data &client_data,
+    state &state,
+    market_interface &market,
+    std::pmr::memory_resource *memory);
+  static void on_client_quote(std::string_view quote_message,
+    client_data &client_data,
+    state &state,
+    market_interface &market,
+    std::pmr::memory_resource *memory);
   static void on_client_cancel(std::string_view cancel_message, client_data &client_data, market_interface &market);
+  static void
+    on_client_cancel_all(std::string_view filter_message, client_data &client_data, market_interface &market);
   static void on_client_list_orders(client_data &client_data);
   static void on_client_list_symbols(client_data &client_data, const state &state);
+  static void on_client_subscribe(std::string_view symbol, client_data &client_data, const state &state);
+  static void on_client_unsubscribe(std::string_view symbol, client_data &client_data, const state &state);
+  static void on_client_snapshot(std::string_view symbol, client_data &client_data, const state &state);
+  static void
+    on_client_disconnected(client_data &client_data, state &state, market_interface &market, orphan_policy policy);
+  // Of a session no connection is attached to anymore
+  static void end_session(session &session, state &state, market_interface &market, orphan_policy policy);
+  static void
+    on_execution(const std::string &id, const fill &fill, session_id owner, state &state, server_metrics &metrics);
+  static void on_client_execution(const std::string &id, const fill &fill, client_data &client_data);
 
   std::shared_ptr<worker_interface> _worker;
   std::shared_ptr<exchange_server::listen_socket_interface> _listener;
   std::shared_ptr<exchange_server::epoll_interface> _epoll;
   std::shared_ptr<socket_interface> _control;
   std::shared_ptr<market_interface> _market;
+  server_options _options;
+  // Responses are held until followers replicated what the market journaled, when there is a quorum
+  std::shared_ptr<journal> _journal;
+  std::shared_ptr<listen_socket_interface> _handoff_listener;
+  std::shared_ptr<socket_interface> _successor;
 
-  std::unordered_map<int, std::shared_ptr<client_data>> _client_data;
+  // Sized to the open files limit on construction, grown on accept only past it
+  std::vector<connection_slot> _connections;
+  std::shared_ptr<block_pool> _client_pool;
+  std::shared_ptr<block_pool> _session_pool;
+  std::shared_ptr<block_pool> _frame_pool;
+  std::shared_ptr<block_pool> _batch_pool;
   std::shared_ptr<state> _state;
+  std::shared_ptr<server_metrics> _metrics;
+
+  // Connection timeouts, only read when one is enabled
+  timer_wheel _timers;
+  timer_wheel::clock::time_point _now;
 
   bool _should_stop{ false };
+  // The listener and control socket are watched from the first run on
+  bool _registered{ false };
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,267 @@
+#include "epoll_impl.h"
+#include "multicast_feed.h"
+#include "socket_impl.h"
+
+#include <CLI/CLI.hpp>
+#include <spdlog/spdlog.h>
+
+#include <charconv>
+#include <sys/epoll.h>
+
+#include <internal_use_only/config.hpp>
+
+namespace {
+
+using steady_clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+struct subscriber_config
+{
+  std::string group{ "239.255.0.1" };
+  int port{ 9091 };
+  std::string interface{ "127.0.0.1" };
+  std::string recovery_host{ "127.0.0.1" };
+  // Gaps are only reported when there is no recovery service
+  int recovery_port{ 0 };
+  int duration{ 10 };
+  bool verbose{ false };
+};
+
+struct subscriber_stats
+{
+  std::uint64_t packets{};
+  std::uint64_t invalid_packets{};
+  std::uint64_t messages{};
+  std::uint64_t duplicates{};
+  std::uint64_t gaps{};
+  std::uint64_t missed{};
+  std::uint64_t recovered{};
+  std::uint64_t unrecovered{};
+};
+
+constexpr std::string_view replay_end_prefix{ "replayend" };
+constexpr std::string_view snapshot_end_prefix{ "snapshotend" };
+constexpr std::string_view reject_message{ "rejected\n" };
+constexpr std::size_t sequence_digits{ 12 };
+
+std::string_view last_line(std::string_view response)
+{
+  const auto start = response.rfind('\n', response.size() - 2);
+  return start == std::string_view::npos ? response : response.substr(start + 1);
+}
+
+bool is_complete(std::string_view response)
+{
+  if (!response.ends_with('\n')) { return false; }
+
+  const auto line = last_line(response);
+  return line.starts_with(replay_end_prefix) || line.starts_with(snapshot_end_prefix) || line == reject_message;
+}
+
+// Sequence number ending a complete response, nothing if it was rejected
+std::optional<std::uint64_t> last_sequence(std::string_view response)
+{
+  auto line = last_line(response);
+  line.remove_prefix(line.starts_with(replay_end_prefix) ? replay_end_prefix.size() : snapshot_end_prefix.size());
+
+  std::uint64_t sequence{};
+  if (std::from_chars(line.data(), line.data() + line.size(), sequence).ec != std::errc{}) { return std::nullopt; }
+
+  return sequence;
+}
+
+// Sends a request to the recovery service and waits for its complete response
+std::optional<std::string> request_recovery(const subscriber_config &config, std::string_view request)
+{
+  exchange_server::client_socket_impl sock{ config.recovery_host, config.recovery_port };
+  exchange_server::epoll_impl epoll;
+  epoll.add(sock.get_fd(), EPOLLIN);
+
+  const auto message = fmt::format("{}\n", request);
+  if (auto [bytes_written, err] = sock.write(message);
+      err || static_cast<std::size_t>(bytes_written) != message.size())
+  {
+    return std::nullopt;
+  }
+
+  std::string response;
+  std::vector<char> buffer(1U << 16U);
+  while (!is_complete(response))
+  {
+    if (epoll.wait_for(5s).empty()) { return std::nullopt; }
+
+    auto [bytes_read, err] = sock.read(buffer);
+    if (err == std::errc::resource_unavailable_try_again || err == std::errc::operation_would_block) { continue; }
+    if (err || bytes_read == 0) { return std::nullopt; }
+
+    response.append(buffer.data(), static_cast<std::size_t>(bytes_read));
+  }
+
+  return response;
+}
+
+class feed_checker
+{
+public:
+  explicit feed_checker(const subscriber_config &config) : _config{ config } {}
+
+  void start()
+  {
+    if (_config.recovery_port == 0) { return; }
+
+    // Later messages apply on top of the snapshot
+    const auto snapshot = request_recovery(_config, "snapshot");
+    if (!snapshot) { throw std::runtime_error{ "Cannot get snapshot from the recovery service" }; }
+
+    if (_config.verbose) { fmt::print("{}", *snapshot); }
+    if (const auto sequence = last_sequence(*snapshot)) { _tracker.reset(*sequence + 1); }
+  }
+
+  void on_datagram(std::span<const char> datagram)
+  {
+    ++_stats.packets;
+
+    const auto packet = exchange_server::parse_feed_packet(datagram);
+    if (!packet)
+    {
+      ++_stats.invalid_packets;
+      return;
+    }
+
+    const auto count = packet->messages.size();
+    const auto duplicates = _tracker.duplicates(packet->sequence, count);
+    _stats.duplicates += duplicates;
+
+    if (const auto gap = _tracker.on_packet(packet->sequence, count))
+    {
+      ++_stats.gaps;
+      _stats.missed += gap->last - gap->first + 1;
+      spdlog::warn("Missed messages {} to {}", gap->first, gap->last);
+
+      // The replay also contains this packet
+      if (recover(*gap)) { return; }
+    }
+
+    for (auto index = duplicates; index < count; ++index)
+    {
+      on_message(packet->sequence + index, packet->messages[index]);
+    }
+  }
+
+  const subscriber_stats &stats() const { return _stats; }
+
+private:
+  bool recover(const exchange_server::feed_sequence_tracker::gap &gap)
+  {
+    const auto response =
+      _config.recovery_port == 0 ? std::nullopt : request_recovery(_config, fmt::format("replay{}", gap.first));
+    const auto last = response ? last_sequence(*response) : std::nullopt;
+    if (!last)
+    {
+      _stats.unrecovered += gap.last - gap.first + 1;
+      return false;
+    }
+
+    std::string_view messages{ *response };
+    messages.remove_suffix(last_line(messages).size());
+    for (auto end = messages.find('\n'); end != std::string_view::npos; end = messages.find('\n'))
+    {
+      const auto line = messages.substr(0, end + 1);
+      messages.remove_prefix(end + 1);
+
+      std::uint64_t sequence{};
+      std::from_chars(line.data(), line.data() + sequence_digits, sequence);
+      if (sequence <= gap.last) { ++_stats.recovered; }
+      on_message(sequence, line.substr(sequence_digits));
+    }
+
+    _tracker.reset(std::max(_tracker.expected(), *last + 1));
+    return true;
+  }
+
+  void on_message(std::uint64_t sequence, std::string_view message)
+  {
+    ++_stats.messages;
+    if (_config.verbose) { fmt::print("{} {}", sequence, message); }
+  }
+
+  const subscriber_config &_config;
+  exchange_server::feed_sequence_tracker _tracker;
+  subscriber_stats _stats;
+};
+
+void print_report(const subscriber_config &config, const subscriber_stats &stats)
+{
+  fmt::print("Listened to {}:{} for {}s\n", config.group, config.port, config.duration);
+  fmt::print("Received: {} packets ({} invalid), {} messages, {} duplicates\n",
+    stats.packets,
+    stats.invalid_packets,
+    stats.messages,
+    stats.duplicates);
+  fmt::print("Gaps: {}, {} messages missed, {} recovered, {} unrecovered\n",
+    stats.gaps,
+    stats.missed,
+    stats.recovered,
+    stats.unrecovered);
+}
+}
+
+int main(int argc, const char **argv)
+{
+  try
+  {
+    CLI::App app{ fmt::format("{} market data subscriber version {}",
+      SmallExchangeServer::cmake::project_name,
+      SmallExchangeServer::cmake::project_version) };
+
+    subscriber_config config;
+    app.add_option("-g,--group", config.group, "Multicast group of the market data feed");
+    app.add_option("-p,--port", config.port, "Port of the market data feed");
+    app.add_option("-i,--interface", config.interface, "Address of the interface joining the group");
+    app.add_option("--recovery-host", config.recovery_host, "Host of the recovery service");
+    app.add_option(
+      "--recovery-port", config.recovery_port, "Port of the recovery service, gaps are not recovered if 0");
+    app.add_option("-d,--duration", config.duration, "Listening duration in seconds")->check(CLI::PositiveNumber);
+    app.add_flag("-v,--verbose", config.verbose, "Print received messages");
+    bool show_version = false;
+    app.add_flag("--version", show_version, "Show version information");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (show_version)
+    {
+      fmt::print("{}\n", SmallExchangeServer::cmake::project_version);
+      return EXIT_SUCCESS;
+    }
+
+    exchange_server::multicast_receiver_socket_impl sock{ config.group, config.port, config.interface };
+    exchange_server::epoll_impl epoll;
+    epoll.add(sock.get_fd(), EPOLLIN);
+
+    feed_checker checker{ config };
+    checker.start();
+
+    std::vector<char> datagram(1U << 16U);
+    const auto end = steady_clock::now() + std::chrono::seconds{ config.duration };
+    while (steady_clock::now() < end)
+    {
+      if (epoll.wait_for(100ms).empty()) { continue; }
+
+      for (;;)
+      {
+        auto [bytes_read, err] = sock.read(datagram);
+        if (err) { break; }
+
+        checker.on_datagram(std::span{ datagram }.first(static_cast<std::size_t>(bytes_read)));
+      }
+    }
+
+    print_report(config, checker.stats());
+
+    return checker.stats().unrecovered == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  } catch (const std::exception &e)
+  {
+    spdlog::error("Unhandled exception in main: {}", e.what());
+    return EXIT_FAILURE;
+  }
+}
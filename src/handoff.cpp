@@ -0,0 +1,411 @@
+#include "handoff.h"
+#include "replication.h"
+#include "scope_exit.h"
+#include "utilities.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <fmt/format.h>
+#include <iterator>
+#include <optional>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+
+namespace exchange_server {
+
+namespace {
+  constexpr std::size_t number_size{ 20 };
+  constexpr std::size_t header_size{ 2 * number_size };
+
+  sockaddr_un make_address(const std::string &path)
+  {
+    sockaddr_un address{ .sun_family = AF_UNIX };
+    if (path.size() >= sizeof(address.sun_path))
+    {
+      throw std::invalid_argument{ fmt::format("Unix socket path too long: {}", path) };
+    }
+
+    std::copy(path.begin(), path.end(), std::begin(address.sun_path));
+    return address;
+  }
+
+  template<class T> void append_number(std::string &data, T value)
+  {
+    fmt::format_to(std::back_inserter(data), "{:020}", value);
+  }
+
+  void append_string(std::string &data, std::string_view value)
+  {
+    append_number(data, value.size());
+    data.append(value);
+  }
+
+  std::optional<std::string_view> take(std::string_view &data, std::size_t size)
+  {
+    if (data.size() < size) { return std::nullopt; }
+
+    const auto field = data.substr(0, size);
+    data.remove_prefix(size);
+    return field;
+  }
+
+  template<class T> std::optional<T> take_number(std::string_view &data)
+  {
+    const auto field = take(data, number_size);
+    if (!field) { return std::nullopt; }
+
+    T value{};
+    const auto *const end = field->data() + field->size();
+    if (const auto [ptr, err] = std::from_chars(field->data(), end, value); err != std::errc{} || ptr != end)
+    {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+  std::optional<std::string> take_string(std::string_view &data)
+  {
+    const auto size = take_number<std::size_t>(data);
+    const auto value = size ? take(data, *size) : std::nullopt;
+    if (!value) { return std::nullopt; }
+
+    return std::string{ *value };
+  }
+
+  void append_session(std::string &data, const handoff_session &session)
+  {
+    data.push_back('S');
+    append_number(data, session.id);
+    append_string(data, session.name);
+    append_string(data, session.token);
+    append_number(data, session.last_sequence);
+    append_number(data, session.outstanding_orders.size());
+    for (const auto &order : session.outstanding_orders) { append_journal_order(data, order); }
+    append_number(data, session.positions.size());
+    for (const auto &[symbol, position] : session.positions)
+    {
+      append_string(data, symbol);
+      append_number(data, position);
+    }
+    append_number(data, session.detached_executions.size());
+    for (const auto &[id, fill] : session.detached_executions)
+    {
+      append_string(data, id);
+      append_number(data, fill.quantity);
+      fmt::format_to(std::back_inserter(data), "{:020.0f}", fill.price);
+    }
+  }
+
+  std::optional<handoff_session> take_session(std::string_view &data)
+  {
+    handoff_session session;
+    const auto id = take_number<session_id>(data);
+    auto name = take_string(data);
+    auto token = take_string(data);
+    const auto last_sequence = take_number<std::uint64_t>(data);
+    if (!id || !name || !token || !last_sequence) { return std::nullopt; }
+
+    session.id = *id;
+    session.name = std::move(*name);
+    session.token = std::move(*token);
+    session.last_sequence = *last_sequence;
+
+    auto count = take_number<std::size_t>(data);
+    for (std::size_t i = 0; count && i < *count; ++i)
+    {
+      auto order = take_journal_order(data);
+      if (!order) { return std::nullopt; }
+      session.outstanding_orders.push_back(std::move(*order));
+    }
+
+    count = count ? take_number<std::size_t>(data) : std::nullopt;
+    for (std::size_t i = 0; count && i < *count; ++i)
+    {
+      auto symbol = take_string(data);
+      const auto position = take_number<std::int64_t>(data);
+      if (!symbol || !position) { return std::nullopt; }
+      session.positions.emplace_back(std::move(*symbol), *position);
+    }
+
+    count = count ? take_number<std::size_t>(data) : std::nullopt;
+    for (std::size_t i = 0; count && i < *count; ++i)
+    {
+      auto id = take_string(data);
+      const auto quantity = take_number<std::uint64_t>(data);
+      const auto price = take_number<std::uint64_t>(data);
+      if (!id || !quantity || !price) { return std::nullopt; }
+      session.detached_executions.emplace_back(
+        std::move(*id), fill{ .quantity = *quantity, .price = static_cast<double>(*price) });
+    }
+
+    if (!count) { return std::nullopt; }
+    return session;
+  }
+
+  void append_connection(std::string &data, const handoff_connection &connection)
+  {
+    data.push_back('C');
+    append_number(data, connection.session);
+    data.push_back(connection.identified ? '1' : '0');
+    append_string(data, connection.name);
+    append_number(data, connection.subscriptions.size());
+    for (const auto &symbol : connection.subscriptions) { append_string(data, symbol); }
+    append_string(data, connection.read_buffer);
+    append_string(data, connection.write_buffer);
+  }
+
+  std::optional<handoff_connection> take_connection(std::string_view &data)
+  {
+    handoff_connection connection;
+    const auto session = take_number<session_id>(data);
+    const auto identified = take(data, 1);
+    auto name = take_string(data);
+    const auto count = take_number<std::size_t>(data);
+    if (!session || !identified || (*identified != "0" && *identified != "1") || !name || !count)
+    {
+      return std::nullopt;
+    }
+
+    connection.session = *session;
+    connection.identified = *identified == "1";
+    connection.name = std::move(*name);
+    for (std::size_t i = 0; i < *count; ++i)
+    {
+      auto symbol = take_string(data);
+      if (!symbol) { return std::nullopt; }
+      connection.subscriptions.push_back(std::move(*symbol));
+    }
+
+    auto read_buffer = take_string(data);
+    auto write_buffer = take_string(data);
+    if (!read_buffer || !write_buffer) { return std::nullopt; }
+
+    connection.read_buffer = std::move(*read_buffer);
+    connection.write_buffer = std::move(*write_buffer);
+    return connection;
+  }
+
+  std::error_code send_all(int sock, std::string_view data)
+  {
+    while (!data.empty())
+    {
+      const auto sent = ::send(sock, data.data(), data.size(), MSG_NOSIGNAL);
+      if (sent < 0 && errno != EINTR) { return get_last_error(); }
+      if (sent > 0) { data.remove_prefix(static_cast<std::size_t>(sent)); }
+    }
+
+    return {};
+  }
+
+  result<std::string> receive_all(int sock, std::size_t size)
+  {
+    std::string data(size, '\0');
+    for (std::size_t offset = 0; offset < size;)
+    {
+      const auto received = ::recv(sock, data.data() + offset, size - offset, 0);
+      if (received < 0 && errno != EINTR) { return { .err = get_last_error() }; }
+      if (received == 0) { return { .err = std::make_error_code(std::errc::connection_aborted) }; }
+      if (received > 0) { offset += static_cast<std::size_t>(received); }
+    }
+
+    return { .result = std::move(data) };
+  }
+}
+
+std::string serialize_handoff(const handoff_state &state)
+{
+  std::string data;
+  data.push_back('L');
+  append_number(data, state.last_session_id);
+  for (const auto &symbol : state.symbols)
+  {
+    data.push_back('Y');
+    append_string(data, symbol);
+  }
+  for (const auto &order : state.resting_orders)
+  {
+    data.push_back('O');
+    append_journal_order(data, order);
+  }
+  for (const auto &session : state.sessions) { append_session(data, session); }
+  for (const auto &connection : state.connections) { append_connection(data, connection); }
+
+  return data;
+}
+
+result<handoff_state> parse_handoff(std::string_view data)
+{
+  const auto invalid = result<handoff_state>{ .err = std::make_error_code(std::errc::bad_message) };
+
+  handoff_state state;
+  while (!data.empty())
+  {
+    const auto kind = data.front();
+    data.remove_prefix(1);
+
+    switch (kind)
+    {
+    case 'L': {
+      const auto last_session_id = take_number<session_id>(data);
+      if (!last_session_id) { return invalid; }
+      state.last_session_id = *last_session_id;
+      break;
+    }
+    case 'Y': {
+      auto symbol = take_string(data);
+      if (!symbol) { return invalid; }
+      state.symbols.push_back(std::move(*symbol));
+      break;
+    }
+    case 'O': {
+      auto order = take_journal_order(data);
+      if (!order) { return invalid; }
+      state.resting_orders.push_back(std::move(*order));
+      break;
+    }
+    case 'S': {
+      auto session = take_session(data);
+      if (!session) { return invalid; }
+      state.sessions.push_back(std::move(*session));
+      break;
+    }
+    case 'C': {
+      auto connection = take_connection(data);
+      if (!connection) { return invalid; }
+      state.connections.push_back(std::move(*connection));
+      break;
+    }
+    default:
+      return invalid;
+    }
+  }
+
+  return { .result = std::move(state) };
+}
+
+std::error_code send_handoff(int sock, const handoff_state &state)
+{
+  std::vector<int> descriptors{ state.listener_fd };
+  for (const auto &connection : state.connections) { descriptors.push_back(connection.fd); }
+  const auto data = serialize_handoff(state);
+
+  std::string header;
+  append_number(header, descriptors.size());
+  append_number(header, data.size());
+  if (const auto err = send_all(sock, header)) { return err; }
+
+  // Each message carries a byte, the descriptors are attached to it
+  for (std::size_t first = 0; first < descriptors.size(); first += max_handoff_descriptors)
+  {
+    const auto count = std::min(descriptors.size() - first, max_handoff_descriptors);
+
+    char byte{};
+    iovec io{ .iov_base = &byte, .iov_len = sizeof(byte) };
+    std::array<char, CMSG_SPACE(max_handoff_descriptors * sizeof(int))> control{};
+    msghdr message{
+      .msg_iov = &io, .msg_iovlen = 1, .msg_control = control.data(), .msg_controllen = CMSG_SPACE(count * sizeof(int))
+    };
+
+    auto *control_header = CMSG_FIRSTHDR(&message);
+    control_header->cmsg_level = SOL_SOCKET;
+    control_header->cmsg_type = SCM_RIGHTS;
+    control_header->cmsg_len = CMSG_LEN(count * sizeof(int));
+    std::memcpy(CMSG_DATA(control_header), descriptors.data() + first, count * sizeof(int));
+
+    if (::sendmsg(sock, &message, MSG_NOSIGNAL) < 0) { return get_last_error(); }
+  }
+
+  return send_all(sock, data);
+}
+
+result<handoff_state> receive_handoff(int sock)
+{
+  const auto invalid = result<handoff_state>{ .err = std::make_error_code(std::errc::bad_message) };
+
+  auto [header, err] = receive_all(sock, header_size);
+  if (err) { return { .err = err }; }
+
+  std::string_view fields{ header };
+  const auto count = take_number<std::size_t>(fields);
+  const auto size = take_number<std::size_t>(fields);
+  if (!count || !size || *count == 0) { return invalid; }
+
+  // Closed unless they end up in the state
+  std::vector<int> descriptors;
+  const scope_exit close_descriptors{ [&descriptors] {
+    for (const auto fd : descriptors) { ::close(fd); }
+  } };
+
+  while (descriptors.size() < *count)
+  {
+    char byte{};
+    iovec io{ .iov_base = &byte, .iov_len = sizeof(byte) };
+    std::array<char, CMSG_SPACE(max_handoff_descriptors * sizeof(int))> control{};
+    msghdr message{ .msg_iov = &io, .msg_iovlen = 1, .msg_control = control.data(), .msg_controllen = control.size() };
+
+    const auto received = ::recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+    if (received < 0) { return { .err = get_last_error() }; }
+    else if (received == 0)
+    {
+      return { .err = std::make_error_code(std::errc::connection_aborted) };
+    }
+
+    const auto *control_header = CMSG_FIRSTHDR(&message);
+    if (control_header == nullptr || control_header->cmsg_type != SCM_RIGHTS) { return invalid; }
+
+    const auto received_count = (control_header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const auto first = descriptors.size();
+    descriptors.resize(first + received_count);
+    std::memcpy(descriptors.data() + first, CMSG_DATA(control_header), received_count * sizeof(int));
+    if ((message.msg_flags & MSG_CTRUNC) != 0U) { return invalid; }
+  }
+
+  auto [data, data_err] = receive_all(sock, *size);
+  if (data_err) { return { .err = data_err }; }
+
+  auto [state, parse_err] = parse_handoff(data);
+  if (parse_err) { return { .err = parse_err }; }
+  if (state.connections.size() + 1 != descriptors.size()) { return invalid; }
+
+  state.listener_fd = descriptors.front();
+  for (std::size_t i = 0; i < state.connections.size(); ++i) { state.connections[i].fd = descriptors[i + 1]; }
+  descriptors.clear();
+
+  return { .result = std::move(state) };
+}
+
+handoff_listen_socket::handoff_listen_socket(const std::string &path)
+  : socket_impl_base{ ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) }
+{
+  // Left over by the process this one took over from: the path is not removed on exit, as the successor may already
+  // listen on it
+  ::unlink(path.c_str());
+
+  const auto address = make_address(path);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast,clang-diagnostic-old-style-cast)
+  if (::bind(_fd, (const sockaddr *)&address, sizeof(address)) < 0) { throw std::system_error{ get_last_error() }; }
+
+  if (::listen(_fd, 1) < 0) { throw std::system_error{ get_last_error() }; }
+}
+
+result<std::shared_ptr<socket_interface>> handoff_listen_socket::accept() const
+{
+  const auto fd = ::accept4(_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd < 0) { return { .err = get_last_error() }; }
+
+  return { .result = std::make_shared<socket_impl>(fd) };
+}
+
+handoff_client_socket::handoff_client_socket(const std::string &path)
+  : socket_impl{ ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) }
+{
+  const auto address = make_address(path);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast,clang-diagnostic-old-style-cast)
+  if (::connect(_fd, (const sockaddr *)&address, sizeof(address)) < 0) { throw std::system_error{ get_last_error() }; }
+}
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "market.h"
+#include "result.h"
+#include "session_registry.h"
+#include "socket_impl.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace exchange_server {
+
+// State of a server handed off to the process taking it over, so that a restart drops no connection. Descriptors are
+// those of the receiving process once received.
+
+struct handoff_session
+{
+  session_id id{};
+  // Empty for the sessions of unnamed connections
+  std::string name;
+  // Clients resume their named session with it
+  std::string token;
+  // Order flow messages numbered so far, their history is not handed off
+  std::uint64_t last_sequence{};
+  // What is left of them
+  std::vector<order> outstanding_orders;
+  std::vector<std::pair<std::string, std::int64_t>> positions;
+  std::vector<std::pair<std::string, fill>> detached_executions;
+};
+
+struct handoff_connection
+{
+  int fd{ -1 };
+  session_id session{};
+  bool identified{ false };
+  std::string name;
+  std::vector<std::string> subscriptions;
+  // Incomplete message read, and responses not written yet
+  std::string read_buffer;
+  std::string write_buffer;
+};
+
+struct handoff_state
+{
+  int listener_fd{ -1 };
+  // Ids up to this one own orders, the successor starts past it
+  session_id last_session_id{};
+  std::vector<std::string> symbols;
+  // Market ids, by priority within each book
+  std::vector<order> resting_orders;
+  std::vector<handoff_session> sessions;
+  std::vector<handoff_connection> connections;
+};
+
+// Everything but the descriptors, as records of fixed size fields:
+//   L<last session id(20)>
+//   Y<symbol>
+//   O<order>                                  resting order, encoded as in the journal
+//   S<id(20)><name><token><last sequence(20)><count(20)><order>...<count(20)>(<symbol><position(20)>)...
+//    <count(20)>(<order id><quantity(20)><price(20)>)...
+//   C<session(20)><identified (0/1)><name><count(20)><symbol>...<read buffer><write buffer>
+// Strings are <size(20)><bytes>, connections are in the order of their descriptors.
+std::string serialize_handoff(const handoff_state &state);
+result<handoff_state> parse_handoff(std::string_view data);
+
+// Blocking transfer over a connected unix socket: <descriptor count(20)><data size(20)>, then the listener and
+// connection descriptors in messages of at most max_handoff_descriptors, then the data
+std::error_code send_handoff(int sock, const handoff_state &state);
+// Descriptors received are closed when the state cannot be parsed
+result<handoff_state> receive_handoff(int sock);
+
+constexpr std::size_t max_handoff_descriptors{ 64 };
+
+// Unix socket a successor connects to to take the server over, the connection accepted is blocking
+class handoff_listen_socket
+  : public socket_impl_base
+  , public listen_socket_interface
+{
+public:
+  explicit handoff_listen_socket(const std::string &path);
+
+  result<std::shared_ptr<socket_interface>> accept() const override;
+
+  int get_fd() const override { return _fd; }
+};
+
+// Connection of the successor to the handoff socket of the running server
+class handoff_client_socket : public socket_impl
+{
+public:
+  explicit handoff_client_socket(const std::string &path);
+};
+
+}
@@ -0,0 +1,94 @@
+#include "latency_histogram.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace exchange_server {
+
+std::size_t latency_histogram::index_of(std::uint64_t value)
+{
+  if (value < 2 * _sub_bucket_count) { return value; }
+
+  // value is in [2^k, 2^(k+1)), keep its _sub_bucket_bits + 1 most significant bits
+  const auto k = static_cast<std::uint64_t>(63 - std::countl_zero(value));
+  const auto shift = k - _sub_bucket_bits;
+  return (k - _sub_bucket_bits) * _sub_bucket_count + (value >> shift);
+}
+
+std::uint64_t latency_histogram::highest_equivalent_value(std::size_t index)
+{
+  if (index < 2 * _sub_bucket_count) { return index; }
+
+  const auto k = index / _sub_bucket_count + _sub_bucket_bits - 1;
+  const auto shift = k - _sub_bucket_bits;
+  const auto lowest = (index % _sub_bucket_count + _sub_bucket_count) << shift;
+  return lowest + ((std::uint64_t{ 1 } << shift) - 1);
+}
+
+void latency_histogram::record(std::chrono::nanoseconds value)
+{
+  const auto ns = static_cast<std::uint64_t>(std::max(value.count(), std::int64_t{ 0 }));
+
+  ++_counts[index_of(ns)];
+  ++_count;
+  _min = std::min(_min, ns);
+  _max = std::max(_max, ns);
+  _sum += static_cast<double>(ns);
+}
+
+void latency_histogram::record_corrected(std::chrono::nanoseconds value, std::chrono::nanoseconds expected_interval)
+{
+  record(value);
+
+  if (expected_interval.count() <= 0) { return; }
+
+  for (auto missing = value - expected_interval; missing >= expected_interval; missing -= expected_interval)
+  {
+    record(missing);
+  }
+}
+
+void latency_histogram::merge(const latency_histogram &other)
+{
+  std::transform(_counts.begin(), _counts.end(), other._counts.begin(), _counts.begin(), std::plus<>{});
+  _count += other._count;
+  _min = std::min(_min, other._min);
+  _max = std::max(_max, other._max);
+  _sum += other._sum;
+}
+
+void latency_histogram::reset() { *this = latency_histogram{}; }
+
+std::chrono::nanoseconds latency_histogram::min() const
+{
+  return std::chrono::nanoseconds{ _count == 0 ? 0 : static_cast<std::int64_t>(_min) };
+}
+
+std::chrono::nanoseconds latency_histogram::mean() const
+{
+  if (_count == 0) { return {}; }
+
+  return std::chrono::nanoseconds{ static_cast<std::int64_t>(std::llround(_sum / static_cast<double>(_count))) };
+}
+
+std::chrono::nanoseconds latency_histogram::percentile(double percentile) const
+{
+  if (_count == 0) { return {}; }
+
+  const auto rank = std::max(std::uint64_t{ 1 },
+    static_cast<std::uint64_t>(std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * static_cast<double>(_count))));
+
+  std::uint64_t seen{};
+  for (std::size_t index = 0; index < _counts.size(); ++index)
+  {
+    seen += _counts[index];
+    if (seen >= rank)
+    {
+      return std::chrono::nanoseconds{ static_cast<std::int64_t>(std::min(highest_equivalent_value(index), _max)) };
+    }
+  }
+
+  return max();
+}
+
+}
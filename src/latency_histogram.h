@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace exchange_server {
+
+// Log-linear histogram (HdrHistogram style): each power of two is split in 128 linear sub-buckets,
+// which bounds the relative error of reported values to under 1% over the whole nanosecond range
+class latency_histogram
+{
+public:
+  void record(std::chrono::nanoseconds value);
+  // Records value and back-fills the samples a stalled closed-loop sender would have missed,
+  // assuming one sample was expected every expected_interval (coordinated omission correction)
+  void record_corrected(std::chrono::nanoseconds value, std::chrono::nanoseconds expected_interval);
+  void merge(const latency_histogram &other);
+  void reset();
+
+  std::uint64_t count() const { return _count; }
+  std::chrono::nanoseconds min() const;
+  std::chrono::nanoseconds max() const { return std::chrono::nanoseconds{ _max }; }
+  std::chrono::nanoseconds mean() const;
+  std::chrono::nanoseconds percentile(double percentile) const;
+
+private:
+  static constexpr int _sub_bucket_bits{ 7 };
+  static constexpr std::uint64_t _sub_bucket_count{ 1U << _sub_bucket_bits };
+  static constexpr std::size_t _bucket_count{ (64 - _sub_bucket_bits + 1) * _sub_bucket_count };
+
+  static std::size_t index_of(std::uint64_t value);
+  static std::uint64_t highest_equivalent_value(std::size_t index);
+
+  std::array<std::uint64_t, _bucket_count> _counts{};
+  std::uint64_t _count{};
+  std::uint64_t _min{ UINT64_MAX };
+  std::uint64_t _max{};
+  double _sum{};
+};
+
+}
@@ -0,0 +1,531 @@
+#include "epoll_impl.h"
+#include "latency_histogram.h"
+#include "scope_exit.h"
+#include "shm_socket.h"
+#include "socket_impl.h"
+
+#include <CLI/CLI.hpp>
+#include <spdlog/spdlog.h>
+
+#include <charconv>
+#include <deque>
+#include <future>
+#include <latch>
+#include <queue>
+#include <random>
+#include <sys/epoll.h>
+#include <unordered_map>
+
+#include <internal_use_only/config.hpp>
+
+namespace {
+
+using steady_clock = std::chrono::steady_clock;
+using exchange_server::latency_histogram;
+
+struct load_config
+{
+  std::string host{ "127.0.0.1" };
+  int port{ 9090 };
+  int connections{ 100 };
+  int threads{ 1 };
+  double rate{ 10'000 };
+  double cancel_ratio{ 0.5 };
+  double ioc_ratio{ 0.0 };
+  int symbols{ 10 };
+  int duration{ 10 };
+  int warmup{ 2 };
+  bool poisson{ false };
+  // Shared memory gateway path, used instead of TCP when set
+  std::string shm_path;
+};
+
+struct load_stats
+{
+  std::uint64_t orders_sent{};
+  std::uint64_t cancels_sent{};
+  std::uint64_t acks{};
+  std::uint64_t rejects{};
+  std::uint64_t execs{};
+  std::uint64_t unexpected{};
+  std::uint64_t measured_replies{};
+  std::uint64_t unanswered{};
+
+  // Measured from the time the message should have been sent according to the schedule, so time spent
+  // queued behind a slow server is accounted for (coordinated omission free)
+  latency_histogram corrected;
+  // Measured from the time the message was actually handed to the socket
+  latency_histogram uncorrected;
+
+  void merge(const load_stats &other)
+  {
+    orders_sent += other.orders_sent;
+    cancels_sent += other.cancels_sent;
+    acks += other.acks;
+    rejects += other.rejects;
+    execs += other.execs;
+    unexpected += other.unexpected;
+    measured_replies += other.measured_replies;
+    unanswered += other.unanswered;
+    corrected.merge(other.corrected);
+    uncorrected.merge(other.uncorrected);
+  }
+};
+
+struct measure_window
+{
+  steady_clock::time_point begin;
+  steady_clock::time_point end;
+
+  bool contains(steady_clock::time_point t) const { return t >= begin && t < end; }
+};
+
+// Orders acknowledged by the server which can still be cancelled
+class live_orders
+{
+public:
+  bool empty() const { return _ids.empty(); }
+
+  void add(const std::string &id)
+  {
+    _positions[id] = _ids.size();
+    _ids.push_back(id);
+  }
+
+  bool remove(const std::string &id)
+  {
+    const auto it = _positions.find(id);
+    if (it == _positions.end()) { return false; }
+
+    take(it->second);
+    return true;
+  }
+
+  template<class Generator> std::string take_random(Generator &gen)
+  {
+    return take(std::uniform_int_distribution<std::size_t>{ 0, _ids.size() - 1 }(gen));
+  }
+
+private:
+  std::string take(std::size_t index)
+  {
+    auto id = std::move(_ids[index]);
+    _positions.erase(id);
+    if (index != _ids.size() - 1)
+    {
+      _ids[index] = std::move(_ids.back());
+      _positions[_ids[index]] = index;
+    }
+    _ids.pop_back();
+    return id;
+  }
+
+  std::vector<std::string> _ids;
+  std::unordered_map<std::string, std::size_t> _positions;
+};
+
+// Immediate orders never rest: they are over once acknowledged
+enum class request_kind { order, immediate_order, cancel };
+
+struct in_flight_request
+{
+  request_kind kind;
+  std::string id;
+  steady_clock::time_point intended;
+  steady_clock::time_point sent;
+};
+
+class connection
+{
+public:
+  connection(const load_config &config, std::string name, std::uint32_t seed)
+    : _config{ config }, _name{ std::move(name) },
+      _sock{ connect(config) }, _gen{ seed }
+  {
+    _write_buffer = fmt::format("id{}\n", _name);
+  }
+
+  int get_fd() const { return _sock->get_fd(); }
+  bool idle() const { return _in_flight.empty(); }
+  std::size_t in_flight() const { return _in_flight.size(); }
+
+  void send_next(steady_clock::time_point intended, steady_clock::time_point now, load_stats &stats)
+  {
+    if (!_live.empty() && std::bernoulli_distribution{ _config.cancel_ratio }(_gen))
+    {
+      auto id = _live.take_random(_gen);
+      fmt::format_to(std::back_inserter(_write_buffer), "cancel{}\n", id);
+      _in_flight.push_back({ request_kind::cancel, std::move(id), intended, now });
+      ++stats.cancels_sent;
+    }
+    else
+    {
+      const auto symbol = std::uniform_int_distribution{ 0, _config.symbols - 1 }(_gen);
+      const auto sell = std::bernoulli_distribution{ 0.5 }(_gen);
+      const auto quantity = std::uniform_int_distribution{ 1, 100 }(_gen);
+      const auto price = std::uniform_int_distribution{ 9'900, 10'100 }(_gen);
+      const auto immediate = std::bernoulli_distribution{ _config.ioc_ratio }(_gen);
+      auto id = allocate_id(static_cast<std::uint64_t>(quantity));
+
+      fmt::format_to(std::back_inserter(_write_buffer),
+        "order{}{: >8}{}{:0>4}{:0>8}{}\n",
+        id,
+        fmt::format("SYM{}", symbol),
+        sell ? '-' : '+',
+        quantity,
+        price,
+        immediate ? "LI" : "");
+      _in_flight.push_back(
+        { immediate ? request_kind::immediate_order : request_kind::order, std::move(id), intended, now });
+      ++stats.orders_sent;
+    }
+  }
+
+  void flush(const exchange_server::epoll_impl &epoll)
+  {
+    if (!_write_buffer.empty())
+    {
+      auto [bytes_written, err] = _sock->write(_write_buffer);
+      if (err && !would_block(err)) { throw std::system_error{ err }; }
+      if (!err) { _write_buffer.erase(0, static_cast<std::size_t>(bytes_written)); }
+    }
+
+    if (_write_buffer.empty() == _waiting_write)
+    {
+      _waiting_write = !_write_buffer.empty();
+      epoll.modify(get_fd(), _waiting_write ? EPOLLIN | EPOLLOUT : EPOLLIN);
+    }
+  }
+
+  void read(steady_clock::time_point now, const measure_window &window, load_stats &stats)
+  {
+    std::array<char, 4096> buffer{};
+    auto [bytes_read, err] = _sock->read(buffer);
+    if (err && would_block(err)) { return; }
+    if (err) { throw std::system_error{ err }; }
+    if (bytes_read == 0) { throw std::runtime_error{ fmt::format("Server closed connection {}", _name) }; }
+
+    _read_buffer.append(buffer.data(), static_cast<std::size_t>(bytes_read));
+
+    std::size_t begin{};
+    for (auto end = _read_buffer.find('\n'); end != std::string::npos; end = _read_buffer.find('\n', begin))
+    {
+      on_reply(std::string_view{ _read_buffer }.substr(begin, end - begin), now, window, stats);
+      begin = end + 1;
+    }
+    _read_buffer.erase(0, begin);
+  }
+
+private:
+  static std::unique_ptr<exchange_server::socket_interface> connect(const load_config &config)
+  {
+    if (!config.shm_path.empty()) { return std::make_unique<exchange_server::shm_client_socket>(config.shm_path); }
+
+    return std::make_unique<exchange_server::client_socket_impl>(config.host, config.port);
+  }
+
+  static bool would_block(std::error_code err)
+  {
+    return err == std::errc::resource_unavailable_try_again || err == std::errc::operation_would_block;
+  }
+
+  std::string allocate_id(std::uint64_t quantity)
+  {
+    constexpr std::string_view digits{ "0123456789abcdefghijklmnopqrstuvwxyz" };
+    constexpr std::uint32_t id_space{ 36 * 36 * 36 * 36 };
+
+    for (;;)
+    {
+      auto value = _next_id++ % id_space;
+      std::string id(4, '0');
+      for (auto it = id.rbegin(); it != id.rend(); ++it, value /= 36) { *it = digits[value % 36]; }
+
+      if (_ids_in_use.try_emplace(id, quantity).second) { return id; }
+    }
+  }
+
+  void on_reply(std::string_view reply, steady_clock::time_point now, const measure_window &window, load_stats &stats)
+  {
+    if (reply.starts_with("exec"))
+    {
+      on_exec(reply.substr(4), stats);
+      return;
+    }
+
+    const auto accepted = reply == "ok";
+    if ((!accepted && reply != "rejected") || _in_flight.empty())
+    {
+      spdlog::warn("Unexpected reply \"{}\" on {}", reply, _name);
+      ++stats.unexpected;
+      return;
+    }
+
+    auto request = std::move(_in_flight.front());
+    _in_flight.pop_front();
+
+    if (window.contains(request.intended))
+    {
+      stats.corrected.record(now - request.intended);
+      stats.uncorrected.record(now - request.sent);
+      ++stats.measured_replies;
+    }
+
+    ++(accepted ? stats.acks : stats.rejects);
+
+    if (request.kind == request_kind::order && accepted)
+    {
+      // The order may have fully executed at once, its executions follow the acknowledgement
+      _live.add(request.id);
+    }
+    else if (request.kind != request_kind::cancel || accepted)
+    {
+      _ids_in_use.erase(request.id);
+    }
+  }
+
+  // <id(4)><quantity(4)><price(8)>
+  void on_exec(std::string_view exec, load_stats &stats)
+  {
+    ++stats.execs;
+
+    const auto id = std::string{ exec.substr(0, 4) };
+    const auto quantity_field = exec.substr(std::min<std::size_t>(4, exec.size()), 4);
+    std::uint64_t quantity{};
+    std::from_chars(quantity_field.data(), quantity_field.data() + quantity_field.size(), quantity);
+
+    // Orders are over once fully executed, immediate ones as soon as they are acknowledged
+    const auto open = _ids_in_use.find(id);
+    if (open == _ids_in_use.end()) { return; }
+    if (quantity < open->second)
+    {
+      open->second -= quantity;
+      return;
+    }
+
+    _ids_in_use.erase(open);
+    _live.remove(id);
+
+    // The server drops cancels of orders it has already reported as executed: no reply will come
+    const auto it = std::find_if(_in_flight.begin(), _in_flight.end(), [&id](const auto &request) {
+      return request.kind == request_kind::cancel && request.id == id;
+    });
+    if (it != _in_flight.end()) { _in_flight.erase(it); }
+  }
+
+  const load_config &_config;
+  std::string _name;
+  std::unique_ptr<exchange_server::socket_interface> _sock;
+  std::mt19937 _gen;
+
+  std::string _write_buffer;
+  bool _waiting_write{ false };
+  std::string _read_buffer;
+
+  std::deque<in_flight_request> _in_flight;
+  live_orders _live;
+  // With the quantity of the order left to execute
+  std::unordered_map<std::string, std::uint64_t> _ids_in_use;
+  std::uint32_t _next_id{};
+};
+
+load_stats run_load(const load_config &config,
+  int first_connection,
+  int connection_count,
+  std::latch &connected,
+  std::shared_future<steady_clock::time_point> start_time)
+{
+  exchange_server::epoll_impl epoll;
+  std::vector<connection> connections;
+  std::unordered_map<int, std::size_t> indexes;
+
+  {
+    exchange_server::scope_exit arrive{ [&connected] { connected.count_down(); } };
+
+    connections.reserve(static_cast<std::size_t>(connection_count));
+    for (auto i = first_connection; i < first_connection + connection_count; ++i)
+    {
+      auto &conn = connections.emplace_back(config, fmt::format("load{}", i), static_cast<std::uint32_t>(i));
+      indexes[conn.get_fd()] = connections.size() - 1;
+      epoll.add(conn.get_fd(), EPOLLIN);
+    }
+  }
+
+  const auto start = start_time.get();
+  const measure_window window{ start + std::chrono::seconds{ config.warmup },
+    start + std::chrono::seconds{ config.warmup + config.duration } };
+
+  // Open loop schedule: each connection sends at its own fixed (or Poisson) rate regardless of replies
+  const auto rate_per_connection = config.rate / config.connections;
+  std::mt19937 gen{ static_cast<std::uint32_t>(first_connection) };
+  std::exponential_distribution<double> poisson_gap{ rate_per_connection };
+  const auto next_gap = [&]() {
+    const auto seconds = config.poisson ? poisson_gap(gen) : 1.0 / rate_per_connection;
+    return std::chrono::duration_cast<steady_clock::duration>(std::chrono::duration<double>{ seconds });
+  };
+
+  using scheduled_send = std::pair<steady_clock::time_point, std::size_t>;
+  std::priority_queue<scheduled_send, std::vector<scheduled_send>, std::greater<>> schedule;
+  for (std::size_t i = 0; i < connections.size(); ++i)
+  {
+    // Stagger the first sends so the connections do not all fire at once
+    const auto offset = (static_cast<double>(first_connection) + static_cast<double>(i)) / config.rate;
+    schedule.emplace(
+      start + std::chrono::duration_cast<steady_clock::duration>(std::chrono::duration<double>{ offset }), i);
+  }
+
+  load_stats stats;
+
+  const auto process_events = [&](std::chrono::milliseconds timeout) {
+    for (const auto &evt : epoll.wait_for(timeout))
+    {
+      auto &conn = connections[indexes.at(evt.data.fd)];
+      if ((evt.events & (EPOLLERR | EPOLLHUP)) != 0U) { throw std::runtime_error{ "Connection error" }; }
+      if ((evt.events & EPOLLIN) != 0U) { conn.read(steady_clock::now(), window, stats); }
+      if ((evt.events & EPOLLOUT) != 0U) { conn.flush(epoll); }
+    }
+  };
+
+  for (auto now = steady_clock::now(); now < window.end; now = steady_clock::now())
+  {
+    while (!schedule.empty() && schedule.top().first <= now)
+    {
+      const auto [intended, index] = schedule.top();
+      schedule.pop();
+
+      connections[index].send_next(intended, now, stats);
+      connections[index].flush(epoll);
+      schedule.emplace(intended + next_gap(), index);
+    }
+
+    // Spin during the last millisecond before a send so it is not delayed by the epoll timeout granularity
+    const auto until_next = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::min(schedule.top().first, window.end) - steady_clock::now());
+    process_events(std::max(until_next, std::chrono::milliseconds{ 0 }));
+  }
+
+  const auto drain_deadline = steady_clock::now() + std::chrono::seconds{ 5 };
+  while (steady_clock::now() < drain_deadline
+         && std::any_of(connections.begin(), connections.end(), [](const auto &conn) { return !conn.idle(); }))
+  {
+    process_events(std::chrono::milliseconds{ 10 });
+  }
+
+  for (const auto &conn : connections) { stats.unanswered += conn.in_flight(); }
+
+  return stats;
+}
+
+void print_report(const load_config &config, const load_stats &stats)
+{
+  fmt::print("Connections: {}, target rate: {:.0f} msg/s, measured over {}s (after {}s warmup)\n",
+    config.connections,
+    config.rate,
+    config.duration,
+    config.warmup);
+  fmt::print("Sent: {} orders, {} cancels\n", stats.orders_sent, stats.cancels_sent);
+  fmt::print("Received: {} ok, {} rejected, {} exec, {} unexpected, {} unanswered\n",
+    stats.acks,
+    stats.rejects,
+    stats.execs,
+    stats.unexpected,
+    stats.unanswered);
+  fmt::print("Throughput: {:.0f} replies/s\n", static_cast<double>(stats.measured_replies) / config.duration);
+
+  const auto to_us = [](std::chrono::nanoseconds value) { return static_cast<double>(value.count()) / 1'000.0; };
+  const auto print_latencies = [&](std::string_view title, const latency_histogram &histogram) {
+    fmt::print("{} latency (us): min {:.1f} mean {:.1f} p50 {:.1f} p90 {:.1f} p99 {:.1f} p99.9 {:.1f} "
+               "p99.99 {:.1f} max {:.1f}\n",
+      title,
+      to_us(histogram.min()),
+      to_us(histogram.mean()),
+      to_us(histogram.percentile(50)),
+      to_us(histogram.percentile(90)),
+      to_us(histogram.percentile(99)),
+      to_us(histogram.percentile(99.9)),
+      to_us(histogram.percentile(99.99)),
+      to_us(histogram.max()));
+  };
+
+  print_latencies("Corrected", stats.corrected);
+  print_latencies("Uncorrected", stats.uncorrected);
+}
+}
+
+int main(int argc, const char **argv)
+{
+  try
+  {
+    CLI::App app{ fmt::format("{} load generator version {}",
+      SmallExchangeServer::cmake::project_name,
+      SmallExchangeServer::cmake::project_version) };
+
+    load_config config;
+    app.add_option("-H,--host", config.host, "Server host");
+    app.add_option("-p,--port", config.port, "Server port");
+    app.add_option("-c,--connections", config.connections, "Number of client connections")->check(CLI::PositiveNumber);
+    app.add_option("-t,--threads", config.threads, "Number of sending threads")->check(CLI::PositiveNumber);
+    app.add_option("-r,--rate", config.rate, "Total messages per second over all connections")
+      ->check(CLI::PositiveNumber);
+    app.add_option("--cancel-ratio", config.cancel_ratio, "Probability of sending a cancel instead of a new order")
+      ->check(CLI::Range(0.0, 1.0));
+    app.add_option("--ioc-ratio", config.ioc_ratio, "Probability of a new order being immediate or cancel")
+      ->check(CLI::Range(0.0, 1.0));
+    app.add_option("--symbols", config.symbols, "Number of distinct symbols")->check(CLI::Range(1, 99'999));
+    app.add_option("-d,--duration", config.duration, "Measurement duration in seconds")->check(CLI::PositiveNumber);
+    app.add_option("--warmup", config.warmup, "Warmup duration in seconds, not measured")
+      ->check(CLI::NonNegativeNumber);
+    app.add_flag("--poisson", config.poisson, "Use Poisson distributed send times instead of a fixed interval");
+    app.add_option("--shm", config.shm_path, "Connect through the shared memory gateway at this path instead of TCP");
+    bool show_version = false;
+    app.add_flag("--version", show_version, "Show version information");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (show_version)
+    {
+      fmt::print("{}\n", SmallExchangeServer::cmake::project_version);
+      return EXIT_SUCCESS;
+    }
+
+    config.threads = std::min(config.threads, config.connections);
+
+    if (config.shm_path.empty())
+    {
+      spdlog::info("Connecting {} clients to {}:{}", config.connections, config.host, config.port);
+    }
+    else
+    {
+      spdlog::info("Connecting {} clients to shared memory gateway {}", config.connections, config.shm_path);
+    }
+
+    std::latch connected{ config.threads };
+    std::promise<steady_clock::time_point> start_time;
+    const auto start_future = start_time.get_future().share();
+    std::vector<std::future<load_stats>> results;
+
+    for (int thread = 0; thread < config.threads; ++thread)
+    {
+      const auto first = config.connections * thread / config.threads;
+      const auto count = config.connections * (thread + 1) / config.threads - first;
+      results.push_back(std::async(std::launch::async,
+        run_load,
+        std::cref(config),
+        first,
+        count,
+        std::ref(connected),
+        start_future));
+    }
+
+    connected.wait();
+    start_time.set_value(steady_clock::now() + std::chrono::milliseconds{ 100 });
+
+    load_stats stats;
+    for (auto &result : results) { stats.merge(result.get()); }
+
+    print_report(config, stats);
+  } catch (const std::exception &e)
+  {
+    spdlog::error("Unhandled exception in main: {}", e.what());
+    return EXIT_FAILURE;
+  }
+}
@@ -1,23 +1,61 @@
+#include "busy_poll.h"
 #include "epoll_impl.h"
 #include "exchange_server.h"
+#include "handoff.h"
 #include "market.h"
+#include "market_data.h"
+#include "multicast_feed.h"
+#include "recovery_service.h"
+#include "replication.h"
 #include "scope_exit.h"
+#include "shm_socket.h"
 #include "socket_impl.h"
 #include "worker.h"
 
 #include <CLI/CLI.hpp>
 #include <spdlog/spdlog.h>
 
+#include <array>
+#include <csignal>
+#include <fcntl.h>
+#include <fstream>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <thread>
+#include <unistd.h>
 
 // This file will be generated automatically when you run the CMake configuration step.
 // It creates a namespace called `SmallExchangeServer`.
 // You can modify the source template at `configured_files/config.hpp.in`.
 #include <internal_use_only/config.hpp>
 
+namespace {
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+int control_fd{ -1 };
+
+void on_reload_signal(int /*signal*/)
+{
+  const auto command = static_cast<std::uint64_t>(exchange_server::control_command::reload_risk_limits);
+  [[maybe_unused]] const auto written = ::write(control_fd, &command, sizeof(command));
+}
+
+void pin_thread(std::string_view name, int cpu)
+{
+  if (cpu < 0) { return; }
+
+  if (const auto err = exchange_server::pin_current_thread(cpu))
+  {
+    spdlog::warn("Cannot pin {} thread to core {}: {}", name, cpu, err.message());
+    return;
+  }
+
+  spdlog::info("Pinned {} thread to core {}", name, cpu);
+}
+}
+
 int main(int argc, const char **argv)
 {
   try
@@ -27,6 +65,124 @@ int main(int argc, const char **argv)
 
     int port{ 9090 };
     app.add_option("-p,--port", port, "Port number to listen");
+
+    exchange_server::server_options options;
+    auto &limits = options.connection;
+    app.add_option("--max-message-size", limits.max_message_size, "Longest message accepted from a client");
+    app.add_option(
+      "--queue-high-watermark", limits.queue_high_watermark, "Queued messages above which reading a client pauses");
+    app.add_option(
+      "--queue-low-watermark", limits.queue_low_watermark, "Queued messages below which reading a client resumes");
+    app.add_option(
+      "--write-high-watermark", limits.write_high_watermark, "Unsent bytes above which reading a client pauses");
+    app.add_option(
+      "--write-low-watermark", limits.write_low_watermark, "Unsent bytes below which reading a client resumes");
+    app.add_option(
+      "--max-write-buffer", limits.max_write_buffer, "Unsent bytes above which a client is a slow consumer");
+    bool keep_slow_consumers = false;
+    app.add_flag(
+      "--keep-slow-consumers", keep_slow_consumers, "Only flag slow consumers instead of disconnecting them");
+
+    auto &throttle = options.throttle;
+    app.add_option("--session-rate", throttle.session_rate, "Orders and cancels per second allowed per client");
+    app.add_option("--session-burst", throttle.session_burst, "Orders and cancels a client may send at once");
+    app.add_option("--symbol-rate", throttle.symbol_rate, "Orders per second allowed per client and symbol");
+    app.add_option("--symbol-burst", throttle.symbol_burst, "Orders a client may send at once for a symbol");
+    app.add_option("--max-quote-entries", throttle.max_quote_entries, "Orders of a quote, unlimited if zero");
+
+    auto &batching = options.batching;
+    auto batch_budget_us = batching.time_budget.count();
+    app.add_option("--max-batch", batching.max_batch, "Messages of a client processed in a row by the worker")
+      ->check(CLI::PositiveNumber);
+    app.add_option("--batch-budget", batch_budget_us, "Microseconds after which a batch ends, unlimited if zero");
+
+    bool cancel_orphan_orders = false;
+    app.add_flag("--cancel-orphan-orders", cancel_orphan_orders, "Cancel the orders of clients which disconnect");
+    app.add_option(
+      "--retransmit-buffer", options.retransmit_buffer, "Order flow messages kept for replay per logged in client")
+      ->check(CLI::PositiveNumber);
+    auto detached_session_timeout_ms = options.detached_session_timeout.count();
+    app.add_option(
+      "--max-detached-sessions", options.max_detached_sessions, "Sessions kept for clients away to resume");
+    app.add_option("--detached-session-timeout",
+      detached_session_timeout_ms,
+      "Milliseconds a session is kept for its client to resume, 0 keeps it");
+    app.add_option(
+      "--max-detached-executions", options.max_detached_executions, "Executions kept per session for a client away");
+
+    auto login_timeout_ms = options.login_timeout.count();
+    auto idle_timeout_ms = options.idle_timeout.count();
+    app.add_option("--login-timeout", login_timeout_ms, "Milliseconds a client has to identify in, 0 disables");
+    app.add_option("--idle-timeout", idle_timeout_ms, "Milliseconds of silence before a client is closed, 0 disables");
+
+    app.add_option("--risk-limits", options.risk_limits_file, "Pre-trade risk limits file, reloaded on SIGHUP")
+      ->check(CLI::ExistingFile);
+
+    exchange_server::market_options market_options;
+    auto auction_interval_ms = market_options.auction_interval.count();
+    app.add_option("--auction-symbol", market_options.auction_symbols, "Symbol traded in periodic call auctions");
+    app.add_option("--auction-interval", auction_interval_ms, "Milliseconds between two auctions")
+      ->check(CLI::PositiveNumber);
+
+    std::string multicast_group;
+    int multicast_port{ 9091 };
+    std::string multicast_interface{ "127.0.0.1" };
+    int recovery_port{ 9092 };
+    exchange_server::multicast_feed_options feed_options;
+    app.add_option("--multicast-group", multicast_group, "Multicast group of the market data feed, disabled if empty");
+    app.add_option("--multicast-port", multicast_port, "Port of the market data feed");
+    app.add_option("--multicast-interface", multicast_interface, "Address of the interface sending the feed");
+    app.add_option("--recovery-port", recovery_port, "Port of the market data snapshot and replay service");
+    app.add_option("--max-packet-size", feed_options.max_packet_size, "Largest market data datagram");
+    app.add_option("--retained-messages", feed_options.retained_messages, "Market data messages kept for replay");
+
+    int replication_port{ 0 };
+    // Followers are not authenticated, the journal is only offered on a trusted interface
+    std::string replication_interface{ "127.0.0.1" };
+    std::size_t replication_quorum{ 0 };
+    std::string leader_host;
+    int leader_port{ 9093 };
+    auto *replication_option =
+      app.add_option("--replication-port", replication_port, "Port followers replicate the market from, 0 disables");
+    app.add_option("--replication-interface", replication_interface, "Address of the interface followers connect to")
+      ->needs(replication_option);
+    app.add_option("--replication-quorum", replication_quorum, "Followers which must replicate an order before its ack")
+      ->needs(replication_option);
+    // The market of a follower only publishes what the leader already did
+    app.add_option("--leader-host", leader_host, "Follow the leader at this host, taking over once it is lost")
+      ->excludes("--multicast-group");
+    app.add_option("--leader-port", leader_port, "Replication port of the leader");
+
+    std::string shm_path;
+    std::size_t shm_ring_size{ 1U << 20U };
+    app.add_option("--shm-path", shm_path, "Unix socket path of the shared memory gateway, disabled if empty");
+    app.add_option("--shm-ring-size", shm_ring_size, "Bytes of each shared memory ring, a power of two");
+
+    // Only the TCP listener and its connections are handed off, and responses are not held for followers. The feed
+    // sequence and its recovery listener are not handed off either, subscribers would see the numbering start over.
+    std::string handoff_path;
+    std::string take_over_path;
+    app.add_option("--handoff-path", handoff_path, "Unix socket path a restarted server takes this one over on")
+      ->excludes("--shm-path")
+      ->excludes("--replication-port")
+      ->excludes("--multicast-group");
+    app.add_option("--take-over", take_over_path, "Take over the listener and clients of the server handing off on it")
+      ->excludes("--shm-path")
+      ->excludes("--replication-port")
+      ->excludes("--leader-host")
+      ->excludes("--multicast-group");
+
+    exchange_server::busy_poll_options busy_poll;
+    int reactor_cpu{ -1 };
+    int worker_cpu{ -1 };
+    int market_cpu{ -1 };
+    app.add_flag("--busy-poll", busy_poll.enabled, "Spin the reactor and worker threads instead of blocking");
+    auto max_sleep_us = busy_poll.max_sleep.count();
+    app.add_option("--busy-poll-max-sleep", max_sleep_us, "Longest pause in microseconds of an idle polling thread");
+    app.add_option("--reactor-cpu", reactor_cpu, "Core the reactor thread is pinned to, unpinned if negative");
+    app.add_option("--worker-cpu", worker_cpu, "Core the worker thread is pinned to, unpinned if negative");
+    app.add_option("--market-cpu", market_cpu, "Core the market thread is pinned to, unpinned if negative");
+
     bool show_version = false;
     app.add_flag("--version", show_version, "Show version information");
 
@@ -38,31 +194,229 @@ int main(int argc, const char **argv)
       return EXIT_SUCCESS;
     }
 
-    spdlog::info("Starting server on port {}", port);
+    busy_poll.max_sleep = std::chrono::microseconds{ max_sleep_us };
+    batching.time_budget = std::chrono::microseconds{ batch_budget_us };
+    options.login_timeout = std::chrono::milliseconds{ login_timeout_ms };
+    options.idle_timeout = std::chrono::milliseconds{ idle_timeout_ms };
+    options.detached_session_timeout = std::chrono::milliseconds{ detached_session_timeout_ms };
+    market_options.auction_interval = std::chrono::milliseconds{ auction_interval_ms };
+    // Symbols of order messages are right aligned on 8 characters
+    for (auto &symbol : market_options.auction_symbols) { symbol = fmt::format("{: >8}", symbol); }
+    if (keep_slow_consumers) { limits.slow_consumer = exchange_server::slow_consumer_policy::flag; }
+    if (cancel_orphan_orders) { options.orphan_orders = exchange_server::orphan_policy::cancel; }
+
+    if (!options.risk_limits_file.empty())
+    {
+      std::ifstream input{ options.risk_limits_file };
+      auto [risk, err] = exchange_server::parse_risk_limits(input);
+      if (err) { throw std::runtime_error{ "Invalid risk limits file" }; }
+
+      options.risk = risk;
+    }
+
+    // A server taking over listens where its predecessor did
+    if (take_over_path.empty()) { spdlog::info("Starting server on port {}", port); }
+
+    auto worker = std::make_shared<exchange_server::worker>(busy_poll);
+    auto market_data = std::make_shared<exchange_server::market_data_publisher>();
+    std::shared_ptr<exchange_server::market_data_sink> market_data_sink = market_data;
+
+    std::shared_ptr<exchange_server::multicast_feed> feed;
+    std::shared_ptr<exchange_server::socket_impl> recovery_control;
+    std::shared_ptr<exchange_server::recovery_service> recovery;
+    if (!multicast_group.empty())
+    {
+      spdlog::info(
+        "Publishing market data to {}:{}, recovery on port {}", multicast_group, multicast_port, recovery_port);
+
+      feed = std::make_shared<exchange_server::multicast_feed>(
+        std::make_shared<exchange_server::multicast_sender_socket_impl>(
+          multicast_group, multicast_port, multicast_interface),
+        feed_options);
+      recovery_control = std::make_shared<exchange_server::socket_impl>(eventfd(0, 0));
+      recovery = std::make_shared<exchange_server::recovery_service>(
+        std::make_shared<exchange_server::listen_socket_impl>(recovery_port),
+        std::make_shared<exchange_server::epoll_impl>(),
+        recovery_control,
+        feed);
+
+      market_data_sink = std::make_shared<exchange_server::market_data_fanout>(
+        std::vector<std::shared_ptr<exchange_server::market_data_sink>>{ market_data_sink, feed });
+    }
+
+    auto market = std::make_shared<exchange_server::market>(market_data_sink, market_options);
+    // Commands written by signal handlers are read one at a time, the write end never blocks
+    std::array<int, 2> control_pipe{};
+    if (::pipe2(control_pipe.data(), O_CLOEXEC) < 0) { throw std::system_error{ errno, std::system_category() }; }
+    auto control = std::make_shared<exchange_server::socket_impl>(control_pipe[0]);
+    const exchange_server::socket_impl control_writer{ control_pipe[1] };
+    if (const auto err = control_writer.make_non_blocking()) { throw std::system_error{ err }; }
 
-    auto worker = std::make_shared<exchange_server::worker>();
-    auto market = std::make_shared<exchange_server::market>();
+    std::shared_ptr<exchange_server::journal> journal;
+    std::shared_ptr<exchange_server::socket_impl> replication_control;
+    std::shared_ptr<exchange_server::replication_service> replication;
+    std::thread replication_runner;
+    if (replication_port != 0)
+    {
+      spdlog::info("Replicating to followers on {}:{}, quorum of {}",
+        replication_interface,
+        replication_port,
+        replication_quorum);
+
+      std::array<int, 2> doorbell{};
+      if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, doorbell.data()) < 0)
+      {
+        throw std::system_error{ errno, std::system_category() };
+      }
+      journal = std::make_shared<exchange_server::journal>(
+        std::make_shared<exchange_server::socket_impl>(doorbell[0]), replication_quorum);
+      replication_control = std::make_shared<exchange_server::socket_impl>(eventfd(0, 0));
+      replication = std::make_shared<exchange_server::replication_service>(
+        std::make_shared<exchange_server::listen_socket_impl>(replication_port, replication_interface),
+        std::make_shared<exchange_server::epoll_impl>(),
+        replication_control,
+        std::make_shared<exchange_server::socket_impl>(doorbell[1]),
+        journal);
+      replication_runner = std::thread{ [replication] { replication->run(); } };
+    }
+
+    exchange_server::scope_exit replication_guard{ [&]() {
+      if (replication)
+      {
+        eventfd_write(replication_control->get_fd(), 1);
+        replication_runner.join();
+      }
+    } };
+
+    // The market only changes through the journal of the leader until it is lost, clients are accepted from then on
+    if (!leader_host.empty())
+    {
+      spdlog::info("Following the leader at {}:{}", leader_host, leader_port);
+
+      exchange_server::replication_follower follower{
+        std::make_shared<exchange_server::client_socket_impl>(leader_host, leader_port),
+        std::make_shared<exchange_server::epoll_impl>(),
+        std::make_shared<exchange_server::socket_impl>(eventfd(0, 0)),
+        market,
+        journal };
+      if (const auto err = follower.run()) { throw std::system_error{ err }; }
+
+      options.first_session_id = follower.last_owner() + 1;
+      spdlog::info("Taking over from the leader at sequence {}", follower.position());
+    }
+
+    std::shared_ptr<exchange_server::market_interface> server_market = market;
+    std::shared_ptr<exchange_server::journaled_market> journaled;
+    if (journal)
+    {
+      journaled = std::make_shared<exchange_server::journaled_market>(market, journal);
+      server_market = journaled;
+    }
+
+    // The previous server stops reading its clients once connected to, and hands them off once it handled what they
+    // sent. What they send meanwhile waits in their sockets.
+    std::optional<exchange_server::handoff_state> handed_off;
+    if (!take_over_path.empty())
+    {
+      spdlog::info("Taking over the server handing off on {}", take_over_path);
+
+      const exchange_server::handoff_client_socket predecessor{ take_over_path };
+      auto [state, err] = exchange_server::receive_handoff(predecessor.get_fd());
+      if (err) { throw std::system_error{ err }; }
+
+      options.first_session_id = state.last_session_id + 1;
+      handed_off = std::move(state);
+    }
+
+    control_fd = control_writer.get_fd();
+    std::signal(SIGHUP, on_reload_signal);
 
-    exchange_server::server server{ std::make_shared<exchange_server::listen_socket_impl>(port),
-      std::make_shared<exchange_server::epoll_impl>(),
+    std::shared_ptr<exchange_server::listen_socket_interface> listener =
+      handed_off ? std::make_shared<exchange_server::listen_socket_impl>(
+                     exchange_server::socket_impl_base{ handed_off->listener_fd })
+                 : std::make_shared<exchange_server::listen_socket_impl>(port);
+    if (!shm_path.empty())
+    {
+      spdlog::info("Accepting shared memory clients on {}", shm_path);
+
+      listener = std::make_shared<exchange_server::listen_socket_group>(
+        std::vector<std::shared_ptr<exchange_server::listen_socket_interface>>{
+          listener, std::make_shared<exchange_server::shm_listen_socket>(shm_path, shm_ring_size) });
+    }
+
+    std::shared_ptr<exchange_server::handoff_listen_socket> handoff_listener;
+    if (!handoff_path.empty())
+    {
+      spdlog::info("Handing off to a successor connecting on {}", handoff_path);
+      handoff_listener = std::make_shared<exchange_server::handoff_listen_socket>(handoff_path);
+    }
+
+    exchange_server::server server{ listener,
+      std::make_shared<exchange_server::epoll_impl>(busy_poll),
       worker,
-      std::make_shared<exchange_server::socket_impl>(eventfd(0, 0)),
-      market };
+      control,
+      server_market,
+      options,
+      market_data,
+      journal,
+      handoff_listener };
 
     // Should use jthread
-    std::thread worker_runner{ [worker] { worker->run(); } };
-    std::thread market_runner{ [market] { market->run(); } };
+    std::thread worker_runner{ [worker, worker_cpu] {
+      pin_thread("worker", worker_cpu);
+      worker->run();
+    } };
+    const auto run_market = [market, journaled, auctions = !market_options.auction_symbols.empty(), market_cpu] {
+      pin_thread("market", market_cpu);
+      // Auctions change the books like orders do, followers replicate them too
+      if (journaled && auctions) { journaled->run(); }
+      else
+      {
+        market->run();
+      }
+    };
+    std::thread market_runner{ run_market };
+    std::thread feed_runner;
+    std::thread recovery_runner;
+    if (feed)
+    {
+      feed_runner = std::thread{ [feed] { feed->run(); } };
+      recovery_runner = std::thread{ [recovery] { recovery->run(); } };
+    }
 
     exchange_server::scope_exit guard{ [&]() {
       worker->stop();
       worker_runner.join();
       market->stop();
-      market_runner.join();
+      if (market_runner.joinable()) { market_runner.join(); }
+      if (feed)
+      {
+        feed->stop();
+        feed_runner.join();
+        eventfd_write(recovery_control->get_fd(), 1);
+        recovery_runner.join();
+      }
     } };
 
-    server.run();
+    if (handed_off) { server.take_over(std::move(*handed_off)); }
+
+    pin_thread("reactor", reactor_cpu);
+    for (;;)
+    {
+      server.run();
+      if (!server.handoff_requested()) { break; }
+
+      // Orders only change through the sessions until they are handed off
+      market->stop();
+      market_runner.join();
+      const auto err = server.hand_off(*market);
+      if (!err) { break; }
+
+      spdlog::error("Cannot hand off to the successor, serving on: {}", err.message());
+      market_runner = std::thread{ run_market };
+    }
 
-    spdlog::info("Closing server");
+    spdlog::info("Closing server, {}", server.metrics().to_string());
   } catch (const std::exception &e)
   {
     spdlog::error("Unhandled exception in main: {}", e.what());
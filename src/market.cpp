@@ -1,84 +1,436 @@
 #include "market.h"
+#include <algorithm>
 #include <chrono>
-#include <random>
-#include <spdlog/spdlog.h>
-#include <thread>
 
 namespace exchange_server {
 
-void market::run()
+market::market(std::shared_ptr<market_data_sink> market_data, market_options options)
+  : _market_data{ std::move(market_data) }, _auction_interval{ options.auction_interval }
 {
-  std::random_device r;
-  std::default_random_engine e{ r() };
-  std::uniform_int_distribution<int> delay_dist{ 1, 10 };
-  std::uniform_real_distribution<double> index_dist{ 0, 1 };
-
+  for (const auto &symbol : options.auction_symbols) { _books[symbol].auction = true; }
+}
 
+void market::run(std::function<void()> auction)
+{
+  auto next_auction = std::chrono::steady_clock::now() + _auction_interval;
   for (;;)
   {
-    auto delay = delay_dist(e);
-    // Sleep for makes clang-tidy crash because of spaceship operator
-    // https://bugs.llvm.org/show_bug.cgi?id=47511
-    std::this_thread::sleep_until(std::chrono::system_clock::now() + std::chrono::seconds{ delay });
-
-    std::optional<decltype(_pending_orders)::value_type> execution;
-    std::unique_lock l{ _mutex };
-    if (_stop_requested) { break; }
-    if (!_pending_orders.empty())
     {
-      auto it = _pending_orders.begin() + static_cast<int>(index_dist(e) * static_cast<double>(_pending_orders.size()));
-      execution = *it;
-      _pending_orders.erase(it);
-      _mapping.erase(execution->first.id);
+      std::unique_lock l{ _mutex };
+      if (_stop_condition.wait_until(l, next_auction, [this] { return _stop_requested; }))
+      {
+        _stop_requested = false;
+        break;
+      }
     }
 
-    l.unlock();
-
-    if (execution)
+    if (auction) { auction(); }
+    else
     {
-      const auto &[order, callback] = *execution;
-      spdlog::info("Executing order {}", order.id);
-      callback();
+      uncross();
     }
+
+    // Auctions which could not run on time are skipped rather than run back to back
+    next_auction = std::max(next_auction + _auction_interval, std::chrono::steady_clock::now());
   }
 }
 
 void market::stop()
+{
+  {
+    std::scoped_lock l{ _mutex };
+    _stop_requested = true;
+  }
+  _stop_condition.notify_all();
+}
+
+void market::uncross()
 {
   std::scoped_lock l{ _mutex };
-  _stop_requested = true;
+  for (auto &[symbol, book] : _books)
+  {
+    if (book.auction) { uncross(symbol, book); }
+  }
 }
 
-void market::add_order(const order &order, std::function<void()> callback)
+order_result market::add_order(const order &order, std::function<void(const fill &)> callback)
 {
   std::scoped_lock l{ _mutex };
-  auto index = _pending_orders.size();
-  _pending_orders.emplace_back(order, std::move(callback));
-  _mapping.insert(std::pair{ order.id, index });
+  return add(order, std::move(callback));
 }
 
 bool market::update_order(const order &order)
 {
   std::scoped_lock l{ _mutex };
-  if (const auto it = _mapping.find(order.id); it != _mapping.end())
+  return update(order);
+}
+
+std::vector<order_result> market::mass_quote(std::vector<quote_entry> entries)
+{
+  std::vector<order_result> results;
+  results.reserve(entries.size());
+
+  std::scoped_lock l{ _mutex };
+  for (auto &entry : entries)
+  {
+    if (!entry.replace) { results.push_back(add(entry.order, std::move(entry.callback))); }
+    else
+    {
+      results.push_back({ .status = update(entry.order) ? order_status::rested : order_status::rejected });
+    }
+  }
+
+  return results;
+}
+
+order_result market::add(const order &order, std::function<void(const fill &)> callback)
+{
+  if (_orders.contains(order.id)) { return { .status = order_status::rejected }; }
+
+  auto &book = _books[order.symbol];
+  if (book.auction)
+  {
+    if (order.tif != time_in_force::day) { return { .status = order_status::rejected }; }
+    if (order.quantity == 0) { return { .status = order_status::done }; }
+
+    rest(order, std::move(callback), book);
+    return {};
+  }
+
+  if (order.type == order_type::post_only && best_match(order, book)) { return { .status = order_status::rejected }; }
+  if (order.tif == time_in_force::fill_or_kill && available(order, book) < order.quantity)
   {
-    _pending_orders[it->second].first = order;
+    return { .status = order_status::rejected };
+  }
+
+  order_result result;
+  const auto remaining = match(order, book, result.fills);
+  if (remaining == 0 || order.tif != time_in_force::day)
+  {
+    result.status = order_status::done;
+    return result;
+  }
+
+  auto rested = order;
+  rested.quantity = remaining;
+  rest(rested, std::move(callback), book);
+  return result;
+}
+
+bool market::update(const order &order)
+{
+  const auto it = _orders.find(order.id);
+  if (it == _orders.end() || order.quantity == 0) { return false; }
+
+  auto &resting = it->second;
+  auto &book = _books[resting.order.symbol];
+  if (ticks(order.price) == ticks(resting.order.price))
+  {
+    auto &level = (resting.order.way == order_side::buy ? book.bids : book.asks).at(ticks(order.price));
+    level.quantity = level.quantity - resting.order.quantity + order.quantity;
+    resting.order.quantity = order.quantity;
+    report_level(resting.order.symbol, resting.order.way, ticks(order.price), level.quantity);
     return true;
   }
 
-  return false;
+  auto moved = resting.order;
+  moved.quantity = order.quantity;
+  moved.price = order.price;
+  if (!book.auction && best_match(moved, book)) { return false; }
+
+  remove(resting, book);
+  resting.order = moved;
+  auto &level = (moved.way == order_side::buy ? book.bids : book.asks)[ticks(moved.price)];
+  push_back(level, resting);
+  report_level(moved.symbol, moved.way, ticks(moved.price), level.quantity);
+  return true;
 }
 
 bool market::cancel_order(const std::string &id)
 {
   std::scoped_lock l{ _mutex };
-  if (const auto it = _mapping.find(id); it != _mapping.end())
+  const auto it = _orders.find(id);
+  if (it == _orders.end()) { return false; }
+
+  remove(it->second, *it->second.book);
+  erase(it->second);
+  return true;
+}
+
+std::vector<std::string> market::cancel_all(std::uint64_t owner, const cancel_filter &filter)
+{
+  std::scoped_lock l{ _mutex };
+  std::vector<std::string> cancelled;
+  const auto it = _owners.find(owner);
+  if (it == _owners.end()) { return cancelled; }
+
+  for (auto *resting = it->second.first; resting != nullptr;)
   {
-    _pending_orders.erase(_pending_orders.begin() + static_cast<std::ptrdiff_t>(it->second));
-    _mapping.erase(it);
-    return true;
+    auto &current = *resting;
+    resting = resting->next_of_owner;
+
+    const auto &order = current.order;
+    if ((!filter.symbol.empty() && order.symbol != filter.symbol) || (filter.side && order.way != *filter.side))
+    {
+      continue;
+    }
+
+    remove(current, *current.book);
+    cancelled.push_back(order.id);
+    erase(current);
+  }
+
+  return cancelled;
+}
+
+std::vector<order> market::resting_orders()
+{
+  std::scoped_lock l{ _mutex };
+  std::vector<order> orders;
+  orders.reserve(_orders.size());
+
+  const auto append_level = [&orders](const level &level) {
+    for (const auto *resting = level.first; resting != nullptr; resting = resting->next)
+    {
+      orders.push_back(resting->order);
+    }
+  };
+  for (auto &[symbol, book] : _books)
+  {
+    for (auto price = book.bids.highest(); price; price = book.bids.next_below(*price))
+    {
+      append_level(book.bids.at(*price));
+    }
+    for (auto price = book.asks.lowest(); price; price = book.asks.next_above(*price))
+    {
+      append_level(book.asks.at(*price));
+    }
+  }
+
+  return orders;
+}
+
+std::optional<market::price_type> market::best_match(const order &order, book &book)
+{
+  const auto best = order.way == order_side::buy ? book.asks.lowest() : book.bids.highest();
+  if (!best || !crosses(order, *best)) { return std::nullopt; }
+  return best;
+}
+
+std::uint64_t market::available(const order &order, book &book)
+{
+  auto &opposite = order.way == order_side::buy ? book.asks : book.bids;
+  std::uint64_t quantity{};
+  for (auto price = best_match(order, book); price && crosses(order, *price) && quantity < order.quantity;
+       price = order.way == order_side::buy ? opposite.next_above(*price) : opposite.next_below(*price))
+  {
+    quantity += opposite.at(*price).quantity;
+  }
+
+  return quantity;
+}
+
+std::uint64_t market::match(const order &order, book &book, std::vector<fill> &fills)
+{
+  auto &opposite = order.way == order_side::buy ? book.asks : book.bids;
+  const auto side = order.way == order_side::buy ? order_side::sell : order_side::buy;
+  auto remaining = order.quantity;
+  std::optional<price_type> price;
+  while (remaining > 0 && (price = best_match(order, book)))
+  {
+    const auto first_fill = fills.size();
+    remaining -= execute(opposite.at(*price), remaining, static_cast<double>(*price), &fills);
+    for (auto i = first_fill; _market_data && i < fills.size(); ++i)
+    {
+      _market_data->on_trade(trade_report{ order.symbol, fills[i].price, fills[i].quantity });
+    }
+
+    settle_level(order.symbol, side, opposite, *price);
+  }
+
+  return remaining;
+}
+
+std::uint64_t market::execute(level &level, std::uint64_t quantity, double price, std::vector<fill> *fills)
+{
+  std::uint64_t executed{};
+  while (executed < quantity && level.first != nullptr)
+  {
+    auto &resting = *level.first;
+    const fill fill{ std::min(quantity - executed, resting.order.quantity), price };
+    executed += fill.quantity;
+    if (fills != nullptr) { fills->push_back(fill); }
+
+    resting.callback(fill);
+    if (fill.quantity < resting.order.quantity)
+    {
+      resting.order.quantity -= fill.quantity;
+      level.quantity -= fill.quantity;
+      break;
+    }
+
+    unlink(level, resting);
+    erase(resting);
+  }
+
+  return executed;
+}
+
+void market::uncross(const std::string &symbol, book &book)
+{
+  const auto best_bid = book.bids.highest();
+  const auto best_ask = book.asks.lowest();
+  if (!best_bid || !best_ask || *best_bid < *best_ask) { return; }
+
+  // Quantities of the crossed levels, by ascending price
+  std::vector<std::pair<price_type, std::uint64_t>> bids;
+  std::vector<std::pair<price_type, std::uint64_t>> asks;
+  std::uint64_t demand{};
+  for (auto price = best_bid; price && *price >= *best_ask; price = book.bids.next_below(*price))
+  {
+    bids.emplace_back(*price, book.bids.at(*price).quantity);
+    demand += bids.back().second;
+  }
+  std::reverse(bids.begin(), bids.end());
+  for (auto price = best_ask; price && *price <= *best_bid; price = book.asks.next_above(*price))
+  {
+    asks.emplace_back(*price, book.asks.at(*price).quantity);
+  }
+
+  // Demand is what bids at or above the price want, supply what asks at or below it offer
+  struct candidate
+  {
+    price_type price{};
+    std::uint64_t volume{};
+    std::uint64_t imbalance{};
+  };
+  candidate best{};
+  std::uint64_t supply{};
+  auto bid = bids.begin();
+  auto ask = asks.begin();
+  while (bid != bids.end() || ask != asks.end())
+  {
+    const auto price = ask == asks.end() || (bid != bids.end() && bid->first < ask->first) ? bid->first : ask->first;
+    for (; ask != asks.end() && ask->first <= price; ++ask) { supply += ask->second; }
+
+    const candidate current{ price, std::min(demand, supply), demand > supply ? demand - supply : supply - demand };
+    if (current.volume > best.volume || (current.volume == best.volume && current.imbalance < best.imbalance))
+    {
+      best = current;
+    }
+
+    for (; bid != bids.end() && bid->first <= price; ++bid) { demand -= bid->second; }
+  }
+
+  if (best.volume == 0) { return; }
+
+  const auto price = static_cast<double>(best.price);
+  for (auto left = best.volume; left > 0;)
+  {
+    const auto level_price = *book.bids.highest();
+    left -= execute(book.bids.at(level_price), left, price, nullptr);
+    settle_level(symbol, order_side::buy, book.bids, level_price);
+  }
+  for (auto left = best.volume; left > 0;)
+  {
+    const auto level_price = *book.asks.lowest();
+    left -= execute(book.asks.at(level_price), left, price, nullptr);
+    settle_level(symbol, order_side::sell, book.asks, level_price);
   }
 
-  return false;
+  if (_market_data) { _market_data->on_trade(trade_report{ symbol, price, best.volume }); }
+}
+
+void market::rest(const order &order, std::function<void(const fill &)> callback, book &book)
+{
+  auto &resting = _orders[order.id];
+  resting.order = order;
+  resting.callback = std::move(callback);
+  resting.book = &book;
+
+  auto &owned = _owners[order.owner];
+  resting.next_of_owner = owned.first;
+  if (owned.first != nullptr) { owned.first->previous_of_owner = &resting; }
+  owned.first = &resting;
+
+  auto &level = (order.way == order_side::buy ? book.bids : book.asks)[ticks(order.price)];
+  push_back(level, resting);
+  report_level(order.symbol, order.way, ticks(order.price), level.quantity);
+}
+
+void market::remove(resting_order &resting, book &book)
+{
+  const auto &order = resting.order;
+  auto &ladder = order.way == order_side::buy ? book.bids : book.asks;
+  const auto price = ticks(order.price);
+  unlink(ladder.at(price), resting);
+  settle_level(order.symbol, order.way, ladder, price);
+}
+
+void market::erase(resting_order &resting)
+{
+  if (resting.previous_of_owner != nullptr) { resting.previous_of_owner->next_of_owner = resting.next_of_owner; }
+  else if (resting.next_of_owner == nullptr)
+  {
+    _owners.erase(resting.order.owner);
+  }
+  else
+  {
+    _owners[resting.order.owner].first = resting.next_of_owner;
+  }
+  if (resting.next_of_owner != nullptr) { resting.next_of_owner->previous_of_owner = resting.previous_of_owner; }
+
+  // The key must outlive the erasure of its node
+  const auto id = resting.order.id;
+  _orders.erase(id);
+}
+
+void market::settle_level(const std::string &symbol, order_side side, price_ladder<level> &ladder, price_type price)
+{
+  const auto &level = ladder.at(price);
+  report_level(symbol, side, price, level.quantity);
+  if (level.first == nullptr) { ladder.erase(price); }
+}
+
+void market::report_level(const std::string &symbol, order_side side, price_type price, std::uint64_t quantity)
+{
+  if (_market_data)
+  {
+    _market_data->on_level_update(price_level_update{ symbol, side, static_cast<double>(price), quantity });
+  }
+}
+
+bool market::crosses(const order &order, price_type price)
+{
+  if (order.type == order_type::market) { return true; }
+  return order.way == order_side::buy ? price <= ticks(order.price) : price >= ticks(order.price);
+}
+
+void market::push_back(level &level, resting_order &resting)
+{
+  resting.previous = level.last;
+  resting.next = nullptr;
+  if (level.last != nullptr) { level.last->next = &resting; }
+  else
+  {
+    level.first = &resting;
+  }
+  level.last = &resting;
+  level.quantity += resting.order.quantity;
+}
+
+void market::unlink(level &level, resting_order &resting)
+{
+  if (resting.previous != nullptr) { resting.previous->next = resting.next; }
+  else
+  {
+    level.first = resting.next;
+  }
+  if (resting.next != nullptr) { resting.next->previous = resting.previous; }
+  else
+  {
+    level.last = resting.previous;
+  }
+  level.quantity -= resting.order.quantity;
+}
 }
-}
\ No newline at end of file
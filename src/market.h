@@ -1,37 +1,182 @@
 #pragma once
 
+#include "market_data.h"
 #include "order.h"
+#include "price_ladder.h"
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <unordered_map>
 #include <vector>
 
 namespace exchange_server {
 
+// Part of an order executed at the price of the resting order it matched
+struct fill
+{
+  std::uint64_t quantity{};
+  double price{};
+};
+
+// rested: the order, or what is left of it, is in the book. done: nothing is left to rest, whatever did not match at
+// once was cancelled. rejected: the order did not enter the market at all.
+enum class order_status { rested, done, rejected };
+
+struct order_result
+{
+  order_status status{ order_status::rested };
+  // Executions of the order as it entered the market
+  std::vector<fill> fills;
+};
+
+// Instruction of a mass quote: a new order, or a new price and quantity for a resting one
+struct quote_entry
+{
+  exchange_server::order order;
+  bool replace{ false };
+  // Reports the executions of a new order once it rests
+  std::function<void(const fill &)> callback;
+};
+
+// Orders of an owner a mass cancel applies to, all of them by default
+struct cancel_filter
+{
+  // Padded like the symbols of order messages, any symbol if empty
+  std::string symbol;
+  std::optional<order_side> side;
+};
+
 class market_interface
 {
 public:
   virtual ~market_interface() = default;
 
-  virtual void add_order(const order &order, std::function<void()> callback) = 0;
+  // The callback reports the executions of the order once it rests, it is called with the market locked and must
+  // not call back into it
+  virtual order_result add_order(const order &order, std::function<void(const fill &)> callback) = 0;
   virtual bool update_order(const order &order) = 0;
   virtual bool cancel_order(const std::string &id) = 0;
+  // Cancels the resting orders of the owner matching the filter, returns their ids
+  virtual std::vector<std::string> cancel_all(std::uint64_t owner, const cancel_filter &filter) = 0;
+  // Applies the entries in order as one operation, no other order enters the market in between. Results are those of
+  // add_order for new orders, replacements either rest or are rejected.
+  virtual std::vector<order_result> mass_quote(std::vector<quote_entry> entries) = 0;
+};
+
+struct market_options
+{
+  // Symbols traded in periodic call auctions instead of continuously
+  std::vector<std::string> auction_symbols;
+  std::chrono::milliseconds auction_interval{ 1'000 };
 };
 
+// Price-time priority books, one per symbol. Prices are whole ticks.
+// Orders of auction symbols only rest, the book may cross until the next auction uncrosses it. They must be day
+// orders: there is no way to tell their owner the part which did not execute was cancelled.
 class market : public market_interface
 {
 public:
-  void run();
+  explicit market(std::shared_ptr<market_data_sink> market_data = nullptr, market_options options = {});
+
+  // Runs the auctions every interval, until stopped. The auction runs uncross unless given. Can run again once stopped.
+  void run(std::function<void()> auction = {});
   void stop();
 
-  void add_order(const order &order, std::function<void()> callback) override;
+  // Executes the crossed part of every auction book at the price which maximizes the executed quantity, ties go to the
+  // price leaving the smallest imbalance then to the lowest one. Each auction reports a single trade.
+  void uncross();
+
+  order_result add_order(const order &order, std::function<void(const fill &)> callback) override;
+  // Quantity changes keep the priority of the order, price changes lose it. Orders cannot be moved across the book of a
+  // continuously traded symbol.
   bool update_order(const order &order) override;
   bool cancel_order(const std::string &id) override;
+  // Walks the orders of the owner only, whatever the size of the books
+  std::vector<std::string> cancel_all(std::uint64_t owner, const cancel_filter &filter) override;
+  // Takes the lock once for all the entries
+  std::vector<order_result> mass_quote(std::vector<quote_entry> entries) override;
+
+  // Every resting order, by priority within each book: adding them back in this order to an empty market with the same
+  // options rebuilds the same books
+  std::vector<order> resting_orders();
 
 private:
+  struct book;
+
+  struct resting_order
+  {
+    exchange_server::order order;
+    std::function<void(const fill &)> callback;
+    market::book *book{};
+    // Orders of a level, by time priority
+    resting_order *previous{};
+    resting_order *next{};
+    // Orders of the same owner, in no particular order
+    resting_order *previous_of_owner{};
+    resting_order *next_of_owner{};
+  };
+
+  struct owner_orders
+  {
+    resting_order *first{};
+  };
+
+  struct level
+  {
+    std::uint64_t quantity{};
+    resting_order *first{};
+    resting_order *last{};
+  };
+
+  struct book
+  {
+    price_ladder<level> bids;
+    price_ladder<level> asks;
+    bool auction{ false };
+  };
+
+  using price_type = price_ladder<level>::price_type;
+
+  // Prices are whole ticks
+  static price_type ticks(double price) { return static_cast<price_type>(price); }
+  static bool crosses(const order &order, price_type price);
+  static void push_back(level &level, resting_order &resting);
+  static void unlink(level &level, resting_order &resting);
+
+  // The helpers below are called with the lock held
+
+  order_result add(const order &order, std::function<void(const fill &)> callback);
+  bool update(const order &order);
+
+  // Best price of the opposite side of the book the order could execute at
+  static std::optional<price_type> best_match(const order &order, book &book);
+  // Quantity of the opposite side of the book the order could execute against, up to its own
+  static std::uint64_t available(const order &order, book &book);
+  // Executes the order against the opposite side of the book, returns the quantity left
+  std::uint64_t match(const order &order, book &book, std::vector<fill> &fills);
+  // Executes up to quantity of the orders of the level by time priority, returns the quantity executed
+  std::uint64_t execute(level &level, std::uint64_t quantity, double price, std::vector<fill> *fills);
+  void uncross(const std::string &symbol, book &book);
+  void rest(const order &order, std::function<void(const fill &)> callback, book &book);
+  // Takes the order out of its level, the order itself stays in _orders
+  void remove(resting_order &resting, book &book);
+  // Erases an order already out of its level
+  void erase(resting_order &resting);
+  // Reports the level after it changed, erases it once empty
+  void settle_level(const std::string &symbol, order_side side, price_ladder<level> &ladder, price_type price);
+  void report_level(const std::string &symbol, order_side side, price_type price, std::uint64_t quantity);
+
+  std::shared_ptr<market_data_sink> _market_data;
+  std::chrono::milliseconds _auction_interval;
+
   bool _stop_requested{ false };
   std::mutex _mutex;
-  std::vector<std::pair<order, std::function<void()>>> _pending_orders;
-  std::unordered_map<std::string, size_t> _mapping;
+  std::condition_variable _stop_condition;
+  std::unordered_map<std::string, book> _books;
+  std::unordered_map<std::string, resting_order> _orders;
+  std::unordered_map<std::uint64_t, owner_orders> _owners;
 };
-}
\ No newline at end of file
+}
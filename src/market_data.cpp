@@ -0,0 +1,159 @@
+#include "market_data.h"
+#include <algorithm>
+#include <fmt/format.h>
+
+namespace exchange_server {
+
+std::string encode_level(std::string_view symbol, order_side side, double price, std::uint64_t quantity)
+{
+  return fmt::format("level{}{}{:0>8}{:0>8.0f}\n", symbol, side == order_side::buy ? '+' : '-', quantity, price);
+}
+
+std::string encode_trade(const trade_report &trade)
+{
+  return fmt::format("trade{}{:0>8}{:0>8.0f}\n", trade.symbol, trade.quantity, trade.price);
+}
+
+void level_book::apply(const price_level_update &update)
+{
+  const auto apply = [&update](auto &levels) {
+    if (update.quantity == 0) { levels.erase(update.price); }
+    else
+    {
+      levels[update.price] = update.quantity;
+    }
+  };
+
+  if (update.side == order_side::buy) { apply(_bids); }
+  else
+  {
+    apply(_asks);
+  }
+}
+
+std::string level_book::encode_snapshot(std::string_view symbol) const
+{
+  auto message = fmt::format("snapshot{}{:0>4}\n", symbol, _bids.size() + _asks.size());
+  for (const auto &[price, quantity] : _bids) { message += encode_level(symbol, order_side::buy, price, quantity); }
+  for (const auto &[price, quantity] : _asks) { message += encode_level(symbol, order_side::sell, price, quantity); }
+
+  return message;
+}
+
+void market_data_fanout::on_level_update(const price_level_update &update)
+{
+  for (const auto &sink : _sinks) { sink->on_level_update(update); }
+}
+
+void market_data_fanout::on_trade(const trade_report &trade)
+{
+  for (const auto &sink : _sinks) { sink->on_trade(trade); }
+}
+
+void market_data_publisher::on_level_update(const price_level_update &update)
+{
+  std::scoped_lock l{ _mutex };
+  auto &feed = _feeds[update.symbol];
+  feed.book.apply(update);
+
+  publish(feed,
+    std::make_shared<const std::string>(encode_level(update.symbol, update.side, update.price, update.quantity)),
+    level_key{ .feed = &feed, .side = update.side, .price = update.price });
+}
+
+void market_data_publisher::on_trade(const trade_report &trade)
+{
+  std::scoped_lock l{ _mutex };
+  auto &feed = _feeds[trade.symbol];
+
+  publish(feed, std::make_shared<const std::string>(encode_trade(trade)), std::nullopt);
+}
+
+bool market_data_publisher::subscribe(const std::string &symbol,
+  const std::shared_ptr<market_data_subscriber> &subscriber)
+{
+  std::shared_ptr<const std::string> snapshot;
+  {
+    std::scoped_lock l{ _mutex };
+    auto &feed = _feeds[symbol];
+
+    if (std::any_of(feed.subscribers.begin(), feed.subscribers.end(), [&subscriber](const auto &existing) {
+          return existing.subscriber.lock() == subscriber;
+        }))
+    {
+      return false;
+    }
+
+    snapshot = std::make_shared<const std::string>(feed.book.encode_snapshot(symbol));
+    feed.subscribers.push_back({ .subscriber = subscriber, .backlog = std::vector<message>{} });
+  }
+
+  // Delivered without blocking the market, the updates published meanwhile wait in the backlog so that none is missed
+  // or applied twice by the subscriber
+  subscriber->deliver(std::move(snapshot), std::nullopt);
+  for (;;)
+  {
+    std::vector<message> backlog;
+    {
+      std::scoped_lock l{ _mutex };
+      // Feeds are never erased, and only the subscriber itself unsubscribes
+      auto &subscribers = _feeds.find(symbol)->second.subscribers;
+      auto &subscription = *std::find_if(subscribers.begin(), subscribers.end(), [&subscriber](const auto &existing) {
+        return existing.subscriber.lock() == subscriber;
+      });
+      if (subscription.backlog->empty())
+      {
+        subscription.backlog.reset();
+        return true;
+      }
+
+      backlog.swap(*subscription.backlog);
+    }
+
+    for (auto &[update, key] : backlog) { subscriber->deliver(std::move(update), key); }
+  }
+}
+
+bool market_data_publisher::unsubscribe(const std::string &symbol, const market_data_subscriber &subscriber)
+{
+  std::scoped_lock l{ _mutex };
+  const auto it = _feeds.find(symbol);
+  if (it == _feeds.end()) { return false; }
+
+  return std::erase_if(it->second.subscribers,
+           [&subscriber](const auto &existing) { return existing.subscriber.lock().get() == &subscriber; })
+         > 0;
+}
+
+void market_data_publisher::snapshot(const std::string &symbol, market_data_subscriber &subscriber)
+{
+  std::shared_ptr<const std::string> snapshot;
+  {
+    std::scoped_lock l{ _mutex };
+    const auto it = _feeds.find(symbol);
+    snapshot = std::make_shared<const std::string>(
+      it != _feeds.end() ? it->second.book.encode_snapshot(symbol) : level_book{}.encode_snapshot(symbol));
+  }
+
+  subscriber.deliver(std::move(snapshot), std::nullopt);
+}
+
+void market_data_publisher::publish(feed &feed,
+  const std::shared_ptr<const std::string> &message,
+  std::optional<level_key> key)
+{
+  // Disconnected subscribers are only forgotten here
+  std::erase_if(feed.subscribers, [&message, key](auto &subscription) {
+    const auto locked = subscription.subscriber.lock();
+    if (!locked) { return true; }
+
+    if (subscription.backlog) { subscription.backlog->emplace_back(message, key); }
+    else
+    {
+      locked->deliver(message, key);
+    }
+    return false;
+  });
+}
+
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "order.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace exchange_server {
+
+// Aggregated quantity now resting at a price, zero when the level is gone
+struct price_level_update
+{
+  std::string symbol;
+  order_side side{};
+  double price{};
+  std::uint64_t quantity{};
+};
+
+struct trade_report
+{
+  std::string symbol;
+  double price{};
+  std::uint64_t quantity{};
+};
+
+// Receives the changes of the books, called by the market in the order they happen
+class market_data_sink
+{
+public:
+  virtual ~market_data_sink() = default;
+
+  virtual void on_level_update(const price_level_update &update) = 0;
+  virtual void on_trade(const trade_report &trade) = 0;
+};
+
+// Identifies a price level of a feed, a newer update of the same level supersedes a pending one
+struct level_key
+{
+  const void *feed{};
+  order_side side{};
+  double price{};
+
+  bool operator==(const level_key &) const = default;
+};
+
+struct level_key_hash
+{
+  std::size_t operator()(const level_key &key) const
+  {
+    return std::hash<const void *>{}(key.feed) ^ std::hash<double>{}(key.price) ^ static_cast<std::size_t>(key.side);
+  }
+};
+
+// Resting quantity per price of one symbol, as rebuilt from its updates
+class level_book
+{
+public:
+  void apply(const price_level_update &update);
+
+  // snapshot<symbol(8)><level count(4)> followed by that many level messages
+  std::string encode_snapshot(std::string_view symbol) const;
+
+private:
+  std::map<double, std::uint64_t, std::greater<>> _bids;
+  std::map<double, std::uint64_t> _asks;
+};
+
+// Forwards the market changes to several sinks
+class market_data_fanout : public market_data_sink
+{
+public:
+  explicit market_data_fanout(std::vector<std::shared_ptr<market_data_sink>> sinks) : _sinks{ std::move(sinks) } {}
+
+  void on_level_update(const price_level_update &update) override;
+  void on_trade(const trade_report &trade) override;
+
+private:
+  std::vector<std::shared_ptr<market_data_sink>> _sinks;
+};
+
+class market_data_subscriber
+{
+public:
+  virtual ~market_data_subscriber() = default;
+
+  // Messages without key (snapshots, trades) must all be delivered, others may be conflated
+  virtual void deliver(std::shared_ptr<const std::string> message, std::optional<level_key> key) = 0;
+};
+
+// Keeps the price levels of every symbol and fans their updates out to subscribers.
+// Messages are encoded once and the same buffer is handed to every subscriber:
+//   level<symbol(8)><+/-><quantity(8)><price(8)>
+//   trade<symbol(8)><quantity(8)><price(8)>
+//   snapshot<symbol(8)><level count(4)> followed by that many level messages
+class market_data_publisher : public market_data_sink
+{
+public:
+  void on_level_update(const price_level_update &update) override;
+  void on_trade(const trade_report &trade) override;
+
+  // The subscriber receives a snapshot of the book followed by its updates, false if it was already subscribed. Callers
+  // only subscribe to symbols the market knows, each one has a feed from then on.
+  bool subscribe(const std::string &symbol, const std::shared_ptr<market_data_subscriber> &subscriber);
+  bool unsubscribe(const std::string &symbol, const market_data_subscriber &subscriber);
+  void snapshot(const std::string &symbol, market_data_subscriber &subscriber);
+
+private:
+  using message = std::pair<std::shared_ptr<const std::string>, std::optional<level_key>>;
+
+  struct subscription
+  {
+    std::weak_ptr<market_data_subscriber> subscriber;
+    // Updates published while the snapshot is delivered, outside the lock, are delivered after it
+    std::optional<std::vector<message>> backlog;
+  };
+
+  struct feed
+  {
+    level_book book;
+    std::vector<subscription> subscribers;
+  };
+
+  static void publish(feed &feed, const std::shared_ptr<const std::string> &message, std::optional<level_key> key);
+
+  std::mutex _mutex;
+  // Never erased: feed addresses are used as level keys
+  std::unordered_map<std::string, feed> _feeds;
+};
+
+std::string encode_level(std::string_view symbol, order_side side, double price, std::uint64_t quantity);
+std::string encode_trade(const trade_report &trade);
+
+}
@@ -0,0 +1,19 @@
+#include "metrics.h"
+#include <fmt/format.h>
+
+namespace exchange_server {
+
+std::string server_metrics::to_string() const
+{
+  return fmt::format("connections: {}, received messages: {}, throttled messages: {}, slow consumers: {}, "
+                     "timed out connections: {}, conflated updates: {}, orphaned executions: {}",
+    connections.load(),
+    received_messages.load(),
+    throttled_messages.load(),
+    slow_consumers.load(),
+    timed_out_connections.load(),
+    conflated_updates.load(),
+    orphaned_executions.load());
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace exchange_server {
+
+// Counters updated from any thread, read for reporting
+struct server_metrics
+{
+  std::atomic<std::uint64_t> connections{};
+  std::atomic<std::uint64_t> received_messages{};
+  std::atomic<std::uint64_t> throttled_messages{};
+  std::atomic<std::uint64_t> slow_consumers{};
+  std::atomic<std::uint64_t> timed_out_connections{};
+  std::atomic<std::uint64_t> conflated_updates{};
+  std::atomic<std::uint64_t> orphaned_executions{};
+
+  std::string to_string() const;
+};
+
+}
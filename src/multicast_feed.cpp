@@ -0,0 +1,215 @@
+#include "multicast_feed.h"
+#include "socket_impl.h"
+#include <algorithm>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+#include <utility>
+
+namespace exchange_server {
+
+namespace {
+  constexpr std::size_t sequence_size{ 8 };
+  constexpr unsigned bits_per_byte{ 8 };
+
+  template<class T> void write_little_endian(T value, std::span<char> output)
+  {
+    for (auto &byte : output)
+    {
+      byte = static_cast<char>(value & 0xFFU);
+      value = static_cast<T>(value >> bits_per_byte);
+    }
+  }
+
+  template<class T> T read_little_endian(std::span<const char> input)
+  {
+    T value{};
+    for (auto it = input.rbegin(); it != input.rend(); ++it)
+    {
+      value = static_cast<T>(value << bits_per_byte) | static_cast<T>(static_cast<unsigned char>(*it));
+    }
+
+    return value;
+  }
+}
+
+std::optional<feed_packet> parse_feed_packet(std::span<const char> datagram)
+{
+  if (datagram.size() < feed_header_size) { return std::nullopt; }
+
+  feed_packet packet{ .sequence = read_little_endian<std::uint64_t>(datagram.first(sequence_size)) };
+  const auto count = read_little_endian<std::uint16_t>(datagram.first(feed_header_size).subspan(sequence_size));
+
+  std::string_view messages{ datagram.data() + feed_header_size, datagram.size() - feed_header_size };
+  while (!messages.empty())
+  {
+    const auto end = messages.find('\n');
+    if (end == std::string_view::npos) { return std::nullopt; }
+
+    packet.messages.push_back(messages.substr(0, end + 1));
+    messages.remove_prefix(end + 1);
+  }
+
+  if (packet.messages.size() != count) { return std::nullopt; }
+
+  return packet;
+}
+
+multicast_feed::multicast_feed(std::shared_ptr<socket_interface> sock, multicast_feed_options options)
+  : _sock{ std::move(sock) }, _options{ options }
+{}
+
+void multicast_feed::on_level_update(const price_level_update &update)
+{
+  std::unique_lock l{ _mutex };
+  _books[update.symbol].apply(update);
+  if (const auto datagram = append(encode_level(update.symbol, update.side, update.price, update.quantity)))
+  {
+    send(l, *datagram);
+  }
+}
+
+void multicast_feed::on_trade(const trade_report &trade)
+{
+  std::unique_lock l{ _mutex };
+  if (const auto datagram = append(encode_trade(trade))) { send(l, *datagram); }
+}
+
+void multicast_feed::run()
+{
+  std::unique_lock l{ _mutex };
+  for (;;)
+  {
+    _condition.wait(l, [this] { return _stop_requested || _batch_count > 0; });
+    if (_stop_requested) { break; }
+
+    // The batch may have been sent because it was full in the meantime, the next one then has its own deadline
+    if (const auto deadline = _batch_start + _options.max_batch_delay; std::chrono::steady_clock::now() < deadline)
+    {
+      _condition.wait_until(l, deadline);
+    }
+    else
+    {
+      send(l, take_batch());
+    }
+  }
+
+  if (_batch_count > 0) { send(l, take_batch()); }
+}
+
+void multicast_feed::stop()
+{
+  std::scoped_lock l{ _mutex };
+  _stop_requested = true;
+  _condition.notify_all();
+}
+
+void multicast_feed::flush()
+{
+  std::unique_lock l{ _mutex };
+  if (_batch_count > 0) { send(l, take_batch()); }
+}
+
+result<std::string> multicast_feed::replay(std::uint64_t first) const
+{
+  std::scoped_lock l{ _mutex };
+  const auto oldest = _next_sequence - _retained.size();
+  if (first < oldest) { return { .err = std::make_error_code(std::errc::result_out_of_range) }; }
+
+  std::string result;
+  for (auto sequence = first; sequence < _next_sequence; ++sequence)
+  {
+    fmt::format_to(std::back_inserter(result), "{:0>12}{}", sequence, _retained[sequence - oldest]);
+  }
+  fmt::format_to(std::back_inserter(result), "replayend{:0>12}\n", _next_sequence - 1);
+
+  return { .result = std::move(result) };
+}
+
+std::string multicast_feed::snapshot() const
+{
+  std::scoped_lock l{ _mutex };
+  std::string result;
+  for (const auto &[symbol, book] : _books) { result += book.encode_snapshot(symbol); }
+  fmt::format_to(std::back_inserter(result), "snapshotend{:0>12}\n", _next_sequence - 1);
+
+  return result;
+}
+
+std::uint64_t multicast_feed::dropped_packets() const
+{
+  std::scoped_lock l{ _mutex };
+  return _dropped_packets;
+}
+
+std::optional<std::string> multicast_feed::append(std::string message)
+{
+  std::optional<std::string> full;
+  if (_batch_count > 0
+      && (_batch.size() + message.size() > _options.max_packet_size
+          || _batch_count == std::numeric_limits<std::uint16_t>::max()))
+  {
+    full = take_batch();
+  }
+
+  if (_batch_count == 0)
+  {
+    _batch.assign(feed_header_size, '\0');
+    _batch_start = std::chrono::steady_clock::now();
+    _condition.notify_all();
+  }
+
+  _batch += message;
+  ++_batch_count;
+  ++_next_sequence;
+
+  _retained.push_back(std::move(message));
+  if (_retained.size() > _options.retained_messages) { _retained.pop_front(); }
+  return full;
+}
+
+std::string multicast_feed::take_batch()
+{
+  const auto header = std::span{ _batch }.first(feed_header_size);
+  write_little_endian(_next_sequence - _batch_count, header.first(sequence_size));
+  write_little_endian(_batch_count, header.subspan(sequence_size));
+
+  _batch_count = 0;
+  return std::exchange(_batch, {});
+}
+
+void multicast_feed::send(std::unique_lock<std::mutex> &lock, const std::string &datagram)
+{
+  std::error_code err;
+  {
+    // The market is not held up by the socket, a datagram taken later waits for this one to be sent
+    const std::scoped_lock sending{ _send_mutex };
+    lock.unlock();
+    err = _sock->write(datagram).err;
+  }
+  lock.lock();
+
+  // Lost datagrams are recovered by subscribers like any other gap
+  if (err)
+  {
+    ++_dropped_packets;
+    spdlog::debug("Cannot send market data datagram: {}", err.message());
+  }
+}
+
+std::size_t feed_sequence_tracker::duplicates(std::uint64_t first, std::size_t count) const
+{
+  if (_expected == 0 || first >= _expected) { return 0; }
+
+  return static_cast<std::size_t>(std::min<std::uint64_t>(_expected - first, count));
+}
+
+std::optional<feed_sequence_tracker::gap> feed_sequence_tracker::on_packet(std::uint64_t first, std::size_t count)
+{
+  std::optional<gap> result;
+  if (_expected != 0 && first > _expected) { result = gap{ .first = _expected, .last = first - 1 }; }
+
+  _expected = std::max(_expected, first + count);
+  return result;
+}
+
+}
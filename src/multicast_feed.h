@@ -0,0 +1,121 @@
+#pragma once
+
+#include "market_data.h"
+#include "result.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace exchange_server {
+
+class socket_interface;
+
+// Datagrams start with the sequence number of their first message (8 bytes) and their message count (2 bytes), both
+// little endian, followed by the messages encoded as for TCP subscribers. Sequence numbers start at 1.
+constexpr std::size_t feed_header_size{ 10 };
+
+struct feed_packet
+{
+  std::uint64_t sequence{};
+  std::vector<std::string_view> messages;
+};
+
+std::optional<feed_packet> parse_feed_packet(std::span<const char> datagram);
+
+struct multicast_feed_options
+{
+  // Updates are batched in datagrams up to this size
+  std::size_t max_packet_size{ 1400 };
+  // Time an update may wait for others to fill its datagram
+  std::chrono::microseconds max_batch_delay{ 100 };
+  // Messages kept for replay
+  std::size_t retained_messages{ 1U << 16U };
+};
+
+// Sends the market data to a multicast group, its cost does not depend on the number of subscribers.
+// Subscribers missing datagrams recover from the replay of retained messages or a snapshot.
+class multicast_feed : public market_data_sink
+{
+public:
+  explicit multicast_feed(std::shared_ptr<socket_interface> sock, multicast_feed_options options = {});
+
+  void on_level_update(const price_level_update &update) override;
+  void on_trade(const trade_report &trade) override;
+
+  // Sends batches once they waited long enough, until stopped
+  void run();
+  void stop();
+  // Sends the current batch immediately
+  void flush();
+
+  // Messages from first onwards, each prefixed by its sequence number (12 digits), then replayend<last sequence(12)>.
+  // Fails once the first message is no longer retained.
+  result<std::string> replay(std::uint64_t first) const;
+  // Snapshot of every symbol, then snapshotend<last sequence(12)> giving the sequence they are at
+  std::string snapshot() const;
+
+  std::uint64_t dropped_packets() const;
+
+private:
+  // Returns the previous batch when the message did not fit in it, it must then be sent
+  std::optional<std::string> append(std::string message);
+  // The datagram of the current batch, a new batch starts with the next message
+  std::string take_batch();
+  // Sends without holding the lock, which is held again once sent
+  void send(std::unique_lock<std::mutex> &lock, const std::string &datagram);
+
+  std::shared_ptr<socket_interface> _sock;
+  multicast_feed_options _options;
+
+  mutable std::mutex _mutex;
+  // Taken before the lock is released, so that datagrams are sent in sequence order
+  std::mutex _send_mutex;
+  std::condition_variable _condition;
+  bool _stop_requested{ false };
+
+  std::map<std::string, level_book> _books;
+  std::uint64_t _next_sequence{ 1 };
+
+  std::string _batch;
+  std::uint16_t _batch_count{};
+  std::chrono::steady_clock::time_point _batch_start;
+
+  // Messages up to _next_sequence - 1
+  std::deque<std::string> _retained;
+  std::uint64_t _dropped_packets{};
+};
+
+// Checks the continuity of the sequence numbers received by a subscriber
+class feed_sequence_tracker
+{
+public:
+  // Missing sequence numbers, both included
+  struct gap
+  {
+    std::uint64_t first{};
+    std::uint64_t last{};
+  };
+
+  // The first packet sets the starting sequence number, unless it was set from a snapshot
+  void reset(std::uint64_t next) { _expected = next; }
+
+  // Number of leading messages of a packet which were already received
+  std::size_t duplicates(std::uint64_t first, std::size_t count) const;
+  // Returns the messages missed before the packet
+  std::optional<gap> on_packet(std::uint64_t first, std::size_t count);
+
+  std::uint64_t expected() const { return _expected; }
+
+private:
+  std::uint64_t _expected{};
+};
+
+}
@@ -1,25 +1,256 @@
 #include "order.h"
-#include <charconv>
+#include <bit>
+#include <cstring>
+#include <optional>
 
-std::optional<exchange_server::order> exchange_server::parse_order(std::string_view message)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace exchange_server {
+
+namespace {
+  constexpr std::size_t id_offset{ 0 };
+  constexpr std::size_t symbol_offset{ 4 };
+  constexpr std::size_t side_offset{ 12 };
+  constexpr std::size_t quantity_offset{ 13 };
+  constexpr std::size_t price_offset{ 17 };
+  constexpr std::size_t message_size{ 25 };
+  constexpr std::size_t type_offset{ 25 };
+  constexpr std::size_t time_in_force_offset{ 26 };
+  constexpr std::size_t extended_message_size{ 27 };
+
+  constexpr order_error field_error(std::size_t position)
+  {
+    if (position < symbol_offset) { return order_error::invalid_id; }
+    if (position < side_offset) { return order_error::invalid_symbol; }
+    if (position < quantity_offset) { return order_error::invalid_side; }
+    if (position < price_offset) { return order_error::invalid_quantity; }
+    return order_error::invalid_price;
+  }
+
+#if defined(__SSE2__)
+  // Bit i set when byte i of the chunk is in [low, high], signed compares work as all bounds are ASCII
+  int in_range(__m128i chunk, char low, char high)
+  {
+    const auto outside =
+      _mm_or_si128(_mm_cmplt_epi8(chunk, _mm_set1_epi8(low)), _mm_cmpgt_epi8(chunk, _mm_set1_epi8(high)));
+    return ~_mm_movemask_epi8(outside) & 0xffff;
+  }
+
+  int equal_to(__m128i chunk, char value) { return _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(value))); }
+
+  // Positions of the 16 bytes chunk starting at offset which belong to the [first, last) field
+  constexpr int position_mask(std::size_t offset, std::size_t first, std::size_t last)
+  {
+    int mask{};
+    for (auto position = offset; position < offset + 16; ++position)
+    {
+      if (position >= first && position < last) { mask |= 1 << (position - offset); }
+    }
+    return mask;
+  }
+
+  // Bit i set when byte i of the chunk is valid for its position in the message
+  template<std::size_t offset> int valid_bytes(const char *data)
+  {
+    constexpr auto id = position_mask(offset, id_offset, symbol_offset);
+    constexpr auto symbol = position_mask(offset, symbol_offset, side_offset);
+    constexpr auto side = position_mask(offset, side_offset, quantity_offset);
+    constexpr auto digit = position_mask(offset, quantity_offset, message_size);
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset));
+    const auto digits = in_range(chunk, '0', '9');
+    const auto letters = in_range(chunk, 'A', 'Z') | in_range(chunk, 'a', 'z');
+
+    return (in_range(chunk, '!', '~') & id) | ((equal_to(chunk, ' ') | digits | letters) & symbol)
+           | ((equal_to(chunk, '+') | equal_to(chunk, '-')) & side) | (digits & digit);
+  }
+
+  // The two overlapping chunks cover the 25 bytes of the mandatory fields
+  std::error_code validate(std::string_view message)
+  {
+    constexpr std::size_t second_chunk{ message_size - 16 };
+
+    if (const auto valid = valid_bytes<0>(message.data()); valid != 0xffff)
+    {
+      return field_error(static_cast<std::size_t>(std::countr_one(static_cast<unsigned>(valid))));
+    }
+    if (const auto valid = valid_bytes<second_chunk>(message.data()); valid != 0xffff)
+    {
+      return field_error(second_chunk + static_cast<std::size_t>(std::countr_one(static_cast<unsigned>(valid))));
+    }
+    return {};
+  }
+#else
+  constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+  constexpr bool is_valid(std::size_t position, char c)
+  {
+    switch (field_error(position))
+    {
+    case order_error::invalid_id:
+      return c > ' ' && c <= '~';
+    case order_error::invalid_symbol:
+      return c == ' ' || is_digit(c) || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+    case order_error::invalid_side:
+      return c == '+' || c == '-';
+    default:
+      return is_digit(c);
+    }
+  }
+
+  std::error_code validate(std::string_view message)
+  {
+    for (std::size_t position = 0; position < message_size; ++position)
+    {
+      if (!is_valid(position, message[position])) { return field_error(position); }
+    }
+    return {};
+  }
+#endif
+
+  // Digits are validated, the first one ends up in the most significant place
+  std::uint32_t parse_4_digits(const char *data)
+  {
+    if constexpr (std::endian::native == std::endian::little)
+    {
+      std::uint32_t value{};
+      std::memcpy(&value, data, sizeof(value));
+      value -= 0x30303030U;
+      value = (value * 10 + (value >> 8U)) & 0x00ff00ffU;
+      return (value * 100 + (value >> 16U)) & 0xffffU;
+    }
+    else
+    {
+      std::uint32_t value{};
+      for (std::size_t i = 0; i < 4; ++i) { value = value * 10 + static_cast<std::uint32_t>(data[i] - '0'); }
+      return value;
+    }
+  }
+
+  std::uint64_t parse_8_digits(const char *data)
+  {
+    if constexpr (std::endian::native == std::endian::little)
+    {
+      std::uint64_t value{};
+      std::memcpy(&value, data, sizeof(value));
+      value -= 0x3030303030303030U;
+      value = (value * 10 + (value >> 8U)) & 0x00ff00ff00ff00ffU;
+      value = (value * 100 + (value >> 16U)) & 0x0000ffff0000ffffU;
+      return (value * 10000 + (value >> 32U)) & 0xffffffffU;
+    }
+    else
+    {
+      std::uint64_t value{};
+      for (std::size_t i = 0; i < 8; ++i) { value = value * 10 + static_cast<std::uint64_t>(data[i] - '0'); }
+      return value;
+    }
+  }
+
+  std::optional<order_type> parse_type(char c)
+  {
+    switch (c)
+    {
+    case 'L':
+      return order_type::limit;
+    case 'M':
+      return order_type::market;
+    case 'P':
+      return order_type::post_only;
+    default:
+      return std::nullopt;
+    }
+  }
+
+  std::optional<time_in_force> parse_time_in_force(char c, order_type type)
+  {
+    switch (c)
+    {
+    case 'D':
+      if (type == order_type::market) { return std::nullopt; }
+      return time_in_force::day;
+    case 'I':
+      if (type == order_type::post_only) { return std::nullopt; }
+      return time_in_force::immediate_or_cancel;
+    case 'F':
+      if (type == order_type::post_only) { return std::nullopt; }
+      return time_in_force::fill_or_kill;
+    default:
+      return std::nullopt;
+    }
+  }
+
+  class order_category_impl : public std::error_category
+  {
+  public:
+    const char *name() const noexcept override { return "order"; }
+
+    std::string message(int condition) const override
+    {
+      switch (static_cast<order_error>(condition))
+      {
+      case order_error::invalid_size:
+        return "invalid order size";
+      case order_error::invalid_id:
+        return "invalid order id";
+      case order_error::invalid_symbol:
+        return "invalid order symbol";
+      case order_error::invalid_side:
+        return "invalid order side";
+      case order_error::invalid_quantity:
+        return "invalid order quantity";
+      case order_error::invalid_price:
+        return "invalid order price";
+      case order_error::invalid_type:
+        return "invalid order type";
+      case order_error::invalid_time_in_force:
+        return "invalid order time in force";
+      default:
+        return "unknown order error";
+      }
+    }
+  };
+}
+
+const std::error_category &order_category()
+{
+  static const order_category_impl category;
+  return category;
+}
+
+std::error_code make_error_code(order_error err) { return { static_cast<int>(err), order_category() }; }
+
+result<order> parse_order(std::string_view message)
 {
-  // id(4)symbol(8)(+/-)quantity(4)price(8)
-  if (message.size() != 4 + 8 + 1 + 4 + 8) { return std::nullopt; }
-
-  const auto id = message.substr(0, 4);
-  const auto symbol = message.substr(4, 8);
-  const auto way = message.substr(4 + 8, 1);
-  const auto quantity = message.substr(4 + 8 + 1, 4);
-  const auto price = message.substr(4 + 8 + 1 + 4, 8);
-
-  int parsed_quantity{};
-  double parsed_price{};
-  std::from_chars(quantity.begin(), quantity.end(), parsed_quantity);
-  std::from_chars(price.begin(), price.end(), parsed_price);
-
-  return order{ std::string{ id },
-    std::string{ symbol },
-    way[0] == '-' ? order_side::sell : order_side::buy,
-    static_cast<std::uint64_t>(parsed_quantity),
-    parsed_price };
-}
\ No newline at end of file
+  if (message.size() != message_size && message.size() != extended_message_size)
+  {
+    return { .err = order_error::invalid_size };
+  }
+
+  if (const auto err = validate(message)) { return { .err = err }; }
+
+  auto type = order_type::limit;
+  auto tif = time_in_force::day;
+  if (message.size() == extended_message_size)
+  {
+    const auto parsed_type = parse_type(message[type_offset]);
+    if (!parsed_type) { return { .err = order_error::invalid_type }; }
+
+    const auto parsed_tif = parse_time_in_force(message[time_in_force_offset], *parsed_type);
+    if (!parsed_tif) { return { .err = order_error::invalid_time_in_force }; }
+
+    type = *parsed_type;
+    tif = *parsed_tif;
+  }
+
+  return { .result = order{ std::string{ message.substr(id_offset, 4) },
+             std::string{ message.substr(symbol_offset, 8) },
+             message[side_offset] == '-' ? order_side::sell : order_side::buy,
+             parse_4_digits(message.data() + quantity_offset),
+             static_cast<double>(parse_8_digits(message.data() + price_offset)),
+             type,
+             tif } };
+}
+}
@@ -1,11 +1,21 @@
 #pragma once
 
-#include <optional>
+#include "result.h"
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <system_error>
 
 namespace exchange_server {
 enum class order_side { buy, sell };
 
+// Market orders take any price, post-only ones are rejected instead of crossing the book
+enum class order_type { limit, market, post_only };
+
+// What is left of an order after it matched: resting until executed or cancelled, cancelled (immediate or cancel),
+// or the whole order is rejected unless it fully executes at once (fill or kill)
+enum class time_in_force { day, immediate_or_cancel, fill_or_kill };
+
 struct order
 {
   std::string id;
@@ -13,7 +23,34 @@ struct order
   order_side way{};
   std::uint64_t quantity{};
   double price{};
+  order_type type{ order_type::limit };
+  time_in_force tif{ time_in_force::day };
+  // Client the order belongs to in the market, set by the server rather than parsed
+  std::uint64_t owner{};
+};
+
+// First invalid field of an order message
+enum class order_error {
+  invalid_size = 1,
+  invalid_id,
+  invalid_symbol,
+  invalid_side,
+  invalid_quantity,
+  invalid_price,
+  invalid_type,
+  invalid_time_in_force,
 };
 
-std::optional<order> parse_order(std::string_view message);
-}
\ No newline at end of file
+const std::error_category &order_category();
+std::error_code make_error_code(order_error err);
+
+// id(4)symbol(8)(+/-)quantity(4)price(8), ids are printable characters, symbols letters, digits or spaces,
+// quantity and price only digits. Optionally followed by the type (L limit, M market, P post-only) and the time in
+// force (D day, I immediate or cancel, F fill or kill), limit day orders otherwise. Market orders cannot rest and
+// post-only ones must.
+result<order> parse_order(std::string_view message);
+}
+
+template<> struct std::is_error_code_enum<exchange_server::order_error> : std::true_type
+{
+};
@@ -0,0 +1 @@
+#include "price_ladder.h"
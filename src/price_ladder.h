@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <vector>
+
+namespace exchange_server {
+
+// Levels of one side of a book, indexed by price in ticks. Prices in a window around the center of the book are
+// stored in an array, with a two level bitmap of the non-empty ones so that the best and next levels are found with a
+// couple of bit scans, prices out of the window fall back to a tree. The window moves to the next price inserted once
+// it is empty.
+template<class Level> class price_ladder
+{
+public:
+  using price_type = std::int64_t;
+
+  static constexpr std::size_t default_window{ 4096 };
+
+  // The window is rounded up to a multiple of 64 levels
+  explicit price_ladder(std::size_t window = default_window)
+    : _levels((std::max<std::size_t>(window, 1) + 63) / 64 * 64), _occupied(_levels.size() / 64),
+      _summary((_occupied.size() + 63) / 64)
+  {}
+
+  bool empty() const { return _count == 0 && _far.empty(); }
+  // Non-empty levels
+  std::size_t size() const { return _count + _far.size(); }
+
+  // Level of the price, default constructed if it was empty
+  Level &operator[](price_type price)
+  {
+    if (_count == 0 && !in_window(price)) { recenter(price); }
+    if (!in_window(price)) { return _far[price]; }
+
+    const auto i = index(price);
+    if (!test(i))
+    {
+      set(i);
+      ++_count;
+    }
+
+    return _levels[i];
+  }
+
+  Level *find(price_type price)
+  {
+    if (in_window(price))
+    {
+      const auto i = index(price);
+      return test(i) ? &_levels[i] : nullptr;
+    }
+
+    const auto it = _far.find(price);
+    return it == _far.end() ? nullptr : &it->second;
+  }
+
+  // Level of a price known to be non-empty, such as one returned by the best or next level lookups
+  Level &at(price_type price)
+  {
+    if (!in_window(price)) { return _far.at(price); }
+
+    const auto i = index(price);
+    assert(test(i));
+    return _levels[i];
+  }
+
+  void erase(price_type price)
+  {
+    if (!in_window(price))
+    {
+      _far.erase(price);
+      return;
+    }
+
+    if (const auto i = index(price); test(i))
+    {
+      clear(i);
+      _levels[i] = Level{};
+      --_count;
+    }
+  }
+
+  // Including levels at the extreme prices, which no price is strictly above or below
+  std::optional<price_type> lowest() const
+  {
+    const auto i = first_from(0);
+    if (!_far.empty() && (i == npos || _far.begin()->first < price_at(i))) { return _far.begin()->first; }
+
+    if (i == npos) { return std::nullopt; }
+    return price_at(i);
+  }
+
+  std::optional<price_type> highest() const
+  {
+    const auto i = last_to(_levels.size() - 1);
+    if (!_far.empty() && (i == npos || _far.rbegin()->first > price_at(i))) { return _far.rbegin()->first; }
+
+    if (i == npos) { return std::nullopt; }
+    return price_at(i);
+  }
+
+  // Closest non-empty level strictly above the price
+  std::optional<price_type> next_above(price_type price) const
+  {
+    auto i = npos;
+    if (price < _base) { i = first_from(0); }
+    else if (price < last())
+    {
+      i = first_from(index(price) + 1);
+    }
+
+    // The window only moves once empty, so tree levels may lie on both sides of it and are compared with the window one
+    if (!_far.empty())
+    {
+      const auto far = _far.upper_bound(price);
+      if (far != _far.end() && (i == npos || far->first < price_at(i))) { return far->first; }
+    }
+
+    if (i == npos) { return std::nullopt; }
+    return price_at(i);
+  }
+
+  // Closest non-empty level strictly below the price
+  std::optional<price_type> next_below(price_type price) const
+  {
+    auto i = npos;
+    if (price > last()) { i = last_to(_levels.size() - 1); }
+    else if (price > _base)
+    {
+      i = last_to(index(price) - 1);
+    }
+
+    if (!_far.empty())
+    {
+      if (auto far = _far.lower_bound(price); far != _far.begin() && (i == npos || std::prev(far)->first > price_at(i)))
+      {
+        return std::prev(far)->first;
+      }
+    }
+
+    if (i == npos) { return std::nullopt; }
+    return price_at(i);
+  }
+
+private:
+  static constexpr std::size_t npos{ SIZE_MAX };
+  static constexpr std::uint64_t all_bits{ ~std::uint64_t{} };
+
+  price_type window_size() const { return static_cast<price_type>(_levels.size()); }
+  // Highest price of the window, the window never extends past the prices representable
+  price_type last() const { return _base + (window_size() - 1); }
+  bool in_window(price_type price) const { return price >= _base && price <= last(); }
+  std::size_t index(price_type price) const { return static_cast<std::size_t>(price - _base); }
+  price_type price_at(std::size_t i) const { return _base + static_cast<price_type>(i); }
+
+  bool test(std::size_t i) const { return (_occupied[i / 64] & (std::uint64_t{ 1 } << (i % 64))) != 0U; }
+
+  void set(std::size_t i)
+  {
+    const auto word = i / 64;
+    _occupied[word] |= std::uint64_t{ 1 } << (i % 64);
+    _summary[word / 64] |= std::uint64_t{ 1 } << (word % 64);
+  }
+
+  void clear(std::size_t i)
+  {
+    const auto word = i / 64;
+    _occupied[word] &= ~(std::uint64_t{ 1 } << (i % 64));
+    if (_occupied[word] == 0) { _summary[word / 64] &= ~(std::uint64_t{ 1 } << (word % 64)); }
+  }
+
+  // First non-empty level of the window at or after i
+  std::size_t first_from(std::size_t i) const
+  {
+    if (i >= _levels.size()) { return npos; }
+
+    auto word = i / 64;
+    if (const auto bits = _occupied[word] & (all_bits << (i % 64)); bits != 0U)
+    {
+      return word * 64 + static_cast<std::size_t>(std::countr_zero(bits));
+    }
+
+    if (++word == _occupied.size()) { return npos; }
+
+    auto summary = word / 64;
+    auto bits = _summary[summary] & (all_bits << (word % 64));
+    while (bits == 0U)
+    {
+      if (++summary == _summary.size()) { return npos; }
+      bits = _summary[summary];
+    }
+
+    word = summary * 64 + static_cast<std::size_t>(std::countr_zero(bits));
+    return word * 64 + static_cast<std::size_t>(std::countr_zero(_occupied[word]));
+  }
+
+  // Last non-empty level of the window at or before i
+  std::size_t last_to(std::size_t i) const
+  {
+    auto word = i / 64;
+    if (const auto bits = _occupied[word] & (all_bits >> (63 - i % 64)); bits != 0U)
+    {
+      return word * 64 + 63 - static_cast<std::size_t>(std::countl_zero(bits));
+    }
+
+    if (word-- == 0) { return npos; }
+
+    auto summary = word / 64;
+    auto bits = _summary[summary] & (all_bits >> (63 - word % 64));
+    while (bits == 0U)
+    {
+      if (summary-- == 0) { return npos; }
+      bits = _summary[summary];
+    }
+
+    word = summary * 64 + 63 - static_cast<std::size_t>(std::countl_zero(bits));
+    return word * 64 + 63 - static_cast<std::size_t>(std::countl_zero(_occupied[word]));
+  }
+
+  // Only called while the window is empty, the levels of the tree which fall in the new window move to it
+  void recenter(price_type center)
+  {
+    const auto half = window_size() / 2;
+    constexpr auto lowest_base = std::numeric_limits<price_type>::min();
+    const auto highest_base = std::numeric_limits<price_type>::max() - (window_size() - 1);
+    _base = center < lowest_base + half ? lowest_base : std::min(center - half, highest_base);
+    for (auto it = _far.lower_bound(_base); it != _far.end() && in_window(it->first); it = _far.erase(it))
+    {
+      const auto i = index(it->first);
+      _levels[i] = std::move(it->second);
+      set(i);
+      ++_count;
+    }
+  }
+
+  std::vector<Level> _levels;
+  std::vector<std::uint64_t> _occupied;
+  std::vector<std::uint64_t> _summary;
+  price_type _base{};
+  std::size_t _count{};
+  std::map<price_type, Level> _far;
+};
+
+}
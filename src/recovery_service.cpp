@@ -0,0 +1,160 @@
+#include "recovery_service.h"
+#include "epoll_impl.h"
+#include "multicast_feed.h"
+#include "socket_impl.h"
+#include <array>
+#include <charconv>
+#include <spdlog/spdlog.h>
+#include <sys/epoll.h>
+
+namespace exchange_server {
+
+namespace {
+  constexpr std::string_view snapshot_message{ "snapshot" };
+  constexpr std::string_view replay_prefix{ "replay" };
+  constexpr std::string_view reject_message{ "rejected\n" };
+}
+
+recovery_service::recovery_service(std::shared_ptr<listen_socket_interface> listener,
+  std::shared_ptr<epoll_interface> epoll,
+  std::shared_ptr<socket_interface> control,
+  std::shared_ptr<multicast_feed> feed,
+  std::size_t max_write_buffer)
+  : _listener{ std::move(listener) }, _epoll{ std::move(epoll) }, _control{ std::move(control) },
+    _feed{ std::move(feed) }, _max_write_buffer{ max_write_buffer }
+{}
+
+void recovery_service::run()
+{
+  _epoll->add(_listener->get_fd(), EPOLLIN);
+  _epoll->add(_control->get_fd(), EPOLLIN);
+
+  for (;;)
+  {
+    const auto events = _epoll->wait();
+    for (const auto &evt : events)
+    {
+      if (evt.data.fd == _control->get_fd()) { return; }
+      else if (evt.data.fd == _listener->get_fd())
+      {
+        on_connect();
+      }
+      else if ((evt.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0U)
+      {
+        on_read(evt.data.fd);
+      }
+      else if ((evt.events & EPOLLOUT) != 0U)
+      {
+        on_write(evt.data.fd);
+      }
+    }
+
+    if (events.empty()) { break; }
+  }
+}
+
+void recovery_service::on_connect()
+{
+  auto [sock, err] = _listener->accept();
+  if (sock)
+  {
+    const auto fd = sock->get_fd();
+    _epoll->add(fd, EPOLLIN);
+    _connections[fd] = connection{ .sock = std::move(sock) };
+  }
+}
+
+void recovery_service::on_read(int fd)
+{
+  const auto it = _connections.find(fd);
+  if (it == _connections.end()) { return; }
+
+  auto &connection = it->second;
+
+  std::array<char, max_request_size> buffer{};
+  auto [bytes_read, err] = connection.sock->read(buffer);
+  if (err == std::errc::resource_unavailable_try_again || err == std::errc::operation_would_block) { return; }
+  if (err || bytes_read == 0)
+  {
+    _connections.erase(it);
+    return;
+  }
+
+  connection.read_buffer.append(buffer.data(), static_cast<std::size_t>(bytes_read));
+  for (auto end = connection.read_buffer.find('\n'); end != std::string::npos; end = connection.read_buffer.find('\n'))
+  {
+    const auto request = connection.read_buffer.substr(0, end);
+    connection.read_buffer.erase(0, end + 1);
+    if (!on_request(request, connection))
+    {
+      _connections.erase(it);
+      return;
+    }
+  }
+
+  if (connection.read_buffer.size() > max_request_size)
+  {
+    spdlog::error("Recovery request too long, disconnecting");
+    _connections.erase(it);
+  }
+}
+
+void recovery_service::on_write(int fd)
+{
+  const auto it = _connections.find(fd);
+  if (it == _connections.end()) { return; }
+
+  if (!send(it->second, "")) { _connections.erase(it); }
+}
+
+bool recovery_service::on_request(std::string_view request, connection &connection)
+{
+  if (request.ends_with('\r')) { request.remove_suffix(1); }
+
+  if (request == snapshot_message) { return send(connection, _feed->snapshot()); }
+
+  std::uint64_t first{};
+  if (request.starts_with(replay_prefix))
+  {
+    const auto sequence = request.substr(replay_prefix.size());
+    if (const auto [end, err] = std::from_chars(sequence.data(), sequence.data() + sequence.size(), first);
+        err == std::errc{} && end == sequence.data() + sequence.size())
+    {
+      if (auto [messages, replay_err] = _feed->replay(first); !replay_err) { return send(connection, messages); }
+    }
+  }
+
+  spdlog::error("Rejecting recovery request \"{}\"", request);
+  return send(connection, reject_message);
+}
+
+bool recovery_service::send(connection &connection, std::string_view message)
+{
+  const auto was_pending = !connection.write_buffer.empty();
+  connection.write_buffer += message;
+
+  auto [bytes_written, err] = connection.sock->write(connection.write_buffer);
+  if (err && err != std::errc::resource_unavailable_try_again && err != std::errc::operation_would_block)
+  {
+    return false;
+  }
+
+  if (!err) { connection.write_buffer.erase(0, static_cast<std::size_t>(bytes_written)); }
+
+  // Requests keep coming from a subscriber which does not read the answers
+  if (connection.write_buffer.size() > _max_write_buffer)
+  {
+    spdlog::error("Recovery subscriber left {} bytes unread, disconnecting", connection.write_buffer.size());
+    return false;
+  }
+
+  // Large replays are sent as the subscriber reads them
+  if (const auto pending = !connection.write_buffer.empty(); pending != was_pending)
+  {
+    _epoll->modify(connection.sock->get_fd(), pending ? EPOLLIN | EPOLLOUT : EPOLLIN);
+  }
+
+  return true;
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace exchange_server {
+
+class listen_socket_interface;
+class epoll_interface;
+class socket_interface;
+class multicast_feed;
+
+// TCP service of the multicast subscribers which missed datagrams, requests are lines:
+//   snapshot            answered with multicast_feed::snapshot
+//   replay<sequence>    answered with multicast_feed::replay, or rejected once the messages are no longer retained
+// Subscribers leaving more than max_write_buffer bytes of answers unread are disconnected.
+class recovery_service
+{
+public:
+  explicit recovery_service(std::shared_ptr<listen_socket_interface> listener,
+    std::shared_ptr<epoll_interface> epoll,
+    std::shared_ptr<socket_interface> control,
+    std::shared_ptr<multicast_feed> feed,
+    std::size_t max_write_buffer = default_max_write_buffer);
+
+  static constexpr std::size_t default_max_write_buffer{ 64U << 20U };
+
+  // Until anything is written to the control socket
+  void run();
+
+private:
+  struct connection
+  {
+    std::shared_ptr<socket_interface> sock;
+    std::string read_buffer;
+    std::string write_buffer;
+  };
+
+  void on_connect();
+  void on_read(int fd);
+  void on_write(int fd);
+  // False when the connection failed
+  bool on_request(std::string_view request, connection &connection);
+  // False when the connection failed
+  bool send(connection &connection, std::string_view message);
+
+  static constexpr std::size_t max_request_size{ 64 };
+
+  std::shared_ptr<listen_socket_interface> _listener;
+  std::shared_ptr<epoll_interface> _epoll;
+  std::shared_ptr<socket_interface> _control;
+  std::shared_ptr<multicast_feed> _feed;
+  std::size_t _max_write_buffer;
+
+  std::unordered_map<int, connection> _connections;
+};
+
+}
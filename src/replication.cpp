@@ -0,0 +1,778 @@
+#include "replication.h"
+#include "epoll_impl.h"
+#include "socket_impl.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <iterator>
+#include <optional>
+#include <spdlog/spdlog.h>
+#include <sys/epoll.h>
+
+namespace exchange_server {
+
+namespace {
+  constexpr std::size_t sequence_size{ 12 };
+  constexpr std::size_t id_size_size{ 2 };
+  constexpr std::size_t symbol_size{ 8 };
+  constexpr std::size_t number_size{ 12 };
+  constexpr std::size_t owner_size{ 20 };
+  constexpr std::size_t count_size{ 4 };
+  constexpr std::string_view ack_prefix{ "ack" };
+  constexpr std::string_view auction_record{ "V" };
+
+  char type_code(order_type type)
+  {
+    switch (type)
+    {
+    case order_type::market:
+      return 'M';
+    case order_type::post_only:
+      return 'P';
+    default:
+      return 'L';
+    }
+  }
+
+  char time_in_force_code(time_in_force tif)
+  {
+    switch (tif)
+    {
+    case time_in_force::immediate_or_cancel:
+      return 'I';
+    case time_in_force::fill_or_kill:
+      return 'F';
+    default:
+      return 'D';
+    }
+  }
+
+  // Removes the first size characters of the record
+  std::optional<std::string_view> take(std::string_view &record, std::size_t size)
+  {
+    if (record.size() < size) { return std::nullopt; }
+
+    const auto field = record.substr(0, size);
+    record.remove_prefix(size);
+    return field;
+  }
+
+  template<class T> std::optional<T> take_number(std::string_view &record, std::size_t size)
+  {
+    const auto field = take(record, size);
+    if (!field) { return std::nullopt; }
+
+    T value{};
+    const auto *const end = field->data() + field->size();
+    if (const auto [ptr, err] = std::from_chars(field->data(), end, value); err != std::errc{} || ptr != end)
+    {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+  // Nobody is told about the executions of a follower, it only keeps its books like the leader's
+  void ignore_fill(const fill & /*fill*/) {}
+
+  // Sequence number of the record before the line starting at offset
+  std::uint64_t previous_sequence(std::string_view lines, std::size_t offset)
+  {
+    const auto next = lines.substr(offset, sequence_size);
+    std::uint64_t sequence{};
+    std::from_chars(next.data(), next.data() + next.size(), sequence);
+    return sequence - 1;
+  }
+
+  // Sequence number of the last record written whole when only part of the buffer was, the buffer holding whole lines
+  std::uint64_t last_written(std::string_view buffer, std::size_t written, std::uint64_t previous)
+  {
+    const auto end = buffer.substr(0, written).rfind('\n');
+    if (end == std::string_view::npos) { return previous; }
+
+    // The record after it was not written whole
+    return previous_sequence(buffer, end + 1);
+  }
+}
+
+void append_journal_order(std::string &record, const order &order)
+{
+  fmt::format_to(std::back_inserter(record),
+    "{:0>2}{}{: >8}{}{:0>12}{:0>12.0f}{}{}{:0>20}",
+    order.id.size(),
+    order.id,
+    order.symbol,
+    order.way == order_side::buy ? '+' : '-',
+    order.quantity,
+    order.price,
+    type_code(order.type),
+    time_in_force_code(order.tif),
+    order.owner);
+}
+
+std::optional<order> take_journal_order(std::string_view &record)
+{
+  const auto id_size = take_number<std::size_t>(record, id_size_size);
+  if (!id_size) { return std::nullopt; }
+
+  const auto id = take(record, *id_size);
+  const auto symbol = take(record, symbol_size);
+  const auto side = take(record, 1);
+  const auto quantity = take_number<std::uint64_t>(record, number_size);
+  const auto price = take_number<std::uint64_t>(record, number_size);
+  const auto type = take(record, 1);
+  const auto tif = take(record, 1);
+  const auto owner = take_number<std::uint64_t>(record, owner_size);
+  if (!id || !symbol || !side || !quantity || !price || !type || !tif || !owner) { return std::nullopt; }
+  if (*side != "+" && *side != "-") { return std::nullopt; }
+
+  order parsed{ .id = std::string{ *id },
+    .symbol = std::string{ *symbol },
+    .way = *side == "+" ? order_side::buy : order_side::sell,
+    .quantity = *quantity,
+    .price = static_cast<double>(*price),
+    .owner = *owner };
+  switch (type->front())
+  {
+  case 'L':
+    break;
+  case 'M':
+    parsed.type = order_type::market;
+    break;
+  case 'P':
+    parsed.type = order_type::post_only;
+    break;
+  default:
+    return std::nullopt;
+  }
+  switch (tif->front())
+  {
+  case 'D':
+    break;
+  case 'I':
+    parsed.tif = time_in_force::immediate_or_cancel;
+    break;
+  case 'F':
+    parsed.tif = time_in_force::fill_or_kill;
+    break;
+  default:
+    return std::nullopt;
+  }
+
+  return parsed;
+}
+
+bool apply_journal_record(std::string_view record, market &market, std::uint64_t &last_owner)
+{
+  const auto kind = take(record, 1);
+  if (!kind) { return false; }
+
+  switch (kind->front())
+  {
+  case 'A':
+  case 'U': {
+    const auto order = take_journal_order(record);
+    if (!order || !record.empty()) { return false; }
+
+    last_owner = std::max(last_owner, order->owner);
+    if (*kind == "A") { market.add_order(*order, ignore_fill); }
+    else
+    {
+      market.update_order(*order);
+    }
+    return true;
+  }
+  case 'C':
+    market.cancel_order(std::string{ record });
+    return true;
+  case 'X': {
+    const auto owner = take_number<std::uint64_t>(record, owner_size);
+    const auto side = take(record, 1);
+    if (!owner || !side) { return false; }
+
+    cancel_filter filter{ .symbol = std::string{ record } };
+    if (*side == "+") { filter.side = order_side::buy; }
+    else if (*side == "-")
+    {
+      filter.side = order_side::sell;
+    }
+    else if (*side != "*")
+    {
+      return false;
+    }
+    market.cancel_all(*owner, filter);
+    return true;
+  }
+  case 'Q': {
+    const auto count = take_number<std::size_t>(record, count_size);
+    if (!count) { return false; }
+
+    std::vector<quote_entry> entries;
+    for (std::size_t i = 0; i < *count; ++i)
+    {
+      const auto replace = take(record, 1);
+      const auto order = replace ? take_journal_order(record) : std::nullopt;
+      if (!order || (*replace != "N" && *replace != "R")) { return false; }
+
+      last_owner = std::max(last_owner, order->owner);
+      entries.push_back({ .order = *order, .replace = *replace == "R", .callback = ignore_fill });
+    }
+    if (!record.empty()) { return false; }
+
+    market.mass_quote(std::move(entries));
+    return true;
+  }
+  case 'S': {
+    const auto count = take_number<std::size_t>(record, number_size);
+    if (!count) { return false; }
+
+    std::vector<order> orders;
+    for (std::size_t i = 0; i < *count; ++i)
+    {
+      auto order = take_journal_order(record);
+      if (!order) { return false; }
+
+      last_owner = std::max(last_owner, order->owner);
+      orders.push_back(std::move(*order));
+    }
+    if (!record.empty()) { return false; }
+
+    // Resting orders do not cross, added by priority they rest as they did
+    for (const auto &order : orders) { market.add_order(order, ignore_fill); }
+    return true;
+  }
+  case 'V':
+    if (!record.empty()) { return false; }
+
+    market.uncross();
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::string snapshot_record(market &market)
+{
+  const auto orders = market.resting_orders();
+  auto record = fmt::format("S{:0>12}", orders.size());
+  for (const auto &order : orders) { append_journal_order(record, order); }
+  return record;
+}
+
+journal::journal(std::shared_ptr<socket_interface> doorbell, std::size_t quorum, std::size_t max_size)
+  : _doorbell{ std::move(doorbell) }, _quorum{ quorum }, _max_size{ max_size }
+{}
+
+std::uint64_t journal::append(std::string_view record)
+{
+  std::uint64_t sequence{};
+  bool ring{};
+  {
+    std::scoped_lock l{ _mutex };
+    sequence = ++_position;
+    fmt::format_to(std::back_inserter(_lines), "{:0>12}{}\n", sequence, record);
+    ring = !std::exchange(_doorbell_rung, true);
+  }
+
+  // Records appended until the journal is read again are sent along with this one
+  if (ring && _doorbell)
+  {
+    constexpr std::array<char, 1> bell{ 1 };
+    _doorbell->write(bell);
+  }
+
+  return sequence;
+}
+
+std::uint64_t journal::position() const
+{
+  std::scoped_lock l{ _mutex };
+  return _position;
+}
+
+bool journal::read(cursor &cursor, std::string &out, std::size_t limit)
+{
+  std::scoped_lock l{ _mutex };
+  _doorbell_rung = false;
+
+  auto offset = cursor.offset.value_or(_lines_offset);
+  if (!cursor.offset && !_snapshot.empty())
+  {
+    out.append(_snapshot);
+    offset = _last_snapshot.offset;
+  }
+  if (offset < _lines_offset) { return false; }
+
+  const auto begin = offset - _lines_offset;
+  auto end = _lines.size();
+  auto position = _position;
+  if (limit > 0 && end - begin > limit)
+  {
+    auto last = _lines.rfind('\n', begin + limit - 1);
+    if (last == std::string::npos || last < begin) { last = _lines.find('\n', begin); }
+    end = last + 1;
+    if (end < _lines.size()) { position = previous_sequence(_lines, end); }
+  }
+
+  out.append(_lines, begin, end - begin);
+  cursor = { .offset = _lines_offset + end, .position = position };
+  return true;
+}
+
+bool journal::needs_snapshot() const
+{
+  std::scoped_lock l{ _mutex };
+  return _lines_offset + _lines.size() - _last_snapshot.offset > _max_size;
+}
+
+void journal::snapshot(std::string_view record)
+{
+  std::scoped_lock l{ _mutex };
+  _snapshot.clear();
+  fmt::format_to(std::back_inserter(_snapshot), "{:0>12}{}\n", _position, record);
+  _previous_snapshot =
+    std::exchange(_last_snapshot, snapshot_point{ .position = _position, .offset = _lines_offset + _lines.size() });
+  truncate();
+}
+
+void journal::restore(std::uint64_t position, std::string_view record)
+{
+  std::scoped_lock l{ _mutex };
+  _position = position;
+  _snapshot.clear();
+  fmt::format_to(std::back_inserter(_snapshot), "{:0>12}{}\n", _position, record);
+  _lines_offset += _lines.size();
+  _lines.clear();
+  _last_snapshot = _previous_snapshot = snapshot_point{ .position = _position, .offset = _lines_offset };
+}
+
+void journal::release(std::uint64_t position)
+{
+  std::scoped_lock l{ _mutex };
+  _released = position;
+  truncate();
+}
+
+void journal::truncate()
+{
+  const auto &kept = _released >= _last_snapshot.position ? _last_snapshot : _previous_snapshot;
+  if (kept.offset <= _lines_offset) { return; }
+
+  _lines.erase(0, kept.offset - _lines_offset);
+  _lines_offset = kept.offset;
+}
+
+std::uint64_t journal::replicated() const
+{
+  // Without a quorum to wait for, whatever is journaled counts as replicated
+  if (_quorum == 0) { return UINT64_MAX; }
+
+  return _replicated.load(std::memory_order_acquire);
+}
+
+void journal::when_replicated(std::uint64_t position, std::function<void()> f)
+{
+  {
+    std::scoped_lock l{ _waiters_mutex };
+    if (replicated() < position)
+    {
+      _waiters.emplace(position, std::move(f));
+      return;
+    }
+  }
+
+  f();
+}
+
+void journal::on_replicated(std::uint64_t position)
+{
+  std::vector<std::function<void()>> ready;
+  {
+    std::scoped_lock l{ _waiters_mutex };
+    _replicated.store(position, std::memory_order_release);
+
+    const auto end = _waiters.upper_bound(position);
+    for (auto it = _waiters.begin(); it != end; ++it) { ready.push_back(std::move(it->second)); }
+    _waiters.erase(_waiters.begin(), end);
+  }
+
+  for (const auto &f : ready) { f(); }
+}
+
+journaled_market::journaled_market(std::shared_ptr<market> market, std::shared_ptr<journal> journal)
+  : _market{ std::move(market) }, _journal{ std::move(journal) }
+{}
+
+order_result journaled_market::add_order(const order &order, std::function<void(const fill &)> callback)
+{
+  std::string record{ "A" };
+  append_journal_order(record, order);
+
+  std::scoped_lock l{ _mutex };
+  append(record);
+  return _market->add_order(order, std::move(callback));
+}
+
+bool journaled_market::update_order(const order &order)
+{
+  std::string record{ "U" };
+  append_journal_order(record, order);
+
+  std::scoped_lock l{ _mutex };
+  append(record);
+  return _market->update_order(order);
+}
+
+bool journaled_market::cancel_order(const std::string &id)
+{
+  const auto record = "C" + id;
+
+  std::scoped_lock l{ _mutex };
+  append(record);
+  return _market->cancel_order(id);
+}
+
+std::vector<std::string> journaled_market::cancel_all(std::uint64_t owner, const cancel_filter &filter)
+{
+  const auto side = filter.side ? (*filter.side == order_side::buy ? '+' : '-') : '*';
+  const auto record = fmt::format("X{:0>20}{}{}", owner, side, filter.symbol);
+
+  std::scoped_lock l{ _mutex };
+  append(record);
+  return _market->cancel_all(owner, filter);
+}
+
+std::vector<order_result> journaled_market::mass_quote(std::vector<quote_entry> entries)
+{
+  auto record = fmt::format("Q{:0>4}", entries.size());
+  for (const auto &entry : entries)
+  {
+    record.push_back(entry.replace ? 'R' : 'N');
+    append_journal_order(record, entry.order);
+  }
+
+  std::scoped_lock l{ _mutex };
+  append(record);
+  return _market->mass_quote(std::move(entries));
+}
+
+void journaled_market::run()
+{
+  _market->run([this] {
+    std::scoped_lock l{ _mutex };
+    append(auction_record);
+    _market->uncross();
+  });
+}
+
+void journaled_market::stop() { _market->stop(); }
+
+void journaled_market::append(std::string_view record)
+{
+  // The market is as of the last record appended until this one is applied
+  if (_journal->needs_snapshot()) { _journal->snapshot(snapshot_record(*_market)); }
+  _journal->append(record);
+}
+
+replication_service::replication_service(std::shared_ptr<listen_socket_interface> listener,
+  std::shared_ptr<epoll_interface> epoll,
+  std::shared_ptr<socket_interface> control,
+  std::shared_ptr<socket_interface> doorbell,
+  std::shared_ptr<journal> journal,
+  std::size_t max_backlog)
+  : _listener{ std::move(listener) }, _epoll{ std::move(epoll) }, _control{ std::move(control) },
+    _doorbell{ std::move(doorbell) }, _journal{ std::move(journal) }, _max_backlog{ max_backlog }
+{}
+
+void replication_service::run()
+{
+  _epoll->add(_listener->get_fd(), EPOLLIN);
+  _epoll->add(_control->get_fd(), EPOLLIN);
+  _epoll->add(_doorbell->get_fd(), EPOLLIN);
+  update_quorum();
+
+  for (;;)
+  {
+    const auto events = _epoll->wait();
+    for (const auto &evt : events)
+    {
+      if (evt.data.fd == _control->get_fd()) { return; }
+      else if (evt.data.fd == _listener->get_fd())
+      {
+        on_connect();
+      }
+      else if (evt.data.fd == _doorbell->get_fd())
+      {
+        on_doorbell();
+      }
+      else if ((evt.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0U)
+      {
+        on_read(evt.data.fd);
+      }
+      else if ((evt.events & EPOLLOUT) != 0U)
+      {
+        on_write(evt.data.fd);
+      }
+    }
+    update_released();
+    update_quorum();
+
+    if (events.empty()) { break; }
+  }
+}
+
+void replication_service::on_connect()
+{
+  auto [sock, err] = _listener->accept();
+  if (!sock) { return; }
+
+  const auto fd = sock->get_fd();
+  _epoll->add(fd, EPOLLIN);
+  auto &follower = _followers[fd] = replication_service::follower{ .sock = std::move(sock) };
+  spdlog::info("Follower connected, replicating {} journaled records", _journal->position());
+
+  // Before it is sent anything, so that the journal keeps what follows
+  update_released();
+  if (!send(follower)) { _followers.erase(fd); }
+}
+
+void replication_service::on_doorbell()
+{
+  // Drained before reading the journal, so that the records appended meanwhile ring it again
+  std::array<char, 64> rings{};
+  _doorbell->read(rings);
+
+  for (auto it = _followers.begin(); it != _followers.end();)
+  {
+    if (send(it->second)) { ++it; }
+    else
+    {
+      spdlog::warn("Lost follower at sequence {}", it->second.acknowledged);
+      it = _followers.erase(it);
+    }
+  }
+}
+
+void replication_service::on_read(int fd)
+{
+  const auto it = _followers.find(fd);
+  if (it == _followers.end()) { return; }
+
+  auto &follower = it->second;
+
+  std::array<char, max_ack_size> buffer{};
+  auto [bytes_read, err] = follower.sock->read(buffer);
+  if (err == std::errc::resource_unavailable_try_again || err == std::errc::operation_would_block) { return; }
+  if (err || bytes_read == 0)
+  {
+    spdlog::warn("Lost follower at sequence {}", follower.acknowledged);
+    _followers.erase(it);
+    return;
+  }
+
+  follower.read_buffer.append(buffer.data(), static_cast<std::size_t>(bytes_read));
+  for (auto end = follower.read_buffer.find('\n'); end != std::string::npos; end = follower.read_buffer.find('\n'))
+  {
+    auto ack = std::string_view{ follower.read_buffer }.substr(0, end);
+    std::uint64_t sequence{};
+    if (!ack.starts_with(ack_prefix)
+        || std::from_chars(ack.data() + ack_prefix.size(), ack.data() + ack.size(), sequence).ec != std::errc{})
+    {
+      spdlog::error("Invalid acknowledgement \"{}\" from follower, disconnecting", ack);
+      _followers.erase(it);
+      return;
+    }
+
+    if (sequence > follower.sent)
+    {
+      spdlog::error("Acknowledgement of {} from follower sent up to {}, disconnecting", sequence, follower.sent);
+      _followers.erase(it);
+      return;
+    }
+
+    follower.acknowledged = std::max(follower.acknowledged, sequence);
+    follower.read_buffer.erase(0, end + 1);
+  }
+
+  if (follower.read_buffer.size() > max_ack_size)
+  {
+    spdlog::error("Acknowledgement from follower too long, disconnecting");
+    _followers.erase(it);
+    return;
+  }
+
+  update_replicated();
+}
+
+void replication_service::on_write(int fd)
+{
+  const auto it = _followers.find(fd);
+  if (it == _followers.end()) { return; }
+
+  if (!send(it->second)) { _followers.erase(it); }
+}
+
+bool replication_service::send(follower &follower)
+{
+  const auto was_pending = !follower.write_buffer.empty();
+  // A follower slower than the market is sent what it takes, until the journal dropped what it did not read yet
+  if (follower.write_buffer.size() < _max_backlog
+      && !_journal->read(follower.cursor, follower.write_buffer, _max_backlog - follower.write_buffer.size()))
+  {
+    spdlog::warn("Follower at sequence {} fell behind the journal", follower.acknowledged);
+    return false;
+  }
+  if (follower.write_buffer.empty()) { return true; }
+
+  auto [bytes_written, err] = follower.sock->write(follower.write_buffer);
+  if (err && err != std::errc::resource_unavailable_try_again && err != std::errc::operation_would_block)
+  {
+    return false;
+  }
+
+  if (!err)
+  {
+    const auto written = static_cast<std::size_t>(bytes_written);
+    follower.sent = written == follower.write_buffer.size()
+                      ? follower.cursor.position
+                      : last_written(follower.write_buffer, written, follower.sent);
+    follower.write_buffer.erase(0, written);
+  }
+
+  // A follower catching up is sent the rest as it reads it
+  if (const auto pending = !follower.write_buffer.empty(); pending != was_pending)
+  {
+    _epoll->modify(follower.sock->get_fd(), pending ? EPOLLIN | EPOLLOUT : EPOLLIN);
+  }
+
+  return true;
+}
+
+void replication_service::update_replicated()
+{
+  const auto quorum = _journal->quorum();
+  if (quorum == 0 || _followers.size() < quorum) { return; }
+
+  // What the quorum-th most advanced follower applied, the others applied at least as much
+  std::vector<std::uint64_t> acknowledged;
+  acknowledged.reserve(_followers.size());
+  for (const auto &[fd, follower] : _followers) { acknowledged.push_back(follower.acknowledged); }
+  const auto nth = acknowledged.begin() + static_cast<std::ptrdiff_t>(quorum - 1);
+  std::nth_element(acknowledged.begin(), nth, acknowledged.end(), std::greater<>{});
+
+  if (*nth > _journal->replicated()) { _journal->on_replicated(*nth); }
+}
+
+void replication_service::update_released()
+{
+  auto released = UINT64_MAX;
+  for (const auto &[fd, follower] : _followers) { released = std::min(released, follower.acknowledged); }
+  _journal->release(released);
+}
+
+void replication_service::update_quorum()
+{
+  const auto quorum = _journal->quorum();
+  const auto connected = _followers.size() >= quorum;
+  if (connected == std::exchange(_quorum_connected, connected)) { return; }
+
+  if (connected) { spdlog::info("{} followers connected, orders are acknowledged again", _followers.size()); }
+  else
+  {
+    spdlog::warn("{} followers connected for a quorum of {}, orders are not acknowledged until more connect",
+      _followers.size(),
+      quorum);
+  }
+}
+
+replication_follower::replication_follower(std::shared_ptr<socket_interface> leader,
+  std::shared_ptr<epoll_interface> epoll,
+  std::shared_ptr<socket_interface> control,
+  std::shared_ptr<market> market,
+  std::shared_ptr<journal> journal)
+  : _leader{ std::move(leader) }, _epoll{ std::move(epoll) }, _control{ std::move(control) },
+    _market{ std::move(market) }, _journal{ std::move(journal) }
+{}
+
+std::error_code replication_follower::run()
+{
+  _epoll->add(_leader->get_fd(), EPOLLIN);
+  _epoll->add(_control->get_fd(), EPOLLIN);
+
+  for (;;)
+  {
+    const auto events = _epoll->wait();
+    for (const auto &evt : events)
+    {
+      if (evt.data.fd == _control->get_fd()) { return {}; }
+
+      auto [connected, err] = on_read();
+      if (err) { return err; }
+      if (!connected)
+      {
+        spdlog::warn("Lost the leader at sequence {}", _position);
+        return {};
+      }
+    }
+
+    if (events.empty()) { break; }
+  }
+
+  return {};
+}
+
+result<bool> replication_follower::on_read()
+{
+  std::array<char, 16 * 1024> buffer{};
+  auto [bytes_read, err] = _leader->read(buffer);
+  if (err == std::errc::resource_unavailable_try_again || err == std::errc::operation_would_block)
+  {
+    return { .result = true };
+  }
+  if (err || bytes_read == 0) { return { .result = false }; }
+
+  _read_buffer.append(buffer.data(), static_cast<std::size_t>(bytes_read));
+
+  // Whatever arrived is applied, then acknowledged at once
+  const auto previous = _position;
+  std::size_t begin{};
+  for (auto end = _read_buffer.find('\n'); end != std::string::npos; end = _read_buffer.find('\n', begin))
+  {
+    const auto line = std::string_view{ _read_buffer }.substr(begin, end - begin);
+    std::uint64_t sequence{};
+    const auto *const sequence_end = line.data() + std::min(line.size(), sequence_size);
+    const auto [ptr, parse_err] = std::from_chars(line.data(), sequence_end, sequence);
+    const auto record = line.substr(std::min(line.size(), sequence_size));
+    // A follower starting from nothing may be sent a snapshot in place of the records up to it
+    const auto snapshot = record.starts_with('S');
+    if (line.size() < sequence_size || parse_err != std::errc{} || ptr != sequence_end
+        || (snapshot ? _position != 0 : sequence != _position + 1)
+        || !apply_journal_record(record, *_market, _last_owner))
+    {
+      spdlog::error("Invalid journal record \"{}\"", line);
+      return { .err = std::make_error_code(std::errc::bad_message) };
+    }
+
+    if (_journal && snapshot) { _journal->restore(sequence, record); }
+    else if (_journal)
+    {
+      _journal->append(record);
+    }
+    _position = sequence;
+    begin = end + 1;
+  }
+  _read_buffer.erase(0, begin);
+  if (_journal && _journal->needs_snapshot()) { _journal->snapshot(snapshot_record(*_market)); }
+
+  if (_position != previous) { acknowledge(); }
+  return { .result = true };
+}
+
+void replication_follower::acknowledge()
+{
+  // Acknowledgements are cumulative, one which could not be sent yet goes with the next
+  fmt::format_to(std::back_inserter(_write_buffer), "{}{:0>12}\n", ack_prefix, _position);
+  auto [bytes_written, err] = _leader->write(_write_buffer);
+  if (!err) { _write_buffer.erase(0, static_cast<std::size_t>(bytes_written)); }
+}
+
+}
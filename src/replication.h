@@ -0,0 +1,250 @@
+#pragma once
+
+#include "market.h"
+#include "result.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace exchange_server {
+
+class listen_socket_interface;
+class epoll_interface;
+class socket_interface;
+
+// The journal is a stream of lines <sequence(12)><record>, sequence numbers starting at 1. Records are the operations
+// of the market interface, with orders encoded as
+//   <id size(2)><id><symbol(8)><+/-><quantity(12)><price(12)><type (L/M/P)><time in force (D/I/F)><owner(20)>
+//   A<order>                            add_order
+//   U<order>                            update_order
+//   C<id>                               cancel_order
+//   X<owner(20)><side (+/-/*)><symbol>  cancel_all, the symbol being empty for any
+//   Q<count(4)><(N/R)<order>...>        mass_quote, new or replacing orders
+//   V                                   auction
+//   S<count(12)><order>...              snapshot of the resting orders by priority, which a follower starting from
+//                                       nothing replaces the records up to its sequence with
+// Followers acknowledge what they applied with ack<sequence(12)>\n, acknowledgements being cumulative.
+
+// Order encoding of the journal, also used to hand the market off to another process. Taking removes the order from
+// the start of the record, nothing if it is invalid.
+void append_journal_order(std::string &record, const order &order);
+std::optional<order> take_journal_order(std::string_view &record);
+
+// Applies a record to the market as the leader did, false if it is invalid. The owner of its orders is raised to the
+// largest one seen so far.
+bool apply_journal_record(std::string_view record, market &market, std::uint64_t &last_owner);
+
+// Snapshot record of the resting orders of the market
+std::string snapshot_record(market &market);
+
+// Operations applied to the market by the leader, and how far followers replicated them. Thread safe.
+// Only the last snapshot of the market and the records since the one before it are kept in memory, followers
+// connecting late replicate from the snapshot. Records up to the last snapshot are dropped once every follower
+// connected acknowledged them, those up to the one before regardless.
+class journal
+{
+public:
+  // A byte is written to the doorbell when records are appended while the previous ones were all read, the replication
+  // service reads the other end of the socket pair. Acknowledgements are awaited from quorum followers, none awaits
+  // nothing. A snapshot is due once max_size bytes of records were appended since the last one.
+  explicit journal(std::shared_ptr<socket_interface> doorbell = nullptr,
+    std::size_t quorum = 0,
+    std::size_t max_size = default_max_size);
+
+  static constexpr std::size_t default_max_size{ 64U << 20U };
+
+  // Returns the sequence number of the record
+  std::uint64_t append(std::string_view record);
+  std::uint64_t position() const;
+
+  // How far a reader read the journal
+  struct cursor
+  {
+    // Offset of the lines not read yet, none to start from the last snapshot
+    std::optional<std::size_t> offset;
+    // Sequence number of the last record read
+    std::uint64_t position{};
+  };
+  // Appends the lines the cursor did not read yet to out, whole ones past limit bytes only if there are no others,
+  // and moves it past them. False when the journal dropped them already.
+  bool read(cursor &cursor, std::string &out, std::size_t limit = SIZE_MAX);
+
+  // Whether a snapshot is due, then taking it: the market as of the last record appended
+  bool needs_snapshot() const;
+  void snapshot(std::string_view record);
+  // Starts an empty journal from a snapshot
+  void restore(std::uint64_t position, std::string_view record);
+  // Records the followers connected all acknowledged, none connected acknowledging everything
+  void release(std::uint64_t position);
+
+  std::size_t quorum() const { return _quorum; }
+  // Position acknowledged by the quorum
+  std::uint64_t replicated() const;
+  // Calls f once the quorum acknowledged the position: at once if it already did, otherwise from the thread reporting
+  // the acknowledgement
+  void when_replicated(std::uint64_t position, std::function<void()> f);
+  // Called by the replication service, positions only grow
+  void on_replicated(std::uint64_t position);
+
+private:
+  struct snapshot_point
+  {
+    std::uint64_t position{};
+    // Offset of the records after it
+    std::size_t offset{};
+  };
+
+  // Drops what neither new followers nor those connected need anymore
+  void truncate();
+
+  std::shared_ptr<socket_interface> _doorbell;
+  std::size_t _quorum;
+  std::size_t _max_size;
+
+  mutable std::mutex _mutex;
+  // Lines from _lines_offset, offsets counting from the first record ever appended
+  std::string _lines;
+  std::size_t _lines_offset{};
+  std::uint64_t _position{};
+  bool _doorbell_rung{ false };
+  // Line of the last snapshot
+  std::string _snapshot;
+  snapshot_point _last_snapshot;
+  snapshot_point _previous_snapshot;
+  std::uint64_t _released{ UINT64_MAX };
+
+  std::atomic<std::uint64_t> _replicated{};
+  std::mutex _waiters_mutex;
+  std::multimap<std::uint64_t, std::function<void()>> _waiters;
+};
+
+// Market journaling the operations applied to it, in the order it applies them, so that followers replicate it
+class journaled_market : public market_interface
+{
+public:
+  journaled_market(std::shared_ptr<market> market, std::shared_ptr<journal> journal);
+
+  order_result add_order(const order &order, std::function<void(const fill &)> callback) override;
+  bool update_order(const order &order) override;
+  bool cancel_order(const std::string &id) override;
+  std::vector<std::string> cancel_all(std::uint64_t owner, const cancel_filter &filter) override;
+  std::vector<order_result> mass_quote(std::vector<quote_entry> entries) override;
+
+  // Runs the auctions of the market through the journal, until stopped
+  void run();
+  void stop();
+
+private:
+  // With the mutex held, snapshots the market first when due
+  void append(std::string_view record);
+
+  std::shared_ptr<market> _market;
+  std::shared_ptr<journal> _journal;
+  // Records are appended and applied as one, so that their order is the order of the market
+  std::mutex _mutex;
+};
+
+// Leader side: streams the journal to the followers connecting to the listener and collects their acknowledgements.
+// Each wake up sends what was journaled meanwhile in a single write per follower, without waiting for acknowledgements
+// of what was sent before. No more than max_backlog bytes are read from the journal for a follower which did not take
+// them yet, one falling behind what the journal keeps is disconnected.
+class replication_service
+{
+public:
+  explicit replication_service(std::shared_ptr<listen_socket_interface> listener,
+    std::shared_ptr<epoll_interface> epoll,
+    std::shared_ptr<socket_interface> control,
+    std::shared_ptr<socket_interface> doorbell,
+    std::shared_ptr<journal> journal,
+    std::size_t max_backlog = default_max_backlog);
+
+  static constexpr std::size_t default_max_backlog{ 16U << 20U };
+
+  // Until anything is written to the control socket
+  void run();
+
+private:
+  struct follower
+  {
+    std::shared_ptr<socket_interface> sock;
+    std::string read_buffer;
+    std::string write_buffer;
+    // What was read into the write buffer
+    journal::cursor cursor;
+    // Sequence number of the last record written whole, the follower cannot acknowledge more
+    std::uint64_t sent{};
+    std::uint64_t acknowledged{};
+  };
+
+  void on_connect();
+  void on_doorbell();
+  void on_read(int fd);
+  void on_write(int fd);
+  // False when the connection failed
+  bool send(follower &follower);
+  void update_replicated();
+  // Tells the journal what the followers connected acknowledged
+  void update_released();
+  // Logs when too few followers are connected for the quorum, and when enough are again
+  void update_quorum();
+
+  static constexpr std::size_t max_ack_size{ 64 };
+
+  std::shared_ptr<listen_socket_interface> _listener;
+  std::shared_ptr<epoll_interface> _epoll;
+  std::shared_ptr<socket_interface> _control;
+  // Non-blocking, read end of the doorbell of the journal
+  std::shared_ptr<socket_interface> _doorbell;
+  std::shared_ptr<journal> _journal;
+  std::size_t _max_backlog;
+
+  std::unordered_map<int, follower> _followers;
+  bool _quorum_connected{ true };
+};
+
+// Follower side: applies the journal of the leader to its own market and acknowledges it, once per read. Records are
+// appended to the journal of the follower if it has one, snapshots of its market taken like the leader's, so that it
+// can serve its own followers once it takes over.
+class replication_follower
+{
+public:
+  explicit replication_follower(std::shared_ptr<socket_interface> leader,
+    std::shared_ptr<epoll_interface> epoll,
+    std::shared_ptr<socket_interface> control,
+    std::shared_ptr<market> market,
+    std::shared_ptr<journal> journal = nullptr);
+
+  // Until the connection to the leader is lost, then the follower may take over, or anything is written to the
+  // control socket. Fails on an invalid record.
+  std::error_code run();
+
+  // Sequence number of the last record applied
+  std::uint64_t position() const { return _position; }
+  // Largest owner of the orders applied, the sessions of a new leader must not reuse it
+  std::uint64_t last_owner() const { return _last_owner; }
+
+private:
+  // False once the leader is lost
+  result<bool> on_read();
+  void acknowledge();
+
+  std::shared_ptr<socket_interface> _leader;
+  std::shared_ptr<epoll_interface> _epoll;
+  std::shared_ptr<socket_interface> _control;
+  std::shared_ptr<market> _market;
+  std::shared_ptr<journal> _journal;
+
+  std::string _read_buffer;
+  std::string _write_buffer;
+  std::uint64_t _position{};
+  std::uint64_t _last_owner{};
+};
+
+}
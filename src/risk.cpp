@@ -0,0 +1,159 @@
+#include "risk.h"
+#include <istream>
+#include <sstream>
+
+namespace exchange_server {
+
+result<risk_limits> parse_risk_limits(std::istream &input)
+{
+  risk_limits limits;
+
+  for (std::string line; std::getline(input, line);)
+  {
+    std::istringstream iss{ line };
+    std::string name;
+    if (!(iss >> name) || name.starts_with('#')) { continue; }
+
+    const auto read = [&iss](auto &value) { return static_cast<bool>(iss >> value); };
+
+    bool valid{};
+    if (name == "max_order_quantity") { valid = read(limits.max_order_quantity); }
+    else if (name == "max_order_notional")
+    {
+      valid = read(limits.max_order_notional);
+    }
+    else if (name == "max_position")
+    {
+      valid = read(limits.max_position);
+    }
+    else if (name == "max_open_orders")
+    {
+      valid = read(limits.max_open_orders);
+    }
+
+    if (!valid) { return { .err = std::make_error_code(std::errc::invalid_argument) }; }
+  }
+
+  return { .result = limits };
+}
+
+risk_breach risk_cache::check_order(const order &order, const risk_limits &limits)
+{
+  if (limits.max_order_quantity != 0 && order.quantity > limits.max_order_quantity)
+  {
+    return risk_breach::order_quantity;
+  }
+
+  // Market orders sweep the book whatever their price, so their notional is not bounded
+  if (limits.max_order_notional != 0
+      && (order.type == order_type::market
+          || static_cast<double>(order.quantity) * order.price > limits.max_order_notional))
+  {
+    return risk_breach::order_notional;
+  }
+
+  return risk_breach::none;
+}
+
+risk_breach risk_cache::check_position(const order &order, std::uint64_t released, const risk_limits &limits) const
+{
+  if (limits.max_position == 0) { return risk_breach::none; }
+
+  exposure current;
+  if (const auto it = _exposures.find(order.symbol); it != _exposures.end()) { current = it->second; }
+
+  // Worst case, all open orders on the side of the new one get executed
+  const auto max_position = static_cast<std::int64_t>(limits.max_position);
+  const auto added = static_cast<std::int64_t>(order.quantity) - static_cast<std::int64_t>(released);
+  if (order.way == order_side::buy)
+  {
+    return current.position + static_cast<std::int64_t>(current.open_buy) + added > max_position
+             ? risk_breach::position
+             : risk_breach::none;
+  }
+
+  return current.position - static_cast<std::int64_t>(current.open_sell) - added < -max_position ? risk_breach::position
+                                                                                                  : risk_breach::none;
+}
+
+risk_breach risk_cache::check_new(const order &order, const risk_limits &limits) const
+{
+  if (const auto breach = check_order(order, limits); breach != risk_breach::none) { return breach; }
+
+  if (limits.max_open_orders != 0 && _open_orders >= limits.max_open_orders) { return risk_breach::open_orders; }
+
+  return check_position(order, 0, limits);
+}
+
+risk_breach risk_cache::check_update(const order &previous, const order &updated, const risk_limits &limits) const
+{
+  if (const auto breach = check_order(updated, limits); breach != risk_breach::none) { return breach; }
+
+  return check_position(updated, previous.quantity, limits);
+}
+
+void risk_cache::on_new(const order &order)
+{
+  auto &current = _exposures[order.symbol];
+  (order.way == order_side::buy ? current.open_buy : current.open_sell) += order.quantity;
+  ++_open_orders;
+}
+
+void risk_cache::on_update(const order &previous, const order &updated)
+{
+  auto &current = _exposures[updated.symbol];
+  auto &open = updated.way == order_side::buy ? current.open_buy : current.open_sell;
+  open = open - previous.quantity + updated.quantity;
+}
+
+void risk_cache::remove_open(const order &order)
+{
+  auto &current = _exposures[order.symbol];
+  (order.way == order_side::buy ? current.open_buy : current.open_sell) -= order.quantity;
+  --_open_orders;
+}
+
+void risk_cache::on_cancel(const order &order) { remove_open(order); }
+
+void risk_cache::on_execution(const order &order, std::uint64_t quantity)
+{
+  auto &current = _exposures[order.symbol];
+  (order.way == order_side::buy ? current.open_buy : current.open_sell) -= quantity;
+  if (quantity >= order.quantity) { --_open_orders; }
+
+  const auto executed = static_cast<std::int64_t>(quantity);
+  current.position += order.way == order_side::buy ? executed : -executed;
+}
+
+std::vector<std::pair<std::string, std::int64_t>> risk_cache::positions() const
+{
+  std::vector<std::pair<std::string, std::int64_t>> result;
+  for (const auto &[symbol, current] : _exposures)
+  {
+    if (current.position != 0) { result.emplace_back(symbol, current.position); }
+  }
+
+  return result;
+}
+
+void risk_cache::restore_position(const std::string &symbol, std::int64_t position)
+{
+  _exposures[symbol].position = position;
+}
+
+void risk_limits_store::publish(const risk_limits &limits)
+{
+  auto current = std::make_shared<const risk_limits>(limits);
+
+  std::scoped_lock l{ _mutex };
+  _current = std::move(current);
+  _version.fetch_add(1, std::memory_order_release);
+}
+
+std::shared_ptr<const risk_limits> risk_limits_store::current() const
+{
+  std::scoped_lock l{ _mutex };
+  return _current;
+}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "order.h"
+#include "result.h"
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace exchange_server {
+
+// A zero limit disables the corresponding check
+struct risk_limits
+{
+  std::uint64_t max_order_quantity{};
+  double max_order_notional{};
+  // Absolute position per symbol, counting open orders as if they were all executed
+  std::uint64_t max_position{};
+  std::size_t max_open_orders{};
+};
+
+// Reads "name value" lines, names being the risk_limits members, empty lines and lines starting with # are ignored
+result<risk_limits> parse_risk_limits(std::istream &input);
+
+enum class risk_breach { none, order_quantity, order_notional, position, open_orders };
+
+// Exposure of a client, only accessed from its strand
+class risk_cache
+{
+public:
+  risk_breach check_new(const order &order, const risk_limits &limits) const;
+  risk_breach check_update(const order &previous, const order &updated, const risk_limits &limits) const;
+
+  void on_new(const order &order);
+  void on_update(const order &previous, const order &updated);
+  void on_cancel(const order &order);
+  // order is what was left of it before this execution
+  void on_execution(const order &order, std::uint64_t quantity);
+
+  // Executed position per symbol, the open orders being restored through on_new
+  std::vector<std::pair<std::string, std::int64_t>> positions() const;
+  void restore_position(const std::string &symbol, std::int64_t position);
+
+private:
+  struct exposure
+  {
+    std::int64_t position{};
+    std::uint64_t open_buy{};
+    std::uint64_t open_sell{};
+  };
+
+  static risk_breach check_order(const order &order, const risk_limits &limits);
+  risk_breach check_position(const order &order, std::uint64_t released, const risk_limits &limits) const;
+  void remove_open(const order &order);
+
+  std::unordered_map<std::string, exposure> _exposures;
+  std::size_t _open_orders{};
+};
+
+// Limits shared by all clients, they may be replaced at any time: clients only compare versions on the hot path
+class risk_limits_store
+{
+public:
+  explicit risk_limits_store(const risk_limits &limits) { publish(limits); }
+
+  void publish(const risk_limits &limits);
+
+  std::uint64_t version() const { return _version.load(std::memory_order_acquire); }
+  std::shared_ptr<const risk_limits> current() const;
+
+private:
+  mutable std::mutex _mutex;
+  std::shared_ptr<const risk_limits> _current;
+  std::atomic<std::uint64_t> _version{};
+};
+
+}
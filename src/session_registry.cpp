@@ -0,0 +1 @@
+#include "session_registry.h"
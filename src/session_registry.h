@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace exchange_server {
+
+// Unlike fds, session ids are never reused
+using session_id = std::uint64_t;
+
+// Sessions by id, so that events outliving a connection, like executions, are routed to it only while it exists.
+// Callers keep ids instead of pointers, the registry only pays a reference count when an event is dispatched.
+template<class Session> class session_registry
+{
+public:
+  // A server taking over from another one starts past the ids it used
+  explicit session_registry(session_id first = 1) : _last_id{ first - 1 } {}
+
+  session_id add(std::weak_ptr<Session> session)
+  {
+    std::scoped_lock l{ _mutex };
+    const auto id = ++_last_id;
+    _sessions.emplace(id, std::move(session));
+    return id;
+  }
+
+  // Registers a session handed off by another server under its id, ids given by add then start past it
+  void restore(session_id id, std::weak_ptr<Session> session)
+  {
+    std::scoped_lock l{ _mutex };
+    _last_id = std::max(_last_id, id);
+    _sessions.insert_or_assign(id, std::move(session));
+  }
+
+  void remove(session_id id)
+  {
+    std::scoped_lock l{ _mutex };
+    _sessions.erase(id);
+  }
+
+  // Calls f with the session if it is still registered and alive, returns whether it was
+  template<class F> bool with_session(session_id id, F &&f) const
+  {
+    std::shared_ptr<Session> session;
+
+    {
+      std::scoped_lock l{ _mutex };
+      if (const auto it = _sessions.find(id); it != _sessions.end()) { session = it->second.lock(); }
+    }
+
+    if (!session) { return false; }
+
+    std::forward<F>(f)(*session);
+    return true;
+  }
+
+  std::size_t size() const
+  {
+    std::scoped_lock l{ _mutex };
+    return _sessions.size();
+  }
+
+  session_id last_id() const
+  {
+    std::scoped_lock l{ _mutex };
+    return _last_id;
+  }
+
+private:
+  mutable std::mutex _mutex;
+  session_id _last_id;
+  std::unordered_map<session_id, std::weak_ptr<Session>> _sessions;
+};
+
+}
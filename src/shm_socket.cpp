@@ -0,0 +1,340 @@
+#include "shm_socket.h"
+#include "scope_exit.h"
+#include "utilities.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <fmt/core.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+
+namespace exchange_server {
+
+namespace {
+  // Smallest kernel buffers, so that few bytes are needed to fill a doorbell
+  constexpr int doorbell_buffer_size{ 1 };
+
+  sockaddr_un make_address(const std::string &path)
+  {
+    sockaddr_un address{ .sun_family = AF_UNIX };
+    if (path.size() >= sizeof(address.sun_path))
+    {
+      throw std::invalid_argument{ fmt::format("Unix socket path too long: {}", path) };
+    }
+
+    std::copy(path.begin(), path.end(), std::begin(address.sun_path));
+    return address;
+  }
+
+  bool would_block(std::error_code err)
+  {
+    return err == std::errc::resource_unavailable_try_again || err == std::errc::operation_would_block;
+  }
+}
+
+spsc_byte_ring::spsc_byte_ring(header &header, std::span<char> data)
+  : _header{ header }, _data{ data }, _mask{ data.size() - 1 }
+{
+  if (!std::has_single_bit(data.size())) { throw std::invalid_argument{ "Ring size must be a power of two" }; }
+}
+
+result<std::size_t> spsc_byte_ring::write(std::span<const char> buffer)
+{
+  const auto head = _header.head.load(std::memory_order_relaxed);
+  const auto tail = _header.tail.load(std::memory_order_acquire);
+  if (head - tail > _data.size()) { return { .err = std::make_error_code(std::errc::bad_message) }; }
+  const std::size_t size = std::min<std::uint64_t>(buffer.size(), _data.size() - (head - tail));
+
+  // The bytes may wrap around the end of the data
+  const std::size_t offset = head & _mask;
+  const auto first = std::min(size, _data.size() - offset);
+  std::copy_n(buffer.begin(), first, _data.begin() + static_cast<std::ptrdiff_t>(offset));
+  std::copy_n(buffer.begin() + static_cast<std::ptrdiff_t>(first), size - first, _data.begin());
+
+  _header.head.store(head + size, std::memory_order_release);
+  return { .result = size };
+}
+
+result<std::size_t> spsc_byte_ring::read(std::span<char> buffer)
+{
+  const auto tail = _header.tail.load(std::memory_order_relaxed);
+  const auto head = _header.head.load(std::memory_order_acquire);
+  if (head - tail > _data.size()) { return { .err = std::make_error_code(std::errc::bad_message) }; }
+  const std::size_t size = std::min<std::uint64_t>(buffer.size(), head - tail);
+
+  const std::size_t offset = tail & _mask;
+  const auto first = std::min(size, _data.size() - offset);
+  std::copy_n(_data.begin() + static_cast<std::ptrdiff_t>(offset), first, buffer.begin());
+  std::copy_n(_data.begin(), size - first, buffer.begin() + static_cast<std::ptrdiff_t>(first));
+
+  _header.tail.store(tail + size, std::memory_order_release);
+  return { .result = size };
+}
+
+struct shm_socket::layout
+{
+  spsc_byte_ring::header to_server;
+  spsc_byte_ring::header to_client;
+};
+
+shm_socket::shm_socket(int memory_fd, int doorbell_fd, side side, bool busy_poll)
+  : _doorbell{ doorbell_fd }, _memory{ map(memory_fd, side) }, _input{ make_ring(_memory, side) },
+    _output{ make_ring(_memory, side == side::server ? side::client : side::server) }
+{
+  _input.get_header().consumer_needs_doorbell = !busy_poll;
+}
+
+shm_socket::~shm_socket()
+{
+  // Busy polling peers do not watch the doorbell
+  _output.get_header().closed = true;
+  ::munmap(_memory.data(), _memory.size());
+}
+
+std::span<char> shm_socket::map(int memory_fd, side side)
+{
+  const scope_exit close_memory{ [memory_fd] { ::close(memory_fd); } };
+
+  struct stat status = {};
+  if (::fstat(memory_fd, &status) < 0) { throw std::system_error{ get_last_error() }; }
+
+  const auto size = static_cast<std::size_t>(status.st_size);
+  if (size <= sizeof(layout)) { throw std::invalid_argument{ "Shared memory too small" }; }
+
+  auto *memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+  if (memory == MAP_FAILED) { throw std::system_error{ get_last_error() }; }
+
+  if (side == side::server) { new (memory) layout{}; }
+
+  return { static_cast<char *>(memory), size };
+}
+
+spsc_byte_ring shm_socket::make_ring(std::span<char> memory, side consumer)
+{
+  auto *channel = std::launder(reinterpret_cast<layout *>(memory.data()));
+  const auto data = memory.subspan(sizeof(layout));
+  const auto ring_size = data.size() / 2;
+
+  return consumer == side::server ? spsc_byte_ring{ channel->to_server, data.first(ring_size) }
+                                  : spsc_byte_ring{ channel->to_client, data.subspan(ring_size, ring_size) };
+}
+
+result<std::ptrdiff_t> shm_socket::read(std::span<char> buffer)
+{
+  auto &header = _input.get_header();
+
+  bool closed{ false };
+  if (header.consumer_needs_doorbell)
+  {
+    // Cleared before checking the ring, so that a write happening after the check rings again
+    header.doorbell_rung = false;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    auto [eof, err] = drain_doorbell();
+    if (err) { return { .err = err }; }
+    closed = eof;
+  }
+
+  const auto [size, ring_err] = _input.read(buffer);
+  if (ring_err) { return { .err = ring_err }; }
+
+  // Busy polling consumers only drain the doorbell when the producer waits for it
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header.producer_blocked.exchange(false))
+  {
+    auto [eof, err] = drain_doorbell();
+    if (err) { return { .err = err }; }
+    closed = closed || eof;
+  }
+
+  if (size > 0 || buffer.empty() || closed || header.closed)
+  {
+    return { .result = static_cast<std::ptrdiff_t>(size) };
+  }
+
+  return { .err = std::make_error_code(std::errc::resource_unavailable_try_again) };
+}
+
+result<std::ptrdiff_t> shm_socket::write(std::span<const char> buffer)
+{
+  auto &header = _output.get_header();
+  if (header.closed) { return { .err = std::make_error_code(std::errc::broken_pipe) }; }
+
+  auto written = _output.write(buffer);
+  if (written.err) { return { .err = written.err }; }
+  if (written.result == 0 && !buffer.empty())
+  {
+    if (const auto err = block_writes()) { return { .err = err }; }
+
+    // The peer drains the doorbell after reading, unless it read in the meantime: the ring then has room
+    header.producer_blocked = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    written = _output.write(buffer);
+    if (written.err) { return { .err = written.err }; }
+    if (written.result == 0) { return { .err = std::make_error_code(std::errc::resource_unavailable_try_again) }; }
+  }
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (written.result > 0 && header.consumer_needs_doorbell && !header.doorbell_rung.exchange(true))
+  {
+    constexpr char ring{ 1 };
+    // A full doorbell already wakes the peer up
+    if (::send(get_fd(), &ring, sizeof(ring), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && !would_block(get_last_error()))
+    {
+      return { .err = get_last_error() };
+    }
+  }
+
+  return { .result = static_cast<std::ptrdiff_t>(written.result) };
+}
+
+std::error_code shm_socket::shutdown()
+{
+  _input.get_header().closed = true;
+  _output.get_header().closed = true;
+  return _doorbell.shutdown();
+}
+
+std::error_code shm_socket::block_writes()
+{
+  const std::array<char, 4096> filler{};
+  for (;;)
+  {
+    if (::send(get_fd(), filler.data(), filler.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+    {
+      const auto err = get_last_error();
+      return would_block(err) ? std::error_code{} : err;
+    }
+  }
+}
+
+result<bool> shm_socket::drain_doorbell()
+{
+  // Doorbell bytes only mean that the rings changed, an end of file means the peer is gone
+  std::array<char, 4096> doorbell{};
+  for (;;)
+  {
+    auto [bytes_read, err] = _doorbell.read(doorbell);
+    if (would_block(err)) { return {}; }
+    if (err) { return { .err = err }; }
+    if (bytes_read == 0) { return { .result = true }; }
+  }
+}
+
+shm_client_socket::shm_client_socket(const std::string &path, bool busy_poll)
+  : shm_client_socket{ receive_channel(path), busy_poll }
+{}
+
+shm_client_socket::shm_client_socket(std::pair<int, int> descriptors, bool busy_poll)
+  : shm_socket{ descriptors.first, descriptors.second, side::client, busy_poll }
+{}
+
+std::pair<int, int> shm_client_socket::receive_channel(const std::string &path)
+{
+  const socket_impl connection{ ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) };
+
+  const auto address = make_address(path);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast,clang-diagnostic-old-style-cast)
+  if (::connect(connection.get_fd(), (const sockaddr *)&address, sizeof(address)) < 0)
+  {
+    throw std::system_error{ get_last_error() };
+  }
+
+  char data{};
+  iovec io{ .iov_base = &data, .iov_len = sizeof(data) };
+  std::array<char, CMSG_SPACE(2 * sizeof(int))> control{};
+  msghdr message{ .msg_iov = &io, .msg_iovlen = 1, .msg_control = control.data(), .msg_controllen = control.size() };
+
+  if (::recvmsg(connection.get_fd(), &message, MSG_CMSG_CLOEXEC) <= 0) { throw std::system_error{ get_last_error() }; }
+
+  const auto *header = CMSG_FIRSTHDR(&message);
+  if (header == nullptr || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+  {
+    throw std::runtime_error{ "Invalid shared memory channel received" };
+  }
+
+  std::array<int, 2> descriptors{};
+  std::memcpy(descriptors.data(), CMSG_DATA(header), sizeof(descriptors));
+  return { descriptors[0], descriptors[1] };
+}
+
+shm_listen_socket::shm_listen_socket(std::string path, std::size_t ring_size)
+  : socket_impl_base{ ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) }, _path{ std::move(path) },
+    _ring_size{ ring_size }
+{
+  if (!std::has_single_bit(_ring_size)) { throw std::invalid_argument{ "Ring size must be a power of two" }; }
+
+  // Left over by a previous run
+  ::unlink(_path.c_str());
+
+  const auto address = make_address(_path);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast,clang-diagnostic-old-style-cast)
+  if (::bind(_fd, (const sockaddr *)&address, sizeof(address)) < 0) { throw std::system_error{ get_last_error() }; }
+
+  if (::listen(_fd, _max_connections) < 0) { throw std::system_error{ get_last_error() }; }
+}
+
+shm_listen_socket::~shm_listen_socket() { ::unlink(_path.c_str()); }
+
+result<std::shared_ptr<socket_interface>> shm_listen_socket::accept() const
+{
+  const auto fd = ::accept4(_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd < 0) { return { .err = get_last_error() }; }
+  const socket_impl connection{ fd };
+
+  const auto memory_fd = ::memfd_create("exchange_server_channel", MFD_CLOEXEC);
+  if (memory_fd < 0) { return { .err = get_last_error() }; }
+  const scope_exit close_memory{ [memory_fd] { ::close(memory_fd); } };
+
+  const auto size = sizeof(spsc_byte_ring::header) * 2 + _ring_size * 2;
+  if (::ftruncate(memory_fd, static_cast<off_t>(size)) < 0) { return { .err = get_last_error() }; }
+
+  std::array<int, 2> doorbells{};
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, doorbells.data()) < 0)
+  {
+    return { .err = get_last_error() };
+  }
+  const socket_impl client_doorbell{ doorbells[1] };
+
+  for (const auto doorbell : doorbells)
+  {
+    ::setsockopt(doorbell, SOL_SOCKET, SO_SNDBUF, &doorbell_buffer_size, sizeof(doorbell_buffer_size));
+    ::setsockopt(doorbell, SOL_SOCKET, SO_RCVBUF, &doorbell_buffer_size, sizeof(doorbell_buffer_size));
+  }
+
+  std::shared_ptr<shm_socket> result;
+  try
+  {
+    // The memory is initialised before the client gets it
+    result = std::make_shared<shm_socket>(::dup(memory_fd), doorbells[0], shm_socket::side::server);
+  } catch (const std::system_error &e)
+  {
+    return { .err = e.code() };
+  }
+
+  char data{};
+  iovec io{ .iov_base = &data, .iov_len = sizeof(data) };
+  std::array<char, CMSG_SPACE(2 * sizeof(int))> control{};
+  msghdr message{ .msg_iov = &io, .msg_iovlen = 1, .msg_control = control.data(), .msg_controllen = control.size() };
+
+  auto *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(2 * sizeof(int));
+  const std::array descriptors{ memory_fd, client_doorbell.get_fd() };
+  std::memcpy(CMSG_DATA(header), descriptors.data(), sizeof(descriptors));
+
+  if (::sendmsg(connection.get_fd(), &message, MSG_NOSIGNAL) < 0) { return { .err = get_last_error() }; }
+
+  return { .result = std::move(result) };
+}
+
+}
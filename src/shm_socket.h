@@ -0,0 +1,126 @@
+#pragma once
+
+#include "socket_impl.h"
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace exchange_server {
+
+// Single producer single consumer byte queue, its header and data may live in memory shared between processes
+class spsc_byte_ring
+{
+public:
+  struct header
+  {
+    // Positions only grow, the ring holds head - tail bytes
+    alignas(64) std::atomic<std::uint64_t> head{};
+    alignas(64) std::atomic<std::uint64_t> tail{};
+    // Busy polling consumers do not need to be woken up
+    alignas(64) std::atomic<bool> consumer_needs_doorbell{ true };
+    // Set by the producer when it rings, cleared by the consumer before checking for data
+    std::atomic<bool> doorbell_rung{ false };
+    // Set by the producer when it filled the doorbell because the ring was full
+    std::atomic<bool> producer_blocked{ false };
+    // Set when either end shuts the channel down
+    std::atomic<bool> closed{ false };
+  };
+
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<bool>::is_always_lock_free,
+    "Atomics shared between processes must be lock free");
+
+  // The capacity must be a power of two
+  spsc_byte_ring(header &header, std::span<char> data);
+
+  // Producer side, returns the number of bytes which fitted. Positions the peer moved out of the ring are an error, the
+  // peer is then broken or hostile.
+  result<std::size_t> write(std::span<const char> buffer);
+  // Consumer side, returns the number of bytes read
+  result<std::size_t> read(std::span<char> buffer);
+
+  header &get_header() const { return _header; }
+
+private:
+  header &_header;
+  std::span<char> _data;
+  std::uint64_t _mask;
+};
+
+// One end of a shared memory channel, made of a ring in each direction. The descriptor is one end of a unix socket
+// pair used as doorbell: it is readable when the peer wrote to the ring, and it is not writable while the ring
+// towards the peer is full, so the reactor handles it exactly like a TCP socket.
+class shm_socket : public socket_interface
+{
+public:
+  enum class side { server, client };
+
+  // Takes ownership of both descriptors, the memory is initialised by the server side
+  shm_socket(int memory_fd, int doorbell_fd, side side, bool busy_poll = false);
+  shm_socket(const shm_socket &) = delete;
+  shm_socket(shm_socket &&) noexcept = delete;
+  shm_socket &operator=(const shm_socket &) = delete;
+  shm_socket &operator=(shm_socket &&) noexcept = delete;
+  ~shm_socket() override;
+
+  result<std::ptrdiff_t> read(std::span<char> buffer) override;
+  result<std::ptrdiff_t> write(std::span<const char> buffer) override;
+  std::error_code shutdown() override;
+
+  int get_fd() const override { return _doorbell.get_fd(); }
+
+private:
+  struct layout;
+
+  static std::span<char> map(int memory_fd, side side);
+  static spsc_byte_ring make_ring(std::span<char> memory, side consumer);
+  // Fills the doorbell so that the descriptor is not writable until the peer reads
+  std::error_code block_writes();
+  // Returns true when the peer closed its end
+  result<bool> drain_doorbell();
+
+  socket_impl _doorbell;
+  std::span<char> _memory;
+  spsc_byte_ring _input;
+  spsc_byte_ring _output;
+};
+
+// Connects to a shm_listen_socket, busy polling clients are not woken up by the server
+class shm_client_socket : public shm_socket
+{
+public:
+  explicit shm_client_socket(const std::string &path, bool busy_poll = false);
+
+private:
+  shm_client_socket(std::pair<int, int> descriptors, bool busy_poll);
+
+  // Memory and doorbell descriptors sent by the server
+  static std::pair<int, int> receive_channel(const std::string &path);
+};
+
+// Listens on a unix socket path, each accepted client gets its channel memory and doorbell through it
+class shm_listen_socket
+  : public socket_impl_base
+  , public listen_socket_interface
+{
+public:
+  shm_listen_socket(std::string path, std::size_t ring_size);
+  shm_listen_socket(const shm_listen_socket &) = delete;
+  shm_listen_socket(shm_listen_socket &&) noexcept = delete;
+  shm_listen_socket &operator=(const shm_listen_socket &) = delete;
+  shm_listen_socket &operator=(shm_listen_socket &&) noexcept = delete;
+  ~shm_listen_socket();
+
+  result<std::shared_ptr<socket_interface>> accept() const override;
+
+  int get_fd() const override { return _fd; }
+
+private:
+  static constexpr int _max_connections{ 128 };
+
+  std::string _path;
+  std::size_t _ring_size;
+};
+
+}
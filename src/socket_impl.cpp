@@ -1,11 +1,14 @@
 #include "socket_impl.h"
 #include "utilities.h"
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <fmt/core.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -13,6 +16,17 @@
 
 namespace {
 
+in_addr parse_address(const std::string &address)
+{
+  in_addr result{};
+  if (::inet_pton(AF_INET, address.c_str(), &result) != 1)
+  {
+    throw std::invalid_argument{ fmt::format("Invalid IPv4 address {}", address) };
+  }
+
+  return result;
+}
+
 void log_client_address(const struct sockaddr_in &client_addr, socklen_t len)
 {
   std::array<char, NI_MAXHOST> hostname{};
@@ -53,7 +67,9 @@ std::error_code socket_impl_base::make_non_blocking() const
 
 result<std::ptrdiff_t> socket_impl::read(std::span<char> buffer)
 {
-  const auto bytes_read = ::recv(_fd, buffer.data(), buffer.size(), 0);
+  auto bytes_read = ::recv(_fd, buffer.data(), buffer.size(), 0);
+  // Control descriptors, pipes or eventfds, are not sockets
+  if (bytes_read < 0 && errno == ENOTSOCK) { bytes_read = ::read(_fd, buffer.data(), buffer.size()); }
   if (bytes_read < 0) { return { .err = std::make_error_code(static_cast<std::errc>(errno)) }; }
 
   return { .result = bytes_read };
@@ -61,13 +77,109 @@ result<std::ptrdiff_t> socket_impl::read(std::span<char> buffer)
 
 result<std::ptrdiff_t> socket_impl::write(std::span<const char> buffer)
 {
-  const auto bytes_written = ::send(_fd, buffer.data(), buffer.size(), 0);
+  auto bytes_written = ::send(_fd, buffer.data(), buffer.size(), 0);
+  if (bytes_written < 0 && errno == ENOTSOCK) { bytes_written = ::write(_fd, buffer.data(), buffer.size()); }
   if (bytes_written < 0) { return { .err = std::make_error_code(static_cast<std::errc>(errno)) }; }
 
   return { .result = bytes_written };
 }
 
-listen_socket_impl::listen_socket_impl(int port) : socket_impl_base{ ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0) }
+std::error_code socket_impl::shutdown()
+{
+  if (::shutdown(_fd, SHUT_RDWR) < 0) { return get_last_error(); }
+
+  return {};
+}
+
+client_socket_impl::client_socket_impl(const std::string &host, int port)
+  : socket_impl{ ::socket(AF_INET, SOCK_STREAM, 0) }
+{
+  struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+  struct addrinfo *addresses = nullptr;
+  if (const auto err = ::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses); err != 0)
+  {
+    throw std::runtime_error{ fmt::format("Cannot resolve {}: {}", host, gai_strerror(err)) };
+  }
+
+  const auto res = ::connect(_fd, addresses->ai_addr, addresses->ai_addrlen);
+  ::freeaddrinfo(addresses);
+  if (res < 0) { throw std::system_error{ get_last_error() }; }
+
+  const int value = 1;
+  if (::setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) < 0)
+  {
+    throw std::system_error{ get_last_error() };
+  }
+
+  if (const auto err = make_non_blocking()) { throw std::system_error{ err }; }
+}
+
+multicast_sender_socket_impl::multicast_sender_socket_impl(const std::string &group,
+  int port,
+  const std::string &interface,
+  int ttl)
+  : socket_impl{ ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0) }
+{
+  const auto interface_address = parse_address(interface);
+  if (::setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_IF, &interface_address, sizeof(interface_address)) < 0)
+  {
+    throw std::system_error{ get_last_error() };
+  }
+
+  if (::setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)
+  {
+    throw std::system_error{ get_last_error() };
+  }
+
+  // Subscribers may run on the same host
+  const int loop = 1;
+  if (::setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0)
+  {
+    throw std::system_error{ get_last_error() };
+  }
+
+  struct sockaddr_in group_addr = { .sin_family = AF_INET, .sin_port = htons(static_cast<uint16_t>(port)) };
+  group_addr.sin_addr = parse_address(group);
+
+  // Connected, so that datagrams are sent with write
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast,clang-diagnostic-old-style-cast)
+  if (::connect(_fd, (struct sockaddr *)&group_addr, sizeof(group_addr)) < 0)
+  {
+    throw std::system_error{ get_last_error() };
+  }
+}
+
+multicast_receiver_socket_impl::multicast_receiver_socket_impl(const std::string &group,
+  int port,
+  const std::string &interface)
+  : socket_impl{ ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0) }
+{
+  // Several subscribers may run on the same host
+  const int value = 1;
+  if (::setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value)) < 0)
+  {
+    throw std::system_error{ get_last_error() };
+  }
+
+  struct sockaddr_in group_addr = { .sin_family = AF_INET, .sin_port = htons(static_cast<uint16_t>(port)) };
+  group_addr.sin_addr = parse_address(group);
+
+  // Bound to the group address to only receive its datagrams
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast,clang-diagnostic-old-style-cast)
+  if (::bind(_fd, (struct sockaddr *)&group_addr, sizeof(group_addr)) < 0)
+  {
+    throw std::system_error{ get_last_error() };
+  }
+
+  const ip_mreq membership{ .imr_multiaddr = group_addr.sin_addr, .imr_interface = parse_address(interface) };
+  if (::setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+  {
+    throw std::system_error{ get_last_error() };
+  }
+}
+
+listen_socket_impl::listen_socket_impl(int port, const std::string &interface)
+  : socket_impl_base{ ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0) }
 {
   const int value = 1;
   if (::setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value)) < 0)
@@ -76,7 +188,11 @@ listen_socket_impl::listen_socket_impl(int port) : socket_impl_base{ ::socket(AF
   }
 
   struct sockaddr_in serv_addr = { .sin_family = AF_INET, .sin_port = htons(static_cast<uint16_t>(port)) };
-  serv_addr.sin_addr.s_addr = INADDR_ANY;
+  if (interface.empty()) { serv_addr.sin_addr.s_addr = INADDR_ANY; }
+  else
+  {
+    serv_addr.sin_addr = parse_address(interface);
+  }
 
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast,clang-diagnostic-old-style-cast)
   if (::bind(_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
@@ -103,4 +219,32 @@ result<std::shared_ptr<socket_interface>> listen_socket_impl::accept() const
 
   return { .result = std::move(result) };
 }
+
+listen_socket_group::listen_socket_group(std::vector<std::shared_ptr<listen_socket_interface>> listeners)
+  : socket_impl_base{ ::epoll_create1(0) }, _listeners{ std::move(listeners) }
+{
+  for (const auto &listener : _listeners)
+  {
+    epoll_event evt{ .events = EPOLLIN, .data = { .fd = listener->get_fd() } };
+    if (::epoll_ctl(_fd, EPOLL_CTL_ADD, listener->get_fd(), &evt) < 0) { throw std::system_error{ get_last_error() }; }
+  }
+}
+
+result<std::shared_ptr<socket_interface>> listen_socket_group::accept() const
+{
+  for (std::size_t i = 0; i < _listeners.size(); ++i)
+  {
+    const auto &listener = _listeners[(_next + i) % _listeners.size()];
+    auto accepted = listener->accept();
+    if (accepted.result
+        || (accepted.err != std::errc::resource_unavailable_try_again
+            && accepted.err != std::errc::operation_would_block))
+    {
+      _next = (_next + i + 1) % _listeners.size();
+      return accepted;
+    }
+  }
+
+  return { .err = std::make_error_code(std::errc::resource_unavailable_try_again) };
+}
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 
 #include <memory>
 #include <span>
+#include <string>
+#include <vector>
 
 namespace exchange_server {
 
@@ -34,6 +36,8 @@ public:
 
   virtual result<std::ptrdiff_t> read(std::span<char> buffer) = 0;
   virtual result<std::ptrdiff_t> write(std::span<const char> buffer) = 0;
+  // Ends both directions of the connection, which is then reported as readable and closed by the peer
+  virtual std::error_code shutdown() = 0;
 
   virtual int get_fd() const = 0;
 };
@@ -47,10 +51,31 @@ public:
 
   result<std::ptrdiff_t> read(std::span<char> buffer) override;
   result<std::ptrdiff_t> write(std::span<const char> buffer) override;
+  std::error_code shutdown() override;
 
   int get_fd() const override { return _fd; }
 };
 
+class client_socket_impl : public socket_impl
+{
+public:
+  client_socket_impl(const std::string &host, int port);
+};
+
+// Non-blocking UDP socket writing datagrams to a multicast group through the given interface
+class multicast_sender_socket_impl : public socket_impl
+{
+public:
+  multicast_sender_socket_impl(const std::string &group, int port, const std::string &interface, int ttl = 1);
+};
+
+// Non-blocking UDP socket reading the datagrams sent to a multicast group, joined on the given interface
+class multicast_receiver_socket_impl : public socket_impl
+{
+public:
+  multicast_receiver_socket_impl(const std::string &group, int port, const std::string &interface);
+};
+
 class listen_socket_interface
 {
 public:
@@ -66,7 +91,10 @@ class listen_socket_impl
   , public listen_socket_interface
 {
 public:
-  explicit listen_socket_impl(int port);
+  // Listens on every interface unless given the address of one
+  explicit listen_socket_impl(int port, const std::string &interface = {});
+  // Adopts a socket already listening, e.g. handed off by another process
+  explicit listen_socket_impl(socket_impl_base listening) : socket_impl_base{ std::move(listening) } {}
 
   result<std::shared_ptr<socket_interface>> accept() const override;
 
@@ -77,4 +105,21 @@ private:
 };
 
 
+// Accepts the connections of several listeners through a single descriptor, itself an epoll instance
+class listen_socket_group
+  : public socket_impl_base
+  , public listen_socket_interface
+{
+public:
+  explicit listen_socket_group(std::vector<std::shared_ptr<listen_socket_interface>> listeners);
+
+  result<std::shared_ptr<socket_interface>> accept() const override;
+
+  int get_fd() const override { return _fd; }
+
+private:
+  std::vector<std::shared_ptr<listen_socket_interface>> _listeners;
+  // Listeners are tried in turn so none of them is starved
+  mutable std::size_t _next{};
+};
 }
\ No newline at end of file
@@ -0,0 +1 @@
+#include "task.h"
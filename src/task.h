@@ -0,0 +1,187 @@
+#pragma once
+
+#include "block_pool.h"
+#include "worker.h"
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace exchange_server {
+
+// Coroutine which starts at once and frees itself when it returns, nothing awaits it. Its frame comes from the pool
+// passed as its first argument, so that the coroutine of each connection costs no heap allocation once the pool is
+// warm.
+class task
+{
+public:
+  using pool_reference = std::shared_ptr<block_pool>;
+
+  // Of a coroutine taking Args after its pool. Taking them as class parameters keeps operator new from being a
+  // template, which gcc pairs with the wrong operator delete.
+  template<class... Args> struct promise
+  {
+    static void *operator new(std::size_t size, const pool_reference &pool, const Args &...)
+    {
+      auto *block = static_cast<std::byte *>(pool->allocate(header_size + size));
+      new (block) pool_reference{ pool };
+      return block + header_size;
+    }
+
+    static void operator delete(void *frame, std::size_t size)
+    {
+      auto *block = static_cast<std::byte *>(frame) - header_size;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      auto *header = std::launder(reinterpret_cast<pool_reference *>(block));
+      const auto pool = std::move(*header);
+      header->~pool_reference();
+      pool->deallocate(block, header_size + size);
+    }
+
+    task get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    // Nothing could observe it
+    [[noreturn]] void unhandled_exception() noexcept { std::terminate(); }
+  };
+
+private:
+  // The frame keeps its pool alive, it may be freed after whatever started the coroutine
+  static constexpr std::size_t header_size{ (sizeof(pool_reference) + alignof(std::max_align_t) - 1)
+                                            / alignof(std::max_align_t) * alignof(std::max_align_t) };
+};
+
+// Events delivered in order to a single coroutine, which is resumed by the executor. Events may be pushed from any
+// thread, a coroutine waiting for them when the queue is destroyed is destroyed with it.
+template<class T> class event_queue
+{
+public:
+  explicit event_queue(worker_interface &executor) : _executor{ executor } {}
+  event_queue(const event_queue &) = delete;
+  event_queue(event_queue &&) noexcept = delete;
+  event_queue &operator=(const event_queue &) = delete;
+  event_queue &operator=(event_queue &&) noexcept = delete;
+  ~event_queue()
+  {
+    if (_waiting) { _waiting.destroy(); }
+  }
+
+  void push(T event)
+  {
+    std::unique_lock l{ _mutex };
+    _events.push_back(std::move(event));
+    resume(l);
+  }
+
+  // The coroutine still gets the events pushed before, then an empty one
+  void close()
+  {
+    std::unique_lock l{ _mutex };
+    _closed = true;
+    resume(l);
+  }
+
+  // Awaited by the coroutine, empty once the queue is closed and drained
+  auto next() { return next_awaiter{ *this }; }
+
+  // Lets the executor run the work posted meanwhile before the coroutine goes on
+  auto reschedule() { return reschedule_awaiter{ _executor }; }
+
+  // True while the coroutine waits for an event, i.e. it is not running nor about to
+  bool idle()
+  {
+    std::scoped_lock l{ _mutex };
+    return _waiting && _events.empty();
+  }
+
+  // Events left once the coroutine stopped waiting
+  std::optional<T> try_pop()
+  {
+    std::scoped_lock l{ _mutex };
+    return pop();
+  }
+
+private:
+  struct next_awaiter
+  {
+    event_queue &queue;
+    std::optional<T> event;
+
+    // Events already queued are taken without suspending
+    bool await_ready()
+    {
+      std::scoped_lock l{ queue._mutex };
+      event = queue.pop();
+      return event || queue._closed;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+      std::scoped_lock l{ queue._mutex };
+      if (!queue._events.empty() || queue._closed) { return false; }
+
+      queue._waiting = handle;
+      return true;
+    }
+
+    std::optional<T> await_resume()
+    {
+      if (event) { return std::move(event); }
+
+      std::scoped_lock l{ queue._mutex };
+      return queue.pop();
+    }
+  };
+
+  struct reschedule_awaiter
+  {
+    worker_interface &executor;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) const
+    {
+      executor.post([handle] { handle.resume(); });
+    }
+    void await_resume() const noexcept {}
+  };
+
+  std::optional<T> pop()
+  {
+    if (_events.empty()) { return std::nullopt; }
+
+    auto event = std::move(_events.front());
+    _events.pop_front();
+    return event;
+  }
+
+  void resume(std::unique_lock<std::mutex> &lock)
+  {
+    const auto waiting = std::exchange(_waiting, nullptr);
+    lock.unlock();
+
+    // Capturing only the handle, the work fits in the function without allocating
+    if (waiting) { _executor.post([waiting] { waiting.resume(); }); }
+  }
+
+  worker_interface &_executor;
+  std::mutex _mutex;
+  std::deque<T> _events;
+  std::coroutine_handle<> _waiting;
+  bool _closed{ false };
+};
+
+}
+
+// Coroutines returning a task take their pool first
+template<class... Args>
+struct std::coroutine_traits<exchange_server::task, const exchange_server::task::pool_reference &, Args...>
+{
+  using promise_type = exchange_server::task::promise<std::remove_cvref_t<Args>...>;
+};
@@ -0,0 +1,229 @@
+#include "timer_wheel.h"
+#include <algorithm>
+#include <bit>
+
+namespace exchange_server {
+
+timer_wheel::timer_wheel(clock::time_point start, clock::duration tick) : _start{ start }, _tick{ tick }
+{
+  _heads.fill(npos);
+}
+
+timer_wheel::timer_id timer_wheel::schedule(clock::time_point deadline, std::function<void()> callback)
+{
+  std::uint32_t index{};
+  if (_free != npos)
+  {
+    index = _free;
+    _free = _nodes[index].next;
+  }
+  else
+  {
+    index = static_cast<std::uint32_t>(_nodes.size());
+    _nodes.emplace_back();
+  }
+
+  auto &timer = _nodes[index];
+  timer.callback = std::move(callback);
+  // Rounded up so that timers never expire early, past deadlines expire on the next advance
+  timer.expiry = std::max(ticks_until(deadline), _current);
+  insert(index);
+  ++_size;
+
+  return (std::uint64_t{ timer.generation } << 32U) | index;
+}
+
+bool timer_wheel::cancel(timer_id id)
+{
+  const auto index = static_cast<std::uint32_t>(id & 0xffff'ffffU);
+  if (index >= _nodes.size() || _nodes[index].generation != id >> 32U || _nodes[index].slot == no_slot)
+  {
+    return false;
+  }
+
+  unlink(index);
+  release(index);
+  return true;
+}
+
+std::size_t timer_wheel::advance(clock::time_point now)
+{
+  const auto elapsed = now < _start ? 0 : static_cast<std::uint64_t>((now - _start) / _tick);
+  std::size_t expired{};
+  while (_current <= elapsed)
+  {
+    if (_size == 0)
+    {
+      _current = elapsed + 1;
+      break;
+    }
+
+    // At the start of each turn of the first level, the slots of the upper levels which became current move down
+    if ((_current & slot_mask) == 0)
+    {
+      for (auto level = level_count - 1; level > 0; --level)
+      {
+        if ((_current & ((std::uint64_t{ 1 } << (slot_bits * level)) - 1)) == 0) { cascade(level); }
+      }
+    }
+
+    const auto slot = _current & slot_mask;
+    if (_heads[slot] == npos)
+    {
+      _current = std::min(next_tick(), elapsed + 1);
+      continue;
+    }
+
+    const auto tick = _current++;
+    while (_heads[slot] != npos)
+    {
+      const auto index = _heads[slot];
+      unlink(index);
+
+      // Only timers beyond the reach of the wheel expire later than the slot they went through
+      if (_nodes[index].expiry > tick)
+      {
+        insert(index);
+        continue;
+      }
+
+      auto callback = std::move(_nodes[index].callback);
+      release(index);
+      callback();
+      ++expired;
+    }
+  }
+
+  return expired;
+}
+
+std::optional<timer_wheel::clock::time_point> timer_wheel::next_deadline() const
+{
+  if (_size == 0) { return std::nullopt; }
+
+  return _start + _tick * static_cast<clock::rep>(next_tick());
+}
+
+std::uint64_t timer_wheel::next_tick() const
+{
+  auto next = UINT64_MAX;
+  if (const auto slot = next_occupied(0, _current & slot_mask); slot != npos) { next = (_current & ~slot_mask) | slot; }
+
+  // Slots of the upper levels move down at their start. The current slot of a level is only occupied when the current
+  // tick starts it and its timers did not move down yet, which may come before the timers of the first level.
+  for (std::size_t level = 1; level < level_count; ++level)
+  {
+    const auto shift = slot_bits * level;
+    const auto starts_slot = (_current & ((std::uint64_t{ 1 } << shift) - 1)) == 0;
+    const auto from = slot_of(_current, level) + (starts_slot ? 0 : 1);
+    const auto block = (_current >> (shift + slot_bits)) << (shift + slot_bits);
+    if (const auto slot = from < slot_count ? next_occupied(level, from) : npos; slot != npos)
+    {
+      next = std::min(next, block | (std::uint64_t{ slot } << shift));
+    }
+    else if (const auto wrapped = next_occupied(level, 0); level == level_count - 1 && wrapped != npos)
+    {
+      // Slots of the last level before the current one belong to its next turn
+      next = std::min(next, block + (std::uint64_t{ 1 } << (shift + slot_bits)) + (std::uint64_t{ wrapped } << shift));
+    }
+  }
+
+  return next;
+}
+
+std::uint64_t timer_wheel::ticks_until(clock::time_point time) const
+{
+  if (time <= _start) { return 0; }
+
+  return static_cast<std::uint64_t>((time - _start + _tick - clock::duration{ 1 }) / _tick);
+}
+
+std::uint32_t timer_wheel::next_occupied(std::size_t level, std::uint64_t from) const
+{
+  const auto &words = _occupied[level];
+  for (auto word = from / 64; word < words.size(); ++word)
+  {
+    auto bits = words[word];
+    if (word == from / 64) { bits &= ~std::uint64_t{} << (from % 64); }
+    if (bits != 0U) { return static_cast<std::uint32_t>(word * 64 + static_cast<std::size_t>(std::countr_zero(bits))); }
+  }
+
+  return npos;
+}
+
+void timer_wheel::insert(std::uint32_t index)
+{
+  auto &timer = _nodes[index];
+  constexpr auto top = level_count - 1;
+
+  // The level is the highest group of bits in which the expiry differs from the current tick
+  std::size_t level{ top };
+  std::uint64_t slot{};
+  if (timer.expiry - _current >= std::uint64_t{ 1 } << (slot_bits * level_count))
+  {
+    // Out of reach, waits in the slot of the last level which moves down last
+    slot = (slot_of(_current, top) - 1) & slot_mask;
+  }
+  else
+  {
+    for (std::size_t candidate = 0; candidate < top; ++candidate)
+    {
+      if (((timer.expiry ^ _current) >> (slot_bits * (candidate + 1))) == 0)
+      {
+        level = candidate;
+        break;
+      }
+    }
+    slot = slot_of(timer.expiry, level);
+  }
+
+  const auto position = level * slot_count + slot;
+  timer.slot = static_cast<std::uint16_t>(position);
+  timer.previous = npos;
+  timer.next = _heads[position];
+  if (timer.next != npos) { _nodes[timer.next].previous = index; }
+  _heads[position] = index;
+  _occupied[level][slot / 64] |= std::uint64_t{ 1 } << (slot % 64);
+}
+
+void timer_wheel::unlink(std::uint32_t index)
+{
+  auto &timer = _nodes[index];
+  if (timer.previous != npos) { _nodes[timer.previous].next = timer.next; }
+  else
+  {
+    _heads[timer.slot] = timer.next;
+  }
+  if (timer.next != npos) { _nodes[timer.next].previous = timer.previous; }
+
+  if (_heads[timer.slot] == npos)
+  {
+    const auto level = timer.slot / slot_count;
+    const auto slot = timer.slot % slot_count;
+    _occupied[level][slot / 64] &= ~(std::uint64_t{ 1 } << (slot % 64));
+  }
+}
+
+void timer_wheel::cascade(std::size_t level)
+{
+  const auto position = level * slot_count + slot_of(_current, level);
+  while (_heads[position] != npos)
+  {
+    const auto index = _heads[position];
+    unlink(index);
+    insert(index);
+  }
+}
+
+void timer_wheel::release(std::uint32_t index)
+{
+  auto &timer = _nodes[index];
+  timer.callback = nullptr;
+  timer.slot = no_slot;
+  ++timer.generation;
+  timer.next = _free;
+  _free = index;
+  --_size;
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+namespace exchange_server {
+
+// Hierarchical timing wheel: 4 levels of 256 slots, each level turning 256 times slower than the one below, cover
+// 2^32 ticks and farther timers wait in the last level. Scheduling and cancelling are O(1), a timer moves down at most
+// 3 levels before it expires, and timers live in a slab so that millions of them cost no allocation each.
+// Not thread safe: each thread which needs timers, the reactor or a market shard, owns its wheel.
+class timer_wheel
+{
+public:
+  using clock = std::chrono::steady_clock;
+  // Generation and slab index, zero is never a timer
+  using timer_id = std::uint64_t;
+
+  explicit timer_wheel(clock::time_point start = clock::now(), clock::duration tick = std::chrono::milliseconds{ 1 });
+
+  // The callback runs from advance once the deadline is reached, at most a tick late
+  timer_id schedule(clock::time_point deadline, std::function<void()> callback);
+  // False if the timer already expired or was cancelled
+  bool cancel(timer_id id);
+  // Runs the callbacks of the timers due at now, returns how many ran. Callbacks may schedule and cancel timers.
+  std::size_t advance(clock::time_point now);
+
+  // Time of the next call to advance with work to do, which may only be moving timers down. Empty without timers.
+  std::optional<clock::time_point> next_deadline() const;
+  bool empty() const { return _size == 0; }
+  std::size_t size() const { return _size; }
+
+private:
+  static constexpr unsigned slot_bits{ 8 };
+  static constexpr std::size_t slot_count{ std::size_t{ 1 } << slot_bits };
+  static constexpr std::uint64_t slot_mask{ slot_count - 1 };
+  static constexpr std::size_t level_count{ 4 };
+  static constexpr std::uint32_t npos{ UINT32_MAX };
+  static constexpr std::uint16_t no_slot{ UINT16_MAX };
+
+  struct node
+  {
+    std::function<void()> callback;
+    std::uint64_t expiry{};
+    std::uint32_t previous{ npos };
+    std::uint32_t next{ npos };
+    std::uint32_t generation{ 1 };
+    // level * slot_count + slot, no_slot once released
+    std::uint16_t slot{ no_slot };
+  };
+
+  static std::uint64_t slot_of(std::uint64_t tick, std::size_t level)
+  {
+    return (tick >> (slot_bits * level)) & slot_mask;
+  }
+
+  std::uint64_t ticks_until(clock::time_point time) const;
+  // Next tick at which timers expire or move down, only called with timers
+  std::uint64_t next_tick() const;
+  // First occupied slot of the level at or after from, npos if none
+  std::uint32_t next_occupied(std::size_t level, std::uint64_t from) const;
+
+  void insert(std::uint32_t index);
+  void unlink(std::uint32_t index);
+  // Moves the timers of the level's slot which just became current to the levels below
+  void cascade(std::size_t level);
+  void release(std::uint32_t index);
+
+  clock::time_point _start;
+  clock::duration _tick;
+  // Ticks before this one were processed
+  std::uint64_t _current{};
+  std::size_t _size{};
+
+  std::array<std::uint32_t, level_count * slot_count> _heads;
+  std::array<std::array<std::uint64_t, slot_count / 64>, level_count> _occupied{};
+  std::vector<node> _nodes;
+  // Released nodes, linked by next
+  std::uint32_t _free{ npos };
+};
+
+}
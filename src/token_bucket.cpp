@@ -0,0 +1,31 @@
+#include "token_bucket.h"
+#include <algorithm>
+
+namespace exchange_server {
+
+token_bucket::token_bucket(double rate, double burst, clock::time_point now)
+  : _rate{ rate }, _burst{ std::max(burst, 1.0) }, _tokens{ _burst }, _last{ now }
+{}
+
+double token_bucket::available(clock::time_point now) const
+{
+  const auto elapsed = std::chrono::duration<double>{ now - _last }.count();
+  return std::min(_burst, _tokens + std::max(elapsed, 0.0) * _rate);
+}
+
+bool token_bucket::try_consume(clock::time_point now)
+{
+  if (_rate <= 0) { return true; }
+
+  _tokens = available(now);
+  _last = std::max(now, _last);
+
+  if (_tokens < 1) { return false; }
+
+  _tokens -= 1;
+  return true;
+}
+
+bool token_bucket::full(clock::time_point now) const { return _rate <= 0 || available(now) >= _burst; }
+
+}
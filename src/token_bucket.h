@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+
+namespace exchange_server {
+
+// Allows rate events per second on average, and up to burst at once after being idle
+class token_bucket
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  // Default bucket never limits
+  token_bucket() = default;
+  token_bucket(double rate, double burst, clock::time_point now);
+
+  bool try_consume(clock::time_point now);
+  // A full bucket behaves as a newly created one
+  bool full(clock::time_point now) const;
+
+private:
+  double available(clock::time_point now) const;
+
+  double _rate{};
+  double _burst{};
+  double _tokens{};
+  clock::time_point _last{};
+};
+
+}
@@ -1,6 +1,8 @@
 #include "worker.h"
+#include <algorithm>
 #include <spdlog/spdlog.h>
 #include <thread>
+#include <utility>
 
 namespace exchange_server {
 
@@ -8,7 +10,13 @@ worker::~worker() { stop(); }
 
 void worker::run()
 {
-  spdlog::info("Starting worker");
+  spdlog::info("Starting worker{}", _busy_poll.enabled ? " in busy poll mode" : "");
+
+  if (_busy_poll.enabled)
+  {
+    run_busy_poll();
+    return;
+  }
 
   for (;;)
   {
@@ -28,10 +36,40 @@ void worker::run()
   }
 }
 
+void worker::run_busy_poll()
+{
+  idle_backoff backoff{ _busy_poll };
+
+  for (;;)
+  {
+    // An idle worker does not contend with the threads posting work
+    if (!_signaled.load(std::memory_order_acquire))
+    {
+      backoff.idle();
+      continue;
+    }
+
+    decltype(_pending)::value_type work;
+
+    {
+      std::scoped_lock l{ _mutex };
+      if (_stop_requested) { break; }
+
+      work = std::move(_pending.front());
+      _pending.pop();
+      _signaled.store(!_pending.empty(), std::memory_order_relaxed);
+    }
+
+    backoff.reset();
+    work();
+  }
+}
+
 void worker::post(std::function<void()> work)
 {
   std::scoped_lock l{ _mutex };
   _pending.push(std::move(work));
+  _signaled.store(true, std::memory_order_release);
   _condition.notify_all();
 }
 
@@ -41,41 +79,60 @@ void worker::stop()
 
   std::scoped_lock l{ _mutex };
   _stop_requested = true;
+  _signaled.store(true, std::memory_order_release);
   _condition.notify_all();
 }
 
 void strand::post(std::function<void()> work)
 {
-  decltype(work) to_post;
-
   std::unique_lock l{ _mutex };
-  if (_pending.empty()) { to_post = work; }
   _pending.push(std::move(work));
+  if (std::exchange(_scheduled, true)) { return; }
 
   l.unlock();
 
-  if (to_post) { do_post(std::move(to_post)); }
+  schedule();
 }
 
-void strand::post_next()
+void strand::schedule()
 {
-  decltype(_pending)::value_type work;
+  // The owner is pinned until the batch ran, one reference count per batch instead of one per work
+  _worker.post([this, owner = _owner.lock()]() { run_batch(); });
+}
 
-  std::unique_lock l{ _mutex };
-  _pending.pop();
-  if (!_pending.empty()) { work = _pending.front(); }
+void strand::run_batch()
+{
+  // The work may own the strand, it is only released once the strand is not used anymore
+  decltype(_pending)::value_type work;
 
-  l.unlock();
+  const auto timed = _options.time_budget.count() > 0;
+  const auto deadline = std::chrono::steady_clock::now() + _options.time_budget;
+  for (std::size_t count = 0; count < std::max<std::size_t>(_options.max_batch, 1); ++count)
+  {
+    {
+      std::scoped_lock l{ _mutex };
+      if (_pending.empty()) { break; }
 
-  if (work) { do_post(std::move(work)); }
-}
+      work = std::move(_pending.front());
+      _pending.pop();
+    }
 
-void strand::do_post(std::function<void()> work)
-{
-  // TODO use std::enable_shared_from_this to be able to check if underlying strand is still alive
-  _worker.post([this, work = std::move(work)]() {
     work();
-    post_next();
-  });
+
+    if (timed && std::chrono::steady_clock::now() >= deadline) { break; }
+  }
+
+  if (_on_batch_end) { _on_batch_end(); }
+
+  {
+    std::scoped_lock l{ _mutex };
+    if (_pending.empty())
+    {
+      _scheduled = false;
+      return;
+    }
+  }
+
+  schedule();
+}
 }
-}
\ No newline at end of file
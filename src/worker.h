@@ -1,7 +1,11 @@
 #pragma once
 
+#include "busy_poll.h"
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
 
@@ -18,7 +22,7 @@ public:
 class worker : public worker_interface
 {
 public:
-  worker() = default;
+  explicit worker(busy_poll_options busy_poll = {}) : _busy_poll{ busy_poll } {}
   worker(const worker &) = delete;
   worker(worker &&) noexcept = delete;
   worker &operator=(const worker &) = delete;
@@ -30,25 +34,49 @@ public:
   void stop();
 
 private:
+  void run_busy_poll();
+
+  busy_poll_options _busy_poll;
   std::mutex _mutex;
   std::condition_variable _condition;
   std::queue<std::function<void()>> _pending;
   bool _stop_requested{};
+  // Set under the lock while work is pending or a stop is requested, polled without it
+  std::atomic<bool> _signaled{};
+};
+
+struct strand_options
+{
+  // Pending work run by one worker slot, the rest goes back to the end of the worker queue so that other strands
+  // are not starved
+  std::size_t max_batch{ 1 };
+  // A batch also ends once it ran for longer, checked after each work, zero disables it
+  std::chrono::microseconds time_budget{};
 };
 
 class strand : public worker_interface
 {
 public:
-  explicit strand(worker_interface &worker) : _worker{ worker } {}
+  explicit strand(worker_interface &worker, strand_options options = {}, std::function<void()> on_batch_end = {})
+    : _worker{ worker }, _options{ options }, _on_batch_end{ std::move(on_batch_end) }
+  {}
   void post(std::function<void()> work) override;
 
+  // Kept alive while work is pending, so that the work does not need to own it
+  void set_owner(std::weak_ptr<void> owner) { _owner = std::move(owner); }
+
 private:
-  void post_next();
-  void do_post(std::function<void()> work);
+  void schedule();
+  void run_batch();
 
   worker_interface &_worker;
+  strand_options _options;
+  // Runs in the strand after each batch, e.g. to flush what the batch produced
+  std::function<void()> _on_batch_end;
+  std::weak_ptr<void> _owner;
 
   std::mutex _mutex;
   std::queue<std::function<void()>> _pending;
+  bool _scheduled{ false };
 };
 }
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include "arena.h"
+#include <functional>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(arena_tests, allocates_from_inline_buffer_until_it_overflows)
+{
+  exchange_server::arena<256> memory;
+  std::pmr::vector<std::pmr::string> messages{ memory.resource() };
+  messages.reserve(2);
+  messages.emplace_back("order1234 BTCUSDT+001000010000");
+
+  const auto is_inline = [&memory](const void *address) {
+    return std::less_equal<const void *>{}(&memory, address) && std::less<const void *>{}(address, &memory + 1);
+  };
+
+  // The vector propagates the arena to its strings
+  EXPECT_TRUE(is_inline(messages.front().data()));
+
+  // Larger than what is left inline, from the heap
+  messages.emplace_back(1024, 'x');
+  EXPECT_FALSE(is_inline(messages.back().data()));
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(arena_tests, release_reuses_inline_buffer)
+{
+  exchange_server::arena<256> memory;
+  const auto *const first = memory.resource()->allocate(64);
+  memory.release();
+  EXPECT_EQ(memory.resource()->allocate(64), first);
+}
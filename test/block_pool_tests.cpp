@@ -0,0 +1,42 @@
+#include "block_pool.h"
+#include <array>
+#include <gtest/gtest.h>
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(block_pool_tests, reuses_released_shared_objects)
+{
+  auto pool = std::make_shared<exchange_server::block_pool>();
+  const exchange_server::pool_allocator<std::string> allocator{ pool };
+
+  auto first = std::allocate_shared<std::string>(allocator, "first");
+  const auto *const address = first.get();
+  first.reset();
+  EXPECT_EQ(pool->free_blocks(), 1U);
+
+  auto second = std::allocate_shared<std::string>(allocator, "second");
+  EXPECT_EQ(second.get(), address);
+  EXPECT_EQ(pool->free_blocks(), 0U);
+
+  // Other sizes are not pooled
+  using large = std::array<char, 256>;
+  auto other = std::allocate_shared<large>(exchange_server::pool_allocator<large>{ pool });
+  other.reset();
+  EXPECT_EQ(pool->free_blocks(), 0U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(block_pool_tests, outlives_objects_released_after_it)
+{
+  std::weak_ptr<exchange_server::block_pool> observer;
+  std::shared_ptr<int> value;
+
+  {
+    auto pool = std::make_shared<exchange_server::block_pool>();
+    observer = pool;
+    value = std::allocate_shared<int>(exchange_server::pool_allocator<int>{ pool }, 42);
+  }
+
+  EXPECT_FALSE(observer.expired());
+  value.reset();
+  EXPECT_TRUE(observer.expired());
+}
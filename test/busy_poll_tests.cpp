@@ -0,0 +1,65 @@
+#include "busy_poll.h"
+#include "epoll_impl.h"
+#include "worker.h"
+#include <future>
+#include <gtest/gtest.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+constexpr exchange_server::busy_poll_options busy_poll{
+  .enabled = true, .spin_polls = 10, .yield_polls = 10, .max_sleep = std::chrono::microseconds{ 100 }
+};
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(busy_poll_tests, worker_runs_work_posted_while_spinning)
+{
+  exchange_server::worker worker{ busy_poll };
+  auto runner = std::async(std::launch::async, [&worker] { worker.run(); });
+
+  std::promise<int> result;
+  // Posted after the worker went idle
+  std::this_thread::sleep_for(std::chrono::milliseconds{ 5 });
+  worker.post([&result] { result.set_value(42); });
+  EXPECT_EQ(result.get_future().get(), 42);
+
+  worker.stop();
+  EXPECT_EQ(runner.wait_for(std::chrono::seconds{ 10 }), std::future_status::ready);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(busy_poll_tests, epoll_wait_returns_only_with_events)
+{
+  exchange_server::epoll_impl epoll{ busy_poll };
+  const int fd = ::eventfd(0, EFD_NONBLOCK);
+  epoll.add(fd, EPOLLIN);
+
+  auto waiter = std::async(std::launch::async, [&epoll] { return epoll.wait().size(); });
+  EXPECT_EQ(waiter.wait_for(std::chrono::milliseconds{ 20 }), std::future_status::timeout);
+
+  eventfd_write(fd, 1);
+  EXPECT_EQ(waiter.get(), 1U);
+
+  ::close(fd);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(busy_poll_tests, pins_to_existing_core_only)
+{
+  // The tests may be restricted to some cores, the first one allowed is used
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+  std::size_t first{};
+  while (!CPU_ISSET(first, &allowed)) { ++first; }
+
+  std::async(std::launch::async, [cpu = static_cast<int>(first)] {
+    EXPECT_FALSE(exchange_server::pin_current_thread(-1));
+    EXPECT_FALSE(exchange_server::pin_current_thread(cpu));
+    EXPECT_EQ(sched_getcpu(), cpu);
+    EXPECT_TRUE(exchange_server::pin_current_thread(1 << 20));
+  }).get();
+}
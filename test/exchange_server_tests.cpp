@@ -1,5 +1,11 @@
+#include "handoff.h"
+#include "market.h"
 #include "mocks.h"
+#include "replication.h"
 #include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
 
 using ::testing::Return;
 using ::testing::StrictMock;
@@ -18,6 +24,17 @@ MATCHER_P(IsMessage, message, "Message matcher")
 {
   return std::equal(arg.begin(), arg.end(), message.begin(), message.end());
 }
+
+// token<token(32)>\n, then the message
+constexpr std::size_t token_line_size{ 38 };
+
+// Responses starting with the random token of the session of a login
+MATCHER_P(IsLoginMessage, message, "Login message matcher")
+{
+  const std::string_view written{ arg.data(), arg.size() };
+  return written.starts_with("token") && written.size() >= token_line_size && written[token_line_size - 1] == '\n'
+         && written.substr(token_line_size) == message;
+}
 }
 
 class exchange_server_tests : public ::testing::Test
@@ -37,8 +54,8 @@ protected:
     EXPECT_CALL(*listen, get_fd()).WillRepeatedly(Return(100));
     EXPECT_CALL(*control, get_fd()).WillRepeatedly(Return(200));
 
-    EXPECT_CALL(*epoll, add(100, EPOLLIN));
-    EXPECT_CALL(*epoll, add(200, EPOLLIN));
+    EXPECT_CALL(*epoll, add(100, EPOLLIN, 100U));
+    EXPECT_CALL(*epoll, add(200, EPOLLIN, 200U));
   }
 
   std::shared_ptr<mocks::listen_socket> listen;
@@ -53,16 +70,16 @@ protected:
 TEST_F(exchange_server_tests, can_process_order)
 {
   // Events setup
-  std::array events{ epoll_event{ .data = { .fd = 100 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } } };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
   EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
 
   // Client connects
   EXPECT_CALL(*listen, accept())
     .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
   EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
-  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
 
   // Client identifies and places order
   EXPECT_CALL(*client, read)
@@ -80,14 +97,14 @@ TEST_F(exchange_server_tests, can_process_order)
 TEST_F(exchange_server_tests, handles_client_disconnection)
 {
   // Events setup
-  std::array events{ epoll_event{ .data = { .fd = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } } };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
   EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
 
   // Client connects
   EXPECT_CALL(*listen, accept())
     .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
   EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
-  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
 
   // Client disconnects
   EXPECT_CALL(*client, read).WillOnce(expect_read(""));
@@ -96,21 +113,285 @@ TEST_F(exchange_server_tests, handles_client_disconnection)
   server.run();
 }
 
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, drops_executions_of_disconnected_client)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Client places an order and disconnects, the order stays in the market
+  std::function<void(const exchange_server::fill &)> execute;
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\n"))
+    .WillOnce(expect_read(""));
+  EXPECT_CALL(*market, add_order)
+    .WillOnce(::testing::DoAll(::testing::SaveArg<1>(&execute), Return(exchange_server::order_result{})));
+  EXPECT_CALL(*market, cancel_order).Times(0);
+  EXPECT_CALL(*client, write(IsMessage("ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 3 }));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+
+  // Nothing is written to the disconnected client
+  execute(exchange_server::fill{ .quantity = 10, .price = 10000 });
+  EXPECT_EQ(server.metrics().orphaned_executions, 1U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, cancels_orders_of_disconnected_client)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Client places an order and disconnects
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\n"))
+    .WillOnce(expect_read(""));
+  EXPECT_CALL(*market, add_order);
+  EXPECT_CALL(*market, cancel_all(1, ::testing::_)).WillOnce(Return(std::vector<std::string>{ "1/1234" }));
+  EXPECT_CALL(*client, write(IsMessage("ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 3 }));
+
+  exchange_server::server server{ listen,
+    epoll,
+    worker,
+    control,
+    market,
+    exchange_server::server_options{ .orphan_orders = exchange_server::orphan_policy::cancel } };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, resumes_session_after_reconnection)
+{
+  // The client places an order and disconnects, the order is executed before it reconnects
+  std::function<void(const exchange_server::fill &)> execute;
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  std::array reconnection{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 301 } } };
+  EXPECT_CALL(*epoll, wait())
+    .WillOnce(Return(std::span{ events }))
+    .WillOnce([&execute, &reconnection] {
+      execute(exchange_server::fill{ .quantity = 10, .price = 10000 });
+      return std::span{ reconnection };
+    })
+    .WillOnce(Return(std::span<epoll_event>{}));
+
+  auto reconnected = std::make_shared<StrictMock<mocks::socket>>();
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }))
+    .WillOnce(
+      Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = reconnected }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*reconnected, get_fd()).WillRepeatedly(Return(301));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+  EXPECT_CALL(*epoll, add(301, EPOLLIN, 301U));
+
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("loginclient_id\norder1234 BTCUSDT+001000010000\n"))
+    .WillOnce(expect_read(""));
+  EXPECT_CALL(*market, add_order)
+    .WillOnce(::testing::DoAll(::testing::SaveArg<1>(&execute), Return(exchange_server::order_result{})));
+  ::testing::InSequence sequence;
+  std::string token;
+  EXPECT_CALL(*client, write(IsLoginMessage("seq00000000\n00000001ok\n"sv)))
+    .WillOnce([&token](std::span<const char> buffer) {
+      token.assign(buffer.data() + 5, token_line_size - 6);
+      return exchange_server::result<std::ptrdiff_t>{ .result = static_cast<std::ptrdiff_t>(buffer.size()) };
+    });
+
+  // The execution follows the resumption, the replay resends what the client may have missed and no order is left
+  std::string resume;
+  EXPECT_CALL(*reconnected, read).WillOnce([&token, &resume](std::span<char> buffer) {
+    resume = "resume" + token + "client_id\nreplay00000001\nlistorders\n";
+    return expect_read(resume)(buffer);
+  });
+  constexpr auto replayed =
+    "seq00000001\n00000002exec1234001000010000\n00000001ok\n00000002exec1234001000010000\n"sv;
+  EXPECT_CALL(*reconnected, write(IsMessage(replayed)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = replayed.size() }));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+
+  EXPECT_EQ(server.metrics().orphaned_executions, 0U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, rejects_replay_of_messages_no_longer_kept)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Only the last response is kept, the responses to the messages of a read are written at once
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("loginclient_id\norder1234 BTCUSDT+001000010000\norder1235 BTCUSDT+001000010000\n"
+                          "replay00000001\nreplay00000002\n"));
+  constexpr auto responses = "seq00000000\n00000001ok\n00000002ok\nrejected\n00000002ok\n"sv;
+  EXPECT_CALL(*client, write(IsLoginMessage(responses)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = token_line_size + responses.size() }));
+
+  exchange_server::server server{
+    listen, epoll, worker, control, market, exchange_server::server_options{ .retransmit_buffer = 1 }
+  };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, rejects_resumption_without_session_token)
+{
+  // The client logs in and disconnects, then someone else tries its session
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 301 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  auto intruder = std::make_shared<StrictMock<mocks::socket>>();
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }))
+    .WillOnce(
+      Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = intruder }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*intruder, get_fd()).WillRepeatedly(Return(301));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+  EXPECT_CALL(*epoll, add(301, EPOLLIN, 301U));
+
+  EXPECT_CALL(*client, read).WillOnce(expect_read("loginclient_id\n")).WillOnce(expect_read(""));
+  EXPECT_CALL(*client, write(IsLoginMessage("seq00000000\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = token_line_size + 12 }));
+
+  // Logging in again or resuming with another token are both rejected
+  EXPECT_CALL(*intruder, read)
+    .WillOnce(expect_read("loginclient_id\nresume00000000000000000000000000000000client_id\nlistorders\n"));
+  EXPECT_CALL(*intruder, write(IsMessage("rejected\nrejected\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 18 }));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, ends_oldest_detached_session_past_limit)
+{
+  // Two clients log in, place an order and disconnect, only one session is kept for a client away
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 301 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 301 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  auto other = std::make_shared<StrictMock<mocks::socket>>();
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }))
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = other }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*other, get_fd()).WillRepeatedly(Return(301));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+  EXPECT_CALL(*epoll, add(301, EPOLLIN, 301U));
+
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("loginalice\norder1234 BTCUSDT+001000010000\n"))
+    .WillOnce(expect_read(""));
+  EXPECT_CALL(*other, read)
+    .WillOnce(expect_read("loginbob\norder1234 BTCUSDT+001000010000\n"))
+    .WillOnce(expect_read(""));
+  EXPECT_CALL(*client, write(IsLoginMessage("seq00000000\n00000001ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = token_line_size + 23 }));
+  EXPECT_CALL(*other, write(IsLoginMessage("seq00000000\n00000001ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = token_line_size + 23 }));
+  EXPECT_CALL(*market, add_order).Times(2).WillRepeatedly(Return(exchange_server::order_result{}));
+
+  // The session of the first client ends, its order with it
+  EXPECT_CALL(*market, cancel_all(2U, ::testing::_)).WillOnce(Return(std::vector<std::string>{ "2/1234" }));
+
+  exchange_server::server server{ listen,
+    epoll,
+    worker,
+    control,
+    market,
+    exchange_server::server_options{
+      .orphan_orders = exchange_server::orphan_policy::cancel, .max_detached_sessions = 1 } };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, ignores_events_of_previous_connection_of_fd)
+{
+  // The first connection is closed and its fd reused by the next one in the same batch
+  constexpr std::uint64_t second_connection{ (std::uint64_t{ 1 } << 32U) | 300U };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = second_connection } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  auto reconnected = std::make_shared<StrictMock<mocks::socket>>();
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }))
+    .WillOnce(
+      Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = reconnected }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*reconnected, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, second_connection));
+
+  EXPECT_CALL(*client, read).WillOnce(expect_read(""));
+  EXPECT_CALL(*reconnected, read).WillOnce(expect_read("idclient_id\n"));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+
+  EXPECT_EQ(server.metrics().connections, 2U);
+}
+
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
 TEST_F(exchange_server_tests, handles_write_buffer_full)
 {
   // Events setup
-  std::array events{ epoll_event{ .data = { .fd = 100 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } },
-    epoll_event{ .events = EPOLLOUT, .data = { .fd = 300 } } };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLOUT, .data = { .u64 = 300 } } };
   EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
 
   // Client connects
   EXPECT_CALL(*listen, accept())
     .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
   EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
-  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
 
   // Client identifies and places order
   EXPECT_CALL(*client, read)
@@ -120,12 +401,12 @@ TEST_F(exchange_server_tests, handles_write_buffer_full)
   // Response is partially written
   EXPECT_CALL(*client, write(IsMessage("ok\n"sv)))
     .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 1 }));
-  EXPECT_CALL(*epoll, modify(300, EPOLLIN | EPOLLOUT));
+  EXPECT_CALL(*epoll, modify(300, EPOLLIN | EPOLLOUT, 300U));
 
   // Remaining is sent once ready
   EXPECT_CALL(*client, write(IsMessage("k\n"sv)))
     .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 2 }));
-  EXPECT_CALL(*epoll, modify(300, EPOLLIN));
+  EXPECT_CALL(*epoll, modify(300, EPOLLIN, 300U));
 
   exchange_server::server server{ listen, epoll, worker, control, market };
   server.run();
@@ -135,14 +416,14 @@ TEST_F(exchange_server_tests, handles_write_buffer_full)
 TEST_F(exchange_server_tests, handle_multiple_messages_in_match)
 {
   // Events setup
-  std::array events{ epoll_event{ .data = { .fd = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } } };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
   EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
 
   // Client connects
   EXPECT_CALL(*listen, accept())
     .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
   EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
-  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
 
   // Client identifies and places order
   EXPECT_CALL(*client, read).WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\n"));
@@ -158,17 +439,17 @@ TEST_F(exchange_server_tests, handle_multiple_messages_in_match)
 TEST_F(exchange_server_tests, can_list_orders)
 {
   // Events setup
-  std::array events{ epoll_event{ .data = { .fd = 100 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } } };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
   EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
 
   // Client connects
   EXPECT_CALL(*listen, accept())
     .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
   EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
-  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
 
   // Client identifies, places order, and lists orders
   EXPECT_CALL(*client, read)
@@ -187,21 +468,132 @@ TEST_F(exchange_server_tests, can_list_orders)
   server.run();
 }
 
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, list_responses_follow_changes)
+{
+  // Events setup
+  const epoll_event readable{ .events = EPOLLIN, .data = { .u64 = 300 } };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    readable,
+    readable,
+    readable,
+    readable,
+    readable,
+    readable,
+    readable,
+    readable };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Responses are cached, and kept up to date as orders and symbols are added or removed
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\n"))
+    .WillOnce(expect_read("listorders\n"))
+    .WillOnce(expect_read("listsymbols\n"))
+    .WillOnce(expect_read("order1234 BTCUSDT+001000010000\n"))
+    .WillOnce(expect_read("listorders\n"))
+    .WillOnce(expect_read("listsymbols\n"))
+    .WillOnce(expect_read("cancel1234\n"))
+    .WillOnce(expect_read("listorders\n"));
+  EXPECT_CALL(*market, cancel_order("1/1234")).WillOnce(Return(true));
+
+  ::testing::InSequence sequence;
+  EXPECT_CALL(*client, write(IsMessage("ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 3 }));
+  EXPECT_CALL(*client, write(IsMessage("1234 BTCUSDT+001000010000\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 26 }));
+  EXPECT_CALL(*client, write(IsMessage(" BTCUSDT\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 9 }));
+  EXPECT_CALL(*client, write(IsMessage("ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 3 }));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, cancels_all_orders_matching_filter)
+{
+  // Events setup
+  const epoll_event readable{ .events = EPOLLIN, .data = { .u64 = 300 } };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, readable, readable, readable };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Client places orders on two symbols then cancels its bids of one of them
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\norder5678 ETHUSDT+001000010000\n"))
+    .WillOnce(expect_read("masscancel BTCUSDT+\nmasscancelBTC\n"))
+    .WillOnce(expect_read("listorders\n"));
+  EXPECT_CALL(*market, add_order).Times(2);
+  const auto bids_of_symbol = ::testing::AllOf(::testing::Field(&exchange_server::cancel_filter::symbol, " BTCUSDT"),
+    ::testing::Field(&exchange_server::cancel_filter::side, ::testing::Optional(exchange_server::order_side::buy)));
+  EXPECT_CALL(*market, cancel_all(1, bids_of_symbol))
+    .WillOnce(Return(std::vector<std::string>{ "1/1234" }));
+
+  // A filter which is neither a symbol nor a side is rejected
+  ::testing::InSequence sequence;
+  EXPECT_CALL(*client, write(IsMessage("ok\nok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 6 }));
+  EXPECT_CALL(*client, write(IsMessage("ok\nrejected\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 12 }));
+  EXPECT_CALL(*client, write(IsMessage("5678 ETHUSDT+001000010000\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 26 }));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, cancels_order_whose_id_starts_like_mass_cancel)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Only that order is cancelled
+  EXPECT_CALL(*client, read).WillOnce(expect_read("idclient_id\norderall+ BTCUSDT+001000010000\ncancelall+\n"));
+  EXPECT_CALL(*market, add_order);
+  EXPECT_CALL(*market, cancel_order("1/all+")).WillOnce(Return(true));
+  EXPECT_CALL(*market, cancel_all).Times(0);
+  EXPECT_CALL(*client, write(IsMessage("ok\nok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 6 }));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+}
+
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
 TEST_F(exchange_server_tests, can_list_symbols)
 {
   // Events setup
-  std::array events{ epoll_event{ .data = { .fd = 100 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } },
-    epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } } };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
   EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
 
   // Client connects
   EXPECT_CALL(*listen, accept())
     .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
   EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
-  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
 
   // Client identifies, places order, and lists symbols
   EXPECT_CALL(*client, read)
@@ -218,4 +610,644 @@ TEST_F(exchange_server_tests, can_list_symbols)
 
   exchange_server::server server{ listen, epoll, worker, control, market };
   server.run();
-}
\ No newline at end of file
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, disconnects_client_sending_unterminated_message)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Client never ends its line, it is disconnected and its last data is never read
+  const std::string chunk(1000, 'x');
+  EXPECT_CALL(*client, read).Times(2).WillRepeatedly(expect_read(chunk));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, reads_queued_control_commands_one_at_a_time)
+{
+  // A real pipe like the server's, its read end where the fixture expects the control descriptor
+  std::array<int, 2> pipe{};
+  ASSERT_EQ(::pipe(pipe.data()), 0);
+  ASSERT_EQ(::dup2(pipe[0], 200), 200);
+  ::close(pipe[0]);
+  auto pipe_control = std::make_shared<exchange_server::socket_impl>(200);
+  const exchange_server::socket_impl writer{ pipe[1] };
+
+  // Commands written before the server reads any, like signals arriving in a row
+  for (const auto command : { exchange_server::control_command::reload_risk_limits,
+         exchange_server::control_command::reload_risk_limits,
+         exchange_server::control_command::stop })
+  {
+    const auto value = static_cast<std::uint64_t>(command);
+    ASSERT_EQ(::write(writer.get_fd(), &value, sizeof(value)), static_cast<ssize_t>(sizeof(value)));
+  }
+
+  // The server stops once it read the third one
+  std::array events{ epoll_event{ .events = EPOLLIN, .data = { .u64 = 200 } } };
+  EXPECT_CALL(*epoll, wait()).Times(3).WillRepeatedly(Return(std::span{ events }));
+
+  exchange_server::server server{ listen, epoll, worker, pipe_control, market };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, pauses_reading_while_messages_are_queued)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Messages are processed later
+  std::vector<std::function<void()>> delayed;
+  EXPECT_CALL(*worker, post).WillRepeatedly([&delayed](std::function<void()> f) { delayed.push_back(std::move(f)); });
+
+  // Client sends more messages than the queue high watermark, reading pauses
+  EXPECT_CALL(*client, read).WillOnce(expect_read("idclient_id\nlistorders\nlistorders\n"));
+  EXPECT_CALL(*epoll, modify(300, 0, 300U));
+
+  exchange_server::server server{ listen,
+    epoll,
+    worker,
+    control,
+    market,
+    exchange_server::server_options{ .connection = { .queue_high_watermark = 2, .queue_low_watermark = 1 } } };
+  server.run();
+
+  // Reading resumes once processing reaches the low watermark, empty responses are not written
+  EXPECT_CALL(*epoll, modify(300, EPOLLIN, 300U));
+  while (!delayed.empty()) { std::exchange(delayed, {}).front()(); }
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, writes_responses_of_pipelined_messages_at_once)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Messages are processed later
+  std::vector<std::function<void()>> delayed;
+  EXPECT_CALL(*worker, post).WillRepeatedly([&delayed](std::function<void()> f) { delayed.push_back(std::move(f)); });
+
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\norder5678 BTCUSDT-001000010000\n"));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+
+  // Both orders are processed in a single worker slot
+  ASSERT_EQ(delayed.size(), 1U);
+  EXPECT_CALL(*client, write(IsMessage("ok\nok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 6 }));
+  std::exchange(delayed, {}).front()();
+  EXPECT_TRUE(delayed.empty());
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, holds_responses_until_quorum_replicated)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // The market journals the order
+  auto journal = std::make_shared<exchange_server::journal>(nullptr, 1);
+  EXPECT_CALL(*market, add_order).WillOnce([&journal](const exchange_server::order &, auto) {
+    journal->append("Cb1");
+    return exchange_server::order_result{};
+  });
+
+  EXPECT_CALL(*client, read).WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\n"));
+
+  exchange_server::server server{ listen, epoll, worker, control, market, {}, nullptr, journal };
+  server.run();
+
+  // Sent once the follower acknowledged the order
+  EXPECT_CALL(*client, write(IsMessage("ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 3 }));
+  journal->on_replicated(1);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, held_responses_do_not_make_slow_consumer)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  auto journal = std::make_shared<exchange_server::journal>(nullptr, 1);
+  EXPECT_CALL(*market, add_order).WillOnce([&journal](const exchange_server::order &, auto) {
+    journal->append("Cb1");
+    return exchange_server::order_result{};
+  });
+
+  EXPECT_CALL(*client, read).WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\n"));
+
+  // The response held past the client outbound limit does not disconnect it, the client could not have read it
+  exchange_server::server server{ listen,
+    epoll,
+    worker,
+    control,
+    market,
+    exchange_server::server_options{ .connection = { .max_write_buffer = 2 } },
+    nullptr,
+    journal };
+  server.run();
+
+  EXPECT_CALL(*client, write(IsMessage("ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 3 }));
+  journal->on_replicated(1);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, successor_takes_over_sessions_and_connections)
+{
+  // Descriptors are really handed off: the client is one end of a socket pair
+  std::array<int, 2> connection{};
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, connection.data()), 0);
+  const auto client_fd = connection[0];
+  const exchange_server::socket_impl peer{ connection[1] };
+  const auto client_key = static_cast<std::uint64_t>(client_fd);
+
+  // The server handing off has its own listener, a real socket
+  const exchange_server::socket_impl listening{ ::socket(AF_UNIX, SOCK_STREAM, 0) };
+  auto handing_off_listen = std::make_shared<StrictMock<mocks::listen_socket>>();
+  auto handing_off_epoll = std::make_shared<StrictMock<mocks::epoll>>();
+  auto handoff = std::make_shared<StrictMock<mocks::listen_socket>>();
+  EXPECT_CALL(*handing_off_listen, get_fd()).WillRepeatedly(Return(listening.get_fd()));
+  EXPECT_CALL(*handoff, get_fd()).WillRepeatedly(Return(400));
+  const auto listener_key = static_cast<std::uint64_t>(listening.get_fd());
+  EXPECT_CALL(*handing_off_epoll, add(listening.get_fd(), EPOLLIN, listener_key));
+  EXPECT_CALL(*handing_off_epoll, add(200, EPOLLIN, 200U));
+  EXPECT_CALL(*handing_off_epoll, add(400, EPOLLIN, 400U));
+
+  // Client connects, logs in and places an order, then the successor connects
+  std::array events{ epoll_event{ .data = { .u64 = listener_key } },
+    epoll_event{ .events = EPOLLIN, .data = { .u64 = client_key } } };
+  std::array successor_connects{ epoll_event{ .events = EPOLLIN, .data = { .u64 = 400 } } };
+  EXPECT_CALL(*handing_off_epoll, wait())
+    .WillOnce(Return(std::span{ events }))
+    .WillOnce(Return(std::span{ successor_connects }));
+
+  EXPECT_CALL(*handing_off_listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(client_fd));
+  EXPECT_CALL(*handing_off_epoll, add(client_fd, EPOLLIN, client_key));
+  EXPECT_CALL(*client, read).WillOnce(expect_read("loginalice\norder1234 BTCUSDT+001000010000\n"));
+  EXPECT_CALL(*client, write(IsLoginMessage("seq00000000\n00000001ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = token_line_size + 23 }));
+
+  std::array<int, 2> channel{};
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, channel.data()), 0);
+  const exchange_server::socket_impl receiver{ channel[1] };
+  EXPECT_CALL(*handoff, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{
+      .result = std::make_shared<exchange_server::socket_impl>(channel[0]) }));
+
+  // Books of the market the order rests in
+  exchange_server::market books;
+  books.add_order(exchange_server::order{ .id = "2/1234",
+                    .symbol = " BTCUSDT",
+                    .way = exchange_server::order_side::buy,
+                    .quantity = 1,
+                    .price = 10000,
+                    .owner = 2 },
+    [](const exchange_server::fill &) {});
+
+  exchange_server::server server{
+    handing_off_listen, handing_off_epoll, worker, control, market, {}, nullptr, nullptr, handoff
+  };
+  server.run();
+  ASSERT_TRUE(server.handoff_requested());
+  ASSERT_FALSE(server.hand_off(books));
+
+  auto [state, err] = exchange_server::receive_handoff(receiver.get_fd());
+  ASSERT_FALSE(err);
+  EXPECT_EQ(state.last_session_id, 2U);
+  EXPECT_EQ(state.resting_orders.size(), 1U);
+  ASSERT_EQ(state.sessions.size(), 1U);
+  EXPECT_EQ(state.sessions[0].name, "alice");
+  EXPECT_EQ(state.sessions[0].outstanding_orders.size(), 1U);
+  ASSERT_EQ(state.connections.size(), 1U);
+  EXPECT_EQ(state.connections[0].session, 2U);
+
+  // The successor reads the next order of the client from the same connection and numbers its response on
+  const auto taken_over_fd = state.connections[0].fd;
+  const auto taken_over_key = static_cast<std::uint64_t>(taken_over_fd);
+  EXPECT_CALL(*epoll, add(taken_over_fd, EPOLLIN, taken_over_key));
+  std::array next_order{ epoll_event{ .events = EPOLLIN, .data = { .u64 = taken_over_key } } };
+  EXPECT_CALL(*epoll, wait())
+    .WillOnce(Return(std::span{ next_order }))
+    .WillOnce(Return(std::span<epoll_event>{}));
+
+  ::close(state.listener_fd);
+  exchange_server::server successor{ listen, epoll, worker, control, market };
+  successor.take_over(std::move(state));
+
+  constexpr std::string_view order_message{ "order5678 BTCUSDT+001000010000\n" };
+  ASSERT_EQ(::write(peer.get_fd(), order_message.data(), order_message.size()),
+    static_cast<ssize_t>(order_message.size()));
+  successor.run();
+
+  std::array<char, 64> response{};
+  const auto size = ::read(peer.get_fd(), response.data(), response.size());
+  ASSERT_GT(size, 0);
+  EXPECT_EQ(std::string_view(response.data(), static_cast<std::size_t>(size)), "00000002ok\n");
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, serves_on_when_handoff_fails)
+{
+  auto handoff = std::make_shared<StrictMock<mocks::listen_socket>>();
+  EXPECT_CALL(*handoff, get_fd()).WillRepeatedly(Return(400));
+  EXPECT_CALL(*epoll, add(400, EPOLLIN, 400U));
+
+  // Client connects and identifies, then the successor connects but is gone before the state is sent
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  std::array successor_connects{ epoll_event{ .events = EPOLLIN, .data = { .u64 = 400 } } };
+  std::array next_order{ epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait())
+    .WillOnce(Return(std::span{ events }))
+    .WillOnce(Return(std::span{ successor_connects }))
+    .WillOnce(Return(std::span{ next_order }))
+    .WillOnce(Return(std::span<epoll_event>{}));
+
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  std::array<int, 2> channel{};
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, channel.data()), 0);
+  ::close(channel[1]);
+  EXPECT_CALL(*handoff, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{
+      .result = std::make_shared<exchange_server::socket_impl>(channel[0]) }));
+
+  // The connection is served again once the handoff failed
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\n"))
+    .WillOnce(expect_read("order1234 BTCUSDT+001000010000\n"));
+  EXPECT_CALL(*client, write(IsMessage("ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 3 }));
+
+  exchange_server::market books;
+  exchange_server::server server{ listen, epoll, worker, control, market, {}, nullptr, nullptr, handoff };
+  server.run();
+  ASSERT_TRUE(server.handoff_requested());
+  EXPECT_TRUE(server.hand_off(books));
+  EXPECT_FALSE(server.handoff_requested());
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, disconnects_slow_consumer)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Client places an order but does not read its response
+  EXPECT_CALL(*client, read).WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\n"));
+  EXPECT_CALL(*client, write(IsMessage("ok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{
+      .err = std::make_error_code(std::errc::resource_unavailable_try_again) }));
+
+  // Response does not fit in the client outbound limit
+  EXPECT_CALL(*client, shutdown()).WillOnce(Return(std::error_code{}));
+
+  exchange_server::server server{
+    listen, epoll, worker, control, market, exchange_server::server_options{ .connection = { .max_write_buffer = 2 } }
+  };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, disconnects_client_which_does_not_identify_in_time)
+{
+  // Events setup, the reactor waits for the login timer once the client is connected
+  std::array connect{ epoll_event{ .data = { .u64 = 100 } } };
+  std::array closed{ epoll_event{ .events = EPOLLHUP, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait())
+    .WillOnce(Return(std::span{ connect }))
+    .WillOnce(Return(std::span{ closed }))
+    .WillOnce(Return(std::span<epoll_event>{}));
+  EXPECT_CALL(*epoll, wait_for).WillRepeatedly([](std::chrono::milliseconds timeout) {
+    std::this_thread::sleep_for(timeout);
+    return std::span<epoll_event>{};
+  });
+
+  // Client connects and stays silent
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // The connection is shut down when the timer expires, then reported closed
+  EXPECT_CALL(*client, shutdown()).WillOnce(Return(std::error_code{}));
+  EXPECT_CALL(*client, read).WillOnce(expect_read(""));
+
+  exchange_server::server server{
+    listen, epoll, worker, control, market, exchange_server::server_options{ .login_timeout = 10ms }
+  };
+  server.run();
+  EXPECT_EQ(server.metrics().timed_out_connections, 1);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, throttles_orders_above_session_rate)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Client sends two orders at once while allowed one
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\norder1235 BTCUSDT+001000010000\n"));
+
+  // Second one never reaches the market
+  EXPECT_CALL(*market, add_order);
+  EXPECT_CALL(*client, write(IsMessage("ok\nrejected\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 12 }));
+
+  exchange_server::server server{ listen,
+    epoll,
+    worker,
+    control,
+    market,
+    exchange_server::server_options{ .throttle = { .session_rate = 1, .session_burst = 1 } } };
+  server.run();
+
+  EXPECT_EQ(server.metrics().throttled_messages, 1U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, throttles_quote_entries_per_symbol)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // A quote over the entries limit, then one with two orders of a symbol allowed one, then an order of another symbol
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\n"
+                          "quote1234 BTCUSDT+001000010000;1235 ETHUSDT+001000010000;1236 SOLUSDT+001000010000\n"
+                          "quote1234 BTCUSDT+001000010000;1235 BTCUSDT+001000010000\n"
+                          "order1236 ETHUSDT+001000010000\n"));
+
+  // Only the order reaches the market
+  EXPECT_CALL(*market, mass_quote).Times(0);
+  EXPECT_CALL(*market, add_order);
+  EXPECT_CALL(*client, write(IsMessage("rejected\nrejected\nok\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 21 }));
+
+  exchange_server::server server{ listen,
+    epoll,
+    worker,
+    control,
+    market,
+    exchange_server::server_options{
+      .throttle = { .symbol_rate = 1, .symbol_burst = 1, .max_quote_entries = 2 } } };
+  server.run();
+
+  EXPECT_EQ(server.metrics().throttled_messages, 2U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, rejects_order_breaching_risk_limits)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Client places an order larger than allowed
+  EXPECT_CALL(*client, read).WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\n"));
+
+  EXPECT_CALL(*market, add_order).Times(0);
+  EXPECT_CALL(*client, write(IsMessage("rejected\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 9 }));
+
+  exchange_server::server server{
+    listen, epoll, worker, control, market, exchange_server::server_options{ .risk = { .max_order_quantity = 5 } }
+  };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, rejects_market_order_under_notional_limit)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // A market order priced at zero would have no notional, yet sweep every level of the book
+  EXPECT_CALL(*client, read).WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+999900000000MI\n"));
+
+  EXPECT_CALL(*market, add_order).Times(0);
+  EXPECT_CALL(*client, write(IsMessage("rejected\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 9 }));
+
+  exchange_server::server server{
+    listen, epoll, worker, control, market, exchange_server::server_options{ .risk = { .max_order_notional = 1e6 } }
+  };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, reports_immediate_executions_of_orders_which_do_not_rest)
+{
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // An immediate or cancel order partially executes, a fill or kill one cannot fully execute
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read(
+      "idclient_id\norder1234 BTCUSDT+001000010000LI\norder1235 BTCUSDT+001000010000LF\ncancel1234\n"));
+  EXPECT_CALL(*market, add_order)
+    .WillOnce(Return(exchange_server::order_result{ .status = exchange_server::order_status::done,
+      .fills = { { .quantity = 4, .price = 9999 } } }))
+    .WillOnce(Return(exchange_server::order_result{ .status = exchange_server::order_status::rejected }));
+
+  // Neither is left to cancel
+  EXPECT_CALL(*market, cancel_order).Times(0);
+  ::testing::InSequence sequence;
+  constexpr auto responses = "ok\nexec1234000400009999\nrejected\n"sv;
+  EXPECT_CALL(*client, write(IsMessage(responses)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = responses.size() }));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, applies_quote_in_one_market_operation)
+{
+  // Events setup
+  const epoll_event readable{ .events = EPOLLIN, .data = { .u64 = 300 } };
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, readable, readable, readable };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // A quote places an order and an immediate one around a malformed entry, the next one replaces the first order
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\nquote1234 BTCUSDT+001000010000;bad;5678 BTCUSDT-001000010100LI\n"))
+    .WillOnce(expect_read("quote1234 BTCUSDT+002000010000\n"))
+    .WillOnce(expect_read("listorders\n"));
+  EXPECT_CALL(*market, add_order).Times(0);
+  EXPECT_CALL(*market, update_order).Times(0);
+  EXPECT_CALL(*market, mass_quote(::testing::SizeIs(2)))
+    .WillOnce(Return(std::vector<exchange_server::order_result>{ {},
+      { .status = exchange_server::order_status::done, .fills = { { .quantity = 4, .price = 10100 } } } }));
+  EXPECT_CALL(*market,
+    mass_quote(::testing::ElementsAre(::testing::Field(&exchange_server::quote_entry::replace, true))))
+    .WillOnce(Return(std::vector<exchange_server::order_result>{ {} }));
+
+  ::testing::InSequence sequence;
+  constexpr auto quoted = "quoteARA\nexec5678000400010100\n"sv;
+  EXPECT_CALL(*client, write(IsMessage(quoted)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = quoted.size() }));
+  EXPECT_CALL(*client, write(IsMessage("quoteA\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 7 }));
+  EXPECT_CALL(*client, write(IsMessage("1234 BTCUSDT+002000010000\n"sv)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 26 }));
+
+  exchange_server::server server{ listen, epoll, worker, control, market };
+  server.run();
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST_F(exchange_server_tests, conflates_market_data_for_slow_subscriber)
+{
+  auto publisher = std::make_shared<exchange_server::market_data_publisher>();
+
+  // Events setup
+  std::array events{ epoll_event{ .data = { .u64 = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .u64 = 300 } } };
+  std::array writable{ epoll_event{ .events = EPOLLOUT, .data = { .u64 = 300 } } };
+  EXPECT_CALL(*epoll, wait())
+    .WillOnce(Return(std::span{ events }))
+    .WillOnce([&publisher, &writable] {
+      // Published while the client is not reading, only the latest quantity of the level is sent
+      using exchange_server::order_side;
+      publisher->on_level_update(exchange_server::price_level_update{ " BTCUSDT", order_side::buy, 100, 5 });
+      publisher->on_level_update(exchange_server::price_level_update{ " BTCUSDT", order_side::buy, 100, 7 });
+      return std::span{ writable };
+    })
+    .WillOnce(Return(std::span<epoll_event>{}));
+
+  // Client connects
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN, 300U));
+
+  // Client places an order then subscribes to its symbol, but does not read the acknowledgements
+  EXPECT_CALL(*client, read)
+    .WillOnce(expect_read("idclient_id\norder1234 BTCUSDT+001000010000\nsubscribe BTCUSDT\nsubscribe ETHUSDT\n"));
+
+  // The acknowledgements and the snapshot are processed in the same batch, symbols without orders are rejected
+  ::testing::InSequence sequence;
+  constexpr auto subscribed = "ok\nok\nrejected\nsnapshot BTCUSDT0000\n"sv;
+  EXPECT_CALL(*client, write(IsMessage(subscribed)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{
+      .err = std::make_error_code(std::errc::resource_unavailable_try_again) }));
+  EXPECT_CALL(*epoll, modify(300, EPOLLOUT, 300U));
+
+  // Until the socket is writable again
+  EXPECT_CALL(*client, write(IsMessage(subscribed)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = subscribed.size() }));
+  EXPECT_CALL(*epoll, modify(300, EPOLLIN, 300U));
+  constexpr auto market_data = "level BTCUSDT+0000000700000100\n"sv;
+  EXPECT_CALL(*client, write(IsMessage(market_data)))
+    .WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = market_data.size() }));
+
+  exchange_server::server server{ listen,
+    epoll,
+    worker,
+    control,
+    market,
+    exchange_server::server_options{ .connection = { .write_high_watermark = 1, .write_low_watermark = 0 } },
+    publisher };
+  server.run();
+
+  EXPECT_EQ(server.metrics().conflated_updates, 1U);
+}
@@ -0,0 +1,103 @@
+#include "handoff.h"
+#include <array>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using exchange_server::order;
+using exchange_server::order_side;
+
+namespace {
+exchange_server::handoff_state make_state()
+{
+  return exchange_server::handoff_state{ .last_session_id = 7,
+    .symbols = { " BTCUSDT", " ETHUSDT" },
+    .resting_orders = { order{ .id = "5/b1",
+      .symbol = " BTCUSDT",
+      .way = order_side::buy,
+      .quantity = 10,
+      .price = 100,
+      .owner = 5 } },
+    .sessions = { exchange_server::handoff_session{ .id = 5,
+      .name = "alice",
+      .token = "0123456789abcdef0123456789abcdef",
+      .last_sequence = 42,
+      .outstanding_orders = { order{ .id = "b1", .symbol = " BTCUSDT", .way = order_side::buy, .quantity = 10 } },
+      .positions = { { " ETHUSDT", -3 } },
+      .detached_executions = { { "s1", exchange_server::fill{ .quantity = 3, .price = 20 } } } } },
+    .connections = { exchange_server::handoff_connection{ .session = 5,
+      .identified = true,
+      .name = "alice",
+      .subscriptions = { " BTCUSDT" },
+      .read_buffer = "order12",
+      .write_buffer = "00000042ok\n" } } };
+}
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(handoff_tests, parses_serialized_state)
+{
+  const auto data = exchange_server::serialize_handoff(make_state());
+  const auto [state, err] = exchange_server::parse_handoff(data);
+  ASSERT_FALSE(err);
+
+  EXPECT_EQ(state.last_session_id, 7U);
+  EXPECT_EQ(state.symbols, (std::vector<std::string>{ " BTCUSDT", " ETHUSDT" }));
+  ASSERT_EQ(state.resting_orders.size(), 1U);
+  EXPECT_EQ(state.resting_orders[0].id, "5/b1");
+  EXPECT_EQ(state.resting_orders[0].owner, 5U);
+
+  ASSERT_EQ(state.sessions.size(), 1U);
+  const auto &session = state.sessions[0];
+  EXPECT_EQ(session.name, "alice");
+  EXPECT_EQ(session.token, "0123456789abcdef0123456789abcdef");
+  EXPECT_EQ(session.last_sequence, 42U);
+  ASSERT_EQ(session.outstanding_orders.size(), 1U);
+  EXPECT_EQ(session.outstanding_orders[0].quantity, 10U);
+  EXPECT_EQ(session.positions, (std::vector<std::pair<std::string, std::int64_t>>{ { " ETHUSDT", -3 } }));
+  ASSERT_EQ(session.detached_executions.size(), 1U);
+  EXPECT_EQ(session.detached_executions[0].second.price, 20);
+
+  ASSERT_EQ(state.connections.size(), 1U);
+  const auto &connection = state.connections[0];
+  EXPECT_TRUE(connection.identified);
+  EXPECT_EQ(connection.subscriptions, std::vector<std::string>{ " BTCUSDT" });
+  EXPECT_EQ(connection.read_buffer, "order12");
+  EXPECT_EQ(connection.write_buffer, "00000042ok\n");
+
+  // Truncated
+  EXPECT_EQ(exchange_server::parse_handoff(std::string_view{ data }.substr(0, data.size() - 1)).err,
+    std::errc::bad_message);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(handoff_tests, sends_descriptors_with_state)
+{
+  std::array<int, 2> channel{};
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, channel.data()), 0);
+  std::array<int, 2> pipe{};
+  ASSERT_EQ(::pipe(pipe.data()), 0);
+
+  // The listener and the connection stand for the read and write ends of the pipe
+  auto sent = make_state();
+  sent.listener_fd = pipe[0];
+  sent.connections[0].fd = pipe[1];
+  ASSERT_FALSE(exchange_server::send_handoff(channel[0], sent));
+
+  const auto [received, err] = exchange_server::receive_handoff(channel[1]);
+  ASSERT_FALSE(err);
+  EXPECT_EQ(received.connections[0].name, "alice");
+
+  // The descriptors received are new ones for the same pipe, in the same places
+  EXPECT_NE(received.listener_fd, pipe[0]);
+  const char byte{ 'x' };
+  ASSERT_EQ(::write(received.connections[0].fd, &byte, 1), 1);
+  char read_byte{};
+  ASSERT_EQ(::read(received.listener_fd, &read_byte, 1), 1);
+  EXPECT_EQ(read_byte, byte);
+
+  for (const auto fd : { channel[0], channel[1], pipe[0], pipe[1], received.listener_fd, received.connections[0].fd })
+  {
+    ::close(fd);
+  }
+}
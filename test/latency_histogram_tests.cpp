@@ -0,0 +1,47 @@
+#include "latency_histogram.h"
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(latency_histogram_tests, reports_percentiles_within_precision)
+{
+  exchange_server::latency_histogram histogram;
+  for (int i = 1; i <= 10'000; ++i) { histogram.record(std::chrono::microseconds{ i }); }
+
+  EXPECT_EQ(histogram.count(), 10'000U);
+  EXPECT_EQ(histogram.min(), 1us);
+  EXPECT_EQ(histogram.max(), 10'000us);
+  EXPECT_NEAR(static_cast<double>(histogram.percentile(50).count()), 5'000'000, 5'000'000 * 0.01);
+  EXPECT_NEAR(static_cast<double>(histogram.percentile(99).count()), 9'900'000, 9'900'000 * 0.01);
+  EXPECT_EQ(histogram.percentile(100), 10'000us);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(latency_histogram_tests, corrects_coordinated_omission)
+{
+  exchange_server::latency_histogram histogram;
+  for (int i = 0; i < 99; ++i) { histogram.record_corrected(1ms, 10ms); }
+
+  // A single 1s stall hides the 99 samples which should have been taken meanwhile
+  histogram.record_corrected(1s, 10ms);
+
+  EXPECT_EQ(histogram.count(), 99U + 100U);
+  EXPECT_GT(histogram.percentile(75), 400ms);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(latency_histogram_tests, can_merge)
+{
+  exchange_server::latency_histogram first;
+  exchange_server::latency_histogram second;
+  first.record(10us);
+  second.record(20us);
+
+  first.merge(second);
+
+  EXPECT_EQ(first.count(), 2U);
+  EXPECT_EQ(first.min(), 10us);
+  EXPECT_EQ(first.max(), 20us);
+  EXPECT_EQ(first.mean(), 15us);
+}
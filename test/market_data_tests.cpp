@@ -0,0 +1,142 @@
+#include "market.h"
+#include "market_data.h"
+#include <gtest/gtest.h>
+
+using exchange_server::order;
+using exchange_server::order_side;
+using exchange_server::price_level_update;
+
+namespace {
+class recording_subscriber : public exchange_server::market_data_subscriber
+{
+public:
+  void deliver(std::shared_ptr<const std::string> message, std::optional<exchange_server::level_key> key) override
+  {
+    messages.push_back(std::move(message));
+    keys.push_back(key);
+  }
+
+  std::vector<std::shared_ptr<const std::string>> messages;
+  std::vector<std::optional<exchange_server::level_key>> keys;
+};
+
+class recording_sink : public exchange_server::market_data_sink
+{
+public:
+  void on_level_update(const price_level_update &update) override { updates.push_back(update); }
+  void on_trade(const exchange_server::trade_report & /*trade*/) override {}
+
+  std::vector<price_level_update> updates;
+};
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_data_tests, sends_snapshot_then_updates)
+{
+  exchange_server::market_data_publisher publisher;
+  publisher.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 5 });
+  publisher.on_level_update(price_level_update{ " BTCUSDT", order_side::sell, 110, 2 });
+
+  auto subscriber = std::make_shared<recording_subscriber>();
+  ASSERT_TRUE(publisher.subscribe(" BTCUSDT", subscriber));
+  EXPECT_FALSE(publisher.subscribe(" BTCUSDT", subscriber));
+
+  publisher.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 0 });
+  publisher.on_trade(exchange_server::trade_report{ " BTCUSDT", 100, 5 });
+  publisher.on_level_update(price_level_update{ " ETHUSDT", order_side::buy, 100, 5 });
+
+  ASSERT_EQ(subscriber->messages.size(), 3U);
+  EXPECT_EQ(*subscriber->messages[0],
+    "snapshot BTCUSDT0002\n"
+    "level BTCUSDT+0000000500000100\n"
+    "level BTCUSDT-0000000200000110\n");
+  EXPECT_EQ(*subscriber->messages[1], "level BTCUSDT+0000000000000100\n");
+  EXPECT_EQ(*subscriber->messages[2], "trade BTCUSDT0000000500000100\n");
+
+  // Only level updates can be conflated
+  EXPECT_FALSE(subscriber->keys[0]);
+  EXPECT_TRUE(subscriber->keys[1]);
+  EXPECT_FALSE(subscriber->keys[2]);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_data_tests, shares_encoded_updates)
+{
+  exchange_server::market_data_publisher publisher;
+  auto first = std::make_shared<recording_subscriber>();
+  auto second = std::make_shared<recording_subscriber>();
+  auto gone = std::make_shared<recording_subscriber>();
+  publisher.subscribe(" BTCUSDT", first);
+  publisher.subscribe(" BTCUSDT", second);
+  publisher.subscribe(" BTCUSDT", gone);
+  gone.reset();
+
+  publisher.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 5 });
+
+  ASSERT_EQ(first->messages.size(), 2U);
+  ASSERT_EQ(second->messages.size(), 2U);
+  EXPECT_EQ(first->messages[1], second->messages[1]);
+  EXPECT_EQ(first->keys[1], second->keys[1]);
+
+  ASSERT_TRUE(publisher.unsubscribe(" BTCUSDT", *second));
+  EXPECT_FALSE(publisher.unsubscribe(" BTCUSDT", *second));
+  publisher.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 6 });
+
+  EXPECT_EQ(first->messages.size(), 3U);
+  EXPECT_EQ(second->messages.size(), 2U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_data_tests, updates_published_during_snapshot_follow_it)
+{
+  exchange_server::market_data_publisher publisher;
+
+  // The market changes the book while the snapshot is being delivered, outside the lock of the publisher
+  class publishing_subscriber : public recording_subscriber
+  {
+  public:
+    explicit publishing_subscriber(exchange_server::market_data_publisher &publisher) : _publisher{ publisher } {}
+
+    void deliver(std::shared_ptr<const std::string> message, std::optional<exchange_server::level_key> key) override
+    {
+      recording_subscriber::deliver(std::move(message), key);
+      if (messages.size() == 1)
+      {
+        _publisher.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 5 });
+      }
+    }
+
+  private:
+    exchange_server::market_data_publisher &_publisher;
+  };
+
+  auto subscriber = std::make_shared<publishing_subscriber>(publisher);
+  ASSERT_TRUE(publisher.subscribe(" BTCUSDT", subscriber));
+  publisher.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 6 });
+
+  ASSERT_EQ(subscriber->messages.size(), 3U);
+  EXPECT_EQ(*subscriber->messages[0], "snapshot BTCUSDT0000\n");
+  EXPECT_EQ(*subscriber->messages[1], "level BTCUSDT+0000000500000100\n");
+  EXPECT_EQ(*subscriber->messages[2], "level BTCUSDT+0000000600000100\n");
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_data_tests, market_reports_aggregated_levels)
+{
+  auto sink = std::make_shared<recording_sink>();
+  exchange_server::market market{ sink };
+
+  market.add_order(order{ "1", " BTCUSDT", order_side::buy, 5, 100 }, [](const exchange_server::fill &) {});
+  market.add_order(order{ "2", " BTCUSDT", order_side::buy, 3, 100 }, [](const exchange_server::fill &) {});
+  market.update_order(order{ "2", " BTCUSDT", order_side::buy, 3, 101 });
+  market.cancel_order("1");
+
+  ASSERT_EQ(sink->updates.size(), 5U);
+  EXPECT_EQ(sink->updates[0].quantity, 5U);
+  EXPECT_EQ(sink->updates[1].quantity, 8U);
+  EXPECT_EQ(sink->updates[2].quantity, 5U);
+  EXPECT_EQ(sink->updates[3].price, 101);
+  EXPECT_EQ(sink->updates[3].quantity, 3U);
+  EXPECT_EQ(sink->updates[4].price, 100);
+  EXPECT_EQ(sink->updates[4].quantity, 0U);
+}
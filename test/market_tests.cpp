@@ -0,0 +1,183 @@
+#include "market.h"
+#include <algorithm>
+#include <gtest/gtest.h>
+
+using exchange_server::fill;
+using exchange_server::order;
+using exchange_server::order_side;
+using exchange_server::order_status;
+using exchange_server::order_type;
+using exchange_server::time_in_force;
+
+namespace {
+struct recorded_fills
+{
+  std::function<void(const fill &)> callback()
+  {
+    return [this](const fill &fill) { fills.push_back(fill); };
+  }
+
+  std::vector<fill> fills;
+};
+
+// Quantity and price of each fill
+using executions = std::vector<std::pair<std::uint64_t, double>>;
+
+void ignore_fills(const fill & /*fill*/) {}
+
+executions as_pairs(const std::vector<fill> &fills)
+{
+  executions pairs;
+  for (const auto &fill : fills) { pairs.emplace_back(fill.quantity, fill.price); }
+  return pairs;
+}
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_tests, matches_by_price_then_time)
+{
+  exchange_server::market market;
+  recorded_fills first;
+  recorded_fills second;
+  recorded_fills third;
+  ASSERT_EQ(market.add_order(order{ "1", "A", order_side::sell, 5, 101 }, first.callback()).status,
+    order_status::rested);
+  ASSERT_EQ(market.add_order(order{ "2", "A", order_side::sell, 5, 100 }, second.callback()).status,
+    order_status::rested);
+  ASSERT_EQ(market.add_order(order{ "3", "A", order_side::sell, 5, 100 }, third.callback()).status,
+    order_status::rested);
+
+  // Executions happen at the price of the resting orders
+  const auto result = market.add_order(order{ "4", "A", order_side::buy, 12, 101 }, ignore_fills);
+  EXPECT_EQ(result.status, order_status::done);
+  EXPECT_EQ(as_pairs(result.fills), (executions{ { 5, 100 }, { 5, 100 }, { 2, 101 } }));
+  EXPECT_EQ(as_pairs(second.fills), (executions{ { 5, 100 } }));
+  EXPECT_EQ(as_pairs(first.fills), (executions{ { 2, 101 } }));
+
+  // What is left of the first order rests, a buy below it rests too
+  EXPECT_TRUE(market.cancel_order("1"));
+  EXPECT_FALSE(market.cancel_order("2"));
+  EXPECT_EQ(market.add_order(order{ "5", "A", order_side::buy, 1, 101 }, ignore_fills).status, order_status::rested);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_tests, immediate_orders_never_rest)
+{
+  exchange_server::market market;
+  market.add_order(order{ "1", "A", order_side::sell, 5, 100 }, ignore_fills);
+  market.add_order(order{ "2", "A", order_side::sell, 5, 102 }, ignore_fills);
+
+  // Not enough at or below 101 to fill the whole order
+  EXPECT_EQ(market
+              .add_order(order{ "3", "A", order_side::buy, 8, 101, order_type::limit, time_in_force::fill_or_kill },
+                ignore_fills)
+              .status,
+    order_status::rejected);
+
+  const auto partial =
+    market.add_order(order{ "4", "A", order_side::buy, 8, 101, order_type::limit, time_in_force::immediate_or_cancel },
+      ignore_fills);
+  EXPECT_EQ(partial.status, order_status::done);
+  EXPECT_EQ(as_pairs(partial.fills), (executions{ { 5, 100 } }));
+  EXPECT_FALSE(market.cancel_order("4"));
+
+  // Market orders sweep whatever price, the rest is cancelled
+  const auto sweep = market.add_order(
+    order{ "5", "A", order_side::buy, 8, 0, order_type::market, time_in_force::immediate_or_cancel }, ignore_fills);
+  EXPECT_EQ(sweep.status, order_status::done);
+  EXPECT_EQ(as_pairs(sweep.fills), (executions{ { 5, 102 } }));
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_tests, post_only_and_updates_never_cross)
+{
+  exchange_server::market market;
+  market.add_order(order{ "1", "A", order_side::sell, 5, 100 }, ignore_fills);
+
+  EXPECT_EQ(market.add_order(order{ "2", "A", order_side::buy, 5, 100, order_type::post_only }, ignore_fills).status,
+    order_status::rejected);
+  EXPECT_EQ(market.add_order(order{ "2", "A", order_side::buy, 5, 99, order_type::post_only }, ignore_fills).status,
+    order_status::rested);
+
+  EXPECT_FALSE(market.update_order(order{ "2", "A", order_side::buy, 5, 100 }));
+  EXPECT_TRUE(market.update_order(order{ "2", "A", order_side::buy, 3, 98 }));
+
+  // Ids are unique in the market
+  EXPECT_EQ(market.add_order(order{ "2", "A", order_side::buy, 5, 90 }, ignore_fills).status, order_status::rejected);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_tests, cancels_all_resting_orders_of_owner)
+{
+  exchange_server::market market;
+  const auto rest = [&market](order order, std::uint64_t owner) {
+    order.owner = owner;
+    market.add_order(order, ignore_fills);
+  };
+  rest({ "1", "A", order_side::buy, 5, 99 }, 1);
+  rest({ "2", "A", order_side::sell, 5, 101 }, 1);
+  rest({ "3", "B", order_side::buy, 5, 99 }, 1);
+  rest({ "4", "B", order_side::buy, 5, 98 }, 1);
+  rest({ "5", "A", order_side::buy, 5, 99 }, 2);
+
+  // Fully executed orders leave the list of their owner
+  market.add_order(order{ "6", "B", order_side::sell, 5, 99 }, ignore_fills);
+
+  using ids = std::vector<std::string>;
+  EXPECT_EQ(market.cancel_all(1, { .symbol = "A", .side = order_side::buy }), ids{ "1" });
+  auto remaining = market.cancel_all(1, {});
+  std::sort(remaining.begin(), remaining.end());
+  EXPECT_EQ(remaining, (ids{ "2", "4" }));
+  EXPECT_TRUE(market.cancel_all(1, {}).empty());
+  EXPECT_TRUE(market.cancel_order("5"));
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_tests, mass_quote_applies_entries_in_order)
+{
+  exchange_server::market market;
+  market.add_order(order{ "1", "A", order_side::sell, 5, 101 }, ignore_fills);
+
+  // Later entries see the book as the previous ones left it
+  std::vector<exchange_server::quote_entry> entries;
+  entries.push_back({ .order = { "2", "A", order_side::buy, 5, 99 }, .callback = ignore_fills });
+  entries.push_back({ .order = { "2", "A", order_side::buy, 6, 100 }, .replace = true });
+  entries.push_back({ .order = { "3", "A", order_side::sell, 2, 100 }, .callback = ignore_fills });
+  entries.push_back({ .order = { "4", "A", order_side::buy, 5, 100 }, .replace = true });
+  const auto results = market.mass_quote(std::move(entries));
+
+  ASSERT_EQ(results.size(), 4);
+  EXPECT_EQ(results[0].status, order_status::rested);
+  EXPECT_EQ(results[1].status, order_status::rested);
+  EXPECT_EQ(results[2].status, order_status::done);
+  EXPECT_EQ(as_pairs(results[2].fills), (executions{ { 2, 100 } }));
+  EXPECT_EQ(results[3].status, order_status::rejected);
+  EXPECT_TRUE(market.cancel_order("2"));
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(market_tests, auction_uncrosses_at_maximum_volume_price)
+{
+  exchange_server::market market{ nullptr, exchange_server::market_options{ .auction_symbols = { "A" } } };
+  recorded_fills partial;
+  recorded_fills unfilled;
+
+  // Orders only rest until the auction, even crossing ones
+  EXPECT_EQ(market.add_order(order{ "1", "A", order_side::sell, 8, 98 }, ignore_fills).status, order_status::rested);
+  EXPECT_EQ(market.add_order(order{ "2", "A", order_side::sell, 6, 100 }, ignore_fills).status, order_status::rested);
+  EXPECT_EQ(market.add_order(order{ "3", "A", order_side::sell, 10, 103 }, ignore_fills).status, order_status::rested);
+  EXPECT_EQ(market.add_order(order{ "4", "A", order_side::buy, 10, 102 }, ignore_fills).status, order_status::rested);
+  EXPECT_EQ(market.add_order(order{ "5", "A", order_side::buy, 5, 101 }, partial.callback()).status,
+    order_status::rested);
+  EXPECT_EQ(market.add_order(order{ "6", "A", order_side::buy, 10, 99 }, unfilled.callback()).status,
+    order_status::rested);
+  const order immediate{ "7", "A", order_side::buy, 1, 110, order_type::limit, time_in_force::immediate_or_cancel };
+  EXPECT_EQ(market.add_order(immediate, ignore_fills).status, order_status::rejected);
+
+  // 14 execute at either 100 or 101 with 1 left over, the lowest wins
+  market.uncross();
+  EXPECT_EQ(as_pairs(partial.fills), (executions{ { 4, 100 } }));
+  EXPECT_TRUE(unfilled.fills.empty());
+  for (const auto *id : { "1", "2", "4" }) { EXPECT_FALSE(market.cancel_order(id)); }
+  for (const auto *id : { "3", "5", "6" }) { EXPECT_TRUE(market.cancel_order(id)); }
+}
@@ -25,9 +25,12 @@ class epoll : public exchange_server::epoll_interface
 public:
   MOCK_METHOD(void, add, (int fd, std::uint32_t events), (const, override));
   MOCK_METHOD(void, modify, (int fd, std::uint32_t events), (const, override));
+  MOCK_METHOD(void, add, (int fd, std::uint32_t events, std::uint64_t data), (const, override));
+  MOCK_METHOD(void, modify, (int fd, std::uint32_t events, std::uint64_t data), (const, override));
   MOCK_METHOD(void, remove, (int fd), (const, override));
 
   MOCK_METHOD(std::span<epoll_event>, wait, (), (override));
+  MOCK_METHOD(std::span<epoll_event>, wait_for, (std::chrono::milliseconds timeout), (override));
 };
 
 class worker : public exchange_server::worker_interface
@@ -41,6 +44,7 @@ class socket : public exchange_server::socket_interface
 public:
   MOCK_METHOD(exchange_server::result<std::ptrdiff_t>, read, (std::span<char> buffer), (override));
   MOCK_METHOD(exchange_server::result<std::ptrdiff_t>, write, (std::span<const char> buffer), (override));
+  MOCK_METHOD(std::error_code, shutdown, (), (override));
 
   MOCK_METHOD(int, get_fd, (), (const, override));
 };
@@ -48,9 +52,20 @@ public:
 class market : public exchange_server::market_interface
 {
 public:
-  MOCK_METHOD(void, add_order, (const exchange_server::order &order, std::function<void()> callback), (override));
+  MOCK_METHOD(exchange_server::order_result,
+    add_order,
+    (const exchange_server::order &order, std::function<void(const exchange_server::fill &)> callback),
+    (override));
   MOCK_METHOD(bool, update_order, (const exchange_server::order &order), (override));
   MOCK_METHOD(bool, cancel_order, (const std::string &id), (override));
+  MOCK_METHOD(std::vector<std::string>,
+    cancel_all,
+    (std::uint64_t owner, const exchange_server::cancel_filter &filter),
+    (override));
+  MOCK_METHOD(std::vector<exchange_server::order_result>,
+    mass_quote,
+    (std::vector<exchange_server::quote_entry> entries),
+    (override));
 };
 
 }
\ No newline at end of file
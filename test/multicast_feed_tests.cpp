@@ -0,0 +1,204 @@
+#include "mocks.h"
+#include "multicast_feed.h"
+#include "recovery_service.h"
+#include <gtest/gtest.h>
+
+using ::testing::Return;
+using ::testing::StrictMock;
+using exchange_server::order_side;
+using exchange_server::price_level_update;
+
+namespace {
+auto capture_writes(std::vector<std::string> &writes)
+{
+  return [&writes](std::span<const char> buffer) {
+    writes.emplace_back(buffer.begin(), buffer.end());
+    return exchange_server::result<std::ptrdiff_t>{ .result = static_cast<std::ptrdiff_t>(buffer.size()) };
+  };
+}
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(multicast_feed_tests, batches_sequenced_messages_in_datagrams)
+{
+  auto sock = std::make_shared<StrictMock<mocks::socket>>();
+  std::vector<std::string> datagrams;
+  EXPECT_CALL(*sock, write).WillRepeatedly(capture_writes(datagrams));
+
+  // Room for the header and two level messages
+  exchange_server::multicast_feed feed{ sock, { .max_packet_size = 72 } };
+  feed.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 5 });
+  feed.on_level_update(price_level_update{ " BTCUSDT", order_side::sell, 110, 2 });
+  feed.on_trade(exchange_server::trade_report{ " BTCUSDT", 110, 2 });
+  feed.flush();
+
+  ASSERT_EQ(datagrams.size(), 2U);
+
+  const auto first = exchange_server::parse_feed_packet(datagrams[0]);
+  ASSERT_TRUE(first);
+  EXPECT_EQ(first->sequence, 1U);
+  ASSERT_EQ(first->messages.size(), 2U);
+  EXPECT_EQ(first->messages[0], "level BTCUSDT+0000000500000100\n");
+  EXPECT_EQ(first->messages[1], "level BTCUSDT-0000000200000110\n");
+
+  const auto second = exchange_server::parse_feed_packet(datagrams[1]);
+  ASSERT_TRUE(second);
+  EXPECT_EQ(second->sequence, 3U);
+  ASSERT_EQ(second->messages.size(), 1U);
+  EXPECT_EQ(second->messages[0], "trade BTCUSDT0000000200000110\n");
+
+  EXPECT_FALSE(exchange_server::parse_feed_packet(std::string_view{ datagrams[0] }.substr(0, 20)));
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(multicast_feed_tests, sends_datagrams_without_holding_the_books)
+{
+  auto sock = std::make_shared<StrictMock<mocks::socket>>();
+  exchange_server::multicast_feed feed{ sock };
+
+  // The books can be read, e.g. for a recovery snapshot, while a datagram is being sent
+  std::string snapshot;
+  EXPECT_CALL(*sock, write).WillOnce([&feed, &snapshot](std::span<const char> buffer) {
+    snapshot = feed.snapshot();
+    return exchange_server::result<std::ptrdiff_t>{ .result = static_cast<std::ptrdiff_t>(buffer.size()) };
+  });
+
+  feed.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 5 });
+  feed.flush();
+
+  EXPECT_EQ(snapshot, "snapshot BTCUSDT0001\nlevel BTCUSDT+0000000500000100\nsnapshotend000000000001\n");
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(multicast_feed_tests, replays_retained_messages)
+{
+  auto sock = std::make_shared<StrictMock<mocks::socket>>();
+  EXPECT_CALL(*sock, write)
+    .WillRepeatedly(Return(exchange_server::result<std::ptrdiff_t>{
+      .err = std::make_error_code(std::errc::resource_unavailable_try_again) }));
+
+  exchange_server::multicast_feed feed{ sock, { .max_packet_size = 0, .retained_messages = 2 } };
+  feed.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 5 });
+  feed.on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 0 });
+  feed.on_level_update(price_level_update{ " ETHUSDT", order_side::sell, 10, 1 });
+  feed.flush();
+
+  // Every datagram was lost, subscribers recover from the service
+  EXPECT_EQ(feed.dropped_packets(), 3U);
+  EXPECT_TRUE(feed.replay(1).err);
+  EXPECT_EQ(feed.replay(2).result,
+    "000000000002level BTCUSDT+0000000000000100\n"
+    "000000000003level ETHUSDT-0000000100000010\n"
+    "replayend000000000003\n");
+  EXPECT_EQ(feed.replay(4).result, "replayend000000000003\n");
+  EXPECT_EQ(feed.snapshot(),
+    "snapshot BTCUSDT0000\n"
+    "snapshot ETHUSDT0001\n"
+    "level ETHUSDT-0000000100000010\n"
+    "snapshotend000000000003\n");
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(multicast_feed_tests, tracks_sequence_gaps)
+{
+  exchange_server::feed_sequence_tracker tracker;
+
+  EXPECT_FALSE(tracker.on_packet(10, 2));
+  EXPECT_EQ(tracker.expected(), 12U);
+
+  const auto gap = tracker.on_packet(15, 1);
+  ASSERT_TRUE(gap);
+  EXPECT_EQ(gap->first, 12U);
+  EXPECT_EQ(gap->last, 14U);
+
+  EXPECT_EQ(tracker.duplicates(14, 4), 2U);
+  EXPECT_FALSE(tracker.on_packet(14, 4));
+  EXPECT_EQ(tracker.expected(), 18U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(multicast_feed_tests, recovery_service_answers_requests)
+{
+  auto feed_sock = std::make_shared<mocks::socket>();
+  EXPECT_CALL(*feed_sock, write)
+    .WillRepeatedly(Return(exchange_server::result<std::ptrdiff_t>{ .result = 0 }));
+  auto feed = std::make_shared<exchange_server::multicast_feed>(feed_sock);
+  feed->on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 5 });
+  feed->flush();
+
+  auto listen = std::make_shared<StrictMock<mocks::listen_socket>>();
+  auto epoll = std::make_shared<StrictMock<mocks::epoll>>();
+  auto control = std::make_shared<StrictMock<mocks::socket>>();
+  auto client = std::make_shared<StrictMock<mocks::socket>>();
+
+  EXPECT_CALL(*listen, get_fd()).WillRepeatedly(Return(100));
+  EXPECT_CALL(*control, get_fd()).WillRepeatedly(Return(200));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(100, EPOLLIN));
+  EXPECT_CALL(*epoll, add(200, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+
+  std::array events{ epoll_event{ .data = { .fd = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+
+  constexpr std::string_view requests{ "replay1\nreplay0\n" };
+  EXPECT_CALL(*client, read).WillOnce([requests](std::span<char> buffer) {
+    std::copy(requests.begin(), requests.end(), buffer.begin());
+    return exchange_server::result<std::ptrdiff_t>{ .result = static_cast<std::ptrdiff_t>(requests.size()) };
+  });
+
+  std::vector<std::string> responses;
+  EXPECT_CALL(*client, write).WillRepeatedly(capture_writes(responses));
+
+  exchange_server::recovery_service service{ listen, epoll, control, feed };
+  service.run();
+
+  ASSERT_EQ(responses.size(), 2U);
+  EXPECT_EQ(responses[0], "000000000001level BTCUSDT+0000000500000100\nreplayend000000000001\n");
+  EXPECT_EQ(responses[1], "rejected\n");
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(multicast_feed_tests, recovery_service_disconnects_subscriber_not_reading)
+{
+  auto feed_sock = std::make_shared<mocks::socket>();
+  EXPECT_CALL(*feed_sock, write)
+    .WillRepeatedly(Return(exchange_server::result<std::ptrdiff_t>{ .result = 0 }));
+  auto feed = std::make_shared<exchange_server::multicast_feed>(feed_sock);
+  feed->on_level_update(price_level_update{ " BTCUSDT", order_side::buy, 100, 5 });
+  feed->flush();
+
+  auto listen = std::make_shared<StrictMock<mocks::listen_socket>>();
+  auto epoll = std::make_shared<StrictMock<mocks::epoll>>();
+  auto control = std::make_shared<StrictMock<mocks::socket>>();
+  auto client = std::make_shared<StrictMock<mocks::socket>>();
+
+  EXPECT_CALL(*listen, get_fd()).WillRepeatedly(Return(100));
+  EXPECT_CALL(*control, get_fd()).WillRepeatedly(Return(200));
+  EXPECT_CALL(*client, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*epoll, add(100, EPOLLIN));
+  EXPECT_CALL(*epoll, add(200, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+  EXPECT_CALL(*epoll, modify(300, EPOLLIN | EPOLLOUT));
+
+  std::array events{ epoll_event{ .data = { .fd = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .fd = 300 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = client }));
+
+  // Snapshots of 76 bytes are requested while none is read, the second one goes past the limit
+  constexpr std::string_view requests{ "snapshot\nsnapshot\nsnapshot\n" };
+  EXPECT_CALL(*client, read).WillOnce([requests](std::span<char> buffer) {
+    std::copy(requests.begin(), requests.end(), buffer.begin());
+    return exchange_server::result<std::ptrdiff_t>{ .result = static_cast<std::ptrdiff_t>(requests.size()) };
+  });
+  EXPECT_CALL(*client, write)
+    .Times(2)
+    .WillRepeatedly(Return(exchange_server::result<std::ptrdiff_t>{
+      .err = std::make_error_code(std::errc::resource_unavailable_try_again) }));
+
+  exchange_server::recovery_service service{ listen, epoll, control, feed, 100 };
+  service.run();
+}
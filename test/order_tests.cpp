@@ -11,12 +11,72 @@ TEST(order_tests, can_parse_order)
     "0010"
     "00010000";
 
-  const auto order = exchange_server::parse_order(message);
-
-  ASSERT_TRUE(order.has_value());
-  EXPECT_EQ(order->id, "1234");
-  EXPECT_EQ(order->symbol, " BTCUSDT");
-  EXPECT_EQ(order->way, exchange_server::order_side::buy);
-  EXPECT_EQ(order->quantity, 10U);
-  EXPECT_EQ(order->price, 10'000);
-}
\ No newline at end of file
+  const auto [order, err] = exchange_server::parse_order(message);
+
+  ASSERT_FALSE(err);
+  EXPECT_EQ(order.id, "1234");
+  EXPECT_EQ(order.symbol, " BTCUSDT");
+  EXPECT_EQ(order.way, exchange_server::order_side::buy);
+  EXPECT_EQ(order.quantity, 10U);
+  EXPECT_EQ(order.price, 10'000);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(order_tests, converts_every_digit)
+{
+  const auto [order, err] = exchange_server::parse_order("a!z~eth usd9-987612345678");
+
+  ASSERT_FALSE(err);
+  EXPECT_EQ(order.id, "a!z~");
+  EXPECT_EQ(order.symbol, "eth usd9");
+  EXPECT_EQ(order.way, exchange_server::order_side::sell);
+  EXPECT_EQ(order.quantity, 9876U);
+  EXPECT_EQ(order.price, 12'345'678);
+
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+999999999999").result.price, 99'999'999);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(order_tests, reports_first_invalid_field)
+{
+  using exchange_server::order_error;
+
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+00100001000").err, order_error::invalid_size);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+0010000100000").err, order_error::invalid_size);
+  EXPECT_EQ(exchange_server::parse_order("12 4 BTCUSDT+001000010000").err, order_error::invalid_id);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTC/SDT+001000010000").err, order_error::invalid_symbol);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT*001000010000").err, order_error::invalid_side);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+00a000010000").err, order_error::invalid_quantity);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+00100001000:").err, order_error::invalid_price);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+0010-0010000").err, order_error::invalid_price);
+  EXPECT_EQ(exchange_server::parse_order("\x80" "234 BTCUSDT+001000010000").err, order_error::invalid_id);
+
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+001000010000XD").err, order_error::invalid_type);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+001000010000LX").err, order_error::invalid_time_in_force);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+001000010000MD").err, order_error::invalid_time_in_force);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+001000010000PI").err, order_error::invalid_time_in_force);
+
+  EXPECT_EQ(exchange_server::make_error_code(order_error::invalid_side).message(), "invalid order side");
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(order_tests, parses_type_and_time_in_force)
+{
+  using exchange_server::order_type;
+  using exchange_server::time_in_force;
+
+  const auto [order, err] = exchange_server::parse_order("1234 BTCUSDT+001000000000MI");
+  ASSERT_FALSE(err);
+  EXPECT_EQ(order.type, order_type::market);
+  EXPECT_EQ(order.tif, time_in_force::immediate_or_cancel);
+  EXPECT_EQ(order.quantity, 10U);
+
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+001000010000LF").result.tif, time_in_force::fill_or_kill);
+  EXPECT_EQ(exchange_server::parse_order("1234 BTCUSDT+001000010000PD").result.type, order_type::post_only);
+
+  // Limit day orders when omitted
+  const auto [plain, plain_err] = exchange_server::parse_order("1234 BTCUSDT+001000010000");
+  ASSERT_FALSE(plain_err);
+  EXPECT_EQ(plain.type, order_type::limit);
+  EXPECT_EQ(plain.tif, time_in_force::day);
+}
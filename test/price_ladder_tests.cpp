@@ -0,0 +1,96 @@
+#include "price_ladder.h"
+#include <gtest/gtest.h>
+
+using ladder = exchange_server::price_ladder<int>;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(price_ladder_tests, finds_best_and_next_levels)
+{
+  ladder levels{ 256 };
+  EXPECT_EQ(levels.lowest(), std::nullopt);
+
+  // Levels spread over several bitmap words
+  for (const auto price : { 1000, 1001, 1063, 1064, 1100 }) { levels[price] = price; }
+  EXPECT_EQ(levels.size(), 5U);
+  EXPECT_EQ(levels.lowest(), 1000);
+  EXPECT_EQ(levels.highest(), 1100);
+  EXPECT_EQ(levels.next_above(1001), 1063);
+  EXPECT_EQ(levels.next_above(1064), 1100);
+  EXPECT_EQ(levels.next_above(1100), std::nullopt);
+  EXPECT_EQ(levels.next_below(1064), 1063);
+  EXPECT_EQ(levels.next_below(1000), std::nullopt);
+  EXPECT_EQ(levels.at(1063), 1063);
+
+  levels.erase(1063);
+  levels.erase(1064);
+  EXPECT_EQ(levels.find(1063), nullptr);
+  EXPECT_EQ(levels.next_above(1001), 1100);
+  EXPECT_EQ(levels.next_below(1100), 1001);
+
+  // Erased levels are empty when used again
+  EXPECT_EQ(levels[1063], 0);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(price_ladder_tests, keeps_prices_out_of_window_in_tree)
+{
+  ladder levels{ 64 };
+  levels[1000] = 1;
+
+  // Out of the window around the first price
+  levels[10] = 2;
+  levels[5000] = 3;
+  EXPECT_EQ(levels.lowest(), 10);
+  EXPECT_EQ(levels.highest(), 5000);
+  EXPECT_EQ(levels.next_above(10), 1000);
+  EXPECT_EQ(levels.next_below(5000), 1000);
+  ASSERT_NE(levels.find(5000), nullptr);
+  EXPECT_EQ(*levels.find(5000), 3);
+  EXPECT_EQ(levels.at(10), 2);
+
+  // Once the window is empty, it moves to the next price and takes the levels of the tree around it
+  levels.erase(1000);
+  levels[4990] = 4;
+  EXPECT_EQ(levels.next_above(4990), 5000);
+  EXPECT_EQ(levels.next_below(4990), 10);
+  EXPECT_EQ(*levels.find(5000), 3);
+  EXPECT_EQ(levels.size(), 3U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(price_ladder_tests, handles_prices_around_zero_and_extremes)
+{
+  // The window starts below zero, the best levels are looked up from the extreme prices
+  ladder levels{ 64 };
+  levels[5] = 1;
+  levels[-10] = 2;
+  levels[-1000] = 3;
+  EXPECT_EQ(levels.lowest(), -1000);
+  EXPECT_EQ(levels.highest(), 5);
+  EXPECT_EQ(levels.next_above(-1000), -10);
+  EXPECT_EQ(levels.next_below(-10), -1000);
+  EXPECT_EQ(levels.next_below(5), -10);
+
+  // Distances from a negative base to the extreme prices do not fit in a price
+  constexpr auto max = std::numeric_limits<ladder::price_type>::max();
+  constexpr auto min = std::numeric_limits<ladder::price_type>::min();
+  EXPECT_EQ(levels.next_below(max), 5);
+  EXPECT_EQ(levels.next_above(min), -1000);
+
+  // Windows around the extreme prices stay within them
+  ladder high{ 64 };
+  high[max] = 1;
+  high[max - 1] = 2;
+  EXPECT_EQ(high.highest(), max);
+  EXPECT_EQ(high.lowest(), max - 1);
+  EXPECT_EQ(high.next_above(max - 1), max);
+  EXPECT_EQ(high.next_above(max), std::nullopt);
+
+  ladder low{ 64 };
+  low[min] = 1;
+  low[min + 1] = 2;
+  EXPECT_EQ(low.lowest(), min);
+  EXPECT_EQ(low.highest(), min + 1);
+  EXPECT_EQ(low.next_below(min + 1), min);
+  EXPECT_EQ(low.next_below(min), std::nullopt);
+}
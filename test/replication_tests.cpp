@@ -0,0 +1,259 @@
+#include "mocks.h"
+#include "replication.h"
+#include <fmt/format.h>
+#include <gtest/gtest.h>
+
+using ::testing::Return;
+using ::testing::StrictMock;
+using exchange_server::order;
+using exchange_server::order_side;
+
+namespace {
+auto capture_writes(std::vector<std::string> &writes)
+{
+  return [&writes](std::span<const char> buffer) {
+    writes.emplace_back(buffer.begin(), buffer.end());
+    return exchange_server::result<std::ptrdiff_t>{ .result = static_cast<std::ptrdiff_t>(buffer.size()) };
+  };
+}
+
+auto expect_read(std::string_view message)
+{
+  return [message](std::span<char> buffer) {
+    std::copy(message.begin(), message.end(), buffer.begin());
+    return exchange_server::result<std::ptrdiff_t>{ .result = static_cast<std::ptrdiff_t>(message.size()) };
+  };
+}
+
+// Book changes as a string, so that two markets can be compared
+class recording_sink : public exchange_server::market_data_sink
+{
+public:
+  void on_level_update(const exchange_server::price_level_update &update) override
+  {
+    updates += fmt::format("{}{}{}@{} ",
+      update.symbol,
+      update.side == order_side::buy ? '+' : '-',
+      update.quantity,
+      static_cast<std::uint64_t>(update.price));
+  }
+
+  void on_trade(const exchange_server::trade_report &trade) override
+  {
+    updates += fmt::format("{}={}@{} ", trade.symbol, trade.quantity, static_cast<std::uint64_t>(trade.price));
+  }
+
+  std::string updates;
+};
+
+void ignore_fills(const exchange_server::fill & /*fill*/) {}
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(replication_tests, follower_replicates_books_of_leader)
+{
+  auto leader_sink = std::make_shared<recording_sink>();
+  auto journal = std::make_shared<exchange_server::journal>();
+  exchange_server::journaled_market leader{ std::make_shared<exchange_server::market>(leader_sink), journal };
+
+  leader.add_order(
+    order{ .id = "b1", .symbol = " BTCUSDT", .way = order_side::buy, .quantity = 10, .price = 100, .owner = 1 },
+    ignore_fills);
+  leader.add_order(
+    order{ .id = "s1", .symbol = " BTCUSDT", .way = order_side::sell, .quantity = 4, .price = 99, .owner = 2 },
+    ignore_fills);
+  leader.update_order(
+    order{ .id = "b1", .symbol = " BTCUSDT", .way = order_side::buy, .quantity = 5, .price = 100, .owner = 1 });
+  leader.mass_quote(
+    { { .order = { .id = "q1", .symbol = " ETHUSDT", .way = order_side::sell, .quantity = 3, .price = 20, .owner = 3 },
+        .callback = ignore_fills },
+      { .order = { .id = "q2", .symbol = " ETHUSDT", .way = order_side::buy, .quantity = 3, .price = 10, .owner = 3 },
+        .callback = ignore_fills } });
+  leader.cancel_all(3, { .side = order_side::buy });
+  leader.cancel_order("b1");
+  EXPECT_EQ(journal->position(), 6U);
+
+  std::string lines;
+  exchange_server::journal::cursor cursor;
+  journal->read(cursor, lines);
+
+  auto follower_sink = std::make_shared<recording_sink>();
+  auto market = std::make_shared<exchange_server::market>(follower_sink);
+  auto leader_sock = std::make_shared<StrictMock<mocks::socket>>();
+  auto epoll = std::make_shared<StrictMock<mocks::epoll>>();
+  auto control = std::make_shared<StrictMock<mocks::socket>>();
+
+  EXPECT_CALL(*leader_sock, get_fd()).WillRepeatedly(Return(100));
+  EXPECT_CALL(*control, get_fd()).WillRepeatedly(Return(200));
+  EXPECT_CALL(*epoll, add(100, EPOLLIN));
+  EXPECT_CALL(*epoll, add(200, EPOLLIN));
+
+  // The whole journal arrives, then the leader is lost
+  std::array events{ epoll_event{ .events = EPOLLIN, .data = { .fd = 100 } } };
+  EXPECT_CALL(*epoll, wait()).WillRepeatedly(Return(std::span{ events }));
+  EXPECT_CALL(*leader_sock, read).WillOnce(expect_read(lines)).WillOnce(expect_read(""));
+
+  // Acknowledged at once
+  std::vector<std::string> acks;
+  EXPECT_CALL(*leader_sock, write).WillOnce(capture_writes(acks));
+
+  exchange_server::replication_follower follower{ leader_sock, epoll, control, market };
+  EXPECT_FALSE(follower.run());
+
+  EXPECT_EQ(follower.position(), 6U);
+  EXPECT_EQ(follower.last_owner(), 3U);
+  EXPECT_EQ(acks, std::vector<std::string>{ "ack000000000006\n" });
+  EXPECT_FALSE(leader_sink->updates.empty());
+  EXPECT_EQ(follower_sink->updates, leader_sink->updates);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(replication_tests, quorum_acknowledgement_releases_waiters)
+{
+  auto listen = std::make_shared<StrictMock<mocks::listen_socket>>();
+  auto epoll = std::make_shared<StrictMock<mocks::epoll>>();
+  auto control = std::make_shared<StrictMock<mocks::socket>>();
+  auto doorbell = std::make_shared<StrictMock<mocks::socket>>();
+  auto follower = std::make_shared<StrictMock<mocks::socket>>();
+
+  EXPECT_CALL(*listen, get_fd()).WillRepeatedly(Return(100));
+  EXPECT_CALL(*control, get_fd()).WillRepeatedly(Return(200));
+  EXPECT_CALL(*doorbell, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*follower, get_fd()).WillRepeatedly(Return(400));
+  EXPECT_CALL(*epoll, add(100, EPOLLIN));
+  EXPECT_CALL(*epoll, add(200, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+  EXPECT_CALL(*epoll, add(400, EPOLLIN));
+
+  // Records appended before the journal is read ring the doorbell once
+  EXPECT_CALL(*doorbell, write).WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 8 }));
+  auto journal = std::make_shared<exchange_server::journal>(doorbell, 1);
+  journal->append("Cb1");
+  journal->append("Cb2");
+
+  std::vector<std::uint64_t> released;
+  journal->when_replicated(1, [&released] { released.push_back(1); });
+  journal->when_replicated(2, [&released] { released.push_back(2); });
+
+  std::array events{ epoll_event{ .data = { .fd = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .fd = 400 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(
+      Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = follower }));
+
+  std::vector<std::string> sent;
+  EXPECT_CALL(*follower, write).WillOnce(capture_writes(sent));
+  EXPECT_CALL(*follower, read).WillOnce(expect_read("ack000000000001\n"));
+
+  exchange_server::replication_service service{ listen, epoll, control, doorbell, journal };
+  service.run();
+
+  EXPECT_EQ(sent, std::vector<std::string>{ "000000000001Cb1\n000000000002Cb2\n" });
+  EXPECT_EQ(journal->replicated(), 1U);
+  EXPECT_EQ(released, std::vector<std::uint64_t>{ 1 });
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(replication_tests, drops_follower_acknowledging_records_not_sent)
+{
+  auto listen = std::make_shared<StrictMock<mocks::listen_socket>>();
+  auto epoll = std::make_shared<StrictMock<mocks::epoll>>();
+  auto control = std::make_shared<StrictMock<mocks::socket>>();
+  auto doorbell = std::make_shared<StrictMock<mocks::socket>>();
+  auto follower = std::make_shared<StrictMock<mocks::socket>>();
+
+  EXPECT_CALL(*listen, get_fd()).WillRepeatedly(Return(100));
+  EXPECT_CALL(*control, get_fd()).WillRepeatedly(Return(200));
+  EXPECT_CALL(*doorbell, get_fd()).WillRepeatedly(Return(300));
+  EXPECT_CALL(*follower, get_fd()).WillRepeatedly(Return(400));
+  EXPECT_CALL(*epoll, add(100, EPOLLIN));
+  EXPECT_CALL(*epoll, add(200, EPOLLIN));
+  EXPECT_CALL(*epoll, add(300, EPOLLIN));
+  EXPECT_CALL(*epoll, add(400, EPOLLIN));
+
+  EXPECT_CALL(*doorbell, write).WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 1 }));
+  auto journal = std::make_shared<exchange_server::journal>(doorbell, 1);
+  journal->append("Cb1");
+  journal->append("Cb2");
+
+  std::array events{ epoll_event{ .data = { .fd = 100 } }, epoll_event{ .events = EPOLLIN, .data = { .fd = 400 } } };
+  EXPECT_CALL(*epoll, wait()).WillOnce(Return(std::span{ events })).WillOnce(Return(std::span<epoll_event>{}));
+  EXPECT_CALL(*listen, accept())
+    .WillOnce(
+      Return(exchange_server::result<std::shared_ptr<exchange_server::socket_interface>>{ .result = follower }));
+
+  // Only the first record and part of the second are written, the rest waits for the socket to be writable
+  EXPECT_CALL(*follower, write).WillOnce(Return(exchange_server::result<std::ptrdiff_t>{ .result = 20 }));
+  EXPECT_CALL(*epoll, modify(400, EPOLLIN | EPOLLOUT));
+  EXPECT_CALL(*follower, read).WillOnce(expect_read("ack000000000001\nack000000000002\n"));
+
+  exchange_server::replication_service service{ listen, epoll, control, doorbell, journal };
+  service.run();
+
+  // The follower acknowledging a record it could not have received is dropped, and none of its acknowledgements count
+  EXPECT_EQ(journal->replicated(), 0U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(replication_tests, follower_starts_from_snapshot_of_truncated_journal)
+{
+  // A snapshot is due after every record or so, and no follower keeps the records before them
+  constexpr std::size_t max_size{ 64 };
+  auto journal = std::make_shared<exchange_server::journal>(nullptr, 0, max_size);
+  auto leader_market = std::make_shared<exchange_server::market>(std::make_shared<recording_sink>());
+  exchange_server::journaled_market leader{ leader_market, journal };
+  for (std::uint64_t i = 1; i <= 10; ++i)
+  {
+    leader.add_order(order{ .id = fmt::format("b{}", i),
+                       .symbol = " BTCUSDT",
+                       .way = order_side::buy,
+                       .quantity = 10,
+                       .price = static_cast<double>(100 + i % 3),
+                       .owner = i },
+      ignore_fills);
+  }
+  leader.add_order(
+    order{ .id = "s1", .symbol = " BTCUSDT", .way = order_side::sell, .quantity = 15, .price = 100, .owner = 11 },
+    ignore_fills);
+  leader.cancel_order("b4");
+
+  std::string lines;
+  exchange_server::journal::cursor from_start{ .offset = 0 };
+  EXPECT_FALSE(journal->read(from_start, lines));
+
+  exchange_server::journal::cursor cursor;
+  ASSERT_TRUE(journal->read(cursor, lines));
+  EXPECT_EQ(lines.at(12), 'S');
+  EXPECT_EQ(cursor.position, journal->position());
+
+  auto market = std::make_shared<exchange_server::market>(std::make_shared<recording_sink>());
+  auto leader_sock = std::make_shared<StrictMock<mocks::socket>>();
+  auto epoll = std::make_shared<StrictMock<mocks::epoll>>();
+  auto control = std::make_shared<StrictMock<mocks::socket>>();
+
+  EXPECT_CALL(*leader_sock, get_fd()).WillRepeatedly(Return(100));
+  EXPECT_CALL(*control, get_fd()).WillRepeatedly(Return(200));
+  EXPECT_CALL(*epoll, add(100, EPOLLIN));
+  EXPECT_CALL(*epoll, add(200, EPOLLIN));
+
+  std::array events{ epoll_event{ .events = EPOLLIN, .data = { .fd = 100 } } };
+  EXPECT_CALL(*epoll, wait()).WillRepeatedly(Return(std::span{ events }));
+  EXPECT_CALL(*leader_sock, read).WillOnce(expect_read(lines)).WillOnce(expect_read(""));
+  std::vector<std::string> acks;
+  EXPECT_CALL(*leader_sock, write).WillOnce(capture_writes(acks));
+
+  auto follower_journal = std::make_shared<exchange_server::journal>(nullptr, 0, max_size);
+  exchange_server::replication_follower follower{ leader_sock, epoll, control, market, follower_journal };
+  EXPECT_FALSE(follower.run());
+
+  EXPECT_EQ(follower.position(), journal->position());
+  EXPECT_EQ(follower_journal->position(), journal->position());
+
+  const auto describe = [](const std::vector<order> &orders) {
+    std::string result;
+    for (const auto &resting : orders) { result += fmt::format("{}:{} ", resting.id, resting.quantity); }
+    return result;
+  };
+  EXPECT_FALSE(describe(leader_market->resting_orders()).empty());
+  EXPECT_EQ(describe(market->resting_orders()), describe(leader_market->resting_orders()));
+}
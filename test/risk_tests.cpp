@@ -0,0 +1,102 @@
+#include "risk.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+using exchange_server::order;
+using exchange_server::order_side;
+using exchange_server::order_type;
+using exchange_server::risk_breach;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(risk_tests, checks_order_size)
+{
+  const exchange_server::risk_limits limits{ .max_order_quantity = 100, .max_order_notional = 50'000 };
+  const exchange_server::risk_cache cache;
+
+  EXPECT_EQ(cache.check_new(order{ "1", "A", order_side::buy, 100, 500 }, limits), risk_breach::none);
+  EXPECT_EQ(cache.check_new(order{ "1", "A", order_side::buy, 101, 1 }, limits), risk_breach::order_quantity);
+  EXPECT_EQ(cache.check_new(order{ "1", "A", order_side::buy, 100, 501 }, limits), risk_breach::order_notional);
+  EXPECT_EQ(cache.check_new(order{ "1", "A", order_side::buy, 1, 0, order_type::market }, limits),
+    risk_breach::order_notional);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(risk_tests, checks_position_including_open_orders)
+{
+  const exchange_server::risk_limits limits{ .max_position = 10 };
+  exchange_server::risk_cache cache;
+
+  const order first{ "1", "A", order_side::buy, 6, 1 };
+  ASSERT_EQ(cache.check_new(first, limits), risk_breach::none);
+  cache.on_new(first);
+
+  // Worst case both buys execute
+  EXPECT_EQ(cache.check_new(order{ "2", "A", order_side::buy, 5, 1 }, limits), risk_breach::position);
+  EXPECT_EQ(cache.check_new(order{ "2", "A", order_side::sell, 10, 1 }, limits), risk_breach::none);
+  EXPECT_EQ(cache.check_new(order{ "2", "B", order_side::buy, 10, 1 }, limits), risk_breach::none);
+
+  // Updating an order only counts the difference
+  EXPECT_EQ(cache.check_update(first, order{ "1", "A", order_side::buy, 10, 1 }, limits), risk_breach::none);
+  EXPECT_EQ(cache.check_update(first, order{ "1", "A", order_side::buy, 11, 1 }, limits), risk_breach::position);
+
+  // Executions become position
+  cache.on_execution(first, 2);
+  cache.on_execution(order{ "1", "A", order_side::buy, 4, 1 }, 4);
+  EXPECT_EQ(cache.check_new(order{ "2", "A", order_side::buy, 5, 1 }, limits), risk_breach::position);
+  EXPECT_EQ(cache.check_new(order{ "2", "A", order_side::sell, 16, 1 }, limits), risk_breach::none);
+  EXPECT_EQ(cache.check_new(order{ "2", "A", order_side::sell, 17, 1 }, limits), risk_breach::position);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(risk_tests, checks_open_orders)
+{
+  const exchange_server::risk_limits limits{ .max_open_orders = 1 };
+  exchange_server::risk_cache cache;
+
+  const order first{ "1", "A", order_side::buy, 1, 1 };
+  cache.on_new(first);
+  EXPECT_EQ(cache.check_new(order{ "2", "A", order_side::buy, 1, 1 }, limits), risk_breach::open_orders);
+
+  cache.on_cancel(first);
+  EXPECT_EQ(cache.check_new(order{ "2", "A", order_side::buy, 1, 1 }, limits), risk_breach::none);
+
+  // Orders stay open until fully executed
+  const order second{ "2", "A", order_side::buy, 2, 1 };
+  cache.on_new(second);
+  cache.on_execution(second, 1);
+  EXPECT_EQ(cache.check_new(order{ "3", "A", order_side::buy, 1, 1 }, limits), risk_breach::open_orders);
+  cache.on_execution(order{ "2", "A", order_side::buy, 1, 1 }, 1);
+  EXPECT_EQ(cache.check_new(order{ "3", "A", order_side::buy, 1, 1 }, limits), risk_breach::none);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(risk_tests, can_parse_limits)
+{
+  std::istringstream valid{ "# limits\nmax_order_quantity 100\n\nmax_order_notional 1e6\nmax_position 500\n"
+                            "max_open_orders 20\n" };
+  const auto [limits, err] = exchange_server::parse_risk_limits(valid);
+
+  ASSERT_FALSE(err);
+  EXPECT_EQ(limits.max_order_quantity, 100U);
+  EXPECT_EQ(limits.max_order_notional, 1e6);
+  EXPECT_EQ(limits.max_position, 500U);
+  EXPECT_EQ(limits.max_open_orders, 20U);
+
+  std::istringstream invalid{ "max_order_quantity lots\n" };
+  EXPECT_TRUE(exchange_server::parse_risk_limits(invalid).err);
+
+  std::istringstream unknown{ "max_leverage 10\n" };
+  EXPECT_TRUE(exchange_server::parse_risk_limits(unknown).err);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(risk_tests, store_publishes_new_versions)
+{
+  exchange_server::risk_limits_store store{ exchange_server::risk_limits{ .max_order_quantity = 1 } };
+  const auto version = store.version();
+
+  store.publish(exchange_server::risk_limits{ .max_order_quantity = 2 });
+
+  EXPECT_NE(store.version(), version);
+  EXPECT_EQ(store.current()->max_order_quantity, 2U);
+}
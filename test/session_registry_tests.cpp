@@ -0,0 +1,37 @@
+#include "session_registry.h"
+#include <gtest/gtest.h>
+#include <string>
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(session_registry_tests, dispatches_to_registered_sessions_only)
+{
+  exchange_server::session_registry<std::string> registry;
+  auto first = std::make_shared<std::string>("first");
+  auto second = std::make_shared<std::string>("second");
+
+  const auto first_id = registry.add(first);
+  const auto second_id = registry.add(second);
+  EXPECT_NE(first_id, second_id);
+
+  std::string dispatched;
+  EXPECT_TRUE(registry.with_session(second_id, [&dispatched](const std::string &session) { dispatched = session; }));
+  EXPECT_EQ(dispatched, "second");
+
+  registry.remove(second_id);
+  EXPECT_FALSE(registry.with_session(second_id, [](const std::string &) { FAIL(); }));
+  EXPECT_EQ(registry.size(), 1U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(session_registry_tests, does_not_extend_session_lifetime)
+{
+  exchange_server::session_registry<std::string> registry;
+  auto session = std::make_shared<std::string>("session");
+  const auto id = registry.add(session);
+
+  session.reset();
+  EXPECT_FALSE(registry.with_session(id, [](const std::string &) { FAIL(); }));
+
+  // Ids of released sessions are not handed out again
+  EXPECT_NE(registry.add(std::make_shared<std::string>("next")), id);
+}
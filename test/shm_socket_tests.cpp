@@ -0,0 +1,152 @@
+#include "shm_socket.h"
+#include <future>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+struct channel
+{
+  std::shared_ptr<exchange_server::socket_interface> server;
+  std::unique_ptr<exchange_server::shm_client_socket> client;
+};
+
+channel connect(exchange_server::shm_listen_socket &listener, const std::string &path, bool busy_poll = false)
+{
+  auto client = std::async(std::launch::async,
+    [&path, busy_poll] { return std::make_unique<exchange_server::shm_client_socket>(path, busy_poll); });
+
+  for (;;)
+  {
+    auto [server, err] = listener.accept();
+    if (server) { return { std::move(server), client.get() }; }
+    if (err != std::errc::resource_unavailable_try_again) { throw std::system_error{ err }; }
+
+    std::this_thread::sleep_for(1ms);
+  }
+}
+
+bool is_ready(int fd, short events)
+{
+  pollfd descriptor{ .fd = fd, .events = events };
+  return ::poll(&descriptor, 1, 0) == 1 && (descriptor.revents & events) != 0;
+}
+
+std::string test_path() { return "/tmp/exchange_server_shm_tests_" + std::to_string(::getpid()); }
+
+std::string read_all(exchange_server::socket_interface &sock)
+{
+  std::string result;
+  std::array<char, 64> buffer{};
+  for (;;)
+  {
+    auto [bytes_read, err] = sock.read(buffer);
+    if (err || bytes_read == 0) { return result; }
+
+    result.append(buffer.data(), static_cast<std::size_t>(bytes_read));
+  }
+}
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(shm_socket_tests, ring_wraps_around)
+{
+  exchange_server::spsc_byte_ring::header header;
+  std::array<char, 8> data{};
+  exchange_server::spsc_byte_ring ring{ header, data };
+
+  EXPECT_EQ(ring.write("abcdef"sv).result, 6U);
+  std::array<char, 4> buffer{};
+  EXPECT_EQ(ring.read(buffer).result, 4U);
+  EXPECT_EQ(std::string_view(buffer.data(), 4), "abcd");
+
+  // Only 6 bytes of room are left
+  EXPECT_EQ(ring.write("ghijklmn"sv).result, 6U);
+  std::array<char, 16> all{};
+  EXPECT_EQ(ring.read(all).result, 8U);
+  EXPECT_EQ(std::string_view(all.data(), 8), "efghijkl");
+  EXPECT_EQ(ring.read(all).result, 0U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(shm_socket_tests, ring_rejects_positions_out_of_range)
+{
+  exchange_server::spsc_byte_ring::header header;
+  std::array<char, 8> data{};
+  exchange_server::spsc_byte_ring ring{ header, data };
+
+  // A peer claiming more bytes than the ring holds, or a tail past the head
+  header.head = 9;
+  std::array<char, 16> all{};
+  EXPECT_EQ(ring.read(all).err, std::errc::bad_message);
+  EXPECT_EQ(header.tail, 0U);
+
+  header.head = 0;
+  header.tail = 1;
+  EXPECT_EQ(ring.write("abc"sv).err, std::errc::bad_message);
+  EXPECT_EQ(header.head, 0U);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(shm_socket_tests, exchanges_messages_and_rings_doorbell)
+{
+  const auto path = test_path();
+  exchange_server::shm_listen_socket listener{ path, 1024 };
+  auto [server, client] = connect(listener, path);
+
+  std::array<char, 16> empty{};
+  EXPECT_FALSE(is_ready(server->get_fd(), POLLIN));
+  EXPECT_EQ(server->read(empty).err, std::errc::resource_unavailable_try_again);
+
+  ASSERT_EQ(client->write("idclient\n"sv).result, 9);
+  EXPECT_TRUE(is_ready(server->get_fd(), POLLIN));
+  EXPECT_EQ(read_all(*server), "idclient\n");
+  EXPECT_FALSE(is_ready(server->get_fd(), POLLIN));
+
+  ASSERT_EQ(server->write("ok\n"sv).result, 3);
+  EXPECT_TRUE(is_ready(client->get_fd(), POLLIN));
+  EXPECT_EQ(read_all(*client), "ok\n");
+
+  // Closing is seen like a TCP disconnection
+  client.reset();
+  std::array<char, 16> buffer{};
+  EXPECT_TRUE(is_ready(server->get_fd(), POLLIN));
+  EXPECT_EQ(server->read(buffer).result, 0);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(shm_socket_tests, is_not_writable_while_ring_is_full)
+{
+  const auto path = test_path();
+  exchange_server::shm_listen_socket listener{ path, 1024 };
+  auto [server, client] = connect(listener, path);
+
+  const std::string message(1000, 'x');
+  ASSERT_EQ(server->write(message).result, 1000);
+  EXPECT_EQ(server->write(message).result, 24);
+  EXPECT_EQ(server->write(message).err, std::errc::resource_unavailable_try_again);
+  EXPECT_FALSE(is_ready(server->get_fd(), POLLOUT));
+
+  // Reading makes room and drains the doorbell
+  EXPECT_EQ(read_all(*client).size(), 1024U);
+  EXPECT_TRUE(is_ready(server->get_fd(), POLLOUT));
+  EXPECT_EQ(server->write(message).result, 1000);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(shm_socket_tests, busy_polling_client_is_not_woken_up)
+{
+  const auto path = test_path();
+  exchange_server::shm_listen_socket listener{ path, 1024 };
+  auto [server, client] = connect(listener, path, true);
+
+  ASSERT_EQ(server->write("exec1234\n"sv).result, 9);
+  EXPECT_FALSE(is_ready(client->get_fd(), POLLIN));
+  EXPECT_EQ(read_all(*client), "exec1234\n");
+
+  server->shutdown();
+  std::array<char, 16> buffer{};
+  EXPECT_EQ(client->read(buffer).result, 0);
+}
@@ -25,4 +25,33 @@ TEST(strand_tests, strand_serializes_messages)
 
   EXPECT_CALL(work2, Call);
   delayed();
-}
\ No newline at end of file
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(strand_tests, strand_runs_pending_messages_in_batches)
+{
+  StrictMock<mocks::worker> worker{};
+  MockFunction<void(void)> batch_end;
+  exchange_server::strand strand{
+    worker, exchange_server::strand_options{ .max_batch = 2 }, batch_end.AsStdFunction()
+  };
+
+  MockFunction<void(void)> work;
+  std::function<void()> delayed;
+
+  EXPECT_CALL(worker, post).WillOnce([&delayed](std::function<void()> f) { delayed = std::move(f); });
+  strand.post(work.AsStdFunction());
+  strand.post(work.AsStdFunction());
+  strand.post(work.AsStdFunction());
+
+  // The last message waits for the next worker slot
+  ::testing::InSequence sequence;
+  EXPECT_CALL(work, Call).Times(2);
+  EXPECT_CALL(batch_end, Call);
+  EXPECT_CALL(worker, post).WillOnce([&delayed](std::function<void()> f) { delayed = std::move(f); });
+  std::exchange(delayed, {})();
+
+  EXPECT_CALL(work, Call);
+  EXPECT_CALL(batch_end, Call);
+  std::exchange(delayed, {})();
+}
@@ -0,0 +1,65 @@
+#include "mocks.h"
+#include "task.h"
+#include <gtest/gtest.h>
+
+using exchange_server::block_pool;
+using exchange_server::event_queue;
+using exchange_server::task;
+using ::testing::StrictMock;
+
+namespace {
+task consume(const std::shared_ptr<block_pool> & /*frames*/, event_queue<int> &events, std::vector<int> &consumed)
+{
+  while (auto event = co_await events.next()) { consumed.push_back(*event); }
+  consumed.push_back(-1);
+}
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(task_tests, delivers_events_in_order_from_the_executor)
+{
+  StrictMock<mocks::worker> worker{};
+  std::vector<std::function<void()>> delayed;
+  ON_CALL(worker, post).WillByDefault([&delayed](std::function<void()> f) { delayed.push_back(std::move(f)); });
+
+  auto frames = std::make_shared<block_pool>();
+  event_queue<int> events{ worker };
+  std::vector<int> consumed;
+  consume(frames, events, consumed);
+  EXPECT_TRUE(consumed.empty());
+
+  // Only the first event resumes the coroutine, the others are taken without suspending
+  EXPECT_CALL(worker, post).Times(1);
+  events.push(1);
+  events.push(2);
+  EXPECT_TRUE(consumed.empty());
+  ASSERT_EQ(delayed.size(), 1);
+  delayed.front()();
+  EXPECT_EQ(consumed, (std::vector{ 1, 2 }));
+
+  EXPECT_CALL(worker, post).Times(1);
+  events.push(3);
+  events.close();
+  delayed.back()();
+  EXPECT_EQ(consumed, (std::vector{ 1, 2, 3, -1 }));
+
+  // The frame went back to the pool for the next coroutine
+  EXPECT_EQ(frames->free_blocks(), 1);
+  EXPECT_FALSE(events.try_pop());
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(task_tests, destroying_the_queue_frees_the_waiting_coroutine)
+{
+  StrictMock<mocks::worker> worker{};
+  auto frames = std::make_shared<block_pool>();
+  std::vector<int> consumed;
+  {
+    event_queue<int> events{ worker };
+    consume(frames, events, consumed);
+    EXPECT_EQ(frames->free_blocks(), 0);
+  }
+
+  EXPECT_TRUE(consumed.empty());
+  EXPECT_EQ(frames->free_blocks(), 1);
+}
@@ -0,0 +1,87 @@
+#include "timer_wheel.h"
+#include <gtest/gtest.h>
+
+using exchange_server::timer_wheel;
+using namespace std::chrono_literals;
+
+namespace {
+const auto start = timer_wheel::clock::time_point{} + 1h;
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(timer_wheel_tests, expires_timers_in_deadline_order_never_early)
+{
+  timer_wheel wheel{ start };
+  std::vector<int> expired;
+
+  // One timer per level of the wheel, scheduled out of order
+  wheel.schedule(start + 5h, [&expired] { expired.push_back(4); });
+  wheel.schedule(start + 300ms, [&expired] { expired.push_back(2); });
+  wheel.schedule(start + 2min, [&expired] { expired.push_back(3); });
+  wheel.schedule(start + 5ms, [&expired] { expired.push_back(1); });
+  EXPECT_EQ(wheel.size(), 4);
+
+  EXPECT_EQ(wheel.advance(start + 4ms), 0);
+  EXPECT_EQ(wheel.advance(start + 5ms), 1);
+  EXPECT_EQ(wheel.advance(start + 299ms), 0);
+  EXPECT_EQ(wheel.advance(start + 2min - 1ms), 1);
+  EXPECT_EQ(wheel.advance(start + 2min), 1);
+  EXPECT_EQ(wheel.advance(start + 5h - 1ms), 0);
+  EXPECT_EQ(wheel.advance(start + 5h), 1);
+  EXPECT_EQ(expired, (std::vector{ 1, 2, 3, 4 }));
+  EXPECT_TRUE(wheel.empty());
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(timer_wheel_tests, cancelled_timers_never_expire)
+{
+  timer_wheel wheel{ start };
+  int expired{};
+  const auto first = wheel.schedule(start + 10ms, [&expired] { ++expired; });
+  const auto second = wheel.schedule(start + 10ms, [&expired] { ++expired; });
+
+  EXPECT_TRUE(wheel.cancel(first));
+  EXPECT_FALSE(wheel.cancel(first));
+  EXPECT_EQ(wheel.advance(start + 10ms), 1);
+  EXPECT_EQ(expired, 1);
+  EXPECT_FALSE(wheel.cancel(second));
+
+  // Released timers are reused under a new id, old ids stay stale
+  const auto third = wheel.schedule(start + 20ms, [&expired] { ++expired; });
+  EXPECT_NE(third, first);
+  EXPECT_NE(third, second);
+  EXPECT_FALSE(wheel.cancel(second));
+  EXPECT_TRUE(wheel.cancel(third));
+  EXPECT_EQ(wheel.advance(start + 1s), 0);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(timer_wheel_tests, next_deadline_skips_idle_time_up_to_far_timers)
+{
+  timer_wheel wheel{ start };
+  EXPECT_FALSE(wheel.next_deadline());
+
+  // Beyond the 2^32 ticks the wheel covers
+  const auto far = start + 24h * 60;
+  int expired{};
+  wheel.schedule(far, [&expired] { ++expired; });
+
+  // Following the deadlines only stops where timers move down, a few times per level
+  int wakeups{};
+  for (auto deadline = wheel.next_deadline(); deadline && *deadline < far; deadline = wheel.next_deadline())
+  {
+    EXPECT_EQ(wheel.advance(*deadline), 0);
+    ASSERT_LT(++wakeups, 1'000);
+  }
+  EXPECT_EQ(wheel.next_deadline(), far);
+  EXPECT_EQ(wheel.advance(far - 1ms), 0);
+  EXPECT_EQ(wheel.advance(far), 1);
+  EXPECT_EQ(expired, 1);
+
+  // A timer scheduled by a callback in the past runs on the next advance
+  wheel.schedule(far + 1s, [&wheel, &expired] { wheel.schedule(start, [&expired] { ++expired; }); });
+  EXPECT_EQ(wheel.advance(far + 1s), 1);
+  EXPECT_EQ(wheel.next_deadline(), far + 1s + 1ms);
+  EXPECT_EQ(wheel.advance(far + 1s + 1ms), 1);
+  EXPECT_EQ(expired, 2);
+}
@@ -0,0 +1,37 @@
+#include "token_bucket.h"
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(token_bucket_tests, allows_burst_then_rate)
+{
+  const auto start = exchange_server::token_bucket::clock::now();
+  exchange_server::token_bucket bucket{ 10, 3, start };
+
+  EXPECT_TRUE(bucket.try_consume(start));
+  EXPECT_TRUE(bucket.try_consume(start));
+  EXPECT_TRUE(bucket.try_consume(start));
+  EXPECT_FALSE(bucket.try_consume(start));
+
+  // One token every 100ms
+  EXPECT_FALSE(bucket.try_consume(start + 50ms));
+  EXPECT_TRUE(bucket.try_consume(start + 100ms));
+  EXPECT_FALSE(bucket.try_consume(start + 100ms));
+
+  // Never more than the burst
+  EXPECT_TRUE(bucket.full(start + 10s));
+  EXPECT_TRUE(bucket.try_consume(start + 10s));
+  EXPECT_TRUE(bucket.try_consume(start + 10s));
+  EXPECT_TRUE(bucket.try_consume(start + 10s));
+  EXPECT_FALSE(bucket.try_consume(start + 10s));
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-owning-memory)
+TEST(token_bucket_tests, default_bucket_never_limits)
+{
+  exchange_server::token_bucket bucket;
+  const auto now = exchange_server::token_bucket::clock::now();
+
+  for (int i = 0; i < 1000; ++i) { EXPECT_TRUE(bucket.try_consume(now)); }
+}